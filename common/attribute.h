@@ -20,11 +20,19 @@ struct cvsync_attr;
 #define	RCS_ATTRLEN_FILE	(18)
 #define	RCS_ATTRLEN_RCS		(10)
 
+/*
+ * The attributes of an RCS file may be followed by its logical digest
+ * (see rcslib_digest()), whose length is that of the hash type.
+ */
+#define	RCS_ATTRLEN_DIGEST	(64)	/* == HASH_MAXLEN */
+
 size_t attr_rcs_encode_dir(uint8_t *, size_t, uint16_t);
 size_t attr_rcs_encode_file(uint8_t *, size_t, time_t, off_t, uint16_t);
 size_t attr_rcs_encode_rcs(uint8_t *, size_t, time_t, uint16_t);
+size_t attr_rcs_encode_digest(uint8_t *, size_t, const uint8_t *, size_t);
 bool attr_rcs_decode_dir(uint8_t *, size_t, struct cvsync_attr *);
 bool attr_rcs_decode_file(uint8_t *, size_t, struct cvsync_attr *);
 bool attr_rcs_decode_rcs(uint8_t *, size_t, struct cvsync_attr *);
+const uint8_t *attr_rcs_digest(const uint8_t *, size_t, size_t);
 
 #endif /* CVSYNC_ATTRIBUTE_H */
@@ -6,6 +6,7 @@
 #include <sys/stat.h>
 
 #include <limits.h>
+#include <string.h>
 
 #include "compat_stdbool.h"
 #include "compat_stdint.h"
@@ -53,6 +54,17 @@ attr_rcs_encode_rcs(uint8_t *buffer, size_t bufsize, time_t mtime, uint16_t mode
 	return (RCS_ATTRLEN_RCS);
 }
 
+size_t
+attr_rcs_encode_digest(uint8_t *buffer, size_t bufsize, const uint8_t *digest, size_t len)
+{
+	if ((bufsize < RCS_ATTRLEN_RCS + len) || (len > RCS_ATTRLEN_DIGEST))
+		return (0);
+
+	(void)memcpy(&buffer[RCS_ATTRLEN_RCS], digest, len);
+
+	return (RCS_ATTRLEN_RCS + len);
+}
+
 bool
 attr_rcs_decode_dir(uint8_t *buffer, size_t bufsize, struct cvsync_attr *cap)
 {
@@ -88,3 +100,12 @@ attr_rcs_decode_rcs(uint8_t *buffer, size_t bufsize, struct cvsync_attr *cap)
 
 	return (true);
 }
+
+const uint8_t *
+attr_rcs_digest(const uint8_t *buffer, size_t bufsize, size_t len)
+{
+	if ((len == 0) || (bufsize != RCS_ATTRLEN_RCS + len))
+		return (NULL);
+
+	return (&buffer[RCS_ATTRLEN_RCS]);
+}
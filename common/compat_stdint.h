@@ -23,6 +23,10 @@
 #define	UINT16_MAX	(65535U)
 #endif /* UINT16_MAX */
 
+#ifndef UINT32_MAX
+#define	UINT32_MAX	(4294967295U)
+#endif /* UINT32_MAX */
+
 #ifndef UINT64_MAX
 #define	UINT64_MAX	(18446744073709551615ULL)
 #endif /* UINT64_MAX */
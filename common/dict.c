@@ -0,0 +1,219 @@
+/*-
+ * This software is released under the BSD License, see LICENSE.
+ */
+
+#include <sys/types.h>
+
+#include <stdlib.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+
+#include "compat_stdbool.h"
+#include "compat_stdint.h"
+#include "compat_inttypes.h"
+#include "compat_limits.h"
+
+#include "dict.h"
+#include "logmsg.h"
+
+struct dict_entry {
+	struct dict_entry	*de_next;
+	size_t			de_id, de_len;
+	char			de_str[1];
+};
+
+struct dict_entry *dict_entry_new(struct dict *, const void *, size_t);
+uint32_t dict_hash(const void *, size_t);
+
+struct dict *
+dict_init(void)
+{
+	struct dict *d;
+
+	if ((d = malloc(sizeof(*d))) == NULL) {
+		logmsg_err("%s", strerror(errno));
+		return (NULL);
+	}
+	if ((d->d_table = calloc(DICT_NBUCKETS, sizeof(*d->d_table))) == NULL) {
+		logmsg_err("%s", strerror(errno));
+		free(d);
+		return (NULL);
+	}
+	d->d_entries = NULL;
+	d->d_count = 0;
+	d->d_max = 0;
+
+	return (d);
+}
+
+void
+dict_destroy(struct dict *d)
+{
+	struct dict_entry *de, *next;
+	size_t i;
+
+	for (i = 0 ; i < DICT_NBUCKETS ; i++) {
+		for (de = d->d_table[i] ; de != NULL ; de = next) {
+			next = de->de_next;
+			free(de);
+		}
+	}
+	if (d->d_entries != NULL) {
+		for (i = 0 ; i < d->d_count ; i++)
+			free(d->d_entries[i]);
+		free(d->d_entries);
+	}
+	free(d->d_table);
+	free(d);
+}
+
+/*
+ * Writes the encoding of the string of len (<= UINT8_MAX) bytes to the
+ * buffer of DICT_MAXENCLEN bytes, and returns its length.
+ */
+size_t
+dict_encode(struct dict *d, const void *str, size_t len, uint8_t *buffer)
+{
+	struct dict_entry *de, **bucket;
+	size_t id, n = 0;
+
+	bucket = &d->d_table[dict_hash(str, len) % DICT_NBUCKETS];
+	for (de = *bucket ; de != NULL ; de = de->de_next) {
+		if ((de->de_len == len) && (memcmp(de->de_str, str, len) == 0))
+			break;
+	}
+	if (de != NULL) {
+		id = de->de_id + DICT_REFERENCE;
+		while (id >= 0x80) {
+			buffer[n++] = (uint8_t)((id & 0x7f) | 0x80);
+			id >>= 7;
+		}
+		buffer[n++] = (uint8_t)id;
+		return (n);
+	}
+
+	if ((d->d_count < DICT_MAXENTRIES) && ((de = dict_entry_new(d, str, len)) != NULL)) {
+		de->de_next = *bucket;
+		*bucket = de;
+		buffer[n++] = DICT_DEFINE;
+	} else {
+		buffer[n++] = DICT_LITERAL;
+	}
+	buffer[n++] = (uint8_t)len;
+	if (len > 0)
+		(void)memcpy(&buffer[n], str, len);
+
+	return (n + len);
+}
+
+/*
+ * Decodes a string from the buffer, and returns the number of bytes
+ * consumed, or 0 on error.  The string is valid as long as the buffer
+ * and the dictionary are.
+ */
+size_t
+dict_decode(struct dict *d, const uint8_t *buffer, size_t bufsize, char **str, size_t *len)
+{
+	struct dict_entry *de, **entries;
+	size_t id = 0, n = 0, shift = 0, max;
+
+	do {
+		if ((n == bufsize) || (shift > 14))
+			return (0);
+		id |= (size_t)(buffer[n] & 0x7f) << shift;
+		shift += 7;
+	} while ((buffer[n++] & 0x80) != 0);
+
+	if (id >= DICT_REFERENCE) {
+		id -= DICT_REFERENCE;
+		if (id >= d->d_count)
+			return (0);
+		de = d->d_entries[id];
+		*str = de->de_str;
+		*len = de->de_len;
+		return (n);
+	}
+
+	if (n == bufsize)
+		return (0);
+	*len = buffer[n++];
+	if (bufsize - n < *len)
+		return (0);
+	*str = (char *)&buffer[n];
+
+	if (id == DICT_DEFINE) {
+		if (d->d_count == DICT_MAXENTRIES)
+			return (0);
+		if (d->d_count == d->d_max) {
+			max = (d->d_max == 0) ? 256 : d->d_max * 2;
+			if ((entries = realloc(d->d_entries, max * sizeof(*entries))) == NULL) {
+				logmsg_err("%s", strerror(errno));
+				return (0);
+			}
+			d->d_entries = entries;
+			d->d_max = max;
+		}
+		if ((de = dict_entry_new(d, *str, *len)) == NULL)
+			return (0);
+		d->d_entries[de->de_id] = de;
+	}
+
+	return (n + *len);
+}
+
+/*
+ * Forgets the strings the encoder has defined since it held count of
+ * them, for when what defined them is never sent.
+ */
+void
+dict_rollback(struct dict *d, size_t count)
+{
+	struct dict_entry *de;
+	size_t i;
+
+	if (d->d_count == count)
+		return;
+
+	/* The newest entries are at the head of each bucket. */
+	for (i = 0 ; i < DICT_NBUCKETS ; i++) {
+		while (((de = d->d_table[i]) != NULL) && (de->de_id >= count)) {
+			d->d_table[i] = de->de_next;
+			free(de);
+		}
+	}
+	d->d_count = count;
+}
+
+struct dict_entry *
+dict_entry_new(struct dict *d, const void *str, size_t len)
+{
+	struct dict_entry *de;
+
+	if ((de = malloc(sizeof(*de) + len)) == NULL) {
+		logmsg_err("%s", strerror(errno));
+		return (NULL);
+	}
+	de->de_next = NULL;
+	de->de_id = d->d_count++;
+	de->de_len = len;
+	if (len > 0)
+		(void)memcpy(de->de_str, str, len);
+	de->de_str[len] = '\0';
+
+	return (de);
+}
+
+uint32_t
+dict_hash(const void *str, size_t len)
+{
+	const uint8_t *sp = str;
+	uint32_t hash = 5381;
+	size_t i;
+
+	for (i = 0 ; i < len ; i++)
+		hash = hash * 33 + sp[i];
+
+	return (hash);
+}
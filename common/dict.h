@@ -0,0 +1,39 @@
+/*-
+ * This software is released under the BSD License, see LICENSE.
+ */
+
+#ifndef CVSYNC_DICT_H
+#define	CVSYNC_DICT_H
+
+struct dict_entry;
+
+/*
+ * A dictionary of the strings which FileCmp sends to the Updater, kept
+ * by both of them for the whole session.  A string is encoded as a
+ * varint, followed by the string itself when the varint is below
+ * DICT_REFERENCE:
+ *   DICT_LITERAL  len(1) string
+ *   DICT_DEFINE   len(1) string, which gets the next id
+ *   id + DICT_REFERENCE
+ */
+#define	DICT_LITERAL		(0)
+#define	DICT_DEFINE		(1)
+#define	DICT_REFERENCE		(2)
+
+#define	DICT_MAXENTRIES		(65536)
+#define	DICT_NBUCKETS		(4096)
+#define	DICT_MAXENCLEN		(UINT8_MAX + 2)
+
+struct dict {
+	struct dict_entry	**d_table;	/* encoder */
+	struct dict_entry	**d_entries;	/* decoder */
+	size_t			d_count, d_max;
+};
+
+struct dict *dict_init(void);
+void dict_destroy(struct dict *);
+size_t dict_encode(struct dict *, const void *, size_t, uint8_t *);
+size_t dict_decode(struct dict *, const uint8_t *, size_t, char **, size_t *);
+void dict_rollback(struct dict *, size_t);
+
+#endif /* CVSYNC_DICT_H */
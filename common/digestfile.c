@@ -0,0 +1,540 @@
+/*-
+ * This software is released under the BSD License, see LICENSE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "compat_stdbool.h"
+#include "compat_stdint.h"
+#include "compat_inttypes.h"
+#include "compat_limits.h"
+#include "basedef.h"
+
+#include "cvsync.h"
+#include "digestfile.h"
+#include "hash.h"
+#include "logmsg.h"
+#include "scanfile.h"
+
+#define	DIGESTFILE_MINBUCKETS	(1024)
+
+struct digestfile_entry {
+	struct digestfile_entry	*de_next;
+	uint64_t		de_ino, de_size;
+	int64_t			de_mtime;
+	uint8_t			*de_digests;
+	size_t			de_count, de_namelen;
+	char			de_name[1];
+};
+
+bool digestfile_decode(struct digestfile *, const uint8_t *, size_t);
+bool digestfile_write(struct digestfile *);
+bool digestfile_write_fd(int, const char *, const uint8_t *, size_t);
+struct digestfile_entry *digestfile_entry_init(struct digestfile *, const char *, size_t, size_t);
+void digestfile_entry_insert(struct digestfile *, struct digestfile_entry *);
+void digestfile_entry_remove(struct digestfile *, const char *, size_t);
+bool digestfile_entry_match(struct digestfile_entry *, const struct stat *);
+struct digestfile_entry **digestfile_bucket(struct digestfile *, const char *, size_t);
+void digestfile_resize(struct digestfile *, size_t);
+
+struct digestfile *
+digestfile_open(const char *fname, int type)
+{
+	const struct hash_args *hashops;
+	struct digestfile *df;
+	struct cvsync_file *cfp;
+	struct stat st;
+	char hash[sizeof(df->df_hash) + 1];
+	size_t len;
+
+	if (!hash_set(type, &hashops))
+		return (NULL);
+	if ((len = hash_ntop(type, hash, sizeof(hash))) == 0)
+		return (NULL);
+
+	if ((df = malloc(sizeof(*df))) == NULL) {
+		logmsg_err("%s", strerror(errno));
+		return (NULL);
+	}
+	df->df_name = fname;
+	(void)memset(df->df_hash, 0, sizeof(df->df_hash));
+	(void)memcpy(df->df_hash, hash, len);
+	df->df_length = hashops->length;
+	df->df_table = NULL;
+	df->df_nbuckets = 0;
+	df->df_nentries = 0;
+	df->df_changed = false;
+
+	if (pthread_mutex_init(&df->df_mtx, NULL) != 0) {
+		logmsg_err("Digestfile Error: mutex init");
+		free(df);
+		return (NULL);
+	}
+
+	digestfile_resize(df, DIGESTFILE_MINBUCKETS);
+	if (df->df_table == NULL) {
+		logmsg_err("%s", strerror(errno));
+		pthread_mutex_destroy(&df->df_mtx);
+		free(df);
+		return (NULL);
+	}
+
+	if ((stat(fname, &st) == -1) && (errno == ENOENT))
+		return (df);
+
+	if ((cfp = cvsync_fopen(fname)) == NULL) {
+		digestfile_close(df);
+		return (NULL);
+	}
+	if (!cvsync_mmap(cfp, (off_t)0, cfp->cf_size)) {
+		cvsync_fclose(cfp);
+		digestfile_close(df);
+		return (NULL);
+	}
+	if (!digestfile_decode(df, cfp->cf_addr, (size_t)cfp->cf_size)) {
+		/* It is only a cache, start over with an empty one. */
+		digestfile_resize(df, 0);
+		digestfile_resize(df, DIGESTFILE_MINBUCKETS);
+		if (df->df_table == NULL) {
+			logmsg_err("%s", strerror(errno));
+			cvsync_fclose(cfp);
+			digestfile_close(df);
+			return (NULL);
+		}
+		df->df_changed = true;
+	}
+	cvsync_fclose(cfp);
+
+	return (df);
+}
+
+void
+digestfile_close(struct digestfile *df)
+{
+	struct digestfile_entry *de;
+	size_t i;
+
+	if (df == NULL)
+		return;
+
+	if (df->df_table != NULL) {
+		if (df->df_changed)
+			(void)digestfile_write(df);
+
+		for (i = 0 ; i < df->df_nbuckets ; i++) {
+			while ((de = df->df_table[i]) != NULL) {
+				df->df_table[i] = de->de_next;
+				free(de);
+			}
+		}
+		free(df->df_table);
+	}
+
+	pthread_mutex_destroy(&df->df_mtx);
+	free(df);
+}
+
+bool
+digestfile_lookup(struct digestfile *df, const char *name, const struct stat *st, size_t count,
+		  struct digestfile_list *dl)
+{
+	struct digestfile_entry *de;
+	uint8_t *digests;
+	size_t namelen = strlen(name), len = count * df->df_length;
+
+	dl->dl_count = 0;
+	dl->dl_valid = true;
+
+	pthread_mutex_lock(&df->df_mtx);
+	for (de = *digestfile_bucket(df, name, namelen) ; de != NULL ; de = de->de_next) {
+		if ((de->de_namelen == namelen) && (memcmp(de->de_name, name, namelen) == 0))
+			break;
+	}
+	if (de == NULL) {
+		pthread_mutex_unlock(&df->df_mtx);
+		return (false);
+	}
+	if (!digestfile_entry_match(de, st) || (de->de_count != count)) {
+		digestfile_entry_remove(df, name, namelen);
+		pthread_mutex_unlock(&df->df_mtx);
+		return (false);
+	}
+	if (count > dl->dl_max) {
+		if ((digests = realloc(dl->dl_digests, len)) == NULL) {
+			pthread_mutex_unlock(&df->df_mtx);
+			dl->dl_valid = false;
+			return (false);
+		}
+		dl->dl_digests = digests;
+		dl->dl_max = count;
+	}
+	(void)memcpy(dl->dl_digests, de->de_digests, len);
+	dl->dl_count = count;
+	pthread_mutex_unlock(&df->df_mtx);
+
+	return (true);
+}
+
+void
+digestfile_insert(struct digestfile *df, const char *name, const struct stat *st, struct digestfile_list *dl)
+{
+	struct digestfile_entry *de;
+	size_t namelen = strlen(name);
+
+	if (!dl->dl_valid)
+		return;
+
+	if ((de = digestfile_entry_init(df, name, namelen, dl->dl_count)) == NULL)
+		return;
+	de->de_ino = (uint64_t)st->st_ino;
+	de->de_size = (uint64_t)st->st_size;
+	de->de_mtime = (int64_t)st->st_mtime;
+	if (dl->dl_count > 0)
+		(void)memcpy(de->de_digests, dl->dl_digests, dl->dl_count * df->df_length);
+
+	pthread_mutex_lock(&df->df_mtx);
+	digestfile_entry_remove(df, name, namelen);
+	digestfile_entry_insert(df, de);
+	pthread_mutex_unlock(&df->df_mtx);
+}
+
+void
+digestfile_remove(struct digestfile *df, const char *name)
+{
+	pthread_mutex_lock(&df->df_mtx);
+	digestfile_entry_remove(df, name, strlen(name));
+	pthread_mutex_unlock(&df->df_mtx);
+}
+
+struct digestfile_list *
+digestfile_list_init(void)
+{
+	struct digestfile_list *dl;
+
+	if ((dl = malloc(sizeof(*dl))) == NULL) {
+		logmsg_err("%s", strerror(errno));
+		return (NULL);
+	}
+	dl->dl_digests = NULL;
+	dl->dl_count = 0;
+	dl->dl_max = 0;
+	dl->dl_valid = false;
+
+	return (dl);
+}
+
+void
+digestfile_list_destroy(struct digestfile_list *dl)
+{
+	if (dl->dl_digests != NULL)
+		free(dl->dl_digests);
+	free(dl);
+}
+
+void
+digestfile_list_add(struct digestfile *df, struct digestfile_list *dl, const uint8_t *digest)
+{
+	uint8_t *digests;
+	size_t max;
+
+	if (!dl->dl_valid)
+		return;
+
+	if (dl->dl_count == dl->dl_max) {
+		max = (dl->dl_max > 0) ? dl->dl_max * 2 : 64;
+		if ((digests = realloc(dl->dl_digests, max * df->df_length)) == NULL) {
+			dl->dl_valid = false;
+			return;
+		}
+		dl->dl_digests = digests;
+		dl->dl_max = max;
+	}
+	(void)memcpy(&dl->dl_digests[dl->dl_count * df->df_length], digest, df->df_length);
+	dl->dl_count++;
+}
+
+bool
+digestfile_decode(struct digestfile *df, const uint8_t *sp, size_t size)
+{
+	struct digestfile_entry *de;
+	const uint8_t *bp = sp + size;
+	uint32_t nentries, i;
+	size_t namelen, count, len;
+
+	if (size < DIGESTFILE_HDRLEN)
+		return (false);
+	if (memcmp(sp, DIGESTFILE_MAGIC, DIGESTFILE_MAGICLEN) != 0)
+		return (false);
+	if (sp[DIGESTFILE_MAGICLEN] != DIGESTFILE_VERSION)
+		return (false);
+	if (memcmp(&sp[24], df->df_hash, sizeof(df->df_hash)) != 0)
+		return (false);
+	nentries = GetDWord(&sp[8]);
+	if (scanfile_digest(SCANFILE_FNV_BASIS, &sp[DIGESTFILE_HDRLEN], size - DIGESTFILE_HDRLEN) !=
+	    GetDDWord(&sp[16])) {
+		logmsg_err("Digestfile Error: %s: digest mismatch", df->df_name);
+		return (false);
+	}
+	sp += DIGESTFILE_HDRLEN;
+
+	for (i = 0 ; i < nentries ; i++) {
+		if ((size_t)(bp - sp) < DIGESTFILE_ENTLEN)
+			return (false);
+		namelen = GetWord(sp);
+		if ((namelen == 0) || ((size_t)(bp - sp) < DIGESTFILE_ENTLEN + namelen))
+			return (false);
+		count = GetDWord(&sp[namelen + 26]);
+		if (count > SIZE_MAX / df->df_length)
+			return (false);
+		len = count * df->df_length;
+		if ((size_t)(bp - sp) - DIGESTFILE_ENTLEN - namelen < len)
+			return (false);
+
+		if ((de = digestfile_entry_init(df, (const char *)&sp[2], namelen, count)) == NULL)
+			return (false);
+		de->de_ino = GetDDWord(&sp[namelen + 2]);
+		de->de_size = GetDDWord(&sp[namelen + 10]);
+		de->de_mtime = (int64_t)GetDDWord(&sp[namelen + 18]);
+		if (len > 0)
+			(void)memcpy(de->de_digests, &sp[DIGESTFILE_ENTLEN + namelen], len);
+		digestfile_entry_remove(df, de->de_name, namelen);
+		digestfile_entry_insert(df, de);
+
+		sp += DIGESTFILE_ENTLEN + namelen + len;
+	}
+	if (sp != bp)
+		return (false);
+
+	df->df_changed = false;
+
+	return (true);
+}
+
+bool
+digestfile_write(struct digestfile *df)
+{
+	struct digestfile_entry *de;
+	uint8_t *image, *sp;
+	char tmpname[PATH_MAX + CVSYNC_NAME_MAX + 1];
+	size_t size = DIGESTFILE_HDRLEN, len, i;
+	int fd;
+
+	for (i = 0 ; i < df->df_nbuckets ; i++) {
+		for (de = df->df_table[i] ; de != NULL ; de = de->de_next)
+			size += DIGESTFILE_ENTLEN + de->de_namelen + de->de_count * df->df_length;
+	}
+	if ((image = malloc(size)) == NULL) {
+		logmsg_err("Digestfile Error: %s", strerror(errno));
+		return (false);
+	}
+
+	sp = &image[DIGESTFILE_HDRLEN];
+	for (i = 0 ; i < df->df_nbuckets ; i++) {
+		for (de = df->df_table[i] ; de != NULL ; de = de->de_next) {
+			SetWord(sp, de->de_namelen);
+			(void)memcpy(&sp[2], de->de_name, de->de_namelen);
+			sp += de->de_namelen + 2;
+			SetDDWord(sp, de->de_ino);
+			SetDDWord(&sp[8], de->de_size);
+			SetDDWord(&sp[16], (uint64_t)de->de_mtime);
+			SetDWord(&sp[24], de->de_count);
+			sp += 28;
+			if ((len = de->de_count * df->df_length) > 0) {
+				(void)memcpy(sp, de->de_digests, len);
+				sp += len;
+			}
+		}
+	}
+
+	(void)memset(image, 0, DIGESTFILE_HDRLEN);
+	(void)memcpy(image, DIGESTFILE_MAGIC, DIGESTFILE_MAGICLEN);
+	image[DIGESTFILE_MAGICLEN] = DIGESTFILE_VERSION;
+	SetDWord(&image[8], df->df_nentries);
+	SetDDWord(&image[16], scanfile_digest(SCANFILE_FNV_BASIS, &image[DIGESTFILE_HDRLEN],
+					      size - DIGESTFILE_HDRLEN));
+	(void)memcpy(&image[24], df->df_hash, sizeof(df->df_hash));
+
+	len = strlen(df->df_name);
+	while ((len > 0) && (df->df_name[len - 1] != '/'))
+		len--;
+	if (len + CVSYNC_TMPFILE_LEN >= sizeof(tmpname)) {
+		logmsg_err("Digestfile Error: %s: %s", df->df_name, strerror(ENAMETOOLONG));
+		free(image);
+		return (false);
+	}
+	(void)memcpy(tmpname, df->df_name, len);
+	(void)memcpy(&tmpname[len], CVSYNC_TMPFILE, CVSYNC_TMPFILE_LEN);
+	tmpname[len + CVSYNC_TMPFILE_LEN] = '\0';
+
+	if ((fd = mkstemp(tmpname)) == -1) {
+		logmsg_err("Digestfile Error: %s: %s", tmpname, strerror(errno));
+		free(image);
+		return (false);
+	}
+	if (!digestfile_write_fd(fd, tmpname, image, size)) {
+		(void)close(fd);
+		(void)unlink(tmpname);
+		free(image);
+		return (false);
+	}
+	free(image);
+	if (close(fd) == -1) {
+		logmsg_err("Digestfile Error: %s: %s", tmpname, strerror(errno));
+		(void)unlink(tmpname);
+		return (false);
+	}
+	if (rename(tmpname, df->df_name) == -1) {
+		logmsg_err("Digestfile Error: %s: %s", df->df_name, strerror(errno));
+		(void)unlink(tmpname);
+		return (false);
+	}
+
+	return (true);
+}
+
+bool
+digestfile_write_fd(int fd, const char *name, const uint8_t *sp, size_t len)
+{
+	const uint8_t *bp = sp + len;
+	ssize_t wn;
+
+	while (sp < bp) {
+		if ((wn = write(fd, sp, (size_t)(bp - sp))) == -1) {
+			if (errno == EINTR) {
+				logmsg_intr();
+				continue;
+			}
+			logmsg_err("Digestfile Error: %s: %s", name, strerror(errno));
+			return (false);
+		}
+		if (wn == 0) {
+			logmsg_err("Digestfile Error: %s: write", name);
+			return (false);
+		}
+		sp += wn;
+	}
+
+	return (true);
+}
+
+struct digestfile_entry *
+digestfile_entry_init(struct digestfile *df, const char *name, size_t namelen, size_t count)
+{
+	struct digestfile_entry *de;
+
+	if ((de = malloc(sizeof(*de) + namelen + count * df->df_length)) == NULL)
+		return (NULL);
+	(void)memcpy(de->de_name, name, namelen);
+	de->de_name[namelen] = '\0';
+	de->de_namelen = namelen;
+	de->de_digests = (uint8_t *)&de->de_name[namelen + 1];
+	de->de_count = count;
+
+	return (de);
+}
+
+void
+digestfile_entry_insert(struct digestfile *df, struct digestfile_entry *de)
+{
+	struct digestfile_entry **dep;
+
+	if (df->df_nentries >= df->df_nbuckets * 2)
+		digestfile_resize(df, df->df_nbuckets * 2);
+
+	dep = digestfile_bucket(df, de->de_name, de->de_namelen);
+	de->de_next = *dep;
+	*dep = de;
+	df->df_nentries++;
+	df->df_changed = true;
+}
+
+void
+digestfile_entry_remove(struct digestfile *df, const char *name, size_t namelen)
+{
+	struct digestfile_entry *de, **dep;
+
+	for (dep = digestfile_bucket(df, name, namelen) ; (de = *dep) != NULL ; dep = &de->de_next) {
+		if ((de->de_namelen == namelen) && (memcmp(de->de_name, name, namelen) == 0)) {
+			*dep = de->de_next;
+			free(de);
+			df->df_nentries--;
+			df->df_changed = true;
+			return;
+		}
+	}
+}
+
+bool
+digestfile_entry_match(struct digestfile_entry *de, const struct stat *st)
+{
+	if (de->de_ino != (uint64_t)st->st_ino)
+		return (false);
+	if (de->de_size != (uint64_t)st->st_size)
+		return (false);
+	if (de->de_mtime != (int64_t)st->st_mtime)
+		return (false);
+
+	return (true);
+}
+
+struct digestfile_entry **
+digestfile_bucket(struct digestfile *df, const char *name, size_t namelen)
+{
+	uint64_t h;
+
+	h = scanfile_digest(SCANFILE_FNV_BASIS, (const uint8_t *)name, namelen);
+
+	return (&df->df_table[(size_t)h & (df->df_nbuckets - 1)]);
+}
+
+void
+digestfile_resize(struct digestfile *df, size_t nbuckets)
+{
+	struct digestfile_entry **table, **otable = df->df_table, *de, **dep;
+	size_t onbuckets = df->df_nbuckets, i;
+
+	if (nbuckets == 0) {
+		/* Drop everything. */
+		for (i = 0 ; i < onbuckets ; i++) {
+			while ((de = otable[i]) != NULL) {
+				otable[i] = de->de_next;
+				free(de);
+			}
+		}
+		free(otable);
+		df->df_table = NULL;
+		df->df_nbuckets = 0;
+		df->df_nentries = 0;
+		return;
+	}
+
+	if ((table = malloc(nbuckets * sizeof(*table))) == NULL) {
+		/* Keep the current table, chains just get longer. */
+		return;
+	}
+	for (i = 0 ; i < nbuckets ; i++)
+		table[i] = NULL;
+	df->df_table = table;
+	df->df_nbuckets = nbuckets;
+
+	for (i = 0 ; i < onbuckets ; i++) {
+		while ((de = otable[i]) != NULL) {
+			otable[i] = de->de_next;
+			dep = digestfile_bucket(df, de->de_name, de->de_namelen);
+			de->de_next = *dep;
+			*dep = de;
+		}
+	}
+	if (otable != NULL)
+		free(otable);
+}
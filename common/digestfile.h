@@ -0,0 +1,62 @@
+/*-
+ * This software is released under the BSD License, see LICENSE.
+ */
+
+#ifndef CVSYNC_DIGESTFILE_H
+#define	CVSYNC_DIGESTFILE_H
+
+struct digestfile_entry;
+struct stat;
+
+#define	DIGESTFILE_MAGIC	"\0CDF"
+#define	DIGESTFILE_MAGICLEN	(4)
+#define	DIGESTFILE_VERSION	(1)
+
+/*
+ * The digestfile keeps the deltatext digests of RCS files, so that
+ * FileScan does not have to hash every revision of a file which has not
+ * changed since (all integers are big-endian):
+ *   header:  magic(4) version(1) pad(3) nentries(4) pad(4) digest(8)
+ *            hash(8)
+ *   entries: namelen(2) name ino(8) size(8) mtime(8) count(4)
+ *            digests(count * hash length)
+ * Entries are keyed by the name relative to the collection prefix and
+ * only used while the inode, size and mtime of the file still match;
+ * stale entries are dropped on lookup and when the updater removes the
+ * file.
+ * The digests are in the order of rcslib_file.delta.rd_rev.  The hash
+ * is the NUL padded name of the hash type, and the digest is 64bit
+ * FNV-1a over the entries.
+ */
+#define	DIGESTFILE_HDRLEN	(32)
+#define	DIGESTFILE_ENTLEN	(30)
+
+struct digestfile {
+	const char		*df_name;
+	char			df_hash[8];
+	size_t			df_length;
+
+	struct digestfile_entry	**df_table;
+	size_t			df_nbuckets, df_nentries;
+	bool			df_changed;
+
+	pthread_mutex_t		df_mtx;
+};
+
+struct digestfile_list {
+	uint8_t			*dl_digests;
+	size_t			dl_count, dl_max;
+	bool			dl_valid;
+};
+
+struct digestfile *digestfile_open(const char *, int);
+void digestfile_close(struct digestfile *);
+bool digestfile_lookup(struct digestfile *, const char *, const struct stat *, size_t, struct digestfile_list *);
+void digestfile_insert(struct digestfile *, const char *, const struct stat *, struct digestfile_list *);
+void digestfile_remove(struct digestfile *, const char *);
+
+struct digestfile_list *digestfile_list_init(void);
+void digestfile_list_destroy(struct digestfile_list *);
+void digestfile_list_add(struct digestfile *, struct digestfile_list *, const uint8_t *);
+
+#endif /* CVSYNC_DIGESTFILE_H */
@@ -26,6 +26,7 @@
 #include "cvsync_attr.h"
 #include "distfile.h"
 #include "filetypes.h"
+#include "hash.h"
 #include "logmsg.h"
 #include "mdirent.h"
 #include "mux.h"
@@ -38,7 +39,7 @@ bool dircmp_fetch(struct dircmp_args *);
 bool dircmp_close(struct dircmp_args *);
 
 struct dircmp_args *
-dircmp_init(struct mux *mx, const char *hostinfo, struct collection *cls, uint32_t proto)
+dircmp_init(struct mux *mx, const char *hostinfo, struct collection *cls, uint32_t proto, int type)
 {
 	struct dircmp_args *dca;
 
@@ -53,6 +54,12 @@ dircmp_init(struct mux *mx, const char *hostinfo, struct collection *cls, uint32
 	dca->dca_pathmax = sizeof(dca->dca_path);
 	dca->dca_namemax = CVSYNC_NAME_MAX;
 	dca->dca_cmdmax = sizeof(dca->dca_cmd);
+	dca->dca_prefetch = NULL;
+
+	if (!hash_set(type, &dca->dca_hash_ops)) {
+		free(dca);
+		return (NULL);
+	}
 
 	return (dca);
 }
@@ -313,7 +320,7 @@ dircmp_access(struct dircmp_args *dca, void *aux)
 	if ((len = dca->dca_pathlen + mdp->md_namelen) >= dca->dca_pathmax)
 		return (false);
 	(void)memcpy(&dca->dca_path[dca->dca_pathlen], mdp->md_name, mdp->md_namelen);
-	if (S_ISDIR(mdp->md_stat.st_mode)) {
+	if (S_ISDIR(mdp->md_mode)) {
 		dca->dca_path[len] = '\0';
 		if (distfile_access(da, dca->dca_rpath) == DISTFILE_DENY)
 			return (false);
@@ -7,6 +7,8 @@
 
 struct collection;
 struct cvsync_attr;
+struct filecmp_prefetch;
+struct hash_args;
 struct mdirent;
 struct mux;
 struct scanfile_attr;
@@ -41,9 +43,13 @@ struct dircmp_args {
 	uint8_t			dca_tag, dca_cmd[CVSYNC_MAXCMDLEN];
 	size_t			dca_cmdmax;
 	struct cvsync_attr	dca_attr;
+
+	const struct hash_args	*dca_hash_ops;
+
+	struct filecmp_prefetch	*dca_prefetch;
 };
 
-struct dircmp_args *dircmp_init(struct mux *, const char *, struct collection *, uint32_t);
+struct dircmp_args *dircmp_init(struct mux *, const char *, struct collection *, uint32_t, int);
 void dircmp_destroy(struct dircmp_args *);
 void *dircmp(void *);
 bool dircmp_start(struct dircmp_args *, const char *, const char *);
@@ -24,11 +24,15 @@
 #include "cvsync.h"
 #include "cvsync_attr.h"
 #include "filetypes.h"
+#include "hash.h"
 #include "list.h"
 #include "mdirent.h"
 #include "mux.h"
+#include "scanfile.h"
+#include "version.h"
 
 #include "dircmp.h"
+#include "filecmp.h"
 #include "filescan.h"
 
 bool dircmp_rcs_fetch(struct dircmp_args *);
@@ -42,6 +46,7 @@ bool dircmp_rcs_remove_dir(struct dircmp_args *);
 bool dircmp_rcs_remove_file(struct dircmp_args *);
 bool dircmp_rcs_replace(struct dircmp_args *, struct mdirent_rcs *);
 bool dircmp_rcs_update(struct dircmp_args *, struct mdirent_rcs *);
+bool dircmp_rcs_same_digest(struct dircmp_args *, struct mdirent_rcs *);
 
 struct mDIR *dircmp_rcs_opendir(struct dircmp_args *, size_t);
 
@@ -285,7 +290,13 @@ dircmp_rcs_fetch(struct dircmp_args *dca)
 		else
 			cap->ca_type = FILETYPE_RCS_ATTIC;
 		if ((cap->ca_namelen == 0) || (cap->ca_namelen > sizeof(cap->ca_name)) ||
-		    (cap->ca_namelen != (len - RCS_ATTRLEN_RCS - 2))) {
+		    (len < cap->ca_namelen + RCS_ATTRLEN_RCS + 2)) {
+			return (false);
+		}
+		/* The client may follow the attributes with the digest since 0.25. */
+		cap->ca_auxlen = len - cap->ca_namelen - RCS_ATTRLEN_RCS - 2;
+		if ((cap->ca_auxlen > 0) &&
+		    ((dca->dca_proto < CVSYNC_PROTO(0, 25)) || (cap->ca_auxlen > RCS_ATTRLEN_DIGEST))) {
 			return (false);
 		}
 		if (!mux_recv(dca->dca_mux, MUX_DIRCMP_IN, cap->ca_name, cap->ca_namelen))
@@ -296,6 +307,8 @@ dircmp_rcs_fetch(struct dircmp_args *dca)
 			return (false);
 		if (!attr_rcs_decode_rcs(cmd, RCS_ATTRLEN_RCS, cap))
 			return (false);
+		if ((cap->ca_auxlen > 0) && !mux_recv(dca->dca_mux, MUX_DIRCMP_IN, cap->ca_aux, cap->ca_auxlen))
+			return (false);
 		break;
 	case DIRCMP_SYMLINK:
 		cap->ca_type = FILETYPE_SYMLINK;
@@ -326,15 +339,14 @@ dircmp_rcs_add(struct dircmp_args *dca, struct mdirent_rcs *mdp)
 	struct mDIR *mdirp;
 	struct mdirent_rcs *entries;
 	struct list *lp;
-	struct stat *st = &mdp->md_stat;
 	size_t len;
 
-	if (S_ISREG(st->st_mode))
+	if (S_ISREG(mdp->md_mode))
 		return (dircmp_rcs_add_file(dca, mdp));
-	if (S_ISLNK(st->st_mode))
+	if (S_ISLNK(mdp->md_mode))
 		return (dircmp_rcs_add_symlink(dca, mdp));
 
-	if (!S_ISDIR(st->st_mode))
+	if (!S_ISDIR(mdp->md_mode))
 		return (false);
 	if (!dircmp_rcs_add_dir(dca, mdp))
 		return (false);
@@ -378,7 +390,7 @@ dircmp_rcs_add(struct dircmp_args *dca, struct mdirent_rcs *mdp)
 			if (!dircmp_access(dca, mdp))
 				continue;
 
-			switch (mdp->md_stat.st_mode & S_IFMT) {
+			switch (mdp->md_mode & S_IFMT) {
 			case S_IFDIR:
 				if (!dircmp_rcs_add_dir(dca, mdp)) {
 					mclosedir(mdirp);
@@ -679,7 +691,7 @@ dircmp_rcs_remove_file(struct dircmp_args *dca)
 bool
 dircmp_rcs_replace(struct dircmp_args *dca, struct mdirent_rcs *mdp)
 {
-	switch (mdp->md_stat.st_mode & S_IFMT) {
+	switch (mdp->md_mode & S_IFMT) {
 	case S_IFDIR:
 	case S_IFREG:
 	case S_IFLNK:
@@ -699,8 +711,7 @@ bool
 dircmp_rcs_update(struct dircmp_args *dca, struct mdirent_rcs *mdp)
 {
 	struct cvsync_attr *cap = &dca->dca_attr;
-	struct stat *st = &mdp->md_stat;
-	uint16_t mode = RCS_MODE(st->st_mode, dca->dca_collection->cl_umask);
+	uint16_t mode = RCS_MODE(mdp->md_mode, dca->dca_collection->cl_umask);
 	uint8_t *cmd = dca->dca_cmd;
 	size_t base, len, rlen;
 	ssize_t wn;
@@ -713,7 +724,7 @@ dircmp_rcs_update(struct dircmp_args *dca, struct mdirent_rcs *mdp)
 
 	len = dca->dca_cmdmax - base;
 
-	switch (st->st_mode & S_IFMT) {
+	switch (mdp->md_mode & S_IFMT) {
 	case S_IFDIR:
 		if (cap->ca_type != FILETYPE_DIR)
 			return (dircmp_rcs_replace(dca, mdp));
@@ -732,29 +743,29 @@ dircmp_rcs_update(struct dircmp_args *dca, struct mdirent_rcs *mdp)
 				cmd[3] = FILETYPE_RCS_ATTIC;
 			else
 				cmd[3] = FILETYPE_RCS;
-			if ((cmd[3] == cap->ca_type) && ((int64_t)st->st_mtime == cap->ca_mtime) &&
+			if ((cmd[3] == cap->ca_type) && ((int64_t)mdp->md_mtime == cap->ca_mtime) &&
 			    (mode == cap->ca_mode)) {
 				return (true);
 			}
 			if (cap->ca_type != cmd[3]) {
 				cmd[2] = FILESCAN_RCS_ATTIC;
 			} else {
-				if ((int64_t)st->st_mtime != cap->ca_mtime)
+				if (((int64_t)mdp->md_mtime != cap->ca_mtime) && !dircmp_rcs_same_digest(dca, mdp))
 					cmd[2] = FILESCAN_UPDATE;
 				else
 					cmd[2] = FILESCAN_SETATTR;
 			}
-			if ((len = attr_rcs_encode_rcs(&cmd[6], len, st->st_mtime, mode)) == 0)
+			if ((len = attr_rcs_encode_rcs(&cmd[6], len, mdp->md_mtime, mode)) == 0)
 				return (false);
 		} else {
 			if (cap->ca_type != FILETYPE_FILE)
 				return (dircmp_rcs_replace(dca, mdp));
-			if (((int64_t)st->st_mtime == cap->ca_mtime) && ((uint64_t)st->st_size == cap->ca_size) &&
+			if (((int64_t)mdp->md_mtime == cap->ca_mtime) && ((uint64_t)mdp->md_size == cap->ca_size) &&
 			    (mode == cap->ca_mode)) {
 				return (true);
 			}
-			if (((int64_t)st->st_mtime != cap->ca_mtime) || ((uint64_t)st->st_size != cap->ca_size)) {
-				if (st->st_size == 0)
+			if (((int64_t)mdp->md_mtime != cap->ca_mtime) || ((uint64_t)mdp->md_size != cap->ca_size)) {
+				if (mdp->md_size == 0)
 					return (dircmp_rcs_replace(dca, mdp));
 
 				cmd[2] = FILESCAN_UPDATE;
@@ -762,7 +773,7 @@ dircmp_rcs_update(struct dircmp_args *dca, struct mdirent_rcs *mdp)
 				cmd[2] = FILESCAN_SETATTR;
 			}
 			cmd[3] = FILETYPE_FILE;
-			if ((len = attr_rcs_encode_file(&cmd[6], len, st->st_mtime, st->st_size, mode)) == 0)
+			if ((len = attr_rcs_encode_file(&cmd[6], len, mdp->md_mtime, mdp->md_size, mode)) == 0)
 				return (false);
 		}
 		break;
@@ -784,6 +795,12 @@ dircmp_rcs_update(struct dircmp_args *dca, struct mdirent_rcs *mdp)
 		return (false);
 	}
 
+	if ((dca->dca_prefetch != NULL) && (cmd[2] == FILESCAN_UPDATE) &&
+	    ((cmd[3] == FILETYPE_RCS) || (cmd[3] == FILETYPE_RCS_ATTIC))) {
+		filecmp_prefetch_push(dca->dca_prefetch, dca->dca_path, dca->dca_pathlen, mdp->md_name, mdp->md_namelen,
+				      cmd[3] == FILETYPE_RCS_ATTIC);
+	}
+
 	SetWord(cmd, len + base - 2);
 	SetWord(&cmd[4], rlen + mdp->md_namelen);
 	if (!mux_send(dca->dca_mux, MUX_FILESCAN, cmd, 6))
@@ -800,11 +817,37 @@ dircmp_rcs_update(struct dircmp_args *dca, struct mdirent_rcs *mdp)
 	return (true);
 }
 
+/*
+ * Only the mtime differs: the file need not be compared if its logical
+ * digest is the same as that of the client.
+ */
+bool
+dircmp_rcs_same_digest(struct dircmp_args *dca, struct mdirent_rcs *mdp)
+{
+	struct cvsync_attr *cap = &dca->dca_attr;
+	uint8_t digest[HASH_MAXLEN];
+	size_t len;
+
+	if ((cap->ca_auxlen == 0) || (cap->ca_auxlen != dca->dca_hash_ops->length))
+		return (false);
+
+	len = dca->dca_pathlen + mdp->md_namelen;
+	(void)memcpy(&dca->dca_path[dca->dca_pathlen], mdp->md_name, mdp->md_namelen);
+	dca->dca_path[len] = '\0';
+	if (mdp->md_attic && !cvsync_rcs_insert_attic(dca->dca_path, len, dca->dca_pathmax))
+		return (false);
+	if (!scanfile_rcs_digest(dca->dca_path, dca->dca_hash_ops, digest))
+		return (false);
+
+	return (memcmp(digest, cap->ca_aux, cap->ca_auxlen) == 0);
+}
+
 struct mDIR *
 dircmp_rcs_opendir(struct dircmp_args *dca, size_t pathlen)
 {
 	struct mDIR *mdirp;
 	struct mdirent_rcs *mdp;
+	struct stat st;
 	struct mdirent_args mda;
 	struct collection *cl = dca->dca_collection;
 	size_t rpathlen, len;
@@ -812,6 +855,7 @@ dircmp_rcs_opendir(struct dircmp_args *dca, size_t pathlen)
 
 	mda.mda_errormode = cl->cl_errormode;
 	mda.mda_symfollow = cl->cl_symfollow;
+	mda.mda_inodeorder = cl->cl_inodeorder;
 	mda.mda_remove = false;
 
 	rpathlen = pathlen - (size_t)(dca->dca_rpath - dca->dca_path);
@@ -822,19 +866,21 @@ dircmp_rcs_opendir(struct dircmp_args *dca, size_t pathlen)
 		return (mdirp);
 	}
 
-	if ((mdp = malloc(sizeof(*mdp))) == NULL)
+	if ((mdp = malloc(sizeof(*mdp) + CVSYNC_NAME_MAX + 1)) == NULL)
 		return (NULL);
 
 	for (len = rpathlen ; len < cl->cl_rprefixlen ; len++) {
 		if (cl->cl_rprefix[len] == '/')
 			break;
 	}
-	if ((len -= rpathlen) >= sizeof(mdp->md_name)) {
+	if ((len -= rpathlen) > CVSYNC_NAME_MAX) {
 		free(mdp);
 		return (NULL);
 	}
+	mdp->md_name = (char *)&mdp[1];
 	(void)memcpy(mdp->md_name, &cl->cl_rprefix[rpathlen], len);
-	mdp->md_namelen = len;
+	mdp->md_nameoff = 0;
+	mdp->md_namelen = (uint16_t)len;
 	mdp->md_attic = false;
 	mdp->md_dead = false;
 
@@ -847,17 +893,20 @@ dircmp_rcs_opendir(struct dircmp_args *dca, size_t pathlen)
 	dca->dca_path[len] = '\0';
 
 	if (cl->cl_symfollow)
-		rv = stat(dca->dca_path, &mdp->md_stat);
+		rv = stat(dca->dca_path, &st);
 	else
-		rv = lstat(dca->dca_path, &mdp->md_stat);
+		rv = lstat(dca->dca_path, &st);
 	if (rv == -1) {
 		free(mdp);
 		return (NULL);
 	}
-	if (!S_ISDIR(mdp->md_stat.st_mode)) {
+	if (!S_ISDIR(st.st_mode)) {
 		free(mdp);
 		return (NULL);
 	}
+	mdp->md_mode = st.st_mode;
+	mdp->md_size = st.st_size;
+	mdp->md_mtime = st.st_mtime;
 
 	if ((mdirp = malloc(sizeof(*mdirp))) == NULL) {
 		free(mdp);
@@ -866,6 +915,7 @@ dircmp_rcs_opendir(struct dircmp_args *dca, size_t pathlen)
 	mdirp->m_entries = mdp;
 	mdirp->m_nentries = 1;
 	mdirp->m_offset = 0;
+	mdirp->m_names = NULL;
 	mdirp->m_parent = NULL;
 	mdirp->m_parent_pathlen = 0;
 
@@ -22,11 +22,14 @@
 #include "cvsync.h"
 #include "cvsync_attr.h"
 #include "filetypes.h"
+#include "hash.h"
 #include "list.h"
 #include "mux.h"
 #include "scanfile.h"
+#include "version.h"
 
 #include "dircmp.h"
+#include "filecmp.h"
 #include "filescan.h"
 
 bool dircmp_rcs_scanfile_add(struct dircmp_args *, struct scanfile_attr *);
@@ -36,6 +39,7 @@ bool dircmp_rcs_scanfile_remove_dir(struct dircmp_args *);
 bool dircmp_rcs_scanfile_remove_file(struct dircmp_args *);
 bool dircmp_rcs_scanfile_replace(struct dircmp_args *, struct scanfile_attr *);
 bool dircmp_rcs_scanfile_update(struct dircmp_args *, struct scanfile_attr *);
+bool dircmp_rcs_scanfile_same_digest(struct dircmp_args *, struct scanfile_attr *);
 
 bool dircmp_rcs_scanfile_fetch(struct dircmp_args *);
 bool dircmp_rcs_scanfile_read(struct dircmp_args *, struct scanfile_attr *);
@@ -305,9 +309,14 @@ dircmp_rcs_scanfile_fetch(struct dircmp_args *dca)
 			cap->ca_type = FILETYPE_RCS;
 		else
 			cap->ca_type = FILETYPE_RCS_ATTIC;
-		cap->ca_auxlen = RCS_ATTRLEN_RCS;
 		if ((cap->ca_namelen == 0) || (cap->ca_namelen > sizeof(cap->ca_name)) ||
-		    (cap->ca_namelen != (len - cap->ca_auxlen - 2))) {
+		    (len < cap->ca_namelen + RCS_ATTRLEN_RCS + 2)) {
+			return (false);
+		}
+		/* The client may follow the attributes with the digest since 0.25. */
+		cap->ca_auxlen = len - cap->ca_namelen - 2;
+		if ((cap->ca_auxlen > RCS_ATTRLEN_RCS) &&
+		    ((dca->dca_proto < CVSYNC_PROTO(0, 25)) || (cap->ca_auxlen > RCS_ATTRLEN_RCS + RCS_ATTRLEN_DIGEST))) {
 			return (false);
 		}
 		break;
@@ -651,6 +660,7 @@ dircmp_rcs_scanfile_replace(struct dircmp_args *dca, struct scanfile_attr *attr)
 bool
 dircmp_rcs_scanfile_update(struct dircmp_args *dca, struct scanfile_attr *attr)
 {
+	struct collection *cl = dca->dca_collection;
 	struct cvsync_attr *cap = &dca->dca_attr;
 	uint8_t *cmd = dca->dca_cmd;
 	size_t base, len;
@@ -688,19 +698,22 @@ dircmp_rcs_scanfile_update(struct dircmp_args *dca, struct scanfile_attr *attr)
 	case FILETYPE_RCS_ATTIC:
 		if ((cap->ca_type != FILETYPE_RCS) && (cap->ca_type != FILETYPE_RCS_ATTIC))
 			return (dircmp_rcs_scanfile_replace(dca, attr));
-		if (attr->a_auxlen != cap->ca_auxlen)
+		if (attr->a_auxlen < RCS_ATTRLEN_RCS)
 			return (false);
-		if (memcmp(cap->ca_aux, attr->a_aux, attr->a_auxlen) == 0)
+		if (memcmp(cap->ca_aux, attr->a_aux, RCS_ATTRLEN_RCS) == 0)
 			return (true);
 		if (cap->ca_type != attr->a_type) {
 			cmd[2] = FILESCAN_RCS_ATTIC;
 		} else {
-			if (memcmp(cap->ca_aux, attr->a_aux, attr->a_auxlen - 2) == 0)
+			if ((memcmp(cap->ca_aux, attr->a_aux, RCS_ATTRLEN_RCS - 2) == 0) ||
+			    dircmp_rcs_scanfile_same_digest(dca, attr)) {
 				cmd[2] = FILESCAN_SETATTR;
-			else
+			} else {
 				cmd[2] = FILESCAN_UPDATE;
+			}
 		}
-		len = attr->a_auxlen;
+		/* FileScan is only given the attributes. */
+		len = RCS_ATTRLEN_RCS;
 		break;
 	case FILETYPE_SYMLINK:
 		if (cap->ca_type != FILETYPE_SYMLINK)
@@ -717,24 +730,49 @@ dircmp_rcs_scanfile_update(struct dircmp_args *dca, struct scanfile_attr *attr)
 	SetWord(cmd, len + base - 2);
 	cmd[3] = attr->a_type;
 	SetWord(&cmd[4], attr->a_namelen);
+	if ((dca->dca_prefetch != NULL) && (cmd[2] == FILESCAN_UPDATE) &&
+	    ((cmd[3] == FILETYPE_RCS) || (cmd[3] == FILETYPE_RCS_ATTIC))) {
+		filecmp_prefetch_push(dca->dca_prefetch, cl->cl_prefix, cl->cl_prefixlen, attr->a_name, attr->a_namelen,
+				      cmd[3] == FILETYPE_RCS_ATTIC);
+	}
 	if (!mux_send(dca->dca_mux, MUX_FILESCAN, cmd, 6))
 		return (false);
 	if (!mux_send(dca->dca_mux, MUX_FILESCAN, attr->a_name, attr->a_namelen))
 		return (false);
 	if (len > 0) {
-		if (!mux_send(dca->dca_mux, MUX_FILESCAN, attr->a_aux, attr->a_auxlen))
+		if (!mux_send(dca->dca_mux, MUX_FILESCAN, attr->a_aux, len))
 			return (false);
 	}
 
 	return (true);
 }
 
+/*
+ * Only the mtime differs: the file need not be compared if its logical
+ * digest is the same as that of the client.
+ */
+bool
+dircmp_rcs_scanfile_same_digest(struct dircmp_args *dca, struct scanfile_attr *attr)
+{
+	struct cvsync_attr *cap = &dca->dca_attr;
+	const uint8_t *digest;
+	size_t len = dca->dca_hash_ops->length;
+
+	if ((digest = attr_rcs_digest(attr->a_aux, attr->a_auxlen, len)) == NULL)
+		return (false);
+	if (attr_rcs_digest(cap->ca_aux, cap->ca_auxlen, len) == NULL)
+		return (false);
+
+	return (memcmp(digest, &cap->ca_aux[RCS_ATTRLEN_RCS], len) == 0);
+}
+
 bool
 dircmp_rcs_scanfile_read(struct dircmp_args *dca, struct scanfile_attr *attr)
 {
 	struct collection *cl = dca->dca_collection;
 	struct scanfile_args *sa = cl->cl_scanfile;
 	struct scanfile_attr rpref_attr;
+	uint8_t *sp;
 	char *name;
 
 	if (sa->sa_start == sa->sa_end)
@@ -758,8 +796,9 @@ dircmp_rcs_scanfile_read(struct dircmp_args *dca, struct scanfile_attr *attr)
 
 		if (attr->a_namelen <= cl->cl_rprefixlen) {
 			if (!dircmp_isparent(attr, &rpref_attr)) {
-				sa->sa_start += attr->a_size;
-				if (sa->sa_start == sa->sa_end)
+				if ((sp = scanfile_seek_prefix(sa, sa->sa_start, attr, cl->cl_rprefix, cl->cl_rprefixlen)) == NULL)
+					sp = sa->sa_start + attr->a_size;
+				if ((sa->sa_start = sp) == sa->sa_end)
 					return (false);
 				continue;
 			}
@@ -781,8 +820,9 @@ dircmp_rcs_scanfile_read(struct dircmp_args *dca, struct scanfile_attr *attr)
 			continue;
 		}
 
-		sa->sa_start += attr->a_size;
-		if (sa->sa_start == sa->sa_end)
+		if ((sp = scanfile_seek_prefix(sa, sa->sa_start, attr, cl->cl_rprefix, cl->cl_rprefixlen)) == NULL)
+			sp = sa->sa_start + attr->a_size;
+		if ((sa->sa_start = sp) == sa->sa_end)
 			return (false);
 	}
 
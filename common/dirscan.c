@@ -199,6 +199,7 @@ dirscan_scanfile_open(struct collection *cl)
 
 		mda.mda_errormode = cl->cl_errormode;
 		mda.mda_symfollow = false;
+		mda.mda_inodeorder = cl->cl_inodeorder;
 		mda.mda_remove = true;
 
 		sca.sca_name = cl->cl_scan_name;
@@ -209,6 +210,8 @@ dirscan_scanfile_open(struct collection *cl)
 		sca.sca_mode = S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH;
 		sca.sca_mdirent_args = &mda;
 		sca.sca_umask = cl->cl_umask;
+		sca.sca_hash_ops = NULL;
+		sca.sca_nocache = cl->cl_scan_nocache;
 
 		if (!scanfile_create(&sca))
 			return (false);
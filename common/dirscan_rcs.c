@@ -83,7 +83,7 @@ dirscan_rcs(struct dirscan_args *dsa)
 			if (mdp->md_dead)
 				continue;
 
-			switch (mdp->md_stat.st_mode & S_IFMT) {
+			switch (mdp->md_mode & S_IFMT) {
 			case S_IFDIR:
 				if (!dirscan_rcs_down(dsa, mdp)) {
 					mclosedir(mdirp);
@@ -161,7 +161,7 @@ bool
 dirscan_rcs_down(struct dirscan_args *dsa, struct mdirent_rcs *mdp)
 {
 	struct collection *cl = dsa->dsa_collection;
-	uint16_t mode = RCS_MODE(mdp->md_stat.st_mode, cl->cl_umask);
+	uint16_t mode = RCS_MODE(mdp->md_mode, cl->cl_umask);
 	uint8_t *cmd = dsa->dsa_cmd;
 	size_t base, len;
 
@@ -199,7 +199,6 @@ dirscan_rcs_up(struct dirscan_args *dsa)
 bool
 dirscan_rcs_file(struct dirscan_args *dsa, struct mdirent_rcs *mdp)
 {
-	struct stat *st = &mdp->md_stat;
 	uint16_t mode;
 	uint8_t *cmd = dsa->dsa_cmd;
 	size_t base, len;
@@ -209,7 +208,7 @@ dirscan_rcs_file(struct dirscan_args *dsa, struct mdirent_rcs *mdp)
 	if ((base = mdp->md_namelen + 4) > dsa->dsa_cmdmax)
 		return (false);
 
-	mode = RCS_MODE(st->st_mode, dsa->dsa_collection->cl_umask);
+	mode = RCS_MODE(mdp->md_mode, dsa->dsa_collection->cl_umask);
 	len = dsa->dsa_cmdmax - base;
 
 	if (IS_FILE_RCS(mdp->md_name, mdp->md_namelen)) {
@@ -217,10 +216,10 @@ dirscan_rcs_file(struct dirscan_args *dsa, struct mdirent_rcs *mdp)
 			cmd[2] = DIRCMP_RCS_ATTIC;
 		else
 			cmd[2] = DIRCMP_RCS;
-		len = attr_rcs_encode_rcs(&cmd[4], len, st->st_mtime, mode);
+		len = attr_rcs_encode_rcs(&cmd[4], len, mdp->md_mtime, mode);
 	} else {
 		cmd[2] = DIRCMP_FILE;
-		len = attr_rcs_encode_file(&cmd[4], len, st->st_mtime, st->st_size, mode);
+		len = attr_rcs_encode_file(&cmd[4], len, mdp->md_mtime, mdp->md_size, mode);
 	}
 	if (len == 0)
 		return (false);
@@ -275,12 +274,14 @@ dirscan_rcs_opendir(struct dirscan_args *dsa, size_t pathlen)
 {
 	struct mDIR *mdirp;
 	struct mdirent_rcs *mdp;
+	struct stat st;
 	struct mdirent_args mda;
 	struct collection *cl = dsa->dsa_collection;
 	size_t rpathlen, len;
 
 	mda.mda_errormode = cl->cl_errormode;
 	mda.mda_symfollow = false;
+	mda.mda_inodeorder = cl->cl_inodeorder;
 	mda.mda_remove = true;
 
 	rpathlen = pathlen - (size_t)(dsa->dsa_rpath - dsa->dsa_path);
@@ -291,19 +292,21 @@ dirscan_rcs_opendir(struct dirscan_args *dsa, size_t pathlen)
 		return (mdirp);
 	}
 
-	if ((mdp = malloc(sizeof(*mdp))) == NULL)
+	if ((mdp = malloc(sizeof(*mdp) + CVSYNC_NAME_MAX + 1)) == NULL)
 		return (NULL);
 
 	for (len = rpathlen ; len < cl->cl_rprefixlen ; len++) {
 		if (cl->cl_rprefix[len] == '/')
 			break;
 	}
-	if ((len -= rpathlen) >= sizeof(mdp->md_name)) {
+	if ((len -= rpathlen) > CVSYNC_NAME_MAX) {
 		free(mdp);
 		return (NULL);
 	}
+	mdp->md_name = (char *)&mdp[1];
 	(void)memcpy(mdp->md_name, &cl->cl_rprefix[rpathlen], len);
-	mdp->md_namelen = len;
+	mdp->md_nameoff = 0;
+	mdp->md_namelen = (uint16_t)len;
 	mdp->md_attic = false;
 	mdp->md_dead = false;
 
@@ -315,14 +318,17 @@ dirscan_rcs_opendir(struct dirscan_args *dsa, size_t pathlen)
 	(void)memcpy(&dsa->dsa_path[cl->cl_prefixlen], cl->cl_rprefix, rpathlen + mdp->md_namelen);
 	dsa->dsa_path[len] = '\0';
 
-	if (lstat(dsa->dsa_path, &mdp->md_stat) == -1) {
+	if (lstat(dsa->dsa_path, &st) == -1) {
 		free(mdp);
 		mdp = NULL;
 	} else {
-		if (!S_ISDIR(mdp->md_stat.st_mode)) {
+		if (!S_ISDIR(st.st_mode)) {
 			free(mdp);
 			return (NULL);
 		}
+		mdp->md_mode = st.st_mode;
+		mdp->md_size = st.st_size;
+		mdp->md_mtime = st.st_mtime;
 	}
 
 	if ((mdirp = malloc(sizeof(*mdirp))) == NULL) {
@@ -333,6 +339,7 @@ dirscan_rcs_opendir(struct dirscan_args *dsa, size_t pathlen)
 	mdirp->m_entries = mdp;
 	mdirp->m_nentries = (mdp != NULL) ? 1 : 0;
 	mdirp->m_offset = 0;
+	mdirp->m_names = NULL;
 	mdirp->m_parent = NULL;
 	mdirp->m_parent_pathlen = 0;
 
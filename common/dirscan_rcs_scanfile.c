@@ -25,6 +25,7 @@
 #include "list.h"
 #include "mux.h"
 #include "scanfile.h"
+#include "version.h"
 
 #include "dirscan.h"
 #include "dircmp.h"
@@ -238,7 +239,7 @@ dirscan_rcs_scanfile_file(struct dirscan_args *dsa, struct scanfile_attr *attr)
 {
 	uint8_t *cmd = dsa->dsa_cmd;
 	const uint8_t *name, *sv_name = attr->a_name;
-	size_t namelen, len;
+	size_t namelen, auxlen, len;
 
 	for (name = &sv_name[attr->a_namelen - 1] ; name >= sv_name ; name--) {
 		if (*name == '/') {
@@ -251,40 +252,44 @@ dirscan_rcs_scanfile_file(struct dirscan_args *dsa, struct scanfile_attr *attr)
 	namelen = attr->a_namelen - (size_t)(name - sv_name);
 	if (namelen > dsa->dsa_namemax)
 		return (false);
-	if ((len = namelen + attr->a_auxlen + 4) > dsa->dsa_cmdmax)
-		return (false);
+	auxlen = attr->a_auxlen;
 
-	SetWord(cmd, len - 2);
 	switch (attr->a_type) {
 	case FILETYPE_FILE:
 		cmd[2] = DIRCMP_FILE;
-		if (attr->a_auxlen != RCS_ATTRLEN_FILE)
+		if (auxlen != RCS_ATTRLEN_FILE)
 			return (false);
 		break;
 	case FILETYPE_RCS:
-		cmd[2] = DIRCMP_RCS;
-		if (attr->a_auxlen != RCS_ATTRLEN_RCS)
-			return (false);
-		break;
 	case FILETYPE_RCS_ATTIC:
-		cmd[2] = DIRCMP_RCS_ATTIC;
-		if (attr->a_auxlen != RCS_ATTRLEN_RCS)
+		if (attr->a_type == FILETYPE_RCS)
+			cmd[2] = DIRCMP_RCS;
+		else
+			cmd[2] = DIRCMP_RCS_ATTIC;
+		if ((auxlen < RCS_ATTRLEN_RCS) || (auxlen > RCS_ATTRLEN_RCS + RCS_ATTRLEN_DIGEST))
 			return (false);
+		/* The digest is sent since 0.25. */
+		if (dsa->dsa_proto < CVSYNC_PROTO(0, 25))
+			auxlen = RCS_ATTRLEN_RCS;
 		break;
 	case FILETYPE_SYMLINK:
 		cmd[2] = DIRCMP_SYMLINK;
-		if (attr->a_auxlen > CVSYNC_MAXAUXLEN)
+		if (auxlen > CVSYNC_MAXAUXLEN)
 			return (false);
 		break;
 	default:
 		return (false);
 	}
+	if ((len = namelen + auxlen + 4) > dsa->dsa_cmdmax)
+		return (false);
+
+	SetWord(cmd, len - 2);
 	cmd[3] = (uint8_t)namelen;
 	if (!mux_send(dsa->dsa_mux, MUX_DIRCMP, cmd, 4))
 		return (false);
 	if (!mux_send(dsa->dsa_mux, MUX_DIRCMP, name, namelen))
 		return (false);
-	if (!mux_send(dsa->dsa_mux, MUX_DIRCMP, attr->a_aux, attr->a_auxlen))
+	if (!mux_send(dsa->dsa_mux, MUX_DIRCMP, attr->a_aux, auxlen))
 		return (false);
 
 	return (true);
@@ -294,7 +299,9 @@ bool
 dirscan_rcs_scanfile_read(struct dirscan_scanfile_args *args, struct scanfile_attr *attr)
 {
 	struct collection *cl = args->sa_collection;
+	struct scanfile_args *sa = cl->cl_scanfile;
 	struct scanfile_attr rpref_attr;
+	uint8_t *sp;
 	char *name;
 
 	rpref_attr.a_name = cl->cl_rprefix;
@@ -307,20 +314,18 @@ dirscan_rcs_scanfile_read(struct dirscan_scanfile_args *args, struct scanfile_at
 		if (cl->cl_rprefixlen == 0)
 			break;
 
-		if (attr->a_namelen <= cl->cl_rprefixlen) {
-			if (!dirscan_isparent(attr, &rpref_attr)) {
-				args->sa_start += attr->a_size;
-				continue;
-			}
+		if ((attr->a_namelen <= cl->cl_rprefixlen) && dirscan_isparent(attr, &rpref_attr))
 			break;
-		}
 
 		name = attr->a_name;
-		if ((name[cl->cl_rprefixlen] == '/') && (memcmp(name, cl->cl_rprefix, cl->cl_rprefixlen) == 0))
+		if ((attr->a_namelen > cl->cl_rprefixlen) && (name[cl->cl_rprefixlen] == '/') &&
+		    (memcmp(name, cl->cl_rprefix, cl->cl_rprefixlen) == 0)) {
 			break;
+		}
 
-		args->sa_start += attr->a_size;
-		if (args->sa_start == args->sa_end)
+		if ((sp = scanfile_seek_prefix(sa, args->sa_start, attr, cl->cl_rprefix, cl->cl_rprefixlen)) == NULL)
+			sp = args->sa_start + attr->a_size;
+		if ((args->sa_start = sp) == args->sa_end)
 			return (false);
 	}
 
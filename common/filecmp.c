@@ -24,10 +24,12 @@
 #include "collection.h"
 #include "cvsync.h"
 #include "cvsync_attr.h"
+#include "dict.h"
 #include "distfile.h"
 #include "hash.h"
 #include "logmsg.h"
 #include "mux.h"
+#include "version.h"
 
 #include "filecmp.h"
 #include "updater.h"
@@ -53,18 +55,40 @@ filecmp_init(struct mux *mx, struct collection *list, struct collection *cls, co
 	fca->fca_pathmax = sizeof(fca->fca_path);
 	fca->fca_namemax = CVSYNC_NAME_MAX;
 	fca->fca_cmdmax = sizeof(fca->fca_cmd);
+	fca->fca_prefetch = NULL;
+	fca->fca_sigs = fca->fca_fsigs = NULL;
+	fca->fca_sigsmax = fca->fca_fsigsmax = 0;
+	fca->fca_rdiff.rd_cmds = fca->fca_frdiff.rd_cmds = NULL;
+	fca->fca_rdiff.rd_max = fca->fca_frdiff.rd_max = 0;
+	fca->fca_nrcs = fca->fca_nrdiff = fca->fca_saved = 0;
+	fca->fca_rewritten = 0;
+	fca->fca_nkept = fca->fca_nchanged = 0;
 
 	if (!hash_set(type, &fca->fca_hash_ops)) {
 		free(fca);
 		return (NULL);
 	}
 
+	fca->fca_dict = NULL;
+	if (proto >= CVSYNC_PROTO(0, 27)) {
+		if ((fca->fca_dict = dict_init()) == NULL) {
+			free(fca);
+			return (NULL);
+		}
+	}
+
 	return (fca);
 }
 
 void
 filecmp_destroy(struct filecmp_args *fca)
 {
+	if (fca->fca_dict != NULL)
+		dict_destroy(fca->fca_dict);
+	free(fca->fca_sigs);
+	free(fca->fca_fsigs);
+	free(fca->fca_rdiff.rd_cmds);
+	free(fca->fca_frdiff.rd_cmds);
 	free(fca);
 }
 
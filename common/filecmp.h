@@ -8,8 +8,11 @@
 struct collection;
 struct cvsync_attr;
 struct cvsync_file;
+struct dict;
+struct filecmp_prefetch;
 struct hash_args;
 struct mux;
+struct rcscache_entry;
 
 #define	FILECMP_START		(0x80)
 #define	FILECMP_END		(0x81)
@@ -38,6 +41,20 @@ struct mux;
 #define	FILECMP_UPDATE_RCS_DESC		(0x08)
 #define	FILECMP_UPDATE_RCS_DELTATEXT	(0x09)
 
+/* How much of an RCS update is held back to be weighed against rdiff. */
+#define	FILECMP_RCS_HOLDMAX	(4194304)	/* 4MB */
+
+/* The COPY and DATA commands of an rdiff, kept to be sent afterwards. */
+struct filecmp_rdiff_cmd {
+	uint64_t		rc_offset, rc_length;
+	uint8_t			rc_cmd;
+};
+
+struct filecmp_rdiff {
+	struct filecmp_rdiff_cmd	*rd_cmds;
+	size_t				rd_count, rd_max;
+};
+
 struct filecmp_args {
 	struct mux		*fca_mux;
 	const char		*fca_hostinfo;
@@ -64,6 +81,18 @@ struct filecmp_args {
 	void			*fca_hash_ctx;
 	const struct hash_args	*fca_hash_ops;
 	uint8_t			fca_hash[HASH_MAXLEN];
+
+	struct filecmp_prefetch	*fca_prefetch;
+	struct dict		*fca_dict;
+
+	uint8_t			*fca_sigs, *fca_fsigs;
+	size_t			fca_sigsmax, fca_fsigsmax;
+	struct filecmp_rdiff	fca_rdiff, fca_frdiff;
+
+	uint64_t		fca_nrcs, fca_nrdiff, fca_saved;
+	/* The deltatexts of the RCS update being held back. */
+	uint64_t		fca_rewritten;
+	size_t			fca_nkept, fca_nchanged;
 };
 
 struct filecmp_args *filecmp_init(struct mux *, struct collection *, struct collection *, const char *, uint32_t, int);
@@ -76,9 +105,18 @@ int filecmp_access(struct filecmp_args *, struct cvsync_attr *);
 bool filecmp_list(struct filecmp_args *);
 bool filecmp_rcs(struct filecmp_args *);
 
+struct filecmp_prefetch *filecmp_prefetch_init(const struct hash_args *);
+void filecmp_prefetch_destroy(struct filecmp_prefetch *);
+void filecmp_prefetch_push(struct filecmp_prefetch *, const char *, size_t, const char *, size_t, bool);
+bool filecmp_prefetch_fetch(struct filecmp_prefetch *, const char *, struct cvsync_file **, struct rcscache_entry **);
+
 bool filecmp_generic_update(struct filecmp_args *, struct cvsync_file *);
 bool filecmp_rdiff_update(struct filecmp_args *, struct cvsync_file *);
 bool filecmp_rdiff_ignore(struct filecmp_args *);
 bool filecmp_rdiff_ischanged(struct filecmp_args *, struct cvsync_file *);
+bool filecmp_rdiff_signatures(struct filecmp_args *, uint8_t **, size_t *, uint64_t, uint32_t);
+bool filecmp_rdiff_text(struct filecmp_args *, struct filecmp_rdiff *, const uint8_t *, const void *, size_t, uint64_t, uint32_t, uint64_t *);
+bool filecmp_rdiff_replay(struct filecmp_args *, const struct filecmp_rdiff *, const void *);
+bool filecmp_rdiff_send(struct filecmp_args *, struct cvsync_file *, const struct filecmp_rdiff *);
 
 #endif /* CVSYNC_FILECMP_H */
@@ -0,0 +1,374 @@
+/*-
+ * This software is released under the BSD License, see LICENSE.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <stdlib.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "compat_stdbool.h"
+#include "compat_stdint.h"
+#include "compat_inttypes.h"
+#include "compat_limits.h"
+#include "basedef.h"
+
+#include "attribute.h"
+#include "cvsync.h"
+#include "cvsync_attr.h"
+#include "hash.h"
+#include "logmsg.h"
+#include "rcscache.h"
+
+#include "filecmp.h"
+
+/*
+ * DirCmp knows which RCS files are to be updated long before FileCmp
+ * receives the FileScan data for them.  The paths are handed to a worker
+ * thread which opens, maps and parses the files in the meantime, so that
+ * FileCmp finds them ready instead of reading them while the peer waits.
+ * At most FILECMP_PREFETCH_DEPTH paths are queued and the worker stops
+ * once FILECMP_PREFETCH_SIZE bytes of prepared files are held.
+ */
+#define	FILECMP_PREFETCH_DEPTH	(1024)
+#define	FILECMP_PREFETCH_SIZE	(32 * 1024 * 1024)
+
+#define	FPE_PENDING	(0)
+#define	FPE_BUSY	(1)
+#define	FPE_READY	(2)
+
+struct filecmp_prefetch_entry {
+	struct filecmp_prefetch_entry	*fpe_next;
+	int				fpe_state;
+	bool				fpe_dropped;
+	struct cvsync_file		*fpe_cfp;
+	struct rcscache_entry		*fpe_rce;
+	dev_t				fpe_dev;
+	ino_t				fpe_ino;
+	size_t				fpe_pathlen;
+	char				fpe_path[1];
+};
+
+struct filecmp_prefetch {
+	pthread_t			fp_thread;
+	pthread_mutex_t			fp_mtx;
+	pthread_cond_t			fp_wait_work, fp_wait_ready;
+	struct filecmp_prefetch_entry	*fp_head, **fp_tail;
+	size_t				fp_count, fp_size;
+	bool				fp_overflow, fp_done;
+	const struct hash_args		*fp_hashops;
+};
+
+void *filecmp_prefetch(void *);
+void filecmp_prefetch_prepare(struct filecmp_prefetch *, struct filecmp_prefetch_entry *);
+void filecmp_prefetch_free(struct filecmp_prefetch_entry *);
+void filecmp_prefetch_unlink(struct filecmp_prefetch *, struct filecmp_prefetch_entry *);
+
+struct filecmp_prefetch *
+filecmp_prefetch_init(const struct hash_args *hashops)
+{
+	struct filecmp_prefetch *fp;
+
+	if ((fp = malloc(sizeof(*fp))) == NULL) {
+		logmsg_err("%s", strerror(errno));
+		return (NULL);
+	}
+	fp->fp_head = NULL;
+	fp->fp_tail = &fp->fp_head;
+	fp->fp_count = 0;
+	fp->fp_size = 0;
+	fp->fp_overflow = false;
+	fp->fp_done = false;
+	fp->fp_hashops = hashops;
+
+	if (pthread_mutex_init(&fp->fp_mtx, NULL) != 0) {
+		logmsg_err("FileCmp Prefetch: pthread_mutex_init failed");
+		free(fp);
+		return (NULL);
+	}
+	if (pthread_cond_init(&fp->fp_wait_work, NULL) != 0) {
+		logmsg_err("FileCmp Prefetch: pthread_cond_init failed");
+		pthread_mutex_destroy(&fp->fp_mtx);
+		free(fp);
+		return (NULL);
+	}
+	if (pthread_cond_init(&fp->fp_wait_ready, NULL) != 0) {
+		logmsg_err("FileCmp Prefetch: pthread_cond_init failed");
+		pthread_cond_destroy(&fp->fp_wait_work);
+		pthread_mutex_destroy(&fp->fp_mtx);
+		free(fp);
+		return (NULL);
+	}
+	if (pthread_create(&fp->fp_thread, NULL, filecmp_prefetch, fp) != 0) {
+		logmsg_err("FileCmp Prefetch: pthread_create failed");
+		pthread_cond_destroy(&fp->fp_wait_ready);
+		pthread_cond_destroy(&fp->fp_wait_work);
+		pthread_mutex_destroy(&fp->fp_mtx);
+		free(fp);
+		return (NULL);
+	}
+
+	return (fp);
+}
+
+void
+filecmp_prefetch_destroy(struct filecmp_prefetch *fp)
+{
+	struct filecmp_prefetch_entry *fpe;
+
+	pthread_mutex_lock(&fp->fp_mtx);
+	fp->fp_done = true;
+	pthread_cond_signal(&fp->fp_wait_work);
+	pthread_mutex_unlock(&fp->fp_mtx);
+
+	pthread_join(fp->fp_thread, NULL);
+
+	while ((fpe = fp->fp_head) != NULL) {
+		fp->fp_head = fpe->fpe_next;
+		filecmp_prefetch_free(fpe);
+	}
+
+	pthread_cond_destroy(&fp->fp_wait_ready);
+	pthread_cond_destroy(&fp->fp_wait_work);
+	pthread_mutex_destroy(&fp->fp_mtx);
+	free(fp);
+}
+
+void
+filecmp_prefetch_push(struct filecmp_prefetch *fp, const char *dir, size_t dirlen, const char *name, size_t namelen,
+		      bool attic)
+{
+	struct filecmp_prefetch_entry *fpe;
+	size_t len = dirlen + namelen, max = len + 7;
+
+	if ((fpe = malloc(sizeof(*fpe) + max)) == NULL)
+		return;
+	(void)memcpy(fpe->fpe_path, dir, dirlen);
+	(void)memcpy(&fpe->fpe_path[dirlen], name, namelen);
+	fpe->fpe_path[len] = '\0';
+	if (attic) {
+		if (!cvsync_rcs_insert_attic(fpe->fpe_path, len, max)) {
+			free(fpe);
+			return;
+		}
+		len += 6;
+	}
+	fpe->fpe_pathlen = len;
+	fpe->fpe_next = NULL;
+	fpe->fpe_state = FPE_PENDING;
+	fpe->fpe_dropped = false;
+	fpe->fpe_cfp = NULL;
+	fpe->fpe_rce = NULL;
+
+	pthread_mutex_lock(&fp->fp_mtx);
+	if (fp->fp_count >= FILECMP_PREFETCH_DEPTH) {
+		fp->fp_overflow = true;
+		pthread_mutex_unlock(&fp->fp_mtx);
+		free(fpe);
+		return;
+	}
+	*fp->fp_tail = fpe;
+	fp->fp_tail = &fpe->fpe_next;
+	fp->fp_count++;
+	pthread_cond_signal(&fp->fp_wait_work);
+	pthread_mutex_unlock(&fp->fp_mtx);
+}
+
+bool
+filecmp_prefetch_fetch(struct filecmp_prefetch *fp, const char *path, struct cvsync_file **cfpp,
+		       struct rcscache_entry **rcep)
+{
+	struct filecmp_prefetch_entry *fpe;
+	struct stat st;
+	size_t len = strlen(path);
+
+	pthread_mutex_lock(&fp->fp_mtx);
+	for (fpe = fp->fp_head ; fpe != NULL ; fpe = fpe->fpe_next) {
+		if ((fpe->fpe_pathlen == len) && (memcmp(fpe->fpe_path, path, len) == 0))
+			break;
+	}
+	if (fpe == NULL) {
+		/*
+		 * Requests arrive in the order the paths were queued, so
+		 * after a path has been refused every queued entry may be
+		 * stale.  Start over rather than stall behind them.
+		 */
+		if (fp->fp_overflow) {
+			while (fp->fp_head != NULL)
+				filecmp_prefetch_unlink(fp, fp->fp_head);
+			fp->fp_overflow = false;
+			pthread_cond_signal(&fp->fp_wait_work);
+		}
+		pthread_mutex_unlock(&fp->fp_mtx);
+		return (false);
+	}
+
+	/* Entries in front of this one will never be asked for. */
+	while (fp->fp_head != fpe)
+		filecmp_prefetch_unlink(fp, fp->fp_head);
+
+	if (fpe->fpe_state == FPE_PENDING) {
+		/* Not started yet; it is cheaper to read it in place. */
+		filecmp_prefetch_unlink(fp, fpe);
+		pthread_cond_signal(&fp->fp_wait_work);
+		pthread_mutex_unlock(&fp->fp_mtx);
+		return (false);
+	}
+	while (fpe->fpe_state != FPE_READY)
+		pthread_cond_wait(&fp->fp_wait_ready, &fp->fp_mtx);
+
+	fp->fp_head = fpe->fpe_next;
+	if (fp->fp_head == NULL)
+		fp->fp_tail = &fp->fp_head;
+	fp->fp_count--;
+	if (fpe->fpe_cfp != NULL)
+		fp->fp_size -= (size_t)fpe->fpe_cfp->cf_size;
+	pthread_cond_signal(&fp->fp_wait_work);
+	pthread_mutex_unlock(&fp->fp_mtx);
+
+	if (fpe->fpe_cfp == NULL) {
+		filecmp_prefetch_free(fpe);
+		return (false);
+	}
+
+	/* The file may have been replaced since it was prepared. */
+	if ((stat(path, &st) == -1) || (st.st_dev != fpe->fpe_dev) || (st.st_ino != fpe->fpe_ino) ||
+	    (st.st_size != fpe->fpe_cfp->cf_size) || (st.st_mtime != fpe->fpe_cfp->cf_mtime)) {
+		filecmp_prefetch_free(fpe);
+		return (false);
+	}
+
+	*cfpp = fpe->fpe_cfp;
+	*rcep = fpe->fpe_rce;
+	free(fpe);
+
+	return (true);
+}
+
+void *
+filecmp_prefetch(void *arg)
+{
+	struct filecmp_prefetch *fp = arg;
+	struct filecmp_prefetch_entry *fpe;
+
+	pthread_mutex_lock(&fp->fp_mtx);
+	for (;;) {
+		for (fpe = fp->fp_head ; fpe != NULL ; fpe = fpe->fpe_next) {
+			if (fpe->fpe_state == FPE_PENDING)
+				break;
+		}
+		if (fp->fp_done)
+			break;
+		if ((fpe == NULL) || (fp->fp_size >= FILECMP_PREFETCH_SIZE)) {
+			pthread_cond_wait(&fp->fp_wait_work, &fp->fp_mtx);
+			continue;
+		}
+
+		fpe->fpe_state = FPE_BUSY;
+		pthread_mutex_unlock(&fp->fp_mtx);
+
+		filecmp_prefetch_prepare(fp, fpe);
+
+		pthread_mutex_lock(&fp->fp_mtx);
+		fpe->fpe_state = FPE_READY;
+		if (fpe->fpe_dropped) {
+			filecmp_prefetch_free(fpe);
+		} else {
+			if (fpe->fpe_cfp != NULL)
+				fp->fp_size += (size_t)fpe->fpe_cfp->cf_size;
+			pthread_cond_broadcast(&fp->fp_wait_ready);
+		}
+	}
+	pthread_mutex_unlock(&fp->fp_mtx);
+
+	return (NULL);
+}
+
+void
+filecmp_prefetch_prepare(struct filecmp_prefetch *fp, struct filecmp_prefetch_entry *fpe)
+{
+	struct cvsync_file *cfp;
+	struct stat st;
+	int fd;
+
+	/*
+	 * Errors are left for FileCmp to run into and report, since the
+	 * file may legitimately have moved by the time it is asked for.
+	 */
+	if ((fd = open(fpe->fpe_path, O_RDONLY, 0)) == -1)
+		return;
+	if ((fstat(fd, &st) == -1) || !S_ISREG(st.st_mode) || ((uint64_t)st.st_size > FILECMP_PREFETCH_SIZE)) {
+		(void)close(fd);
+		return;
+	}
+	if ((cfp = malloc(sizeof(*cfp))) == NULL) {
+		(void)close(fd);
+		return;
+	}
+	cfp->cf_fileno = fd;
+	cfp->cf_size = st.st_size;
+	cfp->cf_mtime = st.st_mtime;
+	cfp->cf_mode = st.st_mode;
+	cfp->cf_addr = NULL;
+	cfp->cf_msize = 0;
+
+	if (!cvsync_mmap(cfp, 0, cfp->cf_size)) {
+		cvsync_fclose(cfp);
+		return;
+	}
+	if (cfp->cf_msize > 0) {
+#if defined(POSIX_MADV_WILLNEED)
+		(void)posix_madvise(cfp->cf_addr, cfp->cf_msize, POSIX_MADV_WILLNEED);
+#endif /* defined(POSIX_MADV_WILLNEED) */
+		fpe->fpe_rce = rcscache_get(cfp, fp->fp_hashops);
+	}
+
+	fpe->fpe_cfp = cfp;
+	fpe->fpe_dev = st.st_dev;
+	fpe->fpe_ino = st.st_ino;
+}
+
+void
+filecmp_prefetch_free(struct filecmp_prefetch_entry *fpe)
+{
+	if (fpe->fpe_rce != NULL)
+		rcscache_put(fpe->fpe_rce);
+	if (fpe->fpe_cfp != NULL)
+		cvsync_fclose(fpe->fpe_cfp);
+	free(fpe);
+}
+
+void
+filecmp_prefetch_unlink(struct filecmp_prefetch *fp, struct filecmp_prefetch_entry *fpe)
+{
+	struct filecmp_prefetch_entry **fpep;
+
+	for (fpep = &fp->fp_head ; *fpep != fpe ; fpep = &(*fpep)->fpe_next)
+		continue;
+	if ((*fpep = fpe->fpe_next) == NULL)
+		fp->fp_tail = fpep;
+	fp->fp_count--;
+
+	switch (fpe->fpe_state) {
+	case FPE_BUSY:
+		/* The worker frees it when done. */
+		fpe->fpe_dropped = true;
+		break;
+	case FPE_READY:
+		if (fpe->fpe_cfp != NULL)
+			fp->fp_size -= (size_t)fpe->fpe_cfp->cf_size;
+		filecmp_prefetch_free(fpe);
+		break;
+	default:
+		filecmp_prefetch_free(fpe);
+		break;
+	}
+}
@@ -5,6 +5,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include <stdlib.h>
+
 #include <errno.h>
 #include <limits.h>
 #include <pthread.h>
@@ -22,12 +24,15 @@
 #include "collection.h"
 #include "cvsync.h"
 #include "cvsync_attr.h"
+#include "dict.h"
 #include "distfile.h"
 #include "filetypes.h"
 #include "hash.h"
 #include "logmsg.h"
 #include "mux.h"
 #include "rcslib.h"
+#include "rcscache.h"
+#include "rdiff.h"
 #include "version.h"
 
 #include "filecmp.h"
@@ -43,22 +48,28 @@ bool filecmp_rcs_remove(struct filecmp_args *);
 bool filecmp_rcs_attic(struct filecmp_args *);
 bool filecmp_rcs_setattr(struct filecmp_args *);
 bool filecmp_rcs_update(struct filecmp_args *);
-bool filecmp_rcs_update_rcs(struct filecmp_args *, struct cvsync_file *);
+bool filecmp_rcs_update_rcs(struct filecmp_args *, struct cvsync_file *, struct rcscache_entry *);
+bool filecmp_rcs_update_rcs_rdiff(struct filecmp_args *, uint64_t *, uint32_t *);
+bool filecmp_rcs_update_rcs_choose(struct filecmp_args *, struct cvsync_file *, uint64_t, uint32_t, size_t);
 bool filecmp_rcs_update_symlink(struct filecmp_args *);
 
 bool filecmp_rcs_admin(struct filecmp_args *, struct rcslib_file *);
 bool filecmp_rcs_admin_access(struct filecmp_args *, struct rcslib_file *, size_t);
 bool filecmp_rcs_admin_symbols(struct filecmp_args *, struct rcslib_file *, size_t);
+bool filecmp_rcs_admin_buckets(struct filecmp_args *, struct rcslib_file *, size_t);
 bool filecmp_rcs_admin_locks(struct filecmp_args *, struct rcslib_file *, size_t);
 bool filecmp_rcs_delta(struct filecmp_args *, struct rcslib_file *, uint32_t *);
 bool filecmp_rcs_delta_add(struct filecmp_args *, struct rcslib_revision *);
 bool filecmp_rcs_delta_remove(struct filecmp_args *, struct rcsnum *);
 bool filecmp_rcs_delta_update(struct filecmp_args *, struct rcslib_revision *, uint8_t *);
+size_t filecmp_rcs_string(struct filecmp_args *, const void *, size_t, uint8_t *);
 bool filecmp_rcs_desc(struct filecmp_args *, struct rcslib_file *);
-bool filecmp_rcs_deltatext(struct filecmp_args *, struct rcslib_file *, uint32_t);
-bool filecmp_rcs_deltatext_add(struct filecmp_args *, struct rcslib_revision *);
+bool filecmp_rcs_deltatext(struct filecmp_args *, struct rcslib_file *, const uint8_t *, uint32_t);
+bool filecmp_rcs_deltatext_add(struct filecmp_args *, struct rcslib_revision *, const uint8_t *);
 bool filecmp_rcs_deltatext_remove(struct filecmp_args *, struct rcsnum *);
-bool filecmp_rcs_deltatext_update(struct filecmp_args *, struct rcslib_revision *, uint8_t *);
+bool filecmp_rcs_deltatext_update(struct filecmp_args *, struct rcslib_revision *, uint8_t *, const uint8_t *, uint64_t, uint32_t);
+bool filecmp_rcs_deltatext_patch(struct filecmp_args *, struct rcslib_revision *, uint64_t, uint32_t, bool *);
+bool filecmp_rcs_deltatext_rotate(struct filecmp_args *, struct rcslib_file *, struct rcslib_revision *, const struct rcsnum *, const uint8_t *, const uint8_t *, bool *);
 
 bool filecmp_rcs_ignore_rcs(struct filecmp_args *);
 bool filecmp_rcs_ignore_rcs_delta(struct filecmp_args *, uint32_t *);
@@ -530,16 +541,16 @@ filecmp_rcs_attic(struct filecmp_args *fca)
 		break;
 	case FILECMP_UPDATE_RCS:
 	    {
-		struct rcslib_file *rcs;
+		struct rcscache_entry *rce;
 
-		if ((rcs = rcslib_init(cfp->cf_addr, cfp->cf_size)) == NULL) {
+		if ((rce = rcscache_get(cfp, fca->fca_hash_ops)) == NULL) {
 			if (!filecmp_rcs_ignore_rcs(fca)) {
 				cvsync_fclose(cfp);
 				return (false);
 			}
 			goto done;
 		}
-		rcslib_destroy(rcs);
+		rcscache_put(rce);
 		break;
 	    }
 	case FILECMP_UPDATE_RDIFF:
@@ -604,7 +615,7 @@ filecmp_rcs_attic(struct filecmp_args *fca)
 		}
 		break;
 	case FILECMP_UPDATE_RCS:
-		if (!filecmp_rcs_update_rcs(fca, cfp)) {
+		if (!filecmp_rcs_update_rcs(fca, cfp, NULL)) {
 			cvsync_fclose(cfp);
 			return (false);
 		}
@@ -700,6 +711,7 @@ filecmp_rcs_update(struct filecmp_args *fca)
 	const struct hash_args *hashops = fca->fca_hash_ops;
 	struct cvsync_attr *cap = &fca->fca_attr;
 	struct cvsync_file *cfp;
+	struct rcscache_entry *rce = NULL;
 	struct stat st;
 	uint16_t mode;
 	uint8_t *cmd = fca->fca_cmd, tag;
@@ -708,6 +720,11 @@ filecmp_rcs_update(struct filecmp_args *fca)
 	if (cap->ca_type == FILETYPE_SYMLINK)
 		return (filecmp_rcs_update_symlink(fca));
 
+	if ((fca->fca_prefetch != NULL) && ((cap->ca_type == FILETYPE_RCS) || (cap->ca_type == FILETYPE_RCS_ATTIC)) &&
+	    filecmp_prefetch_fetch(fca->fca_prefetch, fca->fca_path, &cfp, &rce)) {
+		goto prepared;
+	}
+
 	if ((cfp = cvsync_fopen(fca->fca_path)) == NULL) {
 		switch (cap->ca_type) {
 		case FILETYPE_FILE:
@@ -776,16 +793,18 @@ filecmp_rcs_update(struct filecmp_args *fca)
 		return (false);
 	}
 
-	if (!mux_recv(fca->fca_mux, MUX_FILECMP_IN, cmd, 3)) {
-		cvsync_fclose(cfp);
-		return (false);
-	}
-	if (GetWord(cmd) != 1) {
-		cvsync_fclose(cfp);
-		return (false);
-	}
+prepared:
+	if (!mux_recv(fca->fca_mux, MUX_FILECMP_IN, cmd, 3))
+		goto fail;
+	if (GetWord(cmd) != 1)
+		goto fail;
 	tag = cmd[2];
 
+	if ((rce != NULL) && (tag != FILECMP_UPDATE_RCS)) {
+		rcscache_put(rce);
+		rce = NULL;
+	}
+
 	switch (tag) {
 	case FILECMP_UPDATE_GENERIC:
 		if (!(*hashops->init)(&fca->fca_hash_ctx)) {
@@ -816,19 +835,16 @@ filecmp_rcs_update(struct filecmp_args *fca)
 
 		break;
 	case FILECMP_UPDATE_RCS:
-	    {
-		struct rcslib_file *rcs;
-
-		if ((rcs = rcslib_init(cfp->cf_addr, cfp->cf_size)) == NULL) {
+		if (rce == NULL)
+			rce = rcscache_get(cfp, fca->fca_hash_ops);
+		if (rce == NULL) {
 			if (!filecmp_rcs_ignore_rcs(fca)) {
 				cvsync_fclose(cfp);
 				return (false);
 			}
 			goto done;
 		}
-		rcslib_destroy(rcs);
 		break;
-	    }
 	case FILECMP_UPDATE_RDIFF:
 		if (filecmp_access(fca, cap) == DISTFILE_NORDIFF) {
 			if (filecmp_rdiff_ischanged(fca, cfp)) {
@@ -856,47 +872,34 @@ filecmp_rcs_update(struct filecmp_args *fca)
 
 	mode = RCS_MODE(cfp->cf_mode, fca->fca_umask);
 
-	if ((base = cap->ca_namelen + 6) > fca->fca_cmdmax) {
-		cvsync_fclose(cfp);
-		return (false);
-	}
+	if ((base = cap->ca_namelen + 6) > fca->fca_cmdmax)
+		goto fail;
 	len = fca->fca_cmdmax - base;
 
 	switch (cap->ca_type) {
 	case FILETYPE_FILE:
-		if ((len = attr_rcs_encode_file(&cmd[6], len, cfp->cf_mtime, cfp->cf_size, mode)) == 0) {
-			cvsync_fclose(cfp);
-			return (false);
-		}
+		if ((len = attr_rcs_encode_file(&cmd[6], len, cfp->cf_mtime, cfp->cf_size, mode)) == 0)
+			goto fail;
 		break;
 	case FILETYPE_RCS:
 	case FILETYPE_RCS_ATTIC:
-		if ((len = attr_rcs_encode_rcs(&cmd[6], len, cfp->cf_mtime, mode)) == 0) {
-			cvsync_fclose(cfp);
-			return (false);
-		}
+		if ((len = attr_rcs_encode_rcs(&cmd[6], len, cfp->cf_mtime, mode)) == 0)
+			goto fail;
 		break;
 	default:
-		cvsync_fclose(cfp);
-		return (false);
+		goto fail;
 	}
 
 	SetWord(cmd, len + base - 2);
 	cmd[2] = UPDATER_UPDATE;
 	cmd[3] = cap->ca_type;
 	SetWord(&cmd[4], cap->ca_namelen);
-	if (!mux_send(fca->fca_mux, MUX_UPDATER, cmd, 6)) {
-		cvsync_fclose(cfp);
-		return (false);
-	}
-	if (!mux_send(fca->fca_mux, MUX_UPDATER, cap->ca_name, cap->ca_namelen)) {
-		cvsync_fclose(cfp);
-		return (false);
-	}
-	if (!mux_send(fca->fca_mux, MUX_UPDATER, &cmd[6], len)) {
-		cvsync_fclose(cfp);
-		return (false);
-	}
+	if (!mux_send(fca->fca_mux, MUX_UPDATER, cmd, 6))
+		goto fail;
+	if (!mux_send(fca->fca_mux, MUX_UPDATER, cap->ca_name, cap->ca_namelen))
+		goto fail;
+	if (!mux_send(fca->fca_mux, MUX_UPDATER, &cmd[6], len))
+		goto fail;
 
 	switch (tag) {
 	case FILECMP_UPDATE_GENERIC:
@@ -906,7 +909,7 @@ filecmp_rcs_update(struct filecmp_args *fca)
 		}
 		break;
 	case FILECMP_UPDATE_RCS:
-		if (!filecmp_rcs_update_rcs(fca, cfp)) {
+		if (!filecmp_rcs_update_rcs(fca, cfp, rce)) {
 			cvsync_fclose(cfp);
 			return (false);
 		}
@@ -934,48 +937,160 @@ done:
 		return (false);
 
 	return (true);
+
+fail:
+	if (rce != NULL)
+		rcscache_put(rce);
+	cvsync_fclose(cfp);
+	return (false);
 }
 
 bool
-filecmp_rcs_update_rcs(struct filecmp_args *fca, struct cvsync_file *cfp)
+filecmp_rcs_update_rcs(struct filecmp_args *fca, struct cvsync_file *cfp, struct rcscache_entry *rce)
 {
 	static const uint8_t _cmds[3] = { 0x00, 0x01, UPDATER_UPDATE_RCS };
 	struct rcslib_file *rcs;
-	uint32_t ndeltas;
+	const uint8_t *digests;
+	uint64_t osize;
+	uint32_t ndeltas, bsize;
+	size_t ndefs;
 
-	if ((rcs = rcslib_init(cfp->cf_addr, cfp->cf_size)) == NULL)
+	if ((rce == NULL) && ((rce = rcscache_get(cfp, fca->fca_hash_ops)) == NULL))
+		return (false);
+	rcs = rce->ce_rcs;
+
+	if (!filecmp_rcs_update_rcs_rdiff(fca, &osize, &bsize)) {
+		rcscache_put(rce);
+		return (false);
+	}
+	if ((bsize > 0) && !mux_hold(fca->fca_mux, MUX_UPDATER, FILECMP_RCS_HOLDMAX)) {
+		rcscache_put(rce);
 		return (false);
+	}
+	ndefs = (fca->fca_dict != NULL) ? fca->fca_dict->d_count : 0;
+	fca->fca_nkept = fca->fca_nchanged = 0;
+	fca->fca_rewritten = 0;
 
 	if (!mux_send(fca->fca_mux, MUX_UPDATER, _cmds, sizeof(_cmds))) {
-		rcslib_destroy(rcs);
+		rcscache_put(rce);
 		return (false);
 	}
 
 	if (!filecmp_rcs_admin(fca, rcs)) {
-		rcslib_destroy(rcs);
+		rcscache_put(rce);
 		return (false);
 	}
 	if (!filecmp_rcs_delta(fca, rcs, &ndeltas)) {
-		rcslib_destroy(rcs);
+		rcscache_put(rce);
 		return (false);
 	}
 	if (!filecmp_rcs_desc(fca, rcs)) {
-		rcslib_destroy(rcs);
+		rcscache_put(rce);
 		return (false);
 	}
-	if (!filecmp_rcs_deltatext(fca, rcs, ndeltas)) {
-		rcslib_destroy(rcs);
+	digests = rcscache_digests(rce, fca->fca_hash_ops);
+	if (!filecmp_rcs_deltatext(fca, rcs, digests, ndeltas)) {
+		rcscache_put(rce);
 		return (false);
 	}
 
-	rcslib_destroy(rcs);
+	rcscache_put(rce);
 
 	if (!mux_send(fca->fca_mux, MUX_UPDATER, cmde, sizeof(cmde)))
 		return (false);
 
+	if (bsize > 0)
+		return (filecmp_rcs_update_rcs_choose(fca, cfp, osize, bsize, ndefs));
+
+	return (true);
+}
+
+/*
+ * Receives the signatures of the whole file from FileScan, if any.  bsize
+ * is left 0 when there is no choice to make.
+ */
+bool
+filecmp_rcs_update_rcs_rdiff(struct filecmp_args *fca, uint64_t *osize, uint32_t *bsize)
+{
+	uint8_t *cmd = fca->fca_cmd;
+
+	*bsize = 0;
+
+	if (fca->fca_proto < CVSYNC_PROTO(0, 30))
+		return (true);
+
+	if (!mux_recv(fca->fca_mux, MUX_FILECMP_IN, cmd, 12))
+		return (false);
+	*osize = GetDDWord(cmd);
+	if (GetDWord(&cmd[8]) == 0)
+		return (true);
+	if (!filecmp_rdiff_signatures(fca, &fca->fca_fsigs, &fca->fca_fsigsmax, *osize, GetDWord(&cmd[8])))
+		return (false);
+	*bsize = GetDWord(&cmd[8]);
+
 	return (true);
 }
 
+/*
+ * The RCS update of the file has been held back, and is sent unless the
+ * rdiff would be smaller.  The rdiff can only save on the deltatexts
+ * which are sent again in place, and costs a COPY for every deltatext
+ * besides, so the search is skipped unless that estimate undercuts the
+ * update.  When the rdiff is sent, the strings the update defined in the
+ * dictionary, the first of which got the id ndefs, never reach the
+ * Updater.
+ */
+bool
+filecmp_rcs_update_rcs_choose(struct filecmp_args *fca, struct cvsync_file *cfp, uint64_t osize, uint32_t bsize,
+			      size_t ndefs)
+{
+	uint64_t held = mux_held(fca->fca_mux, MUX_UPDATER), cost;
+
+	/* UPDATER_UPDATE_RDIFF, the commands, the digest and the end */
+	cost = 6 + fca->fca_hash_ops->length;
+
+	if (held > FILECMP_RCS_HOLDMAX) {
+		logmsg_debug(DEBUG_RDIFF, "%s: rcs %" PRIu64 ": rcs", fca->fca_rpath, held);
+		fca->fca_nrcs++;
+		return (mux_release(fca->fca_mux, MUX_UPDATER, false));
+	}
+
+	cost += held - fca->fca_rewritten;
+	cost += (uint64_t)(fca->fca_nkept + fca->fca_nchanged + 1) * RDIFF_MAXCMDLEN;
+	if (cost >= held) {
+		logmsg_debug(DEBUG_RDIFF, "%s: rcs %" PRIu64 ", rdiff >= %" PRIu64 ": rcs", fca->fca_rpath, held,
+			     cost);
+		fca->fca_nrcs++;
+		return (mux_release(fca->fca_mux, MUX_UPDATER, false));
+	}
+
+	cost = 6 + fca->fca_hash_ops->length;
+	if (!filecmp_rdiff_text(fca, &fca->fca_frdiff, fca->fca_fsigs, cfp->cf_addr, (size_t)cfp->cf_size, osize,
+				bsize, &cost)) {
+		return (false);
+	}
+
+	if (held <= cost) {
+		logmsg_debug(DEBUG_RDIFF, "%s: rcs %" PRIu64 ", rdiff %" PRIu64 ": rcs", fca->fca_rpath, held, cost);
+		fca->fca_nrcs++;
+		return (mux_release(fca->fca_mux, MUX_UPDATER, false));
+	}
+
+	logmsg_debug(DEBUG_RDIFF, "%s: rcs %" PRIu64 ", rdiff %" PRIu64 ": rdiff", fca->fca_rpath, held, cost);
+	fca->fca_nrdiff++;
+
+	/* net of the signatures the choice cost */
+	cost += (osize + bsize - 1) / bsize * (fca->fca_hash_ops->length + 4);
+	if (held > cost)
+		fca->fca_saved += held - cost;
+	if (!mux_release(fca->fca_mux, MUX_UPDATER, true))
+		return (false);
+	if (fca->fca_dict != NULL)
+		dict_rollback(fca->fca_dict, ndefs);
+
+	return (filecmp_rdiff_send(fca, cfp, &fca->fca_frdiff));
+}
+
 bool
 filecmp_rcs_update_symlink(struct filecmp_args *fca)
 {
@@ -1101,8 +1216,13 @@ filecmp_rcs_admin(struct filecmp_args *fca, struct rcslib_file *rcs)
 	}
 	if (cmd[0] != FILECMP_UPDATE_RCS_SYMBOLS)
 		return (false);
-	if (!filecmp_rcs_admin_symbols(fca, rcs, n))
-		return (false);
+	if (fca->fca_proto < CVSYNC_PROTO(0, 26)) {
+		if (!filecmp_rcs_admin_symbols(fca, rcs, n))
+			return (false);
+	} else {
+		if (!filecmp_rcs_admin_buckets(fca, rcs, n))
+			return (false);
+	}
 	if (!mux_recv(fca->fca_mux, MUX_FILECMP_IN, cmd, 3))
 		return (false);
 	if (GetWord(cmd) != 1)
@@ -1425,6 +1545,107 @@ filecmp_rcs_admin_symbols(struct filecmp_args *fca, struct rcslib_file *rcs, siz
 	return (true);
 }
 
+/*
+ * Every bucket of the symbol table whose digest differs from the one of
+ * FileScan is reset, and its symbols are sent to the Updater anew.
+ */
+bool
+filecmp_rcs_admin_buckets(struct filecmp_args *fca, struct rcslib_file *rcs, size_t nbuckets)
+{
+	const struct hash_args *hashops = fca->fca_hash_ops;
+	struct rcslib_symbol *symbol;
+	struct rcsnum *num;
+	struct rcssym *sym;
+	uint8_t *cmd = fca->fca_cmd, *digests, mask[RCSLIB_SYMBOL_BUCKETMAX / 8];
+	uint8_t name[DICT_MAXENCLEN];
+	size_t masklen, len, slen, b, i;
+	bool changed = false;
+
+	if ((nbuckets == 0) || (nbuckets > RCSLIB_SYMBOL_BUCKETMAX))
+		return (false);
+	if (hashops->length > fca->fca_cmdmax)
+		return (false);
+	masklen = (nbuckets + 7) / 8;
+
+	if ((digests = malloc(nbuckets * hashops->length)) == NULL) {
+		logmsg_err("%s", strerror(errno));
+		return (false);
+	}
+	if (!rcslib_digest_symbols(rcs, nbuckets, hashops, digests)) {
+		free(digests);
+		return (false);
+	}
+
+	(void)memset(mask, 0, masklen);
+	for (b = 0 ; b < nbuckets ; b++) {
+		if (!mux_recv(fca->fca_mux, MUX_FILECMP_IN, cmd, hashops->length)) {
+			free(digests);
+			return (false);
+		}
+		if (memcmp(cmd, &digests[b * hashops->length], hashops->length) != 0) {
+			mask[b / 8] |= (uint8_t)(1 << (b % 8));
+			changed = true;
+		}
+	}
+
+	free(digests);
+
+	if (!changed)
+		return (true);
+
+	if ((len = masklen + 8) > fca->fca_cmdmax)
+		return (false);
+	SetWord(cmd, len - 2);
+	cmd[2] = UPDATER_UPDATE_RCS_SYMBOLS;
+	cmd[3] = UPDATER_UPDATE_RESET;
+	SetDWord(&cmd[4], nbuckets);
+	(void)memcpy(&cmd[8], mask, masklen);
+	if (!mux_send(fca->fca_mux, MUX_UPDATER, cmd, len))
+		return (false);
+
+	for (i = 0 ; i < rcs->symbols.rs_count ; i++) {
+		symbol = &rcs->symbols.rs_symbols[i];
+		b = rcslib_symbol_bucket(symbol, nbuckets);
+		if ((mask[b / 8] & (1 << (b % 8))) == 0)
+			continue;
+		num = &symbol->num;
+		sym = &symbol->sym;
+		if (fca->fca_proto < CVSYNC_PROTO(0, 27)) {
+			if ((len = sym->s_len + num->n_len + 6) > fca->fca_cmdmax)
+				return (false);
+			SetWord(cmd, len - 2);
+			cmd[2] = UPDATER_UPDATE_RCS_SYMBOLS;
+			cmd[3] = UPDATER_UPDATE_ADD;
+			cmd[4] = (uint8_t)sym->s_len;
+			cmd[5] = (uint8_t)num->n_len;
+			if (!mux_send(fca->fca_mux, MUX_UPDATER, cmd, 6))
+				return (false);
+			if (!mux_send(fca->fca_mux, MUX_UPDATER, sym->s_sym, sym->s_len))
+				return (false);
+			if (!mux_send(fca->fca_mux, MUX_UPDATER, num->n_str, num->n_len))
+				return (false);
+			continue;
+		}
+
+		/* the name goes last, through the dictionary */
+		slen = dict_encode(fca->fca_dict, sym->s_sym, sym->s_len, name);
+		if ((len = num->n_len + slen + 5) > fca->fca_cmdmax)
+			return (false);
+		SetWord(cmd, len - 2);
+		cmd[2] = UPDATER_UPDATE_RCS_SYMBOLS;
+		cmd[3] = UPDATER_UPDATE_ADD;
+		cmd[4] = (uint8_t)num->n_len;
+		if (!mux_send(fca->fca_mux, MUX_UPDATER, cmd, 5))
+			return (false);
+		if (!mux_send(fca->fca_mux, MUX_UPDATER, num->n_str, num->n_len))
+			return (false);
+		if (!mux_send(fca->fca_mux, MUX_UPDATER, name, slen))
+			return (false);
+	}
+
+	return (true);
+}
+
 bool
 filecmp_rcs_admin_locks(struct filecmp_args *fca, struct rcslib_file *rcs, size_t n)
 {
@@ -1642,14 +1863,17 @@ filecmp_rcs_delta_add(struct filecmp_args *fca, struct rcslib_revision *rev)
 {
 	const struct hash_args *hashops = fca->fca_hash_ops;
 	struct rcslib_branches *branches = &rev->branches;
-	uint8_t *cmd = fca->fca_cmd;
-	size_t len, i;
+	uint8_t *cmd = fca->fca_cmd, author[DICT_MAXENCLEN], state[DICT_MAXENCLEN];
+	size_t len, alen, slen, i;
 
 	if (!(*hashops->init)(&fca->fca_hash_ctx))
 		return (false);
 
-	len = rev->num.n_len + rev->date.rd_num.n_len + rev->author.i_len;
-	len += rev->state.i_len + rev->next.n_len + hashops->length + 11;
+	alen = filecmp_rcs_string(fca, rev->author->i_id, rev->author->i_len, author);
+	slen = filecmp_rcs_string(fca, rev->state->i_id, rev->state->i_len, state);
+
+	len = rev->num.n_len + rev->date.rd_num.n_len + alen + slen;
+	len += rev->next.n_len + hashops->length + 9;
 	for (i = 0 ; i < branches->rb_count ; i++)
 		len += branches->rb_num[i].n_len + 1;
 	if (len > fca->fca_cmdmax) {
@@ -1679,22 +1903,15 @@ filecmp_rcs_delta_add(struct filecmp_args *fca, struct rcslib_revision *rev)
 	(*hashops->update)(fca->fca_hash_ctx, rev->date.rd_num.n_str, rev->date.rd_num.n_len);
 
 	/* author */
-	cmd[0] = (uint8_t)rev->author.i_len;
-	if (!mux_send(fca->fca_mux, MUX_UPDATER, cmd, 1))
-		return (false);
-	if (!mux_send(fca->fca_mux, MUX_UPDATER, rev->author.i_id, rev->author.i_len))
+	if (!mux_send(fca->fca_mux, MUX_UPDATER, author, alen))
 		return (false);
-	(*hashops->update)(fca->fca_hash_ctx, rev->author.i_id, rev->author.i_len);
+	(*hashops->update)(fca->fca_hash_ctx, rev->author->i_id, rev->author->i_len);
 
 	/* state */
-	cmd[0] = (uint8_t)rev->state.i_len;
-	if (!mux_send(fca->fca_mux, MUX_UPDATER, cmd, 1))
+	if (!mux_send(fca->fca_mux, MUX_UPDATER, state, slen))
 		return (false);
-	if (rev->state.i_len > 0) {
-		if (!mux_send(fca->fca_mux, MUX_UPDATER, rev->state.i_id, rev->state.i_len))
-			return (false);
-		(*hashops->update)(fca->fca_hash_ctx, rev->state.i_id, rev->state.i_len);
-	}
+	if (rev->state->i_len > 0)
+		(*hashops->update)(fca->fca_hash_ctx, rev->state->i_id, rev->state->i_len);
 
 	/* branches */
 	SetWord(cmd, branches->rb_count);
@@ -1754,8 +1971,8 @@ filecmp_rcs_delta_update(struct filecmp_args *fca, struct rcslib_revision *rev,
 	const struct hash_args *hashops = fca->fca_hash_ops;
 	struct rcslib_branches *branches = &rev->branches;
 	struct rcsnum *num;
-	uint8_t *cmd = fca->fca_cmd;
-	size_t len, i;
+	uint8_t *cmd = fca->fca_cmd, author[DICT_MAXENCLEN], state[DICT_MAXENCLEN];
+	size_t len, alen, slen, i;
 
 	if (!(*hashops->init)(&fca->fca_hash_ctx))
 		return (false);
@@ -1763,10 +1980,10 @@ filecmp_rcs_delta_update(struct filecmp_args *fca, struct rcslib_revision *rev,
 	/* date */
 	(*hashops->update)(fca->fca_hash_ctx, rev->date.rd_num.n_str, rev->date.rd_num.n_len);
 	/* author */
-	(*hashops->update)(fca->fca_hash_ctx, rev->author.i_id, rev->author.i_len);
+	(*hashops->update)(fca->fca_hash_ctx, rev->author->i_id, rev->author->i_len);
 	/* state */
-	if (rev->state.i_len > 0)
-		(*hashops->update)(fca->fca_hash_ctx, rev->state.i_id, rev->state.i_len);
+	if (rev->state->i_len > 0)
+		(*hashops->update)(fca->fca_hash_ctx, rev->state->i_id, rev->state->i_len);
 	/* branches */
 	for (i = 0 ; i < branches->rb_count ; i++) {
 		num = &branches->rb_num[i];
@@ -1781,8 +1998,11 @@ filecmp_rcs_delta_update(struct filecmp_args *fca, struct rcslib_revision *rev,
 	if (memcmp(hash, fca->fca_hash, hashops->length) == 0)
 		return (true);
 
-	len = rev->num.n_len + rev->date.rd_num.n_len + rev->author.i_len;
-	len += rev->state.i_len + rev->next.n_len + hashops->length + 11;
+	alen = filecmp_rcs_string(fca, rev->author->i_id, rev->author->i_len, author);
+	slen = filecmp_rcs_string(fca, rev->state->i_id, rev->state->i_len, state);
+
+	len = rev->num.n_len + rev->date.rd_num.n_len + alen + slen;
+	len += rev->next.n_len + hashops->length + 9;
 	for (i = 0 ; i < branches->rb_count ; i++)
 		len += branches->rb_num[i].n_len + 1;
 	if (len > fca->fca_cmdmax)
@@ -1809,20 +2029,12 @@ filecmp_rcs_delta_update(struct filecmp_args *fca, struct rcslib_revision *rev,
 		return (false);
 
 	/* author */
-	cmd[0] = (uint8_t)rev->author.i_len;
-	if (!mux_send(fca->fca_mux, MUX_UPDATER, cmd, 1))
-		return (false);
-	if (!mux_send(fca->fca_mux, MUX_UPDATER, rev->author.i_id, rev->author.i_len))
+	if (!mux_send(fca->fca_mux, MUX_UPDATER, author, alen))
 		return (false);
 
 	/* state */
-	cmd[0] = (uint8_t)rev->state.i_len;
-	if (!mux_send(fca->fca_mux, MUX_UPDATER, cmd, 1))
+	if (!mux_send(fca->fca_mux, MUX_UPDATER, state, slen))
 		return (false);
-	if (rev->state.i_len > 0) {
-		if (!mux_send(fca->fca_mux, MUX_UPDATER, rev->state.i_id, rev->state.i_len))
-			return (false);
-	}
 
 	/* branches */
 	SetWord(cmd, rev->branches.rb_count);
@@ -1852,6 +2064,23 @@ filecmp_rcs_delta_update(struct filecmp_args *fca, struct rcslib_revision *rev,
 	return (true);
 }
 
+/*
+ * Encodes an author or a state to the buffer of DICT_MAXENCLEN bytes,
+ * and returns its length.
+ */
+size_t
+filecmp_rcs_string(struct filecmp_args *fca, const void *str, size_t len, uint8_t *buffer)
+{
+	if (fca->fca_proto >= CVSYNC_PROTO(0, 27))
+		return (dict_encode(fca->fca_dict, str, len, buffer));
+
+	buffer[0] = (uint8_t)len;
+	if (len > 0)
+		(void)memcpy(&buffer[1], str, len);
+
+	return (len + 1);
+}
+
 bool
 filecmp_rcs_desc(struct filecmp_args *fca, struct rcslib_file *rcs)
 {
@@ -1875,16 +2104,19 @@ filecmp_rcs_desc(struct filecmp_args *fca, struct rcslib_file *rcs)
 }
 
 bool
-filecmp_rcs_deltatext(struct filecmp_args *fca, struct rcslib_file *rcs, uint32_t ndeltas)
+filecmp_rcs_deltatext(struct filecmp_args *fca, struct rcslib_file *rcs, const uint8_t *digests, uint32_t ndeltas)
 {
 	const struct hash_args *hashops = fca->fca_hash_ops;
 	struct rcslib_revision *rev;
 	struct rcsnum num;
 	uint32_t n, i = 0;
+	uint64_t osize = 0, held;
+	uint32_t bsize = 0;
 	uint8_t *cmd = fca->fca_cmd, *hash = NULL;
+	const uint8_t *digest = NULL;
 	size_t len, c = 0;
 	int rv;
-	bool fetched = false;
+	bool fetched = false, done;
 
 	if (!mux_recv(fca->fca_mux, MUX_FILECMP_IN, cmd, 4))
 		return (false);
@@ -1907,11 +2139,21 @@ filecmp_rcs_deltatext(struct filecmp_args *fca, struct rcslib_file *rcs, uint32_
 				return (false);
 			if ((nlen = fca->fca_rvcmd[1]) == 0)
 				return (false);
-			if (len != (nlen + hashops->length + 2))
-				return (false);
 
 			hash = &fca->fca_rvcmd[nlen + 2];
 
+			if (len == (nlen + hashops->length + 2)) {
+				bsize = 0;
+			} else if ((fca->fca_proto >= CVSYNC_PROTO(0, 29)) &&
+				   (len == (nlen + hashops->length + 14))) {
+				osize = GetDDWord(&hash[hashops->length]);
+				bsize = GetDWord(&hash[hashops->length + 8]);
+				if (!filecmp_rdiff_signatures(fca, &fca->fca_sigs, &fca->fca_sigsmax, osize, bsize))
+					return (false);
+			} else {
+				return (false);
+			}
+
 			if (!rcslib_str2num(&fca->fca_rvcmd[2], nlen, &num))
 				return (false);
 
@@ -1927,10 +2169,19 @@ filecmp_rcs_deltatext(struct filecmp_args *fca, struct rcslib_file *rcs, uint32_
 		}
 
 		rev = &rcs->delta.rd_rev[c];
+		if (digests != NULL)
+			digest = &digests[c * hashops->length];
 		rv = rcslib_cmp_num(&rev->num, &num);
 		if (rv == 0) {
-			if (!filecmp_rcs_deltatext_update(fca, rev, hash))
-				return (false);
+			held = mux_held(fca->fca_mux, MUX_UPDATER);
+			if (!filecmp_rcs_deltatext_update(fca, rev, hash, digest, osize, bsize))
+				return (false);
+			if (mux_held(fca->fca_mux, MUX_UPDATER) == held) {
+				fca->fca_nkept++;
+			} else {
+				fca->fca_nchanged++;
+				fca->fca_rewritten += mux_held(fca->fca_mux, MUX_UPDATER) - held;
+			}
 			fetched = false;
 			c++;
 			i++;
@@ -1940,14 +2191,18 @@ filecmp_rcs_deltatext(struct filecmp_args *fca, struct rcslib_file *rcs, uint32_
 			fetched = false;
 			i++;
 		} else { /* rv < 0 */
-			if (!filecmp_rcs_deltatext_add(fca, rev))
+			if (!filecmp_rcs_deltatext_rotate(fca, rcs, rev, &num, hash, digest, &done))
+				return (false);
+			if (!done && !filecmp_rcs_deltatext_add(fca, rev, digest))
 				return (false);
 			c++;
 		}
 	}
 	while (c < rcs->delta.rd_count) {
+		if (digests != NULL)
+			digest = &digests[c * hashops->length];
 		rev = &rcs->delta.rd_rev[c++];
-		if (!filecmp_rcs_deltatext_add(fca, rev))
+		if (!filecmp_rcs_deltatext_add(fca, rev, digest))
 			return (false);
 	}
 
@@ -1965,7 +2220,7 @@ filecmp_rcs_deltatext(struct filecmp_args *fca, struct rcslib_file *rcs, uint32_
 }
 
 bool
-filecmp_rcs_deltatext_add(struct filecmp_args *fca, struct rcslib_revision *rev)
+filecmp_rcs_deltatext_add(struct filecmp_args *fca, struct rcslib_revision *rev, const uint8_t *digest)
 {
 	const struct hash_args *hashops = fca->fca_hash_ops;
 	uint8_t *cmd = fca->fca_cmd;
@@ -1983,19 +2238,22 @@ filecmp_rcs_deltatext_add(struct filecmp_args *fca, struct rcslib_revision *rev)
 	if (!mux_send(fca->fca_mux, MUX_UPDATER, rev->num.n_str, rev->num.n_len))
 		return (false);
 
-	if (!(*hashops->init)(&fca->fca_hash_ctx))
+	if ((digest == NULL) && !(*hashops->init)(&fca->fca_hash_ctx))
 		return (false);
 
 	/* log */
 	SetDWord(cmd, rev->log.s_len);
 	if (!mux_send(fca->fca_mux, MUX_UPDATER, cmd, 4)) {
-		(*hashops->destroy)(fca->fca_hash_ctx);
+		if (digest == NULL)
+			(*hashops->destroy)(fca->fca_hash_ctx);
 		return (false);
 	}
 	if (rev->log.s_len > 0) {
-		(*hashops->update)(fca->fca_hash_ctx, rev->log.s_str, rev->log.s_len);
+		if (digest == NULL)
+			(*hashops->update)(fca->fca_hash_ctx, rev->log.s_str, rev->log.s_len);
 		if (!mux_send(fca->fca_mux, MUX_UPDATER, rev->log.s_str, rev->log.s_len)) {
-			(*hashops->destroy)(fca->fca_hash_ctx);
+			if (digest == NULL)
+				(*hashops->destroy)(fca->fca_hash_ctx);
 			return (false);
 		}
 	}
@@ -2003,19 +2261,25 @@ filecmp_rcs_deltatext_add(struct filecmp_args *fca, struct rcslib_revision *rev)
 	/* text */
 	SetDDWord(cmd, rev->text.s_len);
 	if (!mux_send(fca->fca_mux, MUX_UPDATER, cmd, 8)) {
-		(*hashops->destroy)(fca->fca_hash_ctx);
+		if (digest == NULL)
+			(*hashops->destroy)(fca->fca_hash_ctx);
 		return (false);
 	}
 	if (rev->text.s_len > 0) {
-		(*hashops->update)(fca->fca_hash_ctx, rev->text.s_str, rev->text.s_len);
+		if (digest == NULL)
+			(*hashops->update)(fca->fca_hash_ctx, rev->text.s_str, rev->text.s_len);
 		if (!mux_send(fca->fca_mux, MUX_UPDATER, rev->text.s_str, rev->text.s_len)) {
-			(*hashops->destroy)(fca->fca_hash_ctx);
+			if (digest == NULL)
+				(*hashops->destroy)(fca->fca_hash_ctx);
 			return (false);
 		}
 	}
-	(*hashops->final)(fca->fca_hash_ctx, cmd);
+	if (digest == NULL) {
+		(*hashops->final)(fca->fca_hash_ctx, cmd);
+		digest = cmd;
+	}
 
-	if (!mux_send(fca->fca_mux, MUX_UPDATER, cmd, hashops->length))
+	if (!mux_send(fca->fca_mux, MUX_UPDATER, digest, hashops->length))
 		return (false);
 
 	return (true);
@@ -2043,27 +2307,38 @@ filecmp_rcs_deltatext_remove(struct filecmp_args *fca, struct rcsnum *num)
 }
 
 bool
-filecmp_rcs_deltatext_update(struct filecmp_args *fca, struct rcslib_revision *rev, uint8_t *hash)
+filecmp_rcs_deltatext_update(struct filecmp_args *fca, struct rcslib_revision *rev, uint8_t *hash,
+			     const uint8_t *digest, uint64_t osize, uint32_t bsize)
 {
 	const struct hash_args *hashops = fca->fca_hash_ops;
 	uint8_t *cmd = fca->fca_cmd;
 	size_t len;
+	bool done = false;
 
-	if (!(*hashops->init)(&fca->fca_hash_ctx))
-		return (false);
+	if (digest != NULL) {
+		(void)memcpy(fca->fca_hash, digest, hashops->length);
+	} else {
+		if (!(*hashops->init)(&fca->fca_hash_ctx))
+			return (false);
 
-	/* log */
-	if (rev->log.s_len > 0)
-		(*hashops->update)(fca->fca_hash_ctx, rev->log.s_str, rev->log.s_len);
-	/* text */
-	if (rev->text.s_len > 0)
-		(*hashops->update)(fca->fca_hash_ctx, rev->text.s_str, rev->text.s_len);
+		/* log */
+		if (rev->log.s_len > 0)
+			(*hashops->update)(fca->fca_hash_ctx, rev->log.s_str, rev->log.s_len);
+		/* text */
+		if (rev->text.s_len > 0)
+			(*hashops->update)(fca->fca_hash_ctx, rev->text.s_str, rev->text.s_len);
 
-	(*hashops->final)(fca->fca_hash_ctx, fca->fca_hash);
+		(*hashops->final)(fca->fca_hash_ctx, fca->fca_hash);
+	}
 
 	if (memcmp(hash, fca->fca_hash, hashops->length) == 0)
 		return (true);
 
+	if ((bsize > 0) && !filecmp_rcs_deltatext_patch(fca, rev, osize, bsize, &done))
+		return (false);
+	if (done)
+		return (true);
+
 	if ((len = rev->num.n_len + 5) > fca->fca_cmdmax)
 		return (false);
 
@@ -2100,6 +2375,183 @@ filecmp_rcs_deltatext_update(struct filecmp_args *fca, struct rcslib_revision *r
 	return (true);
 }
 
+/*
+ * A changed deltatext whose old text came with block signatures is sent
+ * as an rdiff against that text, unless sending the text whole is not
+ * more expensive.  fca_hash holds the digest of the new deltatext.
+ */
+bool
+filecmp_rcs_deltatext_patch(struct filecmp_args *fca, struct rcslib_revision *rev, uint64_t osize, uint32_t bsize,
+			    bool *done)
+{
+	const struct hash_args *hashops = fca->fca_hash_ops;
+	uint64_t cost = 0;
+	uint8_t *cmd = fca->fca_cmd;
+	size_t len;
+
+	*done = false;
+
+	if (!filecmp_rdiff_text(fca, &fca->fca_rdiff, fca->fca_sigs, rev->text.s_str, rev->text.s_len, osize, bsize,
+				&cost)) {
+		return (false);
+	}
+	if (cost >= (uint64_t)rev->text.s_len + 8)
+		return (true);
+
+	logmsg_debug(DEBUG_RDIFF, "%s: %.*s: rdiff %" PRIu64 "/%lu", fca->fca_rpath, (int)rev->num.n_len,
+		     rev->num.n_str, cost, (unsigned long)rev->text.s_len);
+
+	if ((len = rev->num.n_len + 5) > fca->fca_cmdmax)
+		return (false);
+
+	SetWord(cmd, len - 2);
+	cmd[2] = UPDATER_UPDATE_RCS_DELTATEXT;
+	cmd[3] = UPDATER_UPDATE_PATCH;
+	cmd[4] = (uint8_t)rev->num.n_len;
+	if (!mux_send(fca->fca_mux, MUX_UPDATER, cmd, 5))
+		return (false);
+	if (!mux_send(fca->fca_mux, MUX_UPDATER, rev->num.n_str, rev->num.n_len))
+		return (false);
+
+	/* log */
+	SetDWord(cmd, rev->log.s_len);
+	if (!mux_send(fca->fca_mux, MUX_UPDATER, cmd, 4))
+		return (false);
+	if (rev->log.s_len > 0) {
+		if (!mux_send(fca->fca_mux, MUX_UPDATER, rev->log.s_str, rev->log.s_len))
+			return (false);
+	}
+
+	/* text */
+	if (!filecmp_rdiff_replay(fca, &fca->fca_rdiff, rev->text.s_str))
+		return (false);
+
+	if (!mux_send(fca->fca_mux, MUX_UPDATER, fca->fca_hash, hashops->length))
+		return (false);
+
+	*done = true;
+
+	return (true);
+}
+
+/*
+ * After a commit the new head has the full text and the old head a diff
+ * against it, while the client still has the full text of the old head.
+ * The new head is then sent as the script which edits the latter into
+ * the former, provided that the client has the very text the server
+ * derives for the old head and that the script is the smaller.
+ */
+bool
+filecmp_rcs_deltatext_rotate(struct filecmp_args *fca, struct rcslib_file *rcs, struct rcslib_revision *rev,
+			     const struct rcsnum *num, const uint8_t *hash, const uint8_t *digest, bool *done)
+{
+	const struct hash_args *hashops = fca->fca_hash_ops;
+	struct rcslib_revision *base;
+	uint8_t *cmd = fca->fca_cmd;
+	char *script;
+	size_t len, scriptlen;
+
+	*done = false;
+
+	if (fca->fca_proto < CVSYNC_PROTO(0, 28))
+		return (true);
+	if ((rcslib_cmp_num(&rev->num, &rcs->head) != 0) || (rev->next.n_len == 0))
+		return (true);
+	if (rcslib_cmp_num(&rev->next, num) != 0)
+		return (true);
+	if ((base = rcslib_lookup_revision(rcs, num)) == NULL)
+		return (true);
+
+	if (!(*hashops->init)(&fca->fca_hash_ctx))
+		return (false);
+	if (base->log.s_len > 0)
+		(*hashops->update)(fca->fca_hash_ctx, base->log.s_str, base->log.s_len);
+	if (!rcslib_apply_rcsdiff(NULL, hashops, fca->fca_hash_ctx, &rev->text, base->text.s_str, base->text.s_len)) {
+		(*hashops->destroy)(fca->fca_hash_ctx);
+		return (true);
+	}
+	(*hashops->final)(fca->fca_hash_ctx, fca->fca_hash);
+	if (memcmp(fca->fca_hash, hash, hashops->length) != 0)
+		return (true);
+
+	if ((script = rcslib_invert_rcsdiff(&rev->text, &base->text, &scriptlen)) == NULL)
+		return (true);
+	if (scriptlen >= rev->text.s_len) {
+		free(script);
+		return (true);
+	}
+
+	if (digest == NULL) {
+		if (!(*hashops->init)(&fca->fca_hash_ctx)) {
+			free(script);
+			return (false);
+		}
+		if (rev->log.s_len > 0)
+			(*hashops->update)(fca->fca_hash_ctx, rev->log.s_str, rev->log.s_len);
+		if (rev->text.s_len > 0)
+			(*hashops->update)(fca->fca_hash_ctx, rev->text.s_str, rev->text.s_len);
+		(*hashops->final)(fca->fca_hash_ctx, fca->fca_hash);
+		digest = fca->fca_hash;
+	}
+
+	if ((len = rev->num.n_len + 5) > fca->fca_cmdmax) {
+		free(script);
+		return (false);
+	}
+	SetWord(cmd, len - 2);
+	cmd[2] = UPDATER_UPDATE_RCS_DELTATEXT;
+	cmd[3] = UPDATER_UPDATE_EDIT;
+	cmd[4] = (uint8_t)rev->num.n_len;
+	if (!mux_send(fca->fca_mux, MUX_UPDATER, cmd, 5) ||
+	    !mux_send(fca->fca_mux, MUX_UPDATER, rev->num.n_str, rev->num.n_len)) {
+		free(script);
+		return (false);
+	}
+
+	/* base */
+	cmd[0] = (uint8_t)base->num.n_len;
+	if (!mux_send(fca->fca_mux, MUX_UPDATER, cmd, 1) ||
+	    !mux_send(fca->fca_mux, MUX_UPDATER, base->num.n_str, base->num.n_len)) {
+		free(script);
+		return (false);
+	}
+
+	/* log */
+	SetDWord(cmd, rev->log.s_len);
+	if (!mux_send(fca->fca_mux, MUX_UPDATER, cmd, 4)) {
+		free(script);
+		return (false);
+	}
+	if (rev->log.s_len > 0) {
+		if (!mux_send(fca->fca_mux, MUX_UPDATER, rev->log.s_str, rev->log.s_len)) {
+			free(script);
+			return (false);
+		}
+	}
+
+	/* script */
+	SetDDWord(cmd, scriptlen);
+	if (!mux_send(fca->fca_mux, MUX_UPDATER, cmd, 8)) {
+		free(script);
+		return (false);
+	}
+	if (scriptlen > 0) {
+		if (!mux_send(fca->fca_mux, MUX_UPDATER, script, scriptlen)) {
+			free(script);
+			return (false);
+		}
+	}
+
+	free(script);
+
+	if (!mux_send(fca->fca_mux, MUX_UPDATER, digest, hashops->length))
+		return (false);
+
+	*done = true;
+
+	return (true);
+}
+
 bool
 filecmp_rcs_ignore_rcs(struct filecmp_args *fca)
 {
@@ -2107,6 +2559,17 @@ filecmp_rcs_ignore_rcs(struct filecmp_args *fca)
 	uint8_t *cmd = fca->fca_cmd;
 	size_t len;
 
+	/* signatures */
+	if (fca->fca_proto >= CVSYNC_PROTO(0, 30)) {
+		if (!mux_recv(fca->fca_mux, MUX_FILECMP_IN, cmd, 12))
+			return (false);
+		if ((GetDWord(&cmd[8]) != 0) &&
+		    !filecmp_rdiff_signatures(fca, &fca->fca_fsigs, &fca->fca_fsigsmax, GetDDWord(cmd),
+					      GetDWord(&cmd[8]))) {
+			return (false);
+		}
+	}
+
 	/* head */
 	if (!mux_recv(fca->fca_mux, MUX_FILECMP_IN, cmd, 2))
 		return (false);
@@ -2233,8 +2696,15 @@ filecmp_rcs_ignore_rcs_deltatext(struct filecmp_args *fca, uint32_t ndeltas)
 			return (false);
 		if (cmd[0] != FILECMP_UPDATE_RCS_DELTATEXT)
 			return (false);
-		if (len != (cmd[1] + hashops->length + 2))
+		if (len == (cmd[1] + hashops->length + 2))
+			continue;
+		if ((fca->fca_proto < CVSYNC_PROTO(0, 29)) || (len != (cmd[1] + hashops->length + 14)))
 			return (false);
+		if (!filecmp_rdiff_signatures(fca, &fca->fca_sigs, &fca->fca_sigsmax,
+					      GetDDWord(&cmd[cmd[1] + hashops->length + 2]),
+					      GetDWord(&cmd[cmd[1] + hashops->length + 10]))) {
+			return (false);
+		}
 	}
 
 	if (!mux_recv(fca->fca_mux, MUX_FILECMP_IN, cmd, 3))
@@ -2281,6 +2751,18 @@ filecmp_rcs_ignore_rcs_list(struct filecmp_args *fca, uint8_t type)
 	} else {
 		n = GetDWord(&cmd[1]);
 	}
+	if ((type == FILECMP_UPDATE_RCS_SYMBOLS) && (fca->fca_proto >= CVSYNC_PROTO(0, 26))) {
+		/* the bucket digests */
+		if (n > RCSLIB_SYMBOL_BUCKETMAX)
+			return (false);
+		if (fca->fca_hash_ops->length > fca->fca_cmdmax)
+			return (false);
+		while (n > 0) {
+			if (!mux_recv(fca->fca_mux, MUX_FILECMP_IN, cmd, fca->fca_hash_ops->length))
+				return (false);
+			n--;
+		}
+	}
 	while (n > 0) {
 		if (!mux_recv(fca->fca_mux, MUX_FILECMP_IN, cmd, 2))
 			return (false);
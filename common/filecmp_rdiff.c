@@ -21,12 +21,15 @@
 #include "cvsync_attr.h"
 #include "filetypes.h"
 #include "hash.h"
+#include "logmsg.h"
 #include "mux.h"
 #include "rdiff.h"
 
 #include "filecmp.h"
 #include "updater.h"
 
+bool filecmp_rdiff_text_add(struct filecmp_rdiff *, uint8_t, uint64_t, uint64_t, uint64_t *);
+
 bool
 filecmp_rdiff_update(struct filecmp_args *fca, struct cvsync_file *cfp)
 {
@@ -257,3 +260,168 @@ filecmp_rdiff_ischanged(struct filecmp_args *fca, struct cvsync_file *cfp)
 
 	return (false);
 }
+
+/* Receives the block signatures of an old text of osize bytes. */
+bool
+filecmp_rdiff_signatures(struct filecmp_args *fca, uint8_t **sigsp, size_t *sigsmaxp, uint64_t osize, uint32_t bsize)
+{
+	uint8_t *sigs;
+	size_t siglen = fca->fca_hash_ops->length + 4, n;
+
+	if ((osize == 0) || (bsize != rdiff_blocksize(osize)))
+		return (false);
+
+	n = (size_t)(osize / bsize);
+	if ((osize % bsize) != 0)
+		n++;
+
+	if (n * siglen > *sigsmaxp) {
+		if ((sigs = realloc(*sigsp, n * siglen)) == NULL) {
+			logmsg_err("%s", strerror(errno));
+			return (false);
+		}
+		*sigsp = sigs;
+		*sigsmaxp = n * siglen;
+	}
+
+	return (mux_recv(fca->fca_mux, MUX_FILECMP_IN, *sigsp, n * siglen));
+}
+
+/*
+ * Encodes the text at addr against the block signatures sigs of an old
+ * text of osize bytes into rd, and adds up the number of bytes that it
+ * takes at costp.  Nothing is sent until filecmp_rdiff_replay().
+ */
+bool
+filecmp_rdiff_text(struct filecmp_args *fca, struct filecmp_rdiff *rd, const uint8_t *sigs, const void *addr,
+		   size_t size, uint64_t osize, uint32_t bsize, uint64_t *costp)
+{
+	const struct hash_args *hashops = fca->fca_hash_ops;
+	uint64_t offset = 0, length = 0;
+	const uint8_t *sig = sigs;
+	uint8_t *sv_sp = (uint8_t *)addr, *sp = sv_sp, *bp = sp + size, *mp;
+	size_t siglen = hashops->length + 4, len, n, i;
+
+	rd->rd_count = 0;
+
+	n = (size_t)(osize / bsize);
+	if ((osize % bsize) != 0)
+		n++;
+
+	for (i = 0 ; (i < n) && (sp < bp) ; i++, sig += siglen) {
+		if ((len = (size_t)(osize - (uint64_t)i * bsize)) > bsize)
+			len = bsize;
+
+		if ((mp = rdiff_search(sp, bp, bsize, len, GetDWord(sig), (uint8_t *)&sig[4], hashops)) == NULL)
+			continue;
+
+		if (mp > sp) {
+			if (!filecmp_rdiff_text_add(rd, RDIFF_CMD_COPY, offset, length, costp))
+				return (false);
+			length = 0;
+			if (!filecmp_rdiff_text_add(rd, RDIFF_CMD_DATA, (uint64_t)(sp - sv_sp), (uint64_t)(mp - sp),
+						    costp)) {
+				return (false);
+			}
+		}
+
+		if ((length > 0) && (offset + length == (uint64_t)i * bsize)) {
+			length += len;
+		} else {
+			if (!filecmp_rdiff_text_add(rd, RDIFF_CMD_COPY, offset, length, costp))
+				return (false);
+			offset = (uint64_t)i * bsize;
+			length = len;
+		}
+
+		sp = mp + len;
+	}
+	if (!filecmp_rdiff_text_add(rd, RDIFF_CMD_COPY, offset, length, costp))
+		return (false);
+	if (sp < bp) {
+		if (!filecmp_rdiff_text_add(rd, RDIFF_CMD_DATA, (uint64_t)(sp - sv_sp), (uint64_t)(bp - sp), costp))
+			return (false);
+	}
+
+	/* EOF */
+	(*costp)++;
+
+	return (true);
+}
+
+/* Sends the commands in rd for the text at addr which they were made of. */
+bool
+filecmp_rdiff_replay(struct filecmp_args *fca, const struct filecmp_rdiff *rd, const void *addr)
+{
+	const struct filecmp_rdiff_cmd *rc;
+	const uint8_t *sp = addr;
+	size_t i;
+
+	for (i = 0 ; i < rd->rd_count ; i++) {
+		rc = &rd->rd_cmds[i];
+		if (rc->rc_cmd == RDIFF_CMD_COPY) {
+			if (!rdiff_copy(fca->fca_mux, MUX_UPDATER, (off_t)rc->rc_offset, (size_t)rc->rc_length))
+				return (false);
+		} else {
+			if (!rdiff_data(fca->fca_mux, MUX_UPDATER, &sp[rc->rc_offset], (size_t)rc->rc_length))
+				return (false);
+		}
+	}
+
+	return (rdiff_eof(fca->fca_mux, MUX_UPDATER));
+}
+
+/* The whole file as the rdiff in rd. */
+bool
+filecmp_rdiff_send(struct filecmp_args *fca, struct cvsync_file *cfp, const struct filecmp_rdiff *rd)
+{
+	static const uint8_t cmds[3] = { 0x00, 0x01, UPDATER_UPDATE_RDIFF };
+	static const uint8_t cmde[3] = { 0x00, 0x01, UPDATER_UPDATE_END };
+	const struct hash_args *hashops = fca->fca_hash_ops;
+
+	if (!mux_send(fca->fca_mux, MUX_UPDATER, cmds, sizeof(cmds)))
+		return (false);
+	if (!filecmp_rdiff_replay(fca, rd, cfp->cf_addr))
+		return (false);
+
+	if (!(*hashops->init)(&fca->fca_hash_ctx))
+		return (false);
+	(*hashops->update)(fca->fca_hash_ctx, cfp->cf_addr, (size_t)cfp->cf_size);
+	(*hashops->final)(fca->fca_hash_ctx, fca->fca_hash);
+
+	if (!mux_send(fca->fca_mux, MUX_UPDATER, fca->fca_hash, hashops->length))
+		return (false);
+
+	return (mux_send(fca->fca_mux, MUX_UPDATER, cmde, sizeof(cmde)));
+}
+
+bool
+filecmp_rdiff_text_add(struct filecmp_rdiff *rd, uint8_t cmd, uint64_t offset, uint64_t length, uint64_t *costp)
+{
+	struct filecmp_rdiff_cmd *cmds;
+	size_t max;
+
+	if (length == 0)
+		return (true);
+
+	if (rd->rd_count == rd->rd_max) {
+		max = (rd->rd_max == 0) ? 256 : rd->rd_max * 2;
+		if ((cmds = realloc(rd->rd_cmds, max * sizeof(*cmds))) == NULL) {
+			logmsg_err("%s", strerror(errno));
+			return (false);
+		}
+		rd->rd_cmds = cmds;
+		rd->rd_max = max;
+	}
+	rd->rd_cmds[rd->rd_count].rc_cmd = cmd;
+	rd->rd_cmds[rd->rd_count].rc_offset = offset;
+	rd->rd_cmds[rd->rd_count].rc_length = length;
+	rd->rd_count++;
+
+	if (cmd == RDIFF_CMD_COPY)
+		*costp += RDIFF_MAXCMDLEN;
+	else
+		*costp += length + 5;
+
+	return (true);
+}
@@ -27,6 +27,7 @@
 #include "collection.h"
 #include "cvsync.h"
 #include "cvsync_attr.h"
+#include "digestfile.h"
 #include "hash.h"
 #include "logmsg.h"
 #include "mux.h"
@@ -52,18 +53,26 @@ filescan_init(struct mux *mx, struct collection *cls, uint32_t proto, int type)
 	fsa->fsa_pathmax = sizeof(fsa->fsa_path);
 	fsa->fsa_namemax = CVSYNC_NAME_MAX;
 	fsa->fsa_cmdmax = sizeof(fsa->fsa_cmd);
+	fsa->fsa_rcs_rdiff = false;
 
 	if (!hash_set(type, &fsa->fsa_hash_ops)) {
 		free(fsa);
 		return (NULL);
 	}
 
+	fsa->fsa_digestfile = NULL;
+	if ((fsa->fsa_digests = digestfile_list_init()) == NULL) {
+		free(fsa);
+		return (NULL);
+	}
+
 	return (fsa);
 }
 
 void
 filescan_destroy(struct filescan_args *fsa)
 {
+	digestfile_list_destroy(fsa->fsa_digests);
 	free(fsa);
 }
 
@@ -118,6 +127,8 @@ filescan(void *arg)
 		fsa->fsa_path[fsa->fsa_pathlen] = '\0';
 		fsa->fsa_rpath = &fsa->fsa_path[fsa->fsa_pathlen];
 		fsa->fsa_umask = cl->cl_umask;
+		fsa->fsa_rcs_rdiff = cl->cl_rcs_rdiff;
+		fsa->fsa_digestfile = cl->cl_digestfile;
 
 		switch (cvsync_release_pton(cl->cl_release)) {
 		case CVSYNC_RELEASE_LIST:
@@ -7,6 +7,8 @@
 
 struct collection;
 struct cvsync_file;
+struct digestfile;
+struct digestfile_list;
 struct hash_args;
 struct mux;
 struct refuse_args;
@@ -39,9 +41,13 @@ struct filescan_args {
 	size_t			fsa_cmdmax;
 	struct cvsync_attr	fsa_attr;
 	uint16_t		fsa_umask;
+	bool			fsa_rcs_rdiff;
 
 	void			*fsa_hash_ctx;
 	const struct hash_args	*fsa_hash_ops;
+
+	struct digestfile	*fsa_digestfile;
+	struct digestfile_list	*fsa_digests;
 };
 
 struct filescan_args *filescan_init(struct mux *, struct collection *, uint32_t, int);
@@ -54,5 +60,6 @@ bool filescan_rcs(struct filescan_args *);
 
 bool filescan_generic_update(struct filescan_args *, struct cvsync_file *);
 bool filescan_rdiff_update(struct filescan_args *, struct cvsync_file *);
+bool filescan_rdiff_signatures(struct filescan_args *, const void *, size_t, uint32_t);
 
 #endif /* CVSYNC_FILESCAN_H */
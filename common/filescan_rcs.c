@@ -5,7 +5,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include <stdlib.h>
+
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <pthread.h>
 #include <string.h>
@@ -20,18 +23,64 @@
 #include "attribute.h"
 #include "cvsync.h"
 #include "cvsync_attr.h"
+#include "digestfile.h"
 #include "filetypes.h"
 #include "hash.h"
 #include "logmsg.h"
 #include "mux.h"
 #include "rcslib.h"
+#include "rdiff.h"
 #include "refuse.h"
 #include "version.h"
 
 #include "filescan.h"
 #include "filecmp.h"
 
-bool filescan_rcs_fetch(struct filescan_args *);
+/*
+ * FileScan requests are read ahead by a separate thread, which asks the
+ * kernel to start reading the files to be updated while the requests in
+ * front of them are processed.  At most FILESCAN_PREFETCH_DEPTH requests
+ * and FILESCAN_PREFETCH_SIZE bytes of announced file data are in flight.
+ */
+#define	FILESCAN_PREFETCH_DEPTH	(64)
+#define	FILESCAN_PREFETCH_SIZE	(16 * 1024 * 1024)
+
+struct filescan_prefetch_entry {
+	uint8_t		fpe_tag, fpe_type;
+	uint16_t	fpe_mode;
+	int64_t		fpe_mtime;
+	uint64_t	fpe_size;
+	char		*fpe_name, *fpe_path;
+	size_t		fpe_namelen, fpe_pathlen;
+	off_t		fpe_prefetched;
+};
+
+struct filescan_prefetch {
+	struct filescan_args		*fp_fsa;
+	struct cvsync_attr		fp_attr;
+	uint8_t				fp_cmd[CVSYNC_MAXCMDLEN];
+	char				fp_path[PATH_MAX + CVSYNC_NAME_MAX + 1];
+
+	struct filescan_prefetch_entry	fp_entries[FILESCAN_PREFETCH_DEPTH];
+	size_t				fp_head, fp_count;
+	off_t				fp_prefetched;
+	bool				fp_done, fp_closed;
+
+	pthread_t			fp_thread;
+	pthread_mutex_t			fp_lock;
+	pthread_cond_t			fp_wait_in, fp_wait_out;
+};
+
+bool filescan_rcs_fetch(struct filescan_args *, struct cvsync_attr *, uint8_t *, char *);
+
+struct filescan_prefetch *filescan_rcs_prefetch_init(struct filescan_args *);
+void filescan_rcs_prefetch_destroy(struct filescan_prefetch *, bool);
+void *filescan_rcs_prefetch(void *);
+bool filescan_rcs_prefetch_push(struct filescan_prefetch *, off_t);
+bool filescan_rcs_prefetch_fetch(struct filescan_prefetch *, struct filescan_args *);
+#if defined(POSIX_FADV_WILLNEED)
+off_t filescan_rcs_prefetch_file(const char *);
+#endif /* defined(POSIX_FADV_WILLNEED) */
 
 bool filescan_rcs_add(struct filescan_args *);
 bool filescan_rcs_remove(struct filescan_args *);
@@ -42,9 +91,12 @@ bool filescan_rcs_setattr_file(struct filescan_args *);
 bool filescan_rcs_update(struct filescan_args *);
 
 bool filescan_rcs_update_rcs(struct filescan_args *, struct cvsync_file *);
+bool filescan_rcs_update_rcs_rdiff(struct filescan_args *, struct cvsync_file *);
 bool filescan_rcs_update_rcs_admin(struct filescan_args *, struct rcslib_file *);
+bool filescan_rcs_update_rcs_symbols(struct filescan_args *, struct rcslib_file *);
 bool filescan_rcs_update_rcs_delta(struct filescan_args *, struct rcslib_file *);
-bool filescan_rcs_update_rcs_deltatext(struct filescan_args *, struct rcslib_file *);
+bool filescan_rcs_update_rcs_deltatext(struct filescan_args *, struct rcslib_file *, const struct stat *, const uint8_t *, bool);
+bool filescan_rcs_signed(struct filescan_args *, struct rcslib_file *, struct rcslib_revision *);
 bool filescan_rcs_update_symlink(struct filescan_args *);
 bool filescan_rcs_replace(struct filescan_args *);
 
@@ -53,14 +105,22 @@ static const uint8_t cmde[3] = { 0x00, 0x01, FILECMP_UPDATE_END };
 bool
 filescan_rcs(struct filescan_args *fsa)
 {
+	struct filescan_prefetch *fp;
 	struct cvsync_attr *cap = &fsa->fsa_attr;
 
+	if ((fp = filescan_rcs_prefetch_init(fsa)) == NULL)
+		return (false);
+
 	for (;;) {
-		if (cvsync_is_interrupted())
+		if (cvsync_is_interrupted()) {
+			filescan_rcs_prefetch_destroy(fp, true);
 			return (false);
+		}
 
-		if (!filescan_rcs_fetch(fsa))
+		if (!filescan_rcs_prefetch_fetch(fp, fsa)) {
+			filescan_rcs_prefetch_destroy(fp, true);
 			return (false);
+		}
 
 		if (cap->ca_tag == FILESCAN_END)
 			break;
@@ -72,46 +132,53 @@ filescan_rcs(struct filescan_args *fsa)
 		case FILESCAN_ADD:
 			if (!filescan_rcs_add(fsa)) {
 				logmsg_err("FileScan(RCS): ADD %s", fsa->fsa_path);
+				filescan_rcs_prefetch_destroy(fp, true);
 				return (false);
 			}
 			break;
 		case FILESCAN_REMOVE:
 			if (!filescan_rcs_remove(fsa)) {
 				logmsg_err("FileScan(RCS): REMOVE %s", fsa->fsa_path);
+				filescan_rcs_prefetch_destroy(fp, true);
 				return (false);
 			}
 			break;
 		case FILESCAN_RCS_ATTIC:
 			if (!filescan_rcs_attic(fsa)) {
 				logmsg_err("FileScan(RCS): ATTIC %s", fsa->fsa_path);
+				filescan_rcs_prefetch_destroy(fp, true);
 				return (false);
 			}
 			break;
 		case FILESCAN_SETATTR:
 			if (!filescan_rcs_setattr(fsa)) {
 				logmsg_err("FileScan(RCS): SETATTR %s", fsa->fsa_path);
+				filescan_rcs_prefetch_destroy(fp, true);
 				return (false);
 			}
 			break;
 		case FILESCAN_UPDATE:
 			if (!filescan_rcs_update(fsa)) {
 				logmsg_err("FileScan(RCS): UPDATE %s", fsa->fsa_path);
+				filescan_rcs_prefetch_destroy(fp, true);
 				return (false);
 			}
 			break;
 		default:
+			filescan_rcs_prefetch_destroy(fp, true);
 			return (false);
 		}
 	}
 
+	filescan_rcs_prefetch_destroy(fp, false);
+
 	return (true);
 }
 
 bool
-filescan_rcs_fetch(struct filescan_args *fsa)
+filescan_rcs_fetch(struct filescan_args *fsa, struct cvsync_attr *cap, uint8_t *cmd, char *path)
 {
-	struct cvsync_attr *cap = &fsa->fsa_attr;
-	uint8_t *cmd = fsa->fsa_cmd;
+	char *rpath = &path[fsa->fsa_pathlen];
 	size_t pathlen, len;
 
 	if (!mux_recv(fsa->fsa_mux, MUX_FILESCAN_IN, cmd, 3))
@@ -214,16 +281,222 @@ filescan_rcs_fetch(struct filescan_args *fsa)
 	if ((pathlen = fsa->fsa_pathlen + cap->ca_namelen) >= fsa->fsa_pathmax)
 		return (false);
 
-	(void)memcpy(fsa->fsa_rpath, cap->ca_name, cap->ca_namelen);
-	fsa->fsa_rpath[cap->ca_namelen] = '\0';
+	(void)memcpy(rpath, cap->ca_name, cap->ca_namelen);
+	rpath[cap->ca_namelen] = '\0';
 	if (cap->ca_type == FILETYPE_RCS_ATTIC) {
-		if (!cvsync_rcs_insert_attic(fsa->fsa_path, pathlen, fsa->fsa_pathmax))
+		if (!cvsync_rcs_insert_attic(path, pathlen, fsa->fsa_pathmax))
 			return (false);
 	}
 
 	return (true);
 }
 
+struct filescan_prefetch *
+filescan_rcs_prefetch_init(struct filescan_args *fsa)
+{
+	struct filescan_prefetch *fp;
+
+	if ((fp = malloc(sizeof(*fp))) == NULL) {
+		logmsg_err("%s", strerror(errno));
+		return (NULL);
+	}
+	fp->fp_fsa = fsa;
+	(void)memcpy(fp->fp_path, fsa->fsa_path, fsa->fsa_pathlen);
+	fp->fp_head = 0;
+	fp->fp_count = 0;
+	fp->fp_prefetched = 0;
+	fp->fp_done = false;
+	fp->fp_closed = false;
+
+	if (pthread_mutex_init(&fp->fp_lock, NULL) != 0) {
+		free(fp);
+		return (NULL);
+	}
+	if (pthread_cond_init(&fp->fp_wait_in, NULL) != 0) {
+		pthread_mutex_destroy(&fp->fp_lock);
+		free(fp);
+		return (NULL);
+	}
+	if (pthread_cond_init(&fp->fp_wait_out, NULL) != 0) {
+		pthread_cond_destroy(&fp->fp_wait_in);
+		pthread_mutex_destroy(&fp->fp_lock);
+		free(fp);
+		return (NULL);
+	}
+
+	if (pthread_create(&fp->fp_thread, NULL, filescan_rcs_prefetch, fp) != 0) {
+		logmsg_err("FileScan(RCS): prefetch thread: %s", strerror(errno));
+		pthread_cond_destroy(&fp->fp_wait_out);
+		pthread_cond_destroy(&fp->fp_wait_in);
+		pthread_mutex_destroy(&fp->fp_lock);
+		free(fp);
+		return (NULL);
+	}
+
+	return (fp);
+}
+
+void
+filescan_rcs_prefetch_destroy(struct filescan_prefetch *fp, bool aborted)
+{
+	struct filescan_prefetch_entry *fpe;
+
+	pthread_mutex_lock(&fp->fp_lock);
+	fp->fp_closed = true;
+	pthread_cond_signal(&fp->fp_wait_out);
+	pthread_mutex_unlock(&fp->fp_lock);
+
+	if (aborted)
+		mux_abort(fp->fp_fsa->fsa_mux);
+	pthread_join(fp->fp_thread, NULL);
+
+	while (fp->fp_count > 0) {
+		fpe = &fp->fp_entries[fp->fp_head];
+		free(fpe->fpe_name);
+		fp->fp_head = (fp->fp_head + 1) % FILESCAN_PREFETCH_DEPTH;
+		fp->fp_count--;
+	}
+
+	pthread_cond_destroy(&fp->fp_wait_out);
+	pthread_cond_destroy(&fp->fp_wait_in);
+	pthread_mutex_destroy(&fp->fp_lock);
+	free(fp);
+}
+
+void *
+filescan_rcs_prefetch(void *arg)
+{
+	struct filescan_prefetch *fp = arg;
+	struct cvsync_attr *cap = &fp->fp_attr;
+	off_t size;
+
+	for (;;) {
+		if (!filescan_rcs_fetch(fp->fp_fsa, cap, fp->fp_cmd, fp->fp_path))
+			break;
+
+		pthread_mutex_lock(&fp->fp_lock);
+		while (!fp->fp_closed &&
+		       ((fp->fp_count == FILESCAN_PREFETCH_DEPTH) ||
+			((fp->fp_count > 0) && (fp->fp_prefetched >= FILESCAN_PREFETCH_SIZE)))) {
+			pthread_cond_wait(&fp->fp_wait_out, &fp->fp_lock);
+		}
+		if (fp->fp_closed) {
+			pthread_mutex_unlock(&fp->fp_lock);
+			return (NULL);
+		}
+		pthread_mutex_unlock(&fp->fp_lock);
+
+		size = 0;
+#if defined(POSIX_FADV_WILLNEED)
+		if ((cap->ca_tag == FILESCAN_UPDATE) && (cap->ca_type != FILETYPE_SYMLINK))
+			size = filescan_rcs_prefetch_file(fp->fp_path);
+#endif /* defined(POSIX_FADV_WILLNEED) */
+
+		if (!filescan_rcs_prefetch_push(fp, size))
+			break;
+		if (cap->ca_tag == FILESCAN_END)
+			return (NULL);
+	}
+
+	pthread_mutex_lock(&fp->fp_lock);
+	fp->fp_done = true;
+	pthread_cond_signal(&fp->fp_wait_in);
+	pthread_mutex_unlock(&fp->fp_lock);
+
+	return (NULL);
+}
+
+bool
+filescan_rcs_prefetch_push(struct filescan_prefetch *fp, off_t size)
+{
+	struct filescan_prefetch_entry *fpe;
+	struct cvsync_attr *cap = &fp->fp_attr;
+	size_t pathlen = strlen(fp->fp_path);
+	char *name;
+
+	if ((name = malloc(cap->ca_namelen + pathlen + 1)) == NULL) {
+		logmsg_err("%s", strerror(errno));
+		return (false);
+	}
+
+	pthread_mutex_lock(&fp->fp_lock);
+	fpe = &fp->fp_entries[(fp->fp_head + fp->fp_count) % FILESCAN_PREFETCH_DEPTH];
+	fpe->fpe_tag = cap->ca_tag;
+	fpe->fpe_type = cap->ca_type;
+	fpe->fpe_mode = cap->ca_mode;
+	fpe->fpe_mtime = cap->ca_mtime;
+	fpe->fpe_size = cap->ca_size;
+	fpe->fpe_name = name;
+	fpe->fpe_path = &name[cap->ca_namelen];
+	fpe->fpe_namelen = cap->ca_namelen;
+	fpe->fpe_pathlen = pathlen;
+	fpe->fpe_prefetched = size;
+	(void)memcpy(fpe->fpe_name, cap->ca_name, cap->ca_namelen);
+	(void)memcpy(fpe->fpe_path, fp->fp_path, pathlen + 1);
+	fp->fp_count++;
+	fp->fp_prefetched += size;
+	if (cap->ca_tag == FILESCAN_END)
+		fp->fp_done = true;
+	pthread_cond_signal(&fp->fp_wait_in);
+	pthread_mutex_unlock(&fp->fp_lock);
+
+	return (true);
+}
+
+bool
+filescan_rcs_prefetch_fetch(struct filescan_prefetch *fp, struct filescan_args *fsa)
+{
+	struct filescan_prefetch_entry fpe;
+	struct cvsync_attr *cap = &fsa->fsa_attr;
+
+	pthread_mutex_lock(&fp->fp_lock);
+	while ((fp->fp_count == 0) && !fp->fp_done)
+		pthread_cond_wait(&fp->fp_wait_in, &fp->fp_lock);
+	if (fp->fp_count == 0) {
+		pthread_mutex_unlock(&fp->fp_lock);
+		return (false);
+	}
+	/* The slot may be refilled as soon as the lock is dropped. */
+	fpe = fp->fp_entries[fp->fp_head];
+	fp->fp_head = (fp->fp_head + 1) % FILESCAN_PREFETCH_DEPTH;
+	fp->fp_count--;
+	fp->fp_prefetched -= fpe.fpe_prefetched;
+	pthread_cond_signal(&fp->fp_wait_out);
+	pthread_mutex_unlock(&fp->fp_lock);
+
+	cap->ca_tag = fpe.fpe_tag;
+	cap->ca_type = fpe.fpe_type;
+	cap->ca_mode = fpe.fpe_mode;
+	cap->ca_mtime = fpe.fpe_mtime;
+	cap->ca_size = fpe.fpe_size;
+	cap->ca_namelen = fpe.fpe_namelen;
+	(void)memcpy(cap->ca_name, fpe.fpe_name, fpe.fpe_namelen);
+	(void)memcpy(fsa->fsa_path, fpe.fpe_path, fpe.fpe_pathlen + 1);
+	free(fpe.fpe_name);
+
+	return (true);
+}
+
+#if defined(POSIX_FADV_WILLNEED)
+off_t
+filescan_rcs_prefetch_file(const char *path)
+{
+	struct stat st;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY, 0)) == -1)
+		return (0);
+	if ((fstat(fd, &st) == -1) || !S_ISREG(st.st_mode)) {
+		(void)close(fd);
+		return (0);
+	}
+	(void)posix_fadvise(fd, (off_t)0, (off_t)0, POSIX_FADV_WILLNEED);
+	(void)close(fd);
+
+	return (st.st_size);
+}
+#endif /* defined(POSIX_FADV_WILLNEED) */
+
 bool
 filescan_rcs_add(struct filescan_args *fsa)
 {
@@ -444,7 +717,12 @@ filescan_rcs_setattr_file(struct filescan_args *fsa)
 	if (lstat(fsa->fsa_path, &st) == -1)
 		return (filescan_rcs_replace(fsa));
 
-	if ((mode = RCS_MODE(st.st_mode, fsa->fsa_umask)) == cap->ca_mode)
+	/*
+	 * DirCmp also sends SETATTR for an RCS file whose mtime has changed
+	 * but whose contents are the same, so that the mtime is taken over.
+	 */
+	mode = RCS_MODE(st.st_mode, fsa->fsa_umask);
+	if ((mode == cap->ca_mode) && ((cap->ca_type == FILETYPE_FILE) || ((int64_t)st.st_mtime == cap->ca_mtime)))
 		return (true);
 
 	if ((base = cap->ca_namelen + 6) > fsa->fsa_cmdmax)
@@ -579,39 +857,71 @@ filescan_rcs_update_rcs(struct filescan_args *fsa, struct cvsync_file *cfp)
 	static const uint8_t _cmds[3] = { 0x00, 0x01, FILECMP_UPDATE_RCS };
 	struct rcslib_file *rcs;
 	struct cvsync_attr *cap = &fsa->fsa_attr;
+	struct stat st, *stp = NULL;
+	uint8_t *digests = NULL;
+	bool cached = false;
 
 	if ((cap->ca_type != FILETYPE_RCS) && (cap->ca_type != FILETYPE_RCS_ATTIC))
 		return (false);
 
-	if ((rcs = rcslib_init(cfp->cf_addr, cfp->cf_size)) == NULL) {
+	/*
+	 * The deltatext section is only parsed when its digests are not
+	 * found in the digestfile, and the digests are computed as it is.
+	 */
+	if ((rcs = rcslib_init_lazy(cfp->cf_addr, cfp->cf_size)) != NULL) {
+		if ((fsa->fsa_digestfile != NULL) && (fstat(cfp->cf_fileno, &st) != -1)) {
+			stp = &st;
+			cached = digestfile_lookup(fsa->fsa_digestfile, fsa->fsa_rpath, stp,
+						   rcs->delta.rd_count, fsa->fsa_digests);
+		}
+		if (cached) {
+			digests = fsa->fsa_digests->dl_digests;
+		} else if (rcs->delta.rd_count > 0) {
+			if ((digests = malloc(rcs->delta.rd_count * fsa->fsa_hash_ops->length)) == NULL) {
+				logmsg_err("%s", strerror(errno));
+				rcslib_destroy(rcs);
+				return (false);
+			}
+		}
+		if (!cached && !rcslib_load_deltatext_fd(rcs, cfp->cf_fileno, fsa->fsa_hash_ops, digests)) {
+			free(digests);
+			rcslib_destroy(rcs);
+			rcs = NULL;
+		}
+		/* The texts are still needed for the signatures of large ones. */
+		if (cached && fsa->fsa_rcs_rdiff && (fsa->fsa_proto >= CVSYNC_PROTO(0, 29)) &&
+		    (cfp->cf_size >= RDIFF_DELTATEXT_MINSIZE) &&
+		    !rcslib_load_deltatext_fd(rcs, cfp->cf_fileno, NULL, NULL)) {
+			rcslib_destroy(rcs);
+			rcs = NULL;
+		}
+	}
+	if (rcs == NULL) {
 		if (fsa->fsa_proto < CVSYNC_PROTO(0, 24))
 			return (filescan_generic_update(fsa, cfp));
 		else
 			return (filescan_rdiff_update(fsa, cfp));
 	}
 	if ((fsa->fsa_proto < CVSYNC_PROTO(0, 24)) && (rcs->symbols.rs_count > UINT8_MAX)) {
+		if (!cached)
+			free(digests);
 		rcslib_destroy(rcs);
 		return (filescan_generic_update(fsa, cfp));
 	}
 
-	if (!mux_send(fsa->fsa_mux, MUX_FILECMP, _cmds, sizeof(_cmds))) {
-		rcslib_destroy(rcs);
-		return (false);
-	}
-
-	if (!filescan_rcs_update_rcs_admin(fsa, rcs)) {
-		rcslib_destroy(rcs);
-		return (false);
-	}
-	if (!filescan_rcs_update_rcs_delta(fsa, rcs)) {
-		rcslib_destroy(rcs);
-		return (false);
-	}
-	if (!filescan_rcs_update_rcs_deltatext(fsa, rcs)) {
+	if (!mux_send(fsa->fsa_mux, MUX_FILECMP, _cmds, sizeof(_cmds)) ||
+	    !filescan_rcs_update_rcs_rdiff(fsa, cfp) ||
+	    !filescan_rcs_update_rcs_admin(fsa, rcs) ||
+	    !filescan_rcs_update_rcs_delta(fsa, rcs) ||
+	    !filescan_rcs_update_rcs_deltatext(fsa, rcs, stp, digests, cached)) {
+		if (!cached)
+			free(digests);
 		rcslib_destroy(rcs);
 		return (false);
 	}
 
+	if (!cached)
+		free(digests);
 	rcslib_destroy(rcs);
 
 	if (!mux_send(fsa->fsa_mux, MUX_FILECMP, cmde, sizeof(cmde)))
@@ -620,6 +930,35 @@ filescan_rcs_update_rcs(struct filescan_args *fsa, struct cvsync_file *cfp)
 	return (true);
 }
 
+/*
+ * The block signatures of the whole file, with which FileCmp may send it
+ * as an rdiff instead when that is the cheaper.  Only with rcs-rdiff.
+ */
+bool
+filescan_rcs_update_rcs_rdiff(struct filescan_args *fsa, struct cvsync_file *cfp)
+{
+	uint64_t size = 0;
+	uint32_t bsize = 0;
+	uint8_t *cmd = fsa->fsa_cmd;
+
+	if (fsa->fsa_proto < CVSYNC_PROTO(0, 30))
+		return (true);
+
+	if (fsa->fsa_rcs_rdiff && (cfp->cf_size >= RDIFF_RCS_MINSIZE)) {
+		size = (uint64_t)cfp->cf_size;
+		bsize = rdiff_blocksize(size);
+	}
+
+	SetDDWord(cmd, size);
+	SetDWord(&cmd[8], bsize);
+	if (!mux_send(fsa->fsa_mux, MUX_FILECMP, cmd, 12))
+		return (false);
+	if (bsize == 0)
+		return (true);
+
+	return (filescan_rdiff_signatures(fsa, cfp->cf_addr, (size_t)cfp->cf_size, bsize));
+}
+
 bool
 filescan_rcs_update_rcs_admin(struct filescan_args *fsa, struct rcslib_file *rcs)
 {
@@ -683,14 +1022,17 @@ filescan_rcs_update_rcs_admin(struct filescan_args *fsa, struct rcslib_file *rcs
 		cmd[3] = (uint8_t)rcs->symbols.rs_count;
 		if (!mux_send(fsa->fsa_mux, MUX_FILECMP, cmd, 4))
 			return (false);
-	} else {
+	} else if (fsa->fsa_proto < CVSYNC_PROTO(0, 26)) {
 		SetWord(cmd, 5);
 		cmd[2] = FILECMP_UPDATE_RCS_SYMBOLS;
 		SetDWord(&cmd[3], rcs->symbols.rs_count);
 		if (!mux_send(fsa->fsa_mux, MUX_FILECMP, cmd, 7))
 			return (false);
+	} else {
+		if (!filescan_rcs_update_rcs_symbols(fsa, rcs))
+			return (false);
 	}
-	if (rcs->symbols.rs_count > 0) {
+	if ((fsa->fsa_proto < CVSYNC_PROTO(0, 26)) && (rcs->symbols.rs_count > 0)) {
 		for (i = 0 ; i < rcs->symbols.rs_count ; i++) {
 			struct rcslib_symbol *symbol;
 
@@ -774,6 +1116,44 @@ filescan_rcs_update_rcs_admin(struct filescan_args *fsa, struct rcslib_file *rcs
 	return (true);
 }
 
+/*
+ * Only the digests of the buckets of the symbol table are sent, FileCmp
+ * replaces the buckets which differ.
+ */
+bool
+filescan_rcs_update_rcs_symbols(struct filescan_args *fsa, struct rcslib_file *rcs)
+{
+	const struct hash_args *hashops = fsa->fsa_hash_ops;
+	uint8_t *cmd = fsa->fsa_cmd, *digests;
+	size_t nbuckets;
+
+	nbuckets = rcslib_symbol_buckets(rcs->symbols.rs_count);
+	if ((digests = malloc(nbuckets * hashops->length)) == NULL) {
+		logmsg_err("%s", strerror(errno));
+		return (false);
+	}
+	if (!rcslib_digest_symbols(rcs, nbuckets, hashops, digests)) {
+		free(digests);
+		return (false);
+	}
+
+	SetWord(cmd, 5);
+	cmd[2] = FILECMP_UPDATE_RCS_SYMBOLS;
+	SetDWord(&cmd[3], nbuckets);
+	if (!mux_send(fsa->fsa_mux, MUX_FILECMP, cmd, 7)) {
+		free(digests);
+		return (false);
+	}
+	if (!mux_send(fsa->fsa_mux, MUX_FILECMP, digests, nbuckets * hashops->length)) {
+		free(digests);
+		return (false);
+	}
+
+	free(digests);
+
+	return (true);
+}
+
 bool
 filescan_rcs_update_rcs_delta(struct filescan_args *fsa, struct rcslib_file *rcs)
 {
@@ -810,10 +1190,10 @@ filescan_rcs_update_rcs_delta(struct filescan_args *fsa, struct rcslib_file *rcs
 		/* date */
 		(*hashops->update)(fsa->fsa_hash_ctx, rev->date.rd_num.n_str, rev->date.rd_num.n_len);
 		/* author */
-		(*hashops->update)(fsa->fsa_hash_ctx, rev->author.i_id, rev->author.i_len);
+		(*hashops->update)(fsa->fsa_hash_ctx, rev->author->i_id, rev->author->i_len);
 		/* state */
-		if (rev->state.i_len > 0)
-			(*hashops->update)(fsa->fsa_hash_ctx, rev->state.i_id, rev->state.i_len);
+		if (rev->state->i_len > 0)
+			(*hashops->update)(fsa->fsa_hash_ctx, rev->state->i_id, rev->state->i_len);
 		/* branches */
 		for (j = 0 ; j < rev->branches.rb_count ; j++) {
 			num = &rev->branches.rb_num[j];
@@ -836,10 +1216,13 @@ filescan_rcs_update_rcs_delta(struct filescan_args *fsa, struct rcslib_file *rcs
 }
 
 bool
-filescan_rcs_update_rcs_deltatext(struct filescan_args *fsa, struct rcslib_file *rcs)
+filescan_rcs_update_rcs_deltatext(struct filescan_args *fsa, struct rcslib_file *rcs, const struct stat *st,
+				  const uint8_t *digests, bool cached)
 {
 	const struct hash_args *hashops = fsa->fsa_hash_ops;
+	struct digestfile_list *dl = fsa->fsa_digests;
 	struct rcslib_revision *rev;
+	uint32_t bsize;
 	uint8_t *cmd = fsa->fsa_cmd;
 	size_t len, i;
 
@@ -852,6 +1235,12 @@ filescan_rcs_update_rcs_deltatext(struct filescan_args *fsa, struct rcslib_file
 		rev = &rcs->delta.rd_rev[i];
 
 		len = rev->num.n_len + hashops->length + 4;
+		if (filescan_rcs_signed(fsa, rcs, rev)) {
+			bsize = rdiff_blocksize((uint64_t)rev->text.s_len);
+			len += 12;
+		} else {
+			bsize = 0;
+		}
 		if (len > fsa->fsa_cmdmax)
 			return (false);
 
@@ -864,21 +1253,23 @@ filescan_rcs_update_rcs_deltatext(struct filescan_args *fsa, struct rcslib_file
 		if (!mux_send(fsa->fsa_mux, MUX_FILECMP, rev->num.n_str, rev->num.n_len))
 			return (false);
 
-		if (!(*hashops->init)(&fsa->fsa_hash_ctx))
-			return (false);
-
-		/* log */
-		if (rev->log.s_len > 0)
-			(*hashops->update)(fsa->fsa_hash_ctx, rev->log.s_str, rev->log.s_len);
-		/* text */
-		if (rev->text.s_len > 0)
-			(*hashops->update)(fsa->fsa_hash_ctx, rev->text.s_str, rev->text.s_len);
+		if (!cached && (st != NULL))
+			digestfile_list_add(fsa->fsa_digestfile, dl, &digests[i * hashops->length]);
 
-		(*hashops->final)(fsa->fsa_hash_ctx, cmd);
-
-		if (!mux_send(fsa->fsa_mux, MUX_FILECMP, cmd, hashops->length))
+		if (!mux_send(fsa->fsa_mux, MUX_FILECMP, &digests[i * hashops->length], hashops->length))
 			return (false);
+
+		if (bsize > 0) {
+			SetDDWord(cmd, (uint64_t)rev->text.s_len);
+			SetDWord(&cmd[8], bsize);
+			if (!mux_send(fsa->fsa_mux, MUX_FILECMP, cmd, 12))
+				return (false);
+			if (!filescan_rdiff_signatures(fsa, rev->text.s_str, rev->text.s_len, bsize))
+				return (false);
+		}
 	}
+	if (!cached && (st != NULL))
+		digestfile_insert(fsa->fsa_digestfile, fsa->fsa_rpath, st, dl);
 
 	if (!mux_send(fsa->fsa_mux, MUX_FILECMP, cmde, sizeof(cmde)))
 		return (false);
@@ -886,6 +1277,28 @@ filescan_rcs_update_rcs_deltatext(struct filescan_args *fsa, struct rcslib_file
 	return (true);
 }
 
+/*
+ * Whether the deltatext of rev goes with the block signatures of its
+ * text, so that FileCmp can send a change of it as an rdiff.  Only with
+ * rcs-rdiff, as the signatures go up with every update of the file.  The
+ * head is left out: it is replaced by every commit, and sent as an edit
+ * of the old one then.
+ */
+bool
+filescan_rcs_signed(struct filescan_args *fsa, struct rcslib_file *rcs, struct rcslib_revision *rev)
+{
+	if (!fsa->fsa_rcs_rdiff || (fsa->fsa_proto < CVSYNC_PROTO(0, 29)))
+		return (false);
+	if (!(rcs->rf_flags & RCSLIB_FILE_DELTATEXT))
+		return (false);
+	if (rev->text.s_len < RDIFF_DELTATEXT_MINSIZE)
+		return (false);
+	if (rcslib_cmp_num(&rev->num, &rcs->head) == 0)
+		return (false);
+
+	return (true);
+}
+
 bool
 filescan_rcs_update_symlink(struct filescan_args *fsa)
 {
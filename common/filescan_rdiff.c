@@ -28,20 +28,14 @@ filescan_rdiff_update(struct filescan_args *fsa, struct cvsync_file *cfp)
 {
 	static const uint8_t cmds[3] = { 0x00, 0x01, FILECMP_UPDATE_RDIFF };
 	static const uint8_t cmde[3] = { 0x00, 0x01, FILECMP_UPDATE_END };
-	const struct hash_args *hashops = fsa->fsa_hash_ops;
 	struct cvsync_attr *cap = &fsa->fsa_attr;
-	uint32_t weak, bsize = RDIFF_MIN_BLOCKSIZE;
-	uint8_t *cmd = fsa->fsa_cmd, *sp, *bp;
-	size_t len;
+	uint32_t bsize;
+	uint8_t *cmd = fsa->fsa_cmd;
 
 	if (cfp->cf_size < RDIFF_MIN_BLOCKSIZE)
 		return (filescan_generic_update(fsa, cfp));
 
-	while (bsize < RDIFF_MAX_BLOCKSIZE) {
-		if (cfp->cf_size / bsize <= RDIFF_NBLOCKS)
-			break;
-		bsize *= 2;
-	}
+	bsize = rdiff_blocksize((uint64_t)cfp->cf_size);
 
 	if ((cap->ca_type != FILETYPE_FILE) && (cap->ca_type != FILETYPE_RCS) && (cap->ca_type != FILETYPE_RCS_ATTIC))
 		return (false);
@@ -54,15 +48,28 @@ filescan_rdiff_update(struct filescan_args *fsa, struct cvsync_file *cfp)
 	if (!mux_send(fsa->fsa_mux, MUX_FILECMP, cmd, 12))
 		return (false);
 
-	sp = cfp->cf_addr;
-	bp = sp + (size_t)cfp->cf_size;
+	if (!filescan_rdiff_signatures(fsa, cfp->cf_addr, (size_t)cfp->cf_size, bsize))
+		return (false);
+
+	if (!mux_send(fsa->fsa_mux, MUX_FILECMP, cmde, sizeof(cmde)))
+		return (false);
+
+	return (true);
+}
+
+bool
+filescan_rdiff_signatures(struct filescan_args *fsa, const void *addr, size_t size, uint32_t bsize)
+{
+	const struct hash_args *hashops = fsa->fsa_hash_ops;
+	const uint8_t *sp = addr, *bp = sp + size;
+	uint8_t *cmd = fsa->fsa_cmd;
+	size_t len;
 
 	while (sp < bp) {
 		if ((len = (size_t)(bp - sp)) > bsize)
 			len = bsize;
 
-		weak = rdiff_weak(sp, len);
-		SetDWord(cmd, weak);
+		SetDWord(cmd, rdiff_weak(sp, len));
 
 		if (!(*hashops->init)(&fsa->fsa_hash_ctx))
 			return (false);
@@ -75,8 +82,5 @@ filescan_rdiff_update(struct filescan_args *fsa, struct cvsync_file *cfp)
 		sp += len;
 	}
 
-	if (!mux_send(fsa->fsa_mux, MUX_FILECMP, cmde, sizeof(cmde)))
-		return (false);
-
 	return (true);
 }
@@ -11,6 +11,8 @@
 #include <string.h>
 
 #include "compat_stdbool.h"
+#include "compat_stdint.h"
+#include "compat_inttypes.h"
 #include "compat_limits.h"
 
 #include "mdirent.h"
@@ -20,6 +22,8 @@ mclosedir(struct mDIR *mdirp)
 {
 	if (mdirp->m_entries != NULL)
 		free(mdirp->m_entries);
+	if (mdirp->m_names != NULL)
+		free(mdirp->m_names);
 	free(mdirp);
 }
 
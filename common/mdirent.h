@@ -5,25 +5,38 @@
 #ifndef CVSYNC_MDIRENT_H
 #define	CVSYNC_MDIRENT_H
 
+/*
+ * Entries are kept compact: the names of a directory live in a single
+ * pool (m_names) and each entry only records what the scanners use from
+ * its stat(2) result.  md_nameoff is the offset of the name in the pool,
+ * md_name points to it once the directory has been read.
+ */
 struct mDIR {
 	void		*m_entries;
 	size_t		m_nentries, m_offset;
+	char		*m_names;
 
 	void		*m_parent;
 	size_t		m_parent_pathlen;
 };
 
 struct mdirent {
-	char		md_name[CVSYNC_NAME_MAX + 1];
-	size_t		md_namelen;
-	struct stat	md_stat;
+	char		*md_name;
+	off_t		md_size;
+	time_t		md_mtime;
+	mode_t		md_mode;
+	uint32_t	md_nameoff;
+	uint16_t	md_namelen;
 	bool		md_dead;
 };
 
 struct mdirent_rcs {
-	char		md_name[CVSYNC_NAME_MAX + 1];
-	size_t		md_namelen;
-	struct stat	md_stat;
+	char		*md_name;
+	off_t		md_size;
+	time_t		md_mtime;
+	mode_t		md_mode;
+	uint32_t	md_nameoff;
+	uint16_t	md_namelen;
 	bool		md_dead;
 
 	/* rcs specific */
@@ -32,7 +45,7 @@ struct mdirent_rcs {
 
 struct mdirent_args {
 	int		mda_errormode;
-	bool		mda_symfollow, mda_remove;
+	bool		mda_symfollow, mda_remove, mda_inodeorder;
 };
 
 void mclosedir(struct mDIR *);
@@ -9,6 +9,7 @@
 
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <pthread.h>
 #include <string.h>
@@ -26,8 +27,69 @@
 #include "logmsg.h"
 #include "mdirent.h"
 
-static pthread_mutex_t mdirent_mtx = PTHREAD_MUTEX_INITIALIZER;
+/*
+ * Entries of a large directory are stat'ed by up to MDIRENT_STAT_NTHREADS
+ * threads, each taking at least MDIRENT_STAT_MINENTS of them, so that the
+ * lookups overlap on high-latency storage.
+ */
+#define	MDIRENT_STAT_NTHREADS	(8)
+#define	MDIRENT_STAT_MINENTS	(128)
 
+/*
+ * With 'inode-order', the entries of a directory are stat'ed in the order
+ * of their inode numbers, which usually follows their place on disk.  The
+ * results are kept in the entries, which are still sorted by name.
+ */
+struct mdirent_order {
+	ino_t	mo_ino;
+	size_t	mo_index;
+};
+
+struct mdirent_list {
+	struct mdirent_rcs	*ml_entries;
+	size_t			ml_nentries, ml_max;
+	char			*ml_names;
+	size_t			ml_nameslen, ml_namesmax;
+	struct mdirent_order	*ml_order;
+	size_t			ml_ordermax;
+};
+
+struct mdirent_stat_result {
+	int	msr_lstat_errno, msr_stat_errno;
+	bool	msr_followed;
+};
+
+struct mdirent_stat_args {
+	DIR				*msa_dirp;
+	char				*msa_path;
+	size_t				msa_pathlen;
+	struct mdirent_rcs		*msa_entries;
+	const char			*msa_names;
+	const struct mdirent_order	*msa_order;
+	struct mdirent_stat_result	*msa_results;
+	size_t				msa_nentries, msa_start, msa_stride;
+	bool				msa_symfollow;
+};
+
+#if defined(AT_SYMLINK_NOFOLLOW)
+#define	MDIRENT_LSTAT(dirp, name, path, st)	\
+	fstatat(dirfd(dirp), (name), (st), AT_SYMLINK_NOFOLLOW)
+#define	MDIRENT_STAT(dirp, name, path, st)	\
+	fstatat(dirfd(dirp), (name), (st), 0)
+#else /* defined(AT_SYMLINK_NOFOLLOW) */
+#define	MDIRENT_LSTAT(dirp, name, path, st)	lstat((path), (st))
+#define	MDIRENT_STAT(dirp, name, path, st)	stat((path), (st))
+#endif /* defined(AT_SYMLINK_NOFOLLOW) */
+
+bool mopendir_rcs_read(DIR *, char *, size_t, size_t, bool,
+		       struct mdirent_args *, struct mdirent_list *, bool *);
+bool mopendir_rcs_sort(struct mdirent_list *);
+int mopendir_rcs_cmp(const void *, const void *);
+int mopendir_rcs_cmp_ino(const void *, const void *);
+bool mopendir_rcs_stat(DIR *, char *, size_t, size_t, struct mdirent_list *,
+		       size_t, const struct mdirent_order *, bool,
+		       struct mdirent_stat_result *);
+void *mopendir_rcs_stat_thread(void *);
 bool mopendir_rcs_unlink(char *, size_t, size_t, struct mdirent_rcs *);
 
 struct mDIR *
@@ -35,14 +97,22 @@ mopendir_rcs(char *path, size_t pathlen, size_t pathmax,
 	     struct mdirent_args *aux)
 {
 	struct mDIR *mdirp;
-	struct mdirent_rcs *mdp = NULL;
+	struct mdirent_rcs *mdp;
+	struct mdirent_list ml;
 	DIR *dirp;
-	struct dirent *dp;
-	char *rpath = &path[pathlen];
-	size_t rpathmax = pathmax - pathlen, namelen, max = 0, n = 0, sv_n;
+	size_t n;
 	int errormode = aux->mda_errormode;
 	bool have_attic = false;
 
+	ml.ml_entries = NULL;
+	ml.ml_nentries = 0;
+	ml.ml_max = 0;
+	ml.ml_names = NULL;
+	ml.ml_nameslen = 0;
+	ml.ml_namesmax = 0;
+	ml.ml_order = NULL;
+	ml.ml_ordermax = 0;
+
 	if ((dirp = opendir(path)) == NULL) {
 		if (errno != EACCES) {
 			logmsg_err("%s: %s", path, strerror(errno));
@@ -51,340 +121,72 @@ mopendir_rcs(char *path, size_t pathlen, size_t pathmax,
 		goto done;
 	}
 
-	if (pthread_mutex_lock(&mdirent_mtx) != 0) {
+	if (!mopendir_rcs_read(dirp, path, pathlen, pathmax, false, aux, &ml,
+			       &have_attic)) {
 		closedir(dirp);
-		return (NULL);
-	}
-
-	for (;;) {
-		errno = 0;
-		if ((dp = readdir(dirp)) == NULL) {
-			if (errno == 0)
-				break;
-			logmsg_err("%s: %s", path, strerror(errno));
-			pthread_mutex_unlock(&mdirent_mtx);
-			closedir(dirp);
-			return (NULL);
-		}
-		namelen = DIRENT_NAMLEN(dp);
-		if ((namelen == 0) || (namelen > CVSYNC_NAME_MAX) ||
-		    (rpathmax < namelen)) {
-			pthread_mutex_unlock(&mdirent_mtx);
-			closedir(dirp);
-			return (NULL);
-		}
-		if (IS_DIR_CURRENT(dp->d_name, namelen) ||
-		    IS_DIR_PARENT(dp->d_name, namelen)) {
-			continue;
-		}
-		if (IS_DIR_ATTIC(dp->d_name, namelen))
-			have_attic = true;
-		else
-			max++;
-	}
-
-	if (pthread_mutex_unlock(&mdirent_mtx) != 0) {
-		closedir(dirp);
-		return (NULL);
-	}
-
-	rewinddir(dirp);
-
-	if (max > 0) {
-		if ((mdp = malloc(max * sizeof(*mdp))) == NULL) {
-			logmsg_err("%s", strerror(errno));
-			closedir(dirp);
-			return (NULL);
-		}
-
-		if (pthread_mutex_lock(&mdirent_mtx) != 0) {
-			free(mdp);
-			closedir(dirp);
-			return (NULL);
-		}
-
-		n = 0;
-		while (n < max) {
-			errno = 0;
-			if ((dp = readdir(dirp)) == NULL) {
-				if (errno == 0)
-					break;
-				logmsg_err("%s: %s", path, strerror(errno));
-				pthread_mutex_unlock(&mdirent_mtx);
-				free(mdp);
-				closedir(dirp);
-				return (NULL);
-			}
-			namelen = DIRENT_NAMLEN(dp);
-			if (IS_DIR_ATTIC(dp->d_name, namelen) ||
-			    IS_DIR_CURRENT(dp->d_name, namelen) ||
-			    IS_DIR_PARENT(dp->d_name, namelen) ||
-			    IS_FILE_CVSLOCK(dp->d_name, namelen)) {
-				continue;
-			}
-			(void)memcpy(rpath, dp->d_name, namelen);
-			rpath[namelen] = '\0';
-			if (aux->mda_remove &&
-			    IS_FILE_TMPFILE(dp->d_name, namelen)) {
-				if (unlink(path) == 0)
-					continue;
-				if (errno == ENOENT)
-					continue;
-				logmsg_err("%s: %s", path, strerror(errno));
-				pthread_mutex_unlock(&mdirent_mtx);
-				free(mdp);
-				closedir(dirp);
-				return (NULL);
-			}
-			if (lstat(path, &mdp[n].md_stat) == -1) {
-				logmsg_err("%s: %s", path, strerror(errno));
-				pthread_mutex_unlock(&mdirent_mtx);
-				free(mdp);
-				closedir(dirp);
-				return (NULL);
-			}
-			if (!S_ISDIR(mdp[n].md_stat.st_mode) &&
-			    !S_ISREG(mdp[n].md_stat.st_mode) &&
-			    !S_ISLNK(mdp[n].md_stat.st_mode)) {
-				pthread_mutex_unlock(&mdirent_mtx);
-				free(mdp);
-				closedir(dirp);
-				return (NULL);
-			}
-			if (aux->mda_symfollow) {
-				if (stat(path, &mdp[n].md_stat) == -1) {
-					if (errno == ENOENT)
-						continue;
-					logmsg_err("%s: %s", path,
-						   strerror(errno));
-					pthread_mutex_unlock(&mdirent_mtx);
-					free(mdp);
-					closedir(dirp);
-					return (NULL);
-				}
-				if (!S_ISDIR(mdp[n].md_stat.st_mode) &&
-				    !S_ISREG(mdp[n].md_stat.st_mode)) {
-					continue;
-				}
-			}
-			if (RCS_MODE(mdp[n].md_stat.st_mode, 0) == 0)
-				continue;
-			(void)memcpy(mdp[n].md_name, dp->d_name, namelen);
-			mdp[n].md_namelen = namelen;
-			mdp[n].md_attic = false;
-			mdp[n].md_dead = false;
-			n++;
-		}
-
-		if (pthread_mutex_unlock(&mdirent_mtx) != 0) {
-			free(mdp);
-			closedir(dirp);
-			return (NULL);
-		}
+		goto fail;
 	}
 
 	if (closedir(dirp) == -1) {
 		logmsg_err("%s: %s", path, strerror(errno));
-		if (mdp != NULL)
-			free(mdp);
-		return (NULL);
+		goto fail;
 	}
 
 	if (have_attic) {
-		if (rpathmax <= 6) {
-			if (mdp != NULL)
-				free(mdp);
-			return (NULL);
-		}
-		(void)memcpy(rpath, "Attic/", 6);
-		rpath += 6;
-		rpathmax -= 6;
-		rpath[0] = '\0';
+		if (pathmax - pathlen <= 6)
+			goto fail;
+		(void)memcpy(&path[pathlen], "Attic/", 6);
+		path[pathlen + 6] = '\0';
 
 		if ((dirp = opendir(path)) == NULL) {
 			logmsg_err("%s: %s", path, strerror(errno));
-			if (mdp != NULL)
-				free(mdp);
-			return (NULL);
+			goto fail;
 		}
 
-		if (pthread_mutex_lock(&mdirent_mtx) != 0) {
-			if (mdp != NULL)
-				free(mdp);
+		if (!mopendir_rcs_read(dirp, path, pathlen + 6, pathmax, true,
+				       aux, &ml, NULL)) {
 			closedir(dirp);
-			return (NULL);
-		}
-
-		sv_n = n;
-		n = 0;
-		for (;;) {
-			errno = 0;
-			if ((dp = readdir(dirp)) == NULL) {
-				if (errno == 0)
-					break;
-				logmsg_err("%s: %s", path, strerror(errno));
-				pthread_mutex_unlock(&mdirent_mtx);
-				if (mdp != NULL)
-					free(mdp);
-				closedir(dirp);
-				return (NULL);
-			}
-			namelen = DIRENT_NAMLEN(dp);
-			if ((namelen == 0) || (namelen > CVSYNC_NAME_MAX) ||
-			    (rpathmax < namelen)) {
-				pthread_mutex_unlock(&mdirent_mtx);
-				if (mdp != NULL)
-					free(mdp);
-				closedir(dirp);
-				return (NULL);
-			}
-			if (IS_DIR_CURRENT(dp->d_name, namelen) ||
-			    IS_DIR_PARENT(dp->d_name, namelen) ||
-			    IS_FILE_TMPFILE(dp->d_name, namelen)) {
-				continue;
-			}
-			if (!IS_FILE_RCS(dp->d_name, namelen)) {
-				logmsg_err("Found an invalid file in Attic: "
-					   "%s%.*s", path, namelen,
-					   dp->d_name);
-				if (errormode == CVSYNC_ERRORMODE_ABORT) {
-					pthread_mutex_unlock(&mdirent_mtx);
-					if (mdp != NULL)
-						free(mdp);
-					closedir(dirp);
-					return (NULL);
-				}
-				continue;
-			}
-			n++;
-		}
-
-		if (pthread_mutex_unlock(&mdirent_mtx) != 0) {
-			if (mdp != NULL)
-				free(mdp);
-			closedir(dirp);
-			return (NULL);
-		}
-
-		if (n == 0) {
-			n = sv_n;
-		} else {
-			struct mdirent_rcs *newp;
-
-			rewinddir(dirp);
-
-			max += n;
-			if ((newp = malloc(max * sizeof(*newp))) == NULL) {
-				logmsg_err("%s", strerror(errno));
-				if (mdp != NULL)
-					free(mdp);
-				closedir(dirp);
-				return (NULL);
-			}
-			n = sv_n;
-			if (mdp != NULL) {
-				if (n > 0) {
-					(void)memcpy(newp, mdp,
-						     n * sizeof(*newp));
-				}
-				free(mdp);
-			}
-			mdp = newp;
-
-			if (pthread_mutex_lock(&mdirent_mtx) != 0) {
-				free(mdp);
-				closedir(dirp);
-				return (NULL);
-			}
-
-			while (n < max) {
-				errno = 0;
-				if ((dp = readdir(dirp)) == NULL) {
-					if (errno == 0)
-						break;
-					logmsg_err("%s: %s", path,
-						   strerror(errno));
-					pthread_mutex_unlock(&mdirent_mtx);
-					free(mdp);
-					closedir(dirp);
-					return (NULL);
-				}
-				namelen = DIRENT_NAMLEN(dp);
-				if (IS_DIR_CURRENT(dp->d_name, namelen) ||
-				    IS_DIR_PARENT(dp->d_name, namelen)) {
-					continue;
-				}
-				(void)memcpy(rpath, dp->d_name, namelen);
-				rpath[namelen] = '\0';
-				if (aux->mda_remove &&
-				    !IS_FILE_RCS(dp->d_name, namelen)) {
-					if (unlink(path) == 0)
-						continue;
-					if (errno == ENOENT)
-						continue;
-					logmsg_err("%s: %s", path,
-						   strerror(errno));
-					pthread_mutex_unlock(&mdirent_mtx);
-					free(mdp);
-					closedir(dirp);
-					return (NULL);
-				}
-				if (lstat(path, &mdp[n].md_stat) == -1) {
-					logmsg_err("%s: %s", path,
-						   strerror(errno));
-					pthread_mutex_unlock(&mdirent_mtx);
-					free(mdp);
-					closedir(dirp);
-					return (NULL);
-				}
-				if (!S_ISREG(mdp[n].md_stat.st_mode))
-					continue;
-				(void)memcpy(mdp[n].md_name, dp->d_name,
-					     namelen);
-				mdp[n].md_namelen = namelen;
-				mdp[n].md_attic = true;
-				mdp[n].md_dead = false;
-				n++;
-			}
-
-			if (pthread_mutex_unlock(&mdirent_mtx) != 0) {
-				free(mdp);
-				closedir(dirp);
-				return (NULL);
-			}
+			goto fail;
 		}
 
 		if (closedir(dirp) == -1) {
 			logmsg_err("%s: %s", path, strerror(errno));
-			free(mdp);
-			return (NULL);
+			goto fail;
 		}
 	}
 
-	if (n == 0) {
-		if (mdp != NULL)
-			free(mdp);
-		mdp = NULL;
+	if (ml.ml_order != NULL) {
+		free(ml.ml_order);
+		ml.ml_order = NULL;
+	}
+
+	if (ml.ml_nentries == 0) {
+		if (ml.ml_entries != NULL)
+			free(ml.ml_entries);
+		if (ml.ml_names != NULL)
+			free(ml.ml_names);
+		ml.ml_entries = NULL;
+		ml.ml_names = NULL;
+	} else {
+		if (!mopendir_rcs_sort(&ml))
+			goto fail;
 	}
 
 done:
 	if ((mdirp = malloc(sizeof(*mdirp))) == NULL) {
 		logmsg_err("%s", strerror(errno));
-		if (mdp != NULL)
-			free(mdp);
-		return (NULL);
+		goto fail;
 	}
-	mdirp->m_entries = mdp;
-	mdirp->m_nentries = n;
+	mdirp->m_entries = mdp = ml.ml_entries;
+	mdirp->m_nentries = ml.ml_nentries;
 	mdirp->m_offset = 0;
+	mdirp->m_names = ml.ml_names;
 	mdirp->m_parent = NULL;
 	mdirp->m_parent_pathlen = 0;
 
 	path[pathlen] = '\0';
 
 	if (mdirp->m_nentries > 1) {
-		qsort(mdirp->m_entries, mdirp->m_nentries, sizeof(*mdp),
-		      malphasort);
 		n = 0;
 		while (n < mdirp->m_nentries - 1) {
 			struct mdirent_rcs *m1 = &mdp[n], *m2 = &mdp[n + 1];
@@ -401,14 +203,13 @@ done:
 			if (errormode == CVSYNC_ERRORMODE_ABORT) {
 				logmsg_err("Please set 'errormode' to 'fixup' "
 					   "or 'ignore' and try again");
-				free(mdirp->m_entries);
-				free(mdirp);
+				mclosedir(mdirp);
 				return (NULL);
 			}
 
 			n += 2;
 
-			if (m1->md_stat.st_mtime < m2->md_stat.st_mtime)
+			if (m1->md_mtime < m2->md_mtime)
 				m = m1;
 			else
 				m = m2;
@@ -418,8 +219,7 @@ done:
 				continue;
 
 			if (!mopendir_rcs_unlink(path, pathlen, pathmax, m)) {
-				free(mdirp->m_entries);
-				free(mdirp);
+				mclosedir(mdirp);
 				return (NULL);
 			}
 
@@ -428,6 +228,15 @@ done:
 	}
 
 	return (mdirp);
+
+fail:
+	if (ml.ml_order != NULL)
+		free(ml.ml_order);
+	if (ml.ml_entries != NULL)
+		free(ml.ml_entries);
+	if (ml.ml_names != NULL)
+		free(ml.ml_names);
+	return (NULL);
 }
 
 bool
@@ -473,3 +282,388 @@ mopendir_rcs_unlink(char *path, size_t pathlen, size_t pathmax,
 
 	return (true);
 }
+
+/*
+ * Reads the directory in a single pass, appending its entries to the list
+ * and their names to the name pool.
+ */
+bool
+mopendir_rcs_read(DIR *dirp, char *path, size_t pathlen, size_t pathmax,
+		  bool attic, struct mdirent_args *aux, struct mdirent_list *ml,
+		  bool *have_attic)
+{
+	struct mdirent_stat_result *msr;
+	struct mdirent_order *order = NULL;
+	struct mdirent_rcs *mdp;
+	struct dirent *dp;
+	char *rpath = &path[pathlen], *names;
+	size_t rpathmax = pathmax - pathlen, namelen, max, start, n, i;
+
+	start = ml->ml_nentries;
+
+	for (;;) {
+		errno = 0;
+		if ((dp = readdir(dirp)) == NULL) {
+			if (errno == 0)
+				break;
+			logmsg_err("%s: %s", path, strerror(errno));
+			return (false);
+		}
+		namelen = DIRENT_NAMLEN(dp);
+		if ((namelen == 0) || (namelen > CVSYNC_NAME_MAX) ||
+		    (rpathmax < namelen)) {
+			return (false);
+		}
+		if (IS_DIR_CURRENT(dp->d_name, namelen) ||
+		    IS_DIR_PARENT(dp->d_name, namelen)) {
+			continue;
+		}
+		if (!attic) {
+			if (IS_DIR_ATTIC(dp->d_name, namelen)) {
+				*have_attic = true;
+				continue;
+			}
+			if (IS_FILE_CVSLOCK(dp->d_name, namelen))
+				continue;
+		}
+
+		(void)memcpy(rpath, dp->d_name, namelen);
+		rpath[namelen] = '\0';
+
+		if (IS_FILE_TMPFILE(dp->d_name, namelen)) {
+			if (aux->mda_remove) {
+				if ((unlink(path) == -1) && (errno != ENOENT)) {
+					logmsg_err("%s: %s", path,
+						   strerror(errno));
+					return (false);
+				}
+				continue;
+			}
+			if (attic)
+				continue;
+		}
+		if (attic && !IS_FILE_RCS(dp->d_name, namelen)) {
+			logmsg_err("Found an invalid file in Attic: %s", path);
+			if (aux->mda_errormode == CVSYNC_ERRORMODE_ABORT)
+				return (false);
+			if (aux->mda_remove) {
+				if ((unlink(path) == -1) && (errno != ENOENT)) {
+					logmsg_err("%s: %s", path,
+						   strerror(errno));
+					return (false);
+				}
+			}
+			continue;
+		}
+
+		if (ml->ml_nentries == ml->ml_max) {
+			if ((max = ml->ml_max * 2) == 0)
+				max = 64;
+			mdp = realloc(ml->ml_entries, max * sizeof(*mdp));
+			if (mdp == NULL) {
+				logmsg_err("%s", strerror(errno));
+				return (false);
+			}
+			ml->ml_entries = mdp;
+			ml->ml_max = max;
+		}
+		if (ml->ml_namesmax - ml->ml_nameslen <= namelen) {
+			if ((max = ml->ml_namesmax * 2) == 0)
+				max = 1024;
+			while (max - ml->ml_nameslen <= namelen)
+				max *= 2;
+			if (max > UINT32_MAX) {
+				logmsg_err("%s: %s", path, strerror(ENOMEM));
+				return (false);
+			}
+			if ((names = realloc(ml->ml_names, max)) == NULL) {
+				logmsg_err("%s", strerror(errno));
+				return (false);
+			}
+			ml->ml_names = names;
+			ml->ml_namesmax = max;
+		}
+		if (aux->mda_inodeorder) {
+			n = ml->ml_nentries - start;
+			if (n == ml->ml_ordermax) {
+				if ((max = ml->ml_ordermax * 2) == 0)
+					max = 64;
+				order = realloc(ml->ml_order,
+						max * sizeof(*order));
+				if (order == NULL) {
+					logmsg_err("%s", strerror(errno));
+					return (false);
+				}
+				ml->ml_order = order;
+				ml->ml_ordermax = max;
+			}
+			ml->ml_order[n].mo_ino = dp->d_ino;
+			ml->ml_order[n].mo_index = n;
+		}
+		mdp = &ml->ml_entries[ml->ml_nentries++];
+
+		(void)memcpy(&ml->ml_names[ml->ml_nameslen], dp->d_name,
+			     namelen);
+		ml->ml_names[ml->ml_nameslen + namelen] = '\0';
+		mdp->md_name = NULL;
+		mdp->md_nameoff = (uint32_t)ml->ml_nameslen;
+		mdp->md_namelen = (uint16_t)namelen;
+		mdp->md_attic = attic;
+		mdp->md_dead = false;
+		ml->ml_nameslen += namelen + 1;
+	}
+
+	if (ml->ml_nentries == start)
+		return (true);
+
+	if ((msr = malloc((ml->ml_nentries - start) * sizeof(*msr))) == NULL) {
+		logmsg_err("%s", strerror(errno));
+		return (false);
+	}
+
+	if (aux->mda_inodeorder) {
+		order = ml->ml_order;
+		qsort(order, ml->ml_nentries - start, sizeof(*order),
+		      mopendir_rcs_cmp_ino);
+	}
+
+	/* Attic entries are never followed. */
+	if (!mopendir_rcs_stat(dirp, path, pathlen, pathmax, ml, start, order,
+			       aux->mda_symfollow && !attic, msr)) {
+		free(msr);
+		return (false);
+	}
+
+	n = start;
+	for (i = start ; i < ml->ml_nentries ; i++) {
+		struct mdirent_stat_result *r = &msr[i - start];
+
+		mdp = &ml->ml_entries[i];
+		(void)memcpy(rpath, &ml->ml_names[mdp->md_nameoff],
+			     (size_t)mdp->md_namelen + 1);
+
+		if (r->msr_lstat_errno != 0) {
+			logmsg_err("%s: %s", path,
+				   strerror(r->msr_lstat_errno));
+			free(msr);
+			return (false);
+		}
+		if (attic) {
+			if (!S_ISREG(mdp->md_mode))
+				continue;
+		} else {
+			if (r->msr_stat_errno != 0) {
+				if (r->msr_stat_errno == ENOENT)
+					continue;
+				logmsg_err("%s: %s", path,
+					   strerror(r->msr_stat_errno));
+				free(msr);
+				return (false);
+			}
+			if (r->msr_followed) {
+				if (!S_ISDIR(mdp->md_mode) &&
+				    !S_ISREG(mdp->md_mode)) {
+					continue;
+				}
+			} else {
+				if (!S_ISDIR(mdp->md_mode) &&
+				    !S_ISREG(mdp->md_mode) &&
+				    !S_ISLNK(mdp->md_mode)) {
+					free(msr);
+					return (false);
+				}
+			}
+			if (RCS_MODE(mdp->md_mode, 0) == 0)
+				continue;
+		}
+
+		if (n != i)
+			ml->ml_entries[n] = *mdp;
+		n++;
+	}
+	ml->ml_nentries = n;
+
+	free(msr);
+
+	return (true);
+}
+
+/*
+ * Resolves the names and puts the entries in name order.  Only an index
+ * is sorted; the entries are then moved once to their final place.
+ */
+bool
+mopendir_rcs_sort(struct mdirent_list *ml)
+{
+	struct mdirent_rcs **index, *entries;
+	size_t n = ml->ml_nentries, i;
+
+	for (i = 0 ; i < n ; i++) {
+		ml->ml_entries[i].md_name =
+			&ml->ml_names[ml->ml_entries[i].md_nameoff];
+	}
+
+	if (n == 1)
+		return (true);
+
+	if ((index = malloc(n * sizeof(*index))) == NULL) {
+		logmsg_err("%s", strerror(errno));
+		return (false);
+	}
+	if ((entries = malloc(n * sizeof(*entries))) == NULL) {
+		logmsg_err("%s", strerror(errno));
+		free(index);
+		return (false);
+	}
+
+	for (i = 0 ; i < n ; i++)
+		index[i] = &ml->ml_entries[i];
+	qsort(index, n, sizeof(*index), mopendir_rcs_cmp);
+	for (i = 0 ; i < n ; i++)
+		entries[i] = *index[i];
+
+	free(index);
+	free(ml->ml_entries);
+	ml->ml_entries = entries;
+	ml->ml_max = n;
+
+	return (true);
+}
+
+int
+mopendir_rcs_cmp(const void *p1, const void *p2)
+{
+	const struct mdirent_rcs * const *mdp1 = p1, * const *mdp2 = p2;
+
+	return (malphasort(*mdp1, *mdp2));
+}
+
+int
+mopendir_rcs_cmp_ino(const void *p1, const void *p2)
+{
+	const struct mdirent_order *mo1 = p1, *mo2 = p2;
+
+	if (mo1->mo_ino < mo2->mo_ino)
+		return (-1);
+	if (mo1->mo_ino > mo2->mo_ino)
+		return (1);
+	return (0);
+}
+
+bool
+mopendir_rcs_stat(DIR *dirp, char *path, size_t pathlen, size_t pathmax,
+		  struct mdirent_list *ml, size_t start,
+		  const struct mdirent_order *order, bool symfollow,
+		  struct mdirent_stat_result *msr)
+{
+	struct mdirent_stat_args msa[MDIRENT_STAT_NTHREADS];
+	pthread_t th[MDIRENT_STAT_NTHREADS];
+	char *buf = NULL;
+	size_t n = ml->ml_nentries - start, nthreads, i;
+	bool created[MDIRENT_STAT_NTHREADS];
+
+	if ((nthreads = n / MDIRENT_STAT_MINENTS) > MDIRENT_STAT_NTHREADS)
+		nthreads = MDIRENT_STAT_NTHREADS;
+	if (nthreads == 0)
+		nthreads = 1;
+
+#if !defined(AT_SYMLINK_NOFOLLOW)
+	if (nthreads > 1) {
+		if ((buf = malloc(nthreads * pathmax)) == NULL) {
+			logmsg_err("%s", strerror(errno));
+			return (false);
+		}
+	}
+#endif /* !defined(AT_SYMLINK_NOFOLLOW) */
+
+	for (i = 0 ; i < nthreads ; i++) {
+		msa[i].msa_dirp = dirp;
+		if (buf != NULL) {
+			msa[i].msa_path = &buf[i * pathmax];
+			(void)memcpy(msa[i].msa_path, path, pathlen);
+		} else {
+			msa[i].msa_path = path;
+		}
+		msa[i].msa_pathlen = pathlen;
+		msa[i].msa_entries = &ml->ml_entries[start];
+		msa[i].msa_names = ml->ml_names;
+		msa[i].msa_order = order;
+		msa[i].msa_results = msr;
+		msa[i].msa_nentries = n;
+		msa[i].msa_start = i;
+		msa[i].msa_stride = nthreads;
+		msa[i].msa_symfollow = symfollow;
+		created[i] = false;
+	}
+
+	for (i = 1 ; i < nthreads ; i++) {
+		if (pthread_create(&th[i], NULL, mopendir_rcs_stat_thread,
+				   &msa[i]) == 0) {
+			created[i] = true;
+		}
+	}
+
+	mopendir_rcs_stat_thread(&msa[0]);
+
+	for (i = 1 ; i < nthreads ; i++) {
+		if (created[i])
+			pthread_join(th[i], NULL);
+		else
+			mopendir_rcs_stat_thread(&msa[i]);
+	}
+
+	if (buf != NULL)
+		free(buf);
+
+	return (true);
+}
+
+void *
+mopendir_rcs_stat_thread(void *arg)
+{
+	struct mdirent_stat_args *msa = arg;
+	struct mdirent_stat_result *r;
+	struct mdirent_rcs *mdp;
+	struct stat st;
+	const char *name;
+	size_t i, idx;
+
+	for (i = msa->msa_start ;
+	     i < msa->msa_nentries ;
+	     i += msa->msa_stride) {
+		if (msa->msa_order != NULL)
+			idx = msa->msa_order[i].mo_index;
+		else
+			idx = i;
+		mdp = &msa->msa_entries[idx];
+		r = &msa->msa_results[idx];
+		r->msr_lstat_errno = 0;
+		r->msr_stat_errno = 0;
+		r->msr_followed = false;
+
+		name = &msa->msa_names[mdp->md_nameoff];
+#if !defined(AT_SYMLINK_NOFOLLOW)
+		(void)memcpy(&msa->msa_path[msa->msa_pathlen], name,
+			     (size_t)mdp->md_namelen + 1);
+#endif /* !defined(AT_SYMLINK_NOFOLLOW) */
+
+		if (MDIRENT_LSTAT(msa->msa_dirp, name, msa->msa_path,
+				  &st) == -1) {
+			r->msr_lstat_errno = errno;
+			continue;
+		}
+		if (msa->msa_symfollow && S_ISLNK(st.st_mode)) {
+			if (MDIRENT_STAT(msa->msa_dirp, name, msa->msa_path,
+					 &st) == -1) {
+				r->msr_stat_errno = errno;
+				continue;
+			}
+			r->msr_followed = true;
+		}
+		mdp->md_mode = st.st_mode;
+		mdp->md_size = st.st_size;
+		mdp->md_mtime = st.st_mtime;
+	}
+
+	return (NULL);
+}
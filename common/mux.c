@@ -24,6 +24,7 @@
 #include "network.h"
 
 bool mux_reset(struct mux *, struct muxbuf *, uint8_t);
+bool mux_hold_send(struct mux *, uint8_t, const void *, size_t);
 
 struct mux *
 mux_init(int sock, uint16_t mss, int compression, int level)
@@ -79,6 +80,11 @@ mux_init(int sock, uint16_t mss, int compression, int level)
 			mx->mx_state[i][j] = false;
 		}
 	}
+	for (i = 0 ; i < MUX_MAXCHANNELS ; i++) {
+		mx->mx_hold[i].mxh_buffer = NULL;
+		mx->mx_hold[i].mxh_active = false;
+		mx->mx_hold[i].mxh_spilled = false;
+	}
 
 	for (i = 0 ; i < MUX_MAXCHANNELS ; i++) {
 		if (!muxbuf_init(&mx->mx_buffer[MUX_IN][i], mss, bufsize, compression)) {
@@ -103,6 +109,7 @@ mux_destroy(struct mux *mx)
 		muxbuf_destroy(&mx->mx_buffer[MUX_IN][i]);
 		if (mx->mx_buffer[MUX_OUT][i].mxb_state != MUX_STATE_INIT)
 			muxbuf_destroy(&mx->mx_buffer[MUX_OUT][i]);
+		free(mx->mx_hold[i].mxh_buffer);
 	}
 	if ((err = pthread_cond_destroy(&mx->mx_wait)) != 0)
 		logmsg_err("Mux Error: cond destroy: %s", strerror(err));
@@ -242,6 +249,9 @@ mux_send(struct mux *mx, uint8_t chnum, const void *buffer, size_t bufsize)
 	size_t len;
 	int err;
 
+	if (mx->mx_hold[chnum].mxh_active)
+		return (mux_hold_send(mx, chnum, buffer, bufsize));
+
 	if ((err = pthread_mutex_lock(&mxb->mxb_lock)) != 0) {
 		logmsg_err("Mux(SEND) Error: mutex lock: %s", strerror(err));
 		return (false);
@@ -422,6 +432,108 @@ mux_send(struct mux *mx, uint8_t chnum, const void *buffer, size_t bufsize)
 	return (true);
 }
 
+/*
+ * Holds back what is sent on chnum from now on, so that the sender can
+ * see how many bytes it would have sent before it decides whether they
+ * are sent at all.  Once more than limit bytes are held, they are sent
+ * and so is the rest, leaving only mux_release() without discard.  The
+ * channel is used by a single thread.
+ */
+bool
+mux_hold(struct mux *mx, uint8_t chnum, size_t limit)
+{
+	struct muxhold *mxh = &mx->mx_hold[chnum];
+
+	if (mxh->mxh_active) {
+		logmsg_err("Mux(HOLD) Error: already held: %u", chnum);
+		return (false);
+	}
+
+	mxh->mxh_length = 0;
+	mxh->mxh_size = 0;
+	mxh->mxh_limit = limit;
+	mxh->mxh_count = 0;
+	mxh->mxh_active = true;
+	mxh->mxh_spilled = false;
+
+	return (true);
+}
+
+uint64_t
+mux_held(struct mux *mx, uint8_t chnum)
+{
+	return (mx->mx_hold[chnum].mxh_count);
+}
+
+/* Sends what has been held back, or throws it away with discard. */
+bool
+mux_release(struct mux *mx, uint8_t chnum, bool discard)
+{
+	struct muxhold *mxh = &mx->mx_hold[chnum];
+	bool rv = true;
+
+	if (mxh->mxh_spilled) {
+		mxh->mxh_spilled = false;
+		if (discard) {
+			logmsg_err("Mux(RELEASE) Error: already sent: %u", chnum);
+			return (false);
+		}
+		return (true);
+	}
+	if (!mxh->mxh_active) {
+		logmsg_err("Mux(RELEASE) Error: not held: %u", chnum);
+		return (false);
+	}
+	mxh->mxh_active = false;
+
+	if (!discard && (mxh->mxh_length > 0))
+		rv = mux_send(mx, chnum, mxh->mxh_buffer, mxh->mxh_length);
+
+	free(mxh->mxh_buffer);
+	mxh->mxh_buffer = NULL;
+
+	return (rv);
+}
+
+bool
+mux_hold_send(struct mux *mx, uint8_t chnum, const void *buffer, size_t bufsize)
+{
+	struct muxhold *mxh = &mx->mx_hold[chnum];
+	uint8_t *newbuf;
+	size_t size;
+
+	if ((mxh->mxh_count += bufsize) > mxh->mxh_limit) {
+		mxh->mxh_active = false;
+		mxh->mxh_spilled = true;
+		if ((mxh->mxh_length > 0) && !mux_send(mx, chnum, mxh->mxh_buffer, mxh->mxh_length))
+			return (false);
+		free(mxh->mxh_buffer);
+		mxh->mxh_buffer = NULL;
+		mxh->mxh_length = mxh->mxh_size = 0;
+		return (mux_send(mx, chnum, buffer, bufsize));
+	}
+
+	if (mxh->mxh_length + bufsize > mxh->mxh_size) {
+		if ((size = mxh->mxh_size) == 0)
+			size = MUX_MAX_BUFSIZE;
+		while (size < mxh->mxh_length + bufsize)
+			size *= 2;
+		if (size > mxh->mxh_limit)
+			size = mxh->mxh_limit;
+		if ((newbuf = realloc(mxh->mxh_buffer, size)) == NULL) {
+			logmsg_err("Mux(HOLD) Error: %s", strerror(errno));
+			return (false);
+		}
+		mxh->mxh_buffer = newbuf;
+		mxh->mxh_size = size;
+	}
+
+	(void)memcpy(&mxh->mxh_buffer[mxh->mxh_length], buffer, bufsize);
+	mxh->mxh_length += bufsize;
+
+	return (true);
+}
+
 bool
 mux_recv(struct mux *mx, uint8_t chnum, void *buffer, size_t bufsize)
 {
@@ -54,9 +54,17 @@ struct muxbuf {
 	pthread_cond_t	mxb_wait_in, mxb_wait_out;
 };
 
+struct muxhold {
+	uint8_t		*mxh_buffer;
+	size_t		mxh_length, mxh_size, mxh_limit;
+	uint64_t	mxh_count;
+	bool		mxh_active, mxh_spilled;
+};
+
 struct mux {
 	int		mx_socket;
 	struct muxbuf	mx_buffer[2][MUX_MAXCHANNELS];
+	struct muxhold	mx_hold[MUX_MAXCHANNELS];
 	uint8_t		mx_recvcmd[MUX_MAXCMDLEN];
 	bool		mx_state[2][MUX_MAXCHANNELS];
 
@@ -78,6 +86,9 @@ void muxbuf_destroy(struct muxbuf *);
 bool mux_send(struct mux *, uint8_t, const void *, size_t);
 bool mux_recv(struct mux *, uint8_t, void *, size_t);
 bool mux_flush(struct mux *, uint8_t);
+bool mux_hold(struct mux *, uint8_t, size_t);
+uint64_t mux_held(struct mux *, uint8_t);
+bool mux_release(struct mux *, uint8_t, bool);
 bool mux_close_in(struct mux *, uint8_t);
 bool mux_close_out(struct mux *, uint8_t);
 void mux_abort(struct mux *);
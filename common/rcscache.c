@@ -0,0 +1,369 @@
+/*-
+ * This software is released under the BSD License, see LICENSE.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <stdlib.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "compat_stdbool.h"
+#include "compat_stdint.h"
+#include "compat_inttypes.h"
+#include "compat_limits.h"
+
+#include "cvsync.h"
+#include "hash.h"
+#include "logmsg.h"
+#include "rcslib.h"
+#include "rcscache.h"
+
+/*
+ * Parsed RCS files are shared by all sessions of the daemon, keyed by
+ * (dev, inode, size, mtime) of the file.  Every entry owns a private
+ * mapping of the file, which the rcslib_file points into, and is never
+ * modified once it is visible, apart from the deltatext digests which
+ * are added for each hash type on first use.  Unreferenced entries are
+ * evicted in LRU order once rcscache_size bytes are accounted for.
+ */
+#define	RCSCACHE_NBUCKETS	(4096)
+
+struct rcscache_digest {
+	struct rcscache_digest	*cd_next;
+	const struct hash_args	*cd_hashops;
+	uint8_t			cd_digests[1];
+};
+
+struct rcscache_entry *rcscache_lookup(dev_t, ino_t);
+void rcscache_unlink(struct rcscache_entry *);
+void rcscache_touch(struct rcscache_entry *);
+void rcscache_lru_insert(struct rcscache_entry *);
+void rcscache_lru_remove(struct rcscache_entry *);
+void rcscache_evict(void);
+void rcscache_free(struct rcscache_entry *);
+struct rcslib_file *rcscache_parse(struct rcscache_entry *, void *, struct cvsync_file *, const struct hash_args *);
+
+static struct rcscache_entry **rcscache_table = NULL;
+static struct rcscache_entry *rcscache_lru_head = NULL, *rcscache_lru_tail = NULL;
+static size_t rcscache_size = 0, rcscache_used = 0;
+
+static pthread_mutex_t rcscache_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+#define	RCSCACHE_BUCKET(dev, ino)	\
+	(rcscache_table[((size_t)(dev) * 31 + (size_t)(ino)) % RCSCACHE_NBUCKETS])
+
+bool
+rcscache_init(size_t sz)
+{
+	if (sz == 0)
+		return (true);
+
+	if ((rcscache_table = malloc(RCSCACHE_NBUCKETS * sizeof(*rcscache_table))) == NULL) {
+		logmsg_err("RCS cache: %s", strerror(errno));
+		return (false);
+	}
+	(void)memset(rcscache_table, 0, RCSCACHE_NBUCKETS * sizeof(*rcscache_table));
+	rcscache_size = sz;
+
+	return (true);
+}
+
+void
+rcscache_destroy(void)
+{
+	struct rcscache_entry *ce;
+
+	if (rcscache_table == NULL)
+		return;
+
+	while ((ce = rcscache_lru_head) != NULL) {
+		rcscache_unlink(ce);
+		if (ce->ce_refcnt == 0)
+			rcscache_free(ce);
+	}
+
+	free(rcscache_table);
+	rcscache_table = NULL;
+	rcscache_size = 0;
+}
+
+struct rcscache_entry *
+rcscache_get(struct cvsync_file *cfp, const struct hash_args *hashops)
+{
+	struct rcscache_entry *ce, *old;
+	struct stat st;
+	void *addr;
+
+	if (cfp->cf_size == 0)
+		return (NULL);
+	if (fstat(cfp->cf_fileno, &st) == -1)
+		return (NULL);
+
+	if (rcscache_table != NULL) {
+		pthread_mutex_lock(&rcscache_mtx);
+		if ((ce = rcscache_lookup(st.st_dev, st.st_ino)) != NULL) {
+			if ((ce->ce_size == st.st_size) && (ce->ce_mtime == st.st_mtime)) {
+				ce->ce_refcnt++;
+				rcscache_touch(ce);
+				pthread_mutex_unlock(&rcscache_mtx);
+				return (ce);
+			}
+			rcscache_unlink(ce);
+			if (ce->ce_refcnt == 0)
+				rcscache_free(ce);
+		}
+		pthread_mutex_unlock(&rcscache_mtx);
+	}
+
+	if ((ce = malloc(sizeof(*ce))) == NULL) {
+		logmsg_err("RCS cache: %s", strerror(errno));
+		return (NULL);
+	}
+	ce->ce_dev = st.st_dev;
+	ce->ce_ino = st.st_ino;
+	ce->ce_size = st.st_size;
+	ce->ce_mtime = st.st_mtime;
+	ce->ce_memsize = 0;
+	ce->ce_digests = NULL;
+	ce->ce_refcnt = 1;
+	ce->ce_cached = false;
+
+	if ((rcscache_table == NULL) || ((uint64_t)cfp->cf_size > rcscache_size)) {
+		/* Not to be shared, so the caller's mapping will do. */
+		ce->ce_addr = NULL;
+		ce->ce_msize = 0;
+		if ((ce->ce_rcs = rcscache_parse(ce, cfp->cf_addr, cfp, hashops)) == NULL) {
+			free(ce);
+			return (NULL);
+		}
+		return (ce);
+	}
+
+	ce->ce_msize = (size_t)cfp->cf_size;
+	addr = mmap(NULL, ce->ce_msize, PROT_READ, MAP_PRIVATE, cfp->cf_fileno, (off_t)0);
+	if (addr == MAP_FAILED) {
+		logmsg_err("RCS cache: %s", strerror(errno));
+		free(ce);
+		return (NULL);
+	}
+	ce->ce_addr = addr;
+	if ((ce->ce_rcs = rcscache_parse(ce, ce->ce_addr, cfp, hashops)) == NULL) {
+		(void)munmap(ce->ce_addr, ce->ce_msize);
+		free(ce);
+		return (NULL);
+	}
+	ce->ce_memsize = ce->ce_msize + rcslib_memsize(ce->ce_rcs);
+	ce->ce_memsize += ce->ce_rcs->delta.rd_count * hashops->length;
+	if (ce->ce_memsize > rcscache_size)
+		return (ce);
+
+	pthread_mutex_lock(&rcscache_mtx);
+	if ((old = rcscache_lookup(ce->ce_dev, ce->ce_ino)) != NULL) {
+		/* Another session has parsed the same file meanwhile. */
+		if ((old->ce_size == ce->ce_size) && (old->ce_mtime == ce->ce_mtime)) {
+			old->ce_refcnt++;
+			rcscache_touch(old);
+			pthread_mutex_unlock(&rcscache_mtx);
+			rcscache_free(ce);
+			return (old);
+		}
+		rcscache_unlink(old);
+		if (old->ce_refcnt == 0)
+			rcscache_free(old);
+	}
+	ce->ce_cached = true;
+	ce->ce_next = RCSCACHE_BUCKET(ce->ce_dev, ce->ce_ino);
+	RCSCACHE_BUCKET(ce->ce_dev, ce->ce_ino) = ce;
+	rcscache_lru_insert(ce);
+	rcscache_used += ce->ce_memsize;
+	rcscache_evict();
+	pthread_mutex_unlock(&rcscache_mtx);
+
+	return (ce);
+}
+
+void
+rcscache_put(struct rcscache_entry *ce)
+{
+	pthread_mutex_lock(&rcscache_mtx);
+	if ((--ce->ce_refcnt > 0) || ce->ce_cached) {
+		if (ce->ce_cached)
+			rcscache_evict();
+		pthread_mutex_unlock(&rcscache_mtx);
+		return;
+	}
+	pthread_mutex_unlock(&rcscache_mtx);
+
+	rcscache_free(ce);
+}
+
+const uint8_t *
+rcscache_digests(struct rcscache_entry *ce, const struct hash_args *hashops)
+{
+	struct rcscache_digest *cd, *dup;
+	struct rcslib_file *rcs = ce->ce_rcs;
+	size_t len;
+
+	pthread_mutex_lock(&rcscache_mtx);
+	for (cd = ce->ce_digests ; cd != NULL ; cd = cd->cd_next) {
+		if (cd->cd_hashops == hashops)
+			break;
+	}
+	pthread_mutex_unlock(&rcscache_mtx);
+	if (cd != NULL)
+		return (cd->cd_digests);
+
+	len = rcs->delta.rd_count * hashops->length;
+	if ((cd = malloc(sizeof(*cd) + len)) == NULL)
+		return (NULL);
+	cd->cd_hashops = hashops;
+	if (!rcslib_digest_deltatext(rcs, hashops, cd->cd_digests)) {
+		free(cd);
+		return (NULL);
+	}
+
+	pthread_mutex_lock(&rcscache_mtx);
+	for (dup = ce->ce_digests ; dup != NULL ; dup = dup->cd_next) {
+		if (dup->cd_hashops == hashops)
+			break;
+	}
+	if (dup != NULL) {
+		pthread_mutex_unlock(&rcscache_mtx);
+		free(cd);
+		return (dup->cd_digests);
+	}
+	cd->cd_next = ce->ce_digests;
+	ce->ce_digests = cd;
+	if (ce->ce_cached) {
+		ce->ce_memsize += len;
+		rcscache_used += len;
+	}
+	pthread_mutex_unlock(&rcscache_mtx);
+
+	return (cd->cd_digests);
+}
+
+/*
+ * The digests for hashops are computed along with the deltatext section,
+ * which for a large file is read without faulting in the mapping.
+ */
+struct rcslib_file *
+rcscache_parse(struct rcscache_entry *ce, void *addr, struct cvsync_file *cfp, const struct hash_args *hashops)
+{
+	struct rcscache_digest *cd;
+	struct rcslib_file *rcs;
+
+	if ((rcs = rcslib_init_lazy(addr, cfp->cf_size)) == NULL)
+		return (NULL);
+
+	if ((cd = malloc(sizeof(*cd) + rcs->delta.rd_count * hashops->length)) == NULL) {
+		logmsg_err("RCS cache: %s", strerror(errno));
+		rcslib_destroy(rcs);
+		return (NULL);
+	}
+	cd->cd_hashops = hashops;
+	if (!rcslib_load_deltatext_fd(rcs, cfp->cf_fileno, hashops, cd->cd_digests)) {
+		free(cd);
+		rcslib_destroy(rcs);
+		return (NULL);
+	}
+	cd->cd_next = NULL;
+	ce->ce_digests = cd;
+
+	return (rcs);
+}
+
+struct rcscache_entry *
+rcscache_lookup(dev_t dev, ino_t ino)
+{
+	struct rcscache_entry *ce;
+
+	for (ce = RCSCACHE_BUCKET(dev, ino) ; ce != NULL ; ce = ce->ce_next) {
+		if ((ce->ce_dev == dev) && (ce->ce_ino == ino))
+			return (ce);
+	}
+
+	return (NULL);
+}
+
+void
+rcscache_unlink(struct rcscache_entry *ce)
+{
+	struct rcscache_entry **cep;
+
+	for (cep = &RCSCACHE_BUCKET(ce->ce_dev, ce->ce_ino) ; *cep != ce ; cep = &(*cep)->ce_next)
+		continue;
+	*cep = ce->ce_next;
+
+	rcscache_lru_remove(ce);
+	rcscache_used -= ce->ce_memsize;
+	ce->ce_cached = false;
+}
+
+void
+rcscache_touch(struct rcscache_entry *ce)
+{
+	if (ce == rcscache_lru_head)
+		return;
+	rcscache_lru_remove(ce);
+	rcscache_lru_insert(ce);
+}
+
+void
+rcscache_lru_insert(struct rcscache_entry *ce)
+{
+	ce->ce_lru_prev = NULL;
+	if ((ce->ce_lru_next = rcscache_lru_head) != NULL)
+		rcscache_lru_head->ce_lru_prev = ce;
+	else
+		rcscache_lru_tail = ce;
+	rcscache_lru_head = ce;
+}
+
+void
+rcscache_lru_remove(struct rcscache_entry *ce)
+{
+	if (ce->ce_lru_prev != NULL)
+		ce->ce_lru_prev->ce_lru_next = ce->ce_lru_next;
+	else
+		rcscache_lru_head = ce->ce_lru_next;
+	if (ce->ce_lru_next != NULL)
+		ce->ce_lru_next->ce_lru_prev = ce->ce_lru_prev;
+	else
+		rcscache_lru_tail = ce->ce_lru_prev;
+}
+
+void
+rcscache_evict(void)
+{
+	struct rcscache_entry *ce, *prev;
+
+	for (ce = rcscache_lru_tail ; (ce != NULL) && (rcscache_used > rcscache_size) ; ce = prev) {
+		prev = ce->ce_lru_prev;
+		if (ce->ce_refcnt > 0)
+			continue;
+		rcscache_unlink(ce);
+		rcscache_free(ce);
+	}
+}
+
+void
+rcscache_free(struct rcscache_entry *ce)
+{
+	struct rcscache_digest *cd;
+
+	while ((cd = ce->ce_digests) != NULL) {
+		ce->ce_digests = cd->cd_next;
+		free(cd);
+	}
+	rcslib_destroy(ce->ce_rcs);
+	if (ce->ce_addr != NULL)
+		(void)munmap(ce->ce_addr, ce->ce_msize);
+	free(ce);
+}
@@ -0,0 +1,34 @@
+/*-
+ * This software is released under the BSD License, see LICENSE.
+ */
+
+#ifndef CVSYNC_RCSCACHE_H
+#define	CVSYNC_RCSCACHE_H
+
+struct cvsync_file;
+struct hash_args;
+struct rcscache_digest;
+struct rcslib_file;
+
+struct rcscache_entry {
+	struct rcscache_entry	*ce_next;
+	struct rcscache_entry	*ce_lru_prev, *ce_lru_next;
+	dev_t			ce_dev;
+	ino_t			ce_ino;
+	off_t			ce_size;
+	time_t			ce_mtime;
+	void			*ce_addr;
+	size_t			ce_msize, ce_memsize;
+	struct rcslib_file	*ce_rcs;
+	struct rcscache_digest	*ce_digests;
+	size_t			ce_refcnt;
+	bool			ce_cached;
+};
+
+bool rcscache_init(size_t);
+void rcscache_destroy(void);
+struct rcscache_entry *rcscache_get(struct cvsync_file *, const struct hash_args *);
+void rcscache_put(struct rcscache_entry *);
+const uint8_t *rcscache_digests(struct rcscache_entry *, const struct hash_args *);
+
+#endif /* CVSYNC_RCSCACHE_H */
@@ -2,19 +2,26 @@
  * This software is released under the BSD License, see LICENSE.
  */
 
+#if defined(HAVE_COPY_FILE_RANGE) && defined(__linux__)
+#define	_GNU_SOURCE
+#endif /* defined(HAVE_COPY_FILE_RANGE) && defined(__linux__) */
+
 #include <sys/types.h>
 #include <sys/uio.h>
 
 #include <stdlib.h>
 
 #include <ctype.h>
+#include <errno.h>
 #include <limits.h>
 #include <string.h>
-#include <time.h>
+#include <unistd.h>
 
 #include "compat_stdbool.h"
 #include "compat_stdint.h"
+#include "compat_inttypes.h"
 
+#include "hash.h"
 #include "rcslib.h"
 
 struct rcs_keyword {
@@ -73,12 +80,77 @@ enum {
 			break;		\
 	}
 
-#define	IS_RCS_IDCHAR(p)					\
-	(isalnum((int)(p)) ||					\
-	(strchr("!\"#%&'()*+-/<=>?[\\]^_`{|}~", (p)) != NULL))
+#define	IS_RCS_IDCHAR(p)	(rcs_idchars[(uint8_t)(p)] != 0)
+
+/* isalnum() and "!\"#%&'()*+-/<=>?[\\]^_`{|}~" */
+static const uint8_t rcs_idchars[256] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,	/* 0x00 */
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,	/* 0x10 */
+	0, 1, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 0, 1, 0, 1,	/* 0x20 */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 1, 1, 1, 1,	/* 0x30 */
+	0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	/* 0x40 */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	/* 0x50 */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	/* 0x60 */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0,	/* 0x70 */
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,	/* 0x80 */
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,	/* 0x90 */
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,	/* 0xa0 */
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,	/* 0xb0 */
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,	/* 0xc0 */
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,	/* 0xd0 */
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,	/* 0xe0 */
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0	/* 0xf0 */
+};
+
+/*
+ * Everything parsed from a file is allocated from a list of chunks which
+ * rcslib_destroy() frees at once.
+ */
+struct rcslib_chunk {
+	struct rcslib_chunk	*rc_next;
+	size_t			rc_size, rc_used;
+};
+#define	RCSLIB_ALIGN(n)		(((n) + 7) & ~(size_t)7)
+#define	RCSLIB_CHUNK_HDRLEN	RCSLIB_ALIGN(sizeof(struct rcslib_chunk))
+#define	RCSLIB_CHUNK_DATA(rc)	((char *)(rc) + RCSLIB_CHUNK_HDRLEN)
+#define	RCSLIB_CHUNK_SIZE	(16384)
+
+/* authors and states are shared by the revisions */
+struct rcslib_ident {
+	struct rcsid		ri_id;
+	struct rcslib_ident	*ri_next;
+};
+#define	RCSLIB_NIDENTS		(64)
+
+static const struct rcsid rcsid_empty = { NULL, 0 };
+
+struct rcslib_reader {
+	int	rr_fd;
+	off_t	rr_offset, rr_size;
+	char	*rr_buf;
+	size_t	rr_pos, rr_len;
+};
+
+#define	RCSNUM_LEVEL(num, i)	\
+	(((i) < RCSNUM_INLINE) ? (num)->n_num[i] : rcslib_num_level((num), (i)))
+
+void *rcslib_alloc(struct rcslib_file *, size_t);
+void *rcslib_realloc(struct rcslib_file *, void *, size_t, size_t);
+const struct rcsid *rcslib_intern_id(struct rcslib_file *, const struct rcsid *);
+uint32_t rcslib_hash(const char *, size_t);
+bool rcslib_index_init(struct rcslib_file *, struct rcslib_index *, size_t);
+void rcslib_index_insert(struct rcslib_index *, uint32_t, size_t);
+bool rcslib_build_index(struct rcslib_file *);
+
+bool rcslib_stream_deltatext(struct rcslib_file *, int, const struct hash_args *, uint8_t *);
+bool rcslib_stream_keyword(struct rcslib_reader *, const char *, size_t);
+bool rcslib_stream_string(struct rcslib_reader *, const struct hash_args *, void *, struct rcsstr *, char *);
+int rcslib_reader_getc(struct rcslib_reader *);
+bool rcslib_reader_fill(struct rcslib_reader *);
 
-void rcslib_destroy_admin(struct rcslib_file *);
-void rcslib_destroy_delta(struct rcslib_file *);
+bool rcslib_writer_output(int, struct iovec *, int);
+bool rcslib_writer_drain(struct rcslib_writer *);
+bool rcslib_writer_copy(struct rcslib_writer *);
 
 bool rcslib_parse_rcstext(struct rcslib_file *, char *, const char *);
 
@@ -86,13 +158,17 @@ char *rcslib_parse_admin(struct rcslib_file *, char *, const char *);
 char *rcslib_parse_delta(struct rcslib_file *, char *, const char *);
 char *rcslib_parse_deltatext(struct rcslib_file *, char *, const char *);
 
-char *rcslib_parse_access(char *, const char *, struct rcslib_access *);
-char *rcslib_parse_symbols(char *, const char *, struct rcslib_symbols *);
-char *rcslib_parse_locks(char *, const char *, struct rcslib_locks *);
+char *rcslib_parse_access(struct rcslib_file *, char *, const char *, struct rcslib_access *);
+char *rcslib_parse_symbols(struct rcslib_file *, char *, const char *, struct rcslib_symbols *);
+char *rcslib_parse_locks(struct rcslib_file *, char *, const char *, struct rcslib_locks *);
 char *rcslib_parse_date(char *, const char *, struct rcslib_date *);
-char *rcslib_parse_branches(char *, const char *, struct rcslib_branches *);
+char *rcslib_parse_branches(struct rcslib_file *, char *, const char *, struct rcslib_branches *);
 char *rcslib_parse_newphrase(char *, const char *);
 char *rcslib_parse_rcsdiff(char *, const char *, struct rcslib_rcsdiff *);
+const char *rcslib_skip_lines(const char *, const char *, size_t);
+bool rcslib_rcsdiff_output(struct rcslib_writer *, const struct hash_args *, void *, const char *, size_t);
+bool rcslib_rcsdiff_append(char **, size_t *, size_t *, const char *, size_t);
+size_t rcslib_rcsdiff_command(char *, char, size_t, size_t);
 
 char *rcslib_parse_word(char *, const char *);
 char *rcslib_parse_num(char *, const char *, struct rcsnum *);
@@ -100,12 +176,37 @@ char *rcslib_parse_id(char *, const char *, struct rcsid *);
 char *rcslib_parse_sym(char *, const char *, struct rcssym *);
 char *rcslib_parse_string(char *, const char *, struct rcsstr *);
 
+bool rcslib_num_levels(struct rcsnum *);
+int32_t rcslib_num_level(const struct rcsnum *, size_t);
+
 void rcslib_sort_revision(struct rcslib_file *);
 
+void rcslib_digest_update(const struct hash_args *, void *, const void *, size_t);
+
 typedef int (*rcslib_cmp_func)(const void *, const void *);
 
 struct rcslib_file *
 rcslib_init(void *addr, off_t addrlen)
+{
+	struct rcslib_file *rcs;
+
+	if ((rcs = rcslib_init_lazy(addr, addrlen)) == NULL)
+		return (NULL);
+
+	if (!rcslib_load_deltatext(rcs)) {
+		rcslib_destroy(rcs);
+		return (NULL);
+	}
+
+	return (rcs);
+}
+
+/*
+ * Parses the admin, delta and desc sections only. The deltatext section,
+ * which usually makes up most of the file, is left to rcslib_load_deltatext().
+ */
+struct rcslib_file *
+rcslib_init_lazy(void *addr, off_t addrlen)
 {
 	struct rcslib_file *rcs;
 	char *sp = addr, *bp = sp + (size_t)(addrlen - 1);
@@ -116,50 +217,455 @@ rcslib_init(void *addr, off_t addrlen)
 	if ((rcs = malloc(sizeof(*rcs))) == NULL)
 		return (NULL);
 	(void)memset(rcs, 0, sizeof(*rcs));
+	rcs->rf_addr = sp;
 
 	if (!rcslib_parse_rcstext(rcs, sp, bp)) {
-		free(rcs);
+		rcslib_destroy(rcs);
 		return (NULL);
 	}
 
 	return (rcs);
 }
 
+bool
+rcslib_load_deltatext(struct rcslib_file *rcs)
+{
+	struct rcslib_revision *rev;
+	char *sp, *p;
+	const char *bp = rcs->rf_bp;
+	size_t i;
+
+	if (rcs->rf_flags & RCSLIB_FILE_DELTATEXT)
+		return (true);
+
+	for (i = 0 ; i < rcs->delta.rd_count ; i++)
+		rcs->delta.rd_rev[i].rv_flags &= ~RCSLIB_REVISION_DELTATEXT;
+
+	if ((sp = rcslib_parse_deltatext(rcs, rcs->rf_deltatext, bp)) == NULL)
+		return (false);
+
+	for (p = sp ; isspace((int)(*p)) ; p++) {
+		if (p == bp)
+			break;
+	}
+	if (p != bp)
+		return (false);
+
+	for (i = 0 ; i < rcs->delta.rd_count ; i++) {
+		rev = &rcs->delta.rd_rev[i];
+		if (!(rev->rv_flags & RCSLIB_REVISION_DELTATEXT))
+			return (false);
+	}
+
+	rcs->rf_flags |= RCSLIB_FILE_DELTATEXT;
+
+	return (true);
+}
+
+/*
+ * Same as rcslib_load_deltatext(), but the deltatext section of a large
+ * file is read from fd so that none of its pages are faulted in, and only
+ * the texts the caller goes on to use are.  The digests of log and text
+ * of each revision are computed on the way if hashops is not NULL.
+ */
+bool
+rcslib_load_deltatext_fd(struct rcslib_file *rcs, int fd, const struct hash_args *hashops, uint8_t *digests)
+{
+	if (!(rcs->rf_flags & RCSLIB_FILE_DELTATEXT) &&
+	    ((rcs->rf_bp - rcs->rf_addr) >= RCSLIB_STREAM_SIZE)) {
+		if (rcslib_stream_deltatext(rcs, fd, hashops, digests))
+			return (true);
+	}
+
+	if (!rcslib_load_deltatext(rcs))
+		return (false);
+	if (hashops == NULL)
+		return (true);
+
+	return (rcslib_digest_deltatext(rcs, hashops, digests));
+}
+
+bool
+rcslib_stream_deltatext(struct rcslib_file *rcs, int fd, const struct hash_args *hashops, uint8_t *digests)
+{
+	struct rcslib_reader rr;
+	struct rcslib_revision *rev;
+	struct rcsnum num;
+	char numbuf[UINT8_MAX + 1];
+	void *ctx = NULL;
+	size_t len, i;
+	int c;
+
+	for (i = 0 ; i < rcs->delta.rd_count ; i++)
+		rcs->delta.rd_rev[i].rv_flags &= ~RCSLIB_REVISION_DELTATEXT;
+
+	if ((rr.rr_buf = malloc(RCSLIB_STREAM_BUFSIZE)) == NULL)
+		return (false);
+	rr.rr_fd = fd;
+	rr.rr_offset = (off_t)(rcs->rf_deltatext - rcs->rf_addr);
+	rr.rr_size = (off_t)(rcs->rf_bp - rcs->rf_addr) + 1;
+	rr.rr_pos = rr.rr_len = 0;
+
+	for (;;) {
+		while (((c = rcslib_reader_getc(&rr)) != -1) && isspace(c))
+			continue;
+		if (c == -1)
+			break;
+
+		/* num */
+		len = 0;
+		while (isdigit(c) || (c == '.')) {
+			if (len == sizeof(numbuf))
+				goto fail;
+			numbuf[len++] = (char)c;
+			c = rcslib_reader_getc(&rr);
+		}
+		if ((len == 0) || !isspace(c))
+			goto fail;
+		if (!rcslib_str2num(numbuf, len, &num))
+			goto fail;
+		if ((rev = rcslib_lookup_revision(rcs, &num)) == NULL)
+			goto fail;
+
+		if ((hashops != NULL) && !(*hashops->init)(&ctx))
+			goto fail;
+
+		/* log string, newphrases are left to rcslib_load_deltatext() */
+		if (!rcslib_stream_keyword(&rr, "log", 3))
+			goto fail;
+		if (!rcslib_stream_string(&rr, hashops, ctx, &rev->log, rcs->rf_addr))
+			goto fail;
+
+		/* text string */
+		if (!rcslib_stream_keyword(&rr, "text", 4))
+			goto fail;
+		if (!rcslib_stream_string(&rr, hashops, ctx, &rev->text, rcs->rf_addr))
+			goto fail;
+
+		if (hashops != NULL) {
+			(*hashops->final)(ctx, &digests[(size_t)(rev - rcs->delta.rd_rev) * hashops->length]);
+			ctx = NULL;
+		}
+		rev->rv_flags |= RCSLIB_REVISION_DELTATEXT;
+	}
+	if (rr.rr_offset + (off_t)rr.rr_len != rr.rr_size)
+		goto fail;
+
+	free(rr.rr_buf);
+
+	for (i = 0 ; i < rcs->delta.rd_count ; i++) {
+		if (!(rcs->delta.rd_rev[i].rv_flags & RCSLIB_REVISION_DELTATEXT))
+			return (false);
+	}
+
+	rcs->rf_flags |= RCSLIB_FILE_DELTATEXT;
+
+	return (true);
+
+fail:
+	if (ctx != NULL)
+		(*hashops->destroy)(ctx);
+	free(rr.rr_buf);
+
+	return (false);
+}
+
+/* Whitespace, the keyword and at least one whitespace. */
+bool
+rcslib_stream_keyword(struct rcslib_reader *rr, const char *name, size_t namelen)
+{
+	size_t i;
+	int c;
+
+	while (((c = rcslib_reader_getc(rr)) != -1) && isspace(c))
+		continue;
+	for (i = 0 ; i < namelen ; i++) {
+		if (c != name[i])
+			return (false);
+		c = rcslib_reader_getc(rr);
+	}
+	if ((c == -1) || !isspace(c))
+		return (false);
+	while (((c = rcslib_reader_getc(rr)) != -1) && isspace(c))
+		continue;
+	if (c == -1)
+		return (false);
+	rr->rr_pos--;
+
+	return (true);
+}
+
+bool
+rcslib_stream_string(struct rcslib_reader *rr, const struct hash_args *hashops, void *ctx,
+		     struct rcsstr *str, char *addr)
+{
+	off_t start;
+	char *sp, *ep;
+	int c;
+
+	if (rcslib_reader_getc(rr) != '@')
+		return (false);
+	start = rr->rr_offset + (off_t)rr->rr_pos;
+
+	for (;;) {
+		if ((rr->rr_pos == rr->rr_len) && !rcslib_reader_fill(rr))
+			return (false);
+		sp = &rr->rr_buf[rr->rr_pos];
+		ep = memchr(sp, '@', rr->rr_len - rr->rr_pos);
+		if (ep == NULL) {
+			if (hashops != NULL)
+				(*hashops->update)(ctx, sp, rr->rr_len - rr->rr_pos);
+			rr->rr_pos = rr->rr_len;
+			continue;
+		}
+		if ((hashops != NULL) && (ep > sp))
+			(*hashops->update)(ctx, sp, (size_t)(ep - sp));
+		rr->rr_pos += (size_t)(ep - sp) + 1;
+		if ((c = rcslib_reader_getc(rr)) == -1)
+			return (false);
+		if (c != '@')
+			break;
+		if (hashops != NULL)
+			(*hashops->update)(ctx, "@@", 2);
+	}
+	/* The closing '@' and the character after it have been read. */
+	str->s_str = addr + start;
+	str->s_len = (size_t)(rr->rr_offset + (off_t)rr->rr_pos - 2 - start);
+	rr->rr_pos--;
+
+	return (true);
+}
+
+int
+rcslib_reader_getc(struct rcslib_reader *rr)
+{
+	if ((rr->rr_pos == rr->rr_len) && !rcslib_reader_fill(rr))
+		return (-1);
+
+	return ((uint8_t)rr->rr_buf[rr->rr_pos++]);
+}
+
+bool
+rcslib_reader_fill(struct rcslib_reader *rr)
+{
+	size_t len = RCSLIB_STREAM_BUFSIZE;
+	ssize_t rn;
+
+	rr->rr_offset += (off_t)rr->rr_len;
+	rr->rr_pos = rr->rr_len = 0;
+	if (rr->rr_offset >= rr->rr_size)
+		return (false);
+	if ((off_t)len > rr->rr_size - rr->rr_offset)
+		len = (size_t)(rr->rr_size - rr->rr_offset);
+
+	while ((rn = pread(rr->rr_fd, rr->rr_buf, len, rr->rr_offset)) == -1) {
+		if (errno != EINTR)
+			return (false);
+	}
+	rr->rr_len = (size_t)rn;
+
+	return (rn > 0);
+}
+
 void
 rcslib_destroy(struct rcslib_file *rcs)
 {
-	rcslib_destroy_admin(rcs);
-	rcslib_destroy_delta(rcs);
+	struct rcslib_chunk *rc;
+
+	while ((rc = rcs->rf_arena) != NULL) {
+		rcs->rf_arena = rc->rc_next;
+		free(rc);
+	}
 	free(rcs);
 }
 
-void
-rcslib_destroy_admin(struct rcslib_file *rcs)
+size_t
+rcslib_memsize(const struct rcslib_file *rcs)
+{
+	return (sizeof(*rcs) + rcs->rf_memsize);
+}
+
+void *
+rcslib_alloc(struct rcslib_file *rcs, size_t size)
+{
+	struct rcslib_chunk *rc = rcs->rf_arena, *new;
+	void *p;
+
+	size = RCSLIB_ALIGN(size);
+
+	if ((rc != NULL) && (size <= rc->rc_size - rc->rc_used)) {
+		p = RCSLIB_CHUNK_DATA(rc) + rc->rc_used;
+		rc->rc_used += size;
+		return (p);
+	}
+
+	if (size > RCSLIB_CHUNK_SIZE / 4) {
+		/* Large arrays get a chunk of their own. */
+		if ((new = malloc(RCSLIB_CHUNK_HDRLEN + size)) == NULL)
+			return (NULL);
+		new->rc_size = size;
+		if (rc != NULL) {
+			new->rc_next = rc->rc_next;
+			rc->rc_next = new;
+		} else {
+			new->rc_next = NULL;
+			rcs->rf_arena = new;
+		}
+	} else {
+		if ((new = malloc(RCSLIB_CHUNK_HDRLEN + RCSLIB_CHUNK_SIZE)) == NULL)
+			return (NULL);
+		new->rc_size = RCSLIB_CHUNK_SIZE;
+		new->rc_next = rc;
+		rcs->rf_arena = new;
+	}
+	new->rc_used = size;
+	rcs->rf_memsize += RCSLIB_CHUNK_HDRLEN + new->rc_size;
+
+	return (RCSLIB_CHUNK_DATA(new));
+}
+
+void *
+rcslib_realloc(struct rcslib_file *rcs, void *ptr, size_t oldsize, size_t newsize)
+{
+	struct rcslib_chunk *rc = rcs->rf_arena, *prev, *new;
+	void *p;
+
+	if (ptr == NULL)
+		return (rcslib_alloc(rcs, newsize));
+
+	oldsize = RCSLIB_ALIGN(oldsize);
+	newsize = RCSLIB_ALIGN(newsize);
+
+	/* The last allocation grows in place. */
+	if (((char *)ptr + oldsize == RCSLIB_CHUNK_DATA(rc) + rc->rc_used) &&
+	    (newsize - oldsize <= rc->rc_size - rc->rc_used)) {
+		rc->rc_used += newsize - oldsize;
+		return (ptr);
+	}
+
+	/* So does an array which has a chunk to itself. */
+	for (prev = NULL ; rc != NULL ; prev = rc, rc = rc->rc_next) {
+		if ((RCSLIB_CHUNK_DATA(rc) == ptr) && (rc->rc_used == oldsize))
+			break;
+	}
+	if (rc != NULL) {
+		if ((new = realloc(rc, RCSLIB_CHUNK_HDRLEN + newsize)) == NULL)
+			return (NULL);
+		rcs->rf_memsize += newsize - new->rc_size;
+		new->rc_size = newsize;
+		new->rc_used = newsize;
+		if (prev != NULL)
+			prev->rc_next = new;
+		else
+			rcs->rf_arena = new;
+		return (RCSLIB_CHUNK_DATA(new));
+	}
+
+	if ((p = rcslib_alloc(rcs, newsize)) == NULL)
+		return (NULL);
+	(void)memcpy(p, ptr, oldsize);
+
+	return (p);
+}
+
+const struct rcsid *
+rcslib_intern_id(struct rcslib_file *rcs, const struct rcsid *id)
+{
+	struct rcslib_ident *ri, **bucket;
+
+	if (rcs->rf_ids == NULL) {
+		rcs->rf_ids = rcslib_alloc(rcs, RCSLIB_NIDENTS * sizeof(*rcs->rf_ids));
+		if (rcs->rf_ids == NULL)
+			return (NULL);
+		(void)memset(rcs->rf_ids, 0, RCSLIB_NIDENTS * sizeof(*rcs->rf_ids));
+	}
+
+	bucket = &rcs->rf_ids[rcslib_hash(id->i_id, id->i_len) % RCSLIB_NIDENTS];
+
+	for (ri = *bucket ; ri != NULL ; ri = ri->ri_next) {
+		if ((ri->ri_id.i_len == id->i_len) && (memcmp(ri->ri_id.i_id, id->i_id, id->i_len) == 0))
+			return (&ri->ri_id);
+	}
+
+	if ((ri = rcslib_alloc(rcs, sizeof(*ri))) == NULL)
+		return (NULL);
+	ri->ri_id = *id;
+	ri->ri_next = *bucket;
+	*bucket = ri;
+
+	return (&ri->ri_id);
+}
+
+uint32_t
+rcslib_hash(const char *s, size_t len)
+{
+	uint32_t hash = RCSLIB_HASH_INIT;
+	size_t i;
+
+	for (i = 0 ; i < len ; i++)
+		hash = RCSLIB_HASH(hash, s[i]);
+
+	return (RCSLIB_HASH_END(hash));
+}
+
+bool
+rcslib_index_init(struct rcslib_file *rcs, struct rcslib_index *idx, size_t count)
 {
-	if (rcs->access.ra_id != NULL)
-		free(rcs->access.ra_id);
-	if (rcs->symbols.rs_symbols != NULL)
-		free(rcs->symbols.rs_symbols);
-	if (rcs->locks.rl_locks != NULL)
-		free(rcs->locks.rl_locks);
+	size_t size = 16;
+
+	if (count >= UINT32_MAX / 2)
+		return (false);
+	while (size < count * 2)
+		size <<= 1;
+
+	if ((idx->ri_slots = rcslib_alloc(rcs, size * sizeof(*idx->ri_slots))) == NULL)
+		return (false);
+	(void)memset(idx->ri_slots, 0, size * sizeof(*idx->ri_slots));
+	idx->ri_mask = size - 1;
+
+	return (true);
 }
 
 void
-rcslib_destroy_delta(struct rcslib_file *rcs)
+rcslib_index_insert(struct rcslib_index *idx, uint32_t hash, size_t pos)
+{
+	size_t i;
+
+	for (i = hash & idx->ri_mask ; idx->ri_slots[i] != 0 ; i = (i + 1) & idx->ri_mask)
+		continue;
+	idx->ri_slots[i] = (uint32_t)(pos + 1);
+}
+
+/*
+ * Duplicates stay reachable in array order, so lookups find the first
+ * revision or symbol of a name as a linear scan would.
+ */
+bool
+rcslib_build_index(struct rcslib_file *rcs)
 {
 	struct rcslib_revision *rev;
+	struct rcslib_symbol *sym;
 	size_t i;
 
 	if (rcs->delta.rd_count > 0) {
+		if (!rcslib_index_init(rcs, &rcs->rf_revidx, rcs->delta.rd_count))
+			return (false);
 		for (i = 0 ; i < rcs->delta.rd_count ; i++) {
 			rev = &rcs->delta.rd_rev[i];
-			if (rev->branches.rb_num != NULL)
-				free(rev->branches.rb_num);
+			rcslib_index_insert(&rcs->rf_revidx, rcslib_hash(rev->num.n_str, rev->num.n_len), i);
+		}
+	}
+
+	if (rcs->symbols.rs_count > 0) {
+		if (!rcslib_index_init(rcs, &rcs->rf_symidx, rcs->symbols.rs_count))
+			return (false);
+		for (i = 0 ; i < rcs->symbols.rs_count ; i++) {
+			sym = &rcs->symbols.rs_symbols[i];
+			rcslib_index_insert(&rcs->rf_symidx, rcslib_hash(sym->sym.s_sym, sym->sym.s_len), i);
 		}
 	}
-	free(rcs->delta.rd_rev);
-	if (rcs->delta.rd_rev_deltatext != NULL)
-		free(rcs->delta.rd_rev_deltatext);
+
+	return (true);
 }
 
 bool
@@ -173,75 +679,42 @@ rcslib_parse_rcstext(struct rcslib_file *rcs, char *sp, const char *bp)
 	if ((sp = rcslib_parse_admin(rcs, sp, bp)) == NULL)
 		return (false);
 
-	if ((sp = rcslib_parse_delta(rcs, sp, bp)) == NULL) {
-		rcslib_destroy_admin(rcs);
+	if ((sp = rcslib_parse_delta(rcs, sp, bp)) == NULL)
 		return (false);
-	}
 	if (rcs->delta.rd_count > 0)
 		rcslib_sort_revision(rcs);
+	if (!rcslib_build_index(rcs))
+		return (false);
 
 	/* desc string */
-	if (((sp + rcskey->namelen) > bp) || (memcmp(sp, rcskey->name, rcskey->namelen) != 0)) {
-		rcslib_destroy_admin(rcs);
-		rcslib_destroy_delta(rcs);
+	if (((sp + rcskey->namelen) > bp) || (memcmp(sp, rcskey->name, rcskey->namelen) != 0))
 		return (false);
-	}
 	sp += rcskey->namelen;
 
 	p = sp;
 	while (isspace((int)(*sp))) {
-		if (++sp > bp) {
-			rcslib_destroy_admin(rcs);
-			rcslib_destroy_delta(rcs);
+		if (++sp > bp)
 			return (false);
-		}
 	}
-	if (sp == p) {
-		rcslib_destroy_admin(rcs);
-		rcslib_destroy_delta(rcs);
+	if (sp == p)
 		return (false);
-	}
 
-	if ((sp = rcslib_parse_string(sp, bp, &rcs->desc)) == NULL) {
-		rcslib_destroy_admin(rcs);
-		rcslib_destroy_delta(rcs);
+	if ((sp = rcslib_parse_string(sp, bp, &rcs->desc)) == NULL)
 		return (false);
-	}
 
 	while (isspace((int)(*sp))) {
-		if (++sp > bp) {
-			rcslib_destroy_admin(rcs);
-			rcslib_destroy_delta(rcs);
+		if (++sp > bp)
 			return (false);
-		}
 	}
 
-	if ((sp = rcslib_parse_deltatext(rcs, sp, bp)) == NULL) {
-		rcslib_destroy_admin(rcs);
-		rcslib_destroy_delta(rcs);
-		return (false);
-	}
-
-	for (p = sp ; isspace((int)(*p)) ; p++) {
-		if (p == bp)
-			break;
-	}
-	if (p != bp) {
-		rcslib_destroy_admin(rcs);
-		rcslib_destroy_delta(rcs);
-		return (false);
-	}
+	rcs->rf_deltatext = sp;
+	rcs->rf_bp = bp;
 
 	if (rcs->delta.rd_count == 0)
 		return (true);
 
 	for (i = 0 ; i < rcs->delta.rd_count ; i++) {
 		rev = &rcs->delta.rd_rev[i];
-		if (!(rev->rv_flags & RCSLIB_REVISION_DELTATEXT)) {
-			rcslib_destroy_admin(rcs);
-			rcslib_destroy_delta(rcs);
-			return (false);
-		}
 		if (rev->next.n_len == 0)
 			continue;
 		if ((i + 1) == rcs->delta.rd_count)
@@ -251,11 +724,8 @@ rcslib_parse_rcstext(struct rcslib_file *rcs, char *sp, const char *bp)
 			continue;
 		}
 		rev->rv_next = rcslib_lookup_revision(rcs, &rev->next);
-		if (rev->rv_next == NULL) {
-			rcslib_destroy_admin(rcs);
-			rcslib_destroy_delta(rcs);
+		if (rev->rv_next == NULL)
 			return (false);
-		}
 	}
 
 	/* XXX - construct RCS appropriate deltatext list */
@@ -316,15 +786,15 @@ rcslib_parse_admin(struct rcslib_file *rcs, char *sp, const char *bp)
 	}
 
 	/* access {id}*; */
-	if ((sp = rcslib_parse_access(sp, bp, &rcs->access)) == NULL)
+	if ((sp = rcslib_parse_access(rcs, sp, bp, &rcs->access)) == NULL)
 		return (NULL);
 
 	/* symbols {sym : num}*; */
-	if ((sp = rcslib_parse_symbols(sp, bp, &rcs->symbols)) == NULL)
+	if ((sp = rcslib_parse_symbols(rcs, sp, bp, &rcs->symbols)) == NULL)
 		return (NULL);
 
 	/* locks {id : num}*; {strict ;} */
-	if ((sp = rcslib_parse_locks(sp, bp, &rcs->locks)) == NULL)
+	if ((sp = rcslib_parse_locks(rcs, sp, bp, &rcs->locks)) == NULL)
 		return (NULL);
 
 	/* { comment {string}; } */
@@ -374,6 +844,7 @@ rcslib_parse_delta(struct rcslib_file *rcs, char *sp, const char *bp)
 	const struct rcs_keyword *rcskey;
 	struct rcslib_delta *delta = &rcs->delta;
 	struct rcslib_revision *rev;
+	struct rcsid id;
 	char *p;
 
 	for (;;) {
@@ -382,16 +853,10 @@ rcslib_parse_delta(struct rcslib_file *rcs, char *sp, const char *bp)
 
 			new = (size == 0) ? 32 : size * 4;
 
-			rev = malloc(new * RCSLIB_REVISION_SIZE);
-			if (rev == NULL) {
-				if (delta->rd_rev != NULL)
-					free(delta->rd_rev);
+			rev = rcslib_realloc(rcs, delta->rd_rev, size * RCSLIB_REVISION_SIZE,
+					     new * RCSLIB_REVISION_SIZE);
+			if (rev == NULL)
 				return (NULL);
-			}
-			if (size > 0) {
-				(void)memcpy(rev, delta->rd_rev, size * RCSLIB_REVISION_SIZE);
-				free(delta->rd_rev);
-			}
 			(void)memset(rev + size, 0, (new - size) * RCSLIB_REVISION_SIZE);
 			delta->rd_rev = rev;
 			delta->rd_size = new;
@@ -399,155 +864,114 @@ rcslib_parse_delta(struct rcslib_file *rcs, char *sp, const char *bp)
 
 		/* num */
 		rev = &delta->rd_rev[delta->rd_count++];
-		if ((sp = rcslib_parse_num(sp, bp, &rev->num)) == NULL) {
-			free(delta->rd_rev);
+		if ((sp = rcslib_parse_num(sp, bp, &rev->num)) == NULL)
 			return (NULL);
-		}
 
 		RCS_SKIP_NORET(sp, bp)
-		if (sp > bp) {
-			free(delta->rd_rev);
+		if (sp > bp)
 			return (NULL);
-		}
 
 		/* date num; */
-		if ((sp = rcslib_parse_date(sp, bp, &rev->date)) == NULL) {
-			free(delta->rd_rev);
+		if ((sp = rcslib_parse_date(sp, bp, &rev->date)) == NULL)
 			return (NULL);
-		}
 		RCS_SKIP_NORET(sp, bp)
-		if (sp > bp) {
-			free(delta->rd_rev);
+		if (sp > bp)
 			return (NULL);
-		}
-		if (*sp++ != ';') {
-			free(delta->rd_rev);
+		if (*sp++ != ';')
 			return (NULL);
-		}
 
 		RCS_SKIP_NORET(sp, bp)
-		if (sp > bp) {
-			free(delta->rd_rev);
+		if (sp > bp)
 			return (NULL);
-		}
 
 		/* author id; */
 		rcskey = &rcs_keywords[RCS_AUTHOR];
-		if (((sp + rcskey->namelen) > bp) || (memcmp(sp, rcskey->name, rcskey->namelen) != 0)) {
-			free(delta->rd_rev);
+		if (((sp + rcskey->namelen) > bp) || (memcmp(sp, rcskey->name, rcskey->namelen) != 0))
 			return (NULL);
-		}
 		sp += rcskey->namelen;
 
 		p = sp;
 		RCS_SKIP_NORET(sp, bp)
-		if ((sp > bp) || (sp == p)) {
-			free(delta->rd_rev);
+		if ((sp > bp) || (sp == p))
 			return (NULL);
-		}
 
-		if ((sp = rcslib_parse_id(sp, bp, &rev->author)) == NULL) {
-			free(delta->rd_rev);
+		if ((sp = rcslib_parse_id(sp, bp, &id)) == NULL)
+			return (NULL);
+		if ((rev->author = rcslib_intern_id(rcs, &id)) == NULL)
 			return (NULL);
-		}
 
 		RCS_SKIP_NORET(sp, bp)
-		if ((sp > bp) || (*sp++ != ';')) {
-			free(delta->rd_rev);
+		if ((sp > bp) || (*sp++ != ';'))
 			return (NULL);
-		}
 
 		RCS_SKIP_NORET(sp, bp)
-		if (sp > bp) {
-			free(delta->rd_rev);
+		if (sp > bp)
 			return (NULL);
-		}
 
 		/* state {id}; */
 		rcskey = &rcs_keywords[RCS_STATE];
-		if (((sp + rcskey->namelen) > bp) || (memcmp(sp, rcskey->name, rcskey->namelen) != 0)) {
-			free(delta->rd_rev);
+		if (((sp + rcskey->namelen) > bp) || (memcmp(sp, rcskey->name, rcskey->namelen) != 0))
 			return (NULL);
-		}
 		sp += rcskey->namelen;
 
 		p = sp;
 		RCS_SKIP_NORET(sp, bp)
-		if ((sp > bp) || ((sp == p) && (*sp != ';'))) {
-			free(delta->rd_rev);
+		if ((sp > bp) || ((sp == p) && (*sp != ';')))
 			return (NULL);
-		}
 
 		p = sp;
-		if ((sp = rcslib_parse_id(sp, bp, &rev->state)) != NULL) {
+		if ((sp = rcslib_parse_id(sp, bp, &id)) != NULL) {
+			if ((rev->state = rcslib_intern_id(rcs, &id)) == NULL)
+				return (NULL);
 			RCS_SKIP_NORET(sp, bp)
-			if (sp > bp) {
-				free(delta->rd_rev);
+			if (sp > bp)
 				return (NULL);
-			}
 		} else {
+			rev->state = &rcsid_empty;
 			sp = p;
 		}
 
-		if (*sp++ != ';') {
-			free(delta->rd_rev);
+		if (*sp++ != ';')
 			return (NULL);
-		}
 
 		RCS_SKIP_NORET(sp, bp)
-		if (sp > bp) {
-			free(delta->rd_rev);
+		if (sp > bp)
 			return (NULL);
-		}
 
 		/* branches {num}*; */
-		if ((sp = rcslib_parse_branches(sp, bp, &rev->branches)) == NULL) {
-			free(delta->rd_rev);
+		if ((sp = rcslib_parse_branches(rcs, sp, bp, &rev->branches)) == NULL)
 			return (NULL);
-		}
 
 		RCS_SKIP_NORET(sp, bp)
-		if (sp > bp) {
-			free(delta->rd_rev);
+		if (sp > bp)
 			return (NULL);
-		}
 
 		/* next {num}; */
 		rcskey = &rcs_keywords[RCS_NEXT];
-		if (((sp + rcskey->namelen) > bp) || (memcmp(sp, rcskey->name, rcskey->namelen) != 0)) {
-			free(delta->rd_rev);
+		if (((sp + rcskey->namelen) > bp) || (memcmp(sp, rcskey->name, rcskey->namelen) != 0))
 			return (NULL);
-		}
 		sp += rcskey->namelen;
 
 		p = sp;
 		RCS_SKIP_NORET(sp, bp)
-		if ((sp > bp) || ((sp == p) && (*sp != ';'))) {
-			free(delta->rd_rev);
+		if ((sp > bp) || ((sp == p) && (*sp != ';')))
 			return (NULL);
-		}
 
 		p = sp;
 		if ((sp = rcslib_parse_num(sp, bp, &rev->next)) != NULL) {
 			RCS_SKIP_NORET(sp, bp)
-			if (sp > bp) {
-				free(delta->rd_rev);
+			if (sp > bp)
 				return (NULL);
-			}
 		} else {
 			sp = p;
 		}
 
-		if (*sp++ != ';') {
-			free(delta->rd_rev);
+		if (*sp++ != ';')
 			return (NULL);
-		}
 
 		RCS_SKIP_NORET(sp, bp)
-		if (sp > bp) {
-			free(delta->rd_rev);
+		if (sp > bp)
 			return (NULL);
-		}
 
 		/* { newphrase }* */
 		p = sp;
@@ -557,11 +981,6 @@ rcslib_parse_delta(struct rcslib_file *rcs, char *sp, const char *bp)
 		}
 	}
 
-	if (delta->rd_count == 0) {
-		free(delta->rd_rev);
-		delta->rd_rev = NULL;
-	}
-
 	return (sp);
 }
 
@@ -640,7 +1059,7 @@ rcslib_parse_deltatext(struct rcslib_file *rcs, char *sp, const char *bp)
 }
 
 char *
-rcslib_parse_access(char *sp, const char *bp, struct rcslib_access *access)
+rcslib_parse_access(struct rcslib_file *rcs, char *sp, const char *bp, struct rcslib_access *access)
 {
 	const struct rcs_keyword *rcskey = &rcs_keywords[RCS_ACCESS];
 	struct rcsid *id;
@@ -664,45 +1083,31 @@ rcslib_parse_access(char *sp, const char *bp, struct rcslib_access *access)
 		if (access->ra_count == access->ra_size) {
 			size_t size = access->ra_size, new = size + 4;
 
-			if ((id = malloc(new * RCSID_SIZE)) == NULL) {
-				if (access->ra_id != NULL)
-					free(access->ra_id);
+			id = rcslib_realloc(rcs, access->ra_id, size * RCSID_SIZE, new * RCSID_SIZE);
+			if (id == NULL)
 				return (NULL);
-			}
-			if (size > 0) {
-				(void)memcpy(id, access->ra_id, size * RCSID_SIZE);
-				free(access->ra_id);
-			}
 			access->ra_id = id;
 			access->ra_size = new;
 		}
 
 		id = &access->ra_id[access->ra_count++];
-		if ((sp = rcslib_parse_id(sp, bp, id)) == NULL) {
-			free(access->ra_id);
+		if ((sp = rcslib_parse_id(sp, bp, id)) == NULL)
 			return (NULL);
-		}
 
 		p = sp;
 		RCS_SKIP_NORET(sp, bp)
-		if (sp > bp) {
-			free(access->ra_id);
+		if (sp > bp)
 			return (NULL);
-		}
 		if (*sp == ';')
 			break;
 	}
 
-	if (*sp++ != ';') {
-		free(access->ra_id);
+	if (*sp++ != ';')
 		return (NULL);
-	}
 
 	RCS_SKIP_NORET(sp, bp)
-	if (sp > bp) {
-		free(access->ra_id);
+	if (sp > bp)
 		return (NULL);
-	}
 
 	if (access->ra_count > 0) {
 		qsort(access->ra_id, access->ra_count, RCSID_SIZE, (rcslib_cmp_func)(void *)rcslib_cmp_id);
@@ -712,7 +1117,7 @@ rcslib_parse_access(char *sp, const char *bp, struct rcslib_access *access)
 }
 
 char *
-rcslib_parse_symbols(char *sp, const char *bp, struct rcslib_symbols *symbols)
+rcslib_parse_symbols(struct rcslib_file *rcs, char *sp, const char *bp, struct rcslib_symbols *symbols)
 {
 	const struct rcs_keyword *rcskey = &rcs_keywords[RCS_SYMBOLS];
 	struct rcslib_symbol *sym;
@@ -739,39 +1144,26 @@ rcslib_parse_symbols(char *sp, const char *bp, struct rcslib_symbols *symbols)
 
 			new = (size == 0) ? 32 : size * 4;
 
-			sym = malloc(new * RCSLIB_SYMBOL_SIZE);
-			if (sym == NULL) {
-				if (symbols->rs_symbols != NULL)
-					free(symbols->rs_symbols);
+			sym = rcslib_realloc(rcs, symbols->rs_symbols, size * RCSLIB_SYMBOL_SIZE, new * RCSLIB_SYMBOL_SIZE);
+			if (sym == NULL)
 				return (NULL);
-			}
-			if (size > 0) {
-				(void)memcpy(sym, symbols->rs_symbols, size * RCSLIB_SYMBOL_SIZE);
-				free(symbols->rs_symbols);
-			}
 			symbols->rs_symbols = sym;
 			symbols->rs_size = new;
 		}
 
 		sym = &symbols->rs_symbols[symbols->rs_count++];
-		if ((sp = rcslib_parse_sym(sp, bp, &sym->sym)) == NULL) {
-			free(symbols->rs_symbols);
+		if ((sp = rcslib_parse_sym(sp, bp, &sym->sym)) == NULL)
 			return (NULL);
-		}
 
 		if (*sp++ != ':')
 			return (NULL);
 
-		if ((sp = rcslib_parse_num(sp, bp, &sym->num)) == NULL) {
-			free(symbols->rs_symbols);
+		if ((sp = rcslib_parse_num(sp, bp, &sym->num)) == NULL)
 			return (NULL);
-		}
 
 		RCS_SKIP_NORET(sp, bp)
-		if (sp > bp) {
-			free(symbols->rs_symbols);
+		if (sp > bp)
 			return (NULL);
-		}
 		if (*sp == ';')
 			break;
 	}
@@ -780,10 +1172,8 @@ rcslib_parse_symbols(char *sp, const char *bp, struct rcslib_symbols *symbols)
 		return (NULL);
 
 	RCS_SKIP_NORET(sp, bp)
-	if (sp > bp) {
-		free(symbols->rs_symbols);
+	if (sp > bp)
 		return (NULL);
-	}
 
 	if (symbols->rs_count > 0) {
 		qsort(symbols->rs_symbols, symbols->rs_count, RCSLIB_SYMBOL_SIZE,
@@ -794,7 +1184,7 @@ rcslib_parse_symbols(char *sp, const char *bp, struct rcslib_symbols *symbols)
 }
 
 char *
-rcslib_parse_locks(char *sp, const char *bp, struct rcslib_locks *locks)
+rcslib_parse_locks(struct rcslib_file *rcs, char *sp, const char *bp, struct rcslib_locks *locks)
 {
 	const struct rcs_keyword *rcskey = &rcs_keywords[RCS_LOCKS];
 	struct rcslib_lock *lock;
@@ -817,54 +1207,36 @@ rcslib_parse_locks(char *sp, const char *bp, struct rcslib_locks *locks)
 		if (locks->rl_count == locks->rl_size) {
 			size_t size = locks->rl_size, new = size + 4;
 
-			if ((lock = malloc(new * RCSLIB_LOCK_SIZE)) == NULL) {
-				if (locks->rl_locks != NULL)
-					free(locks->rl_locks);
+			lock = rcslib_realloc(rcs, locks->rl_locks, size * RCSLIB_LOCK_SIZE, new * RCSLIB_LOCK_SIZE);
+			if (lock == NULL)
 				return (NULL);
-			}
-			if (size > 0) {
-				(void)memcpy(lock, locks->rl_locks, size * RCSLIB_LOCK_SIZE);
-				free(locks->rl_locks);
-			}
 			locks->rl_locks = lock;
 			locks->rl_size = new;
 		}
 
 		lock = &locks->rl_locks[locks->rl_count++];
-		if ((sp = rcslib_parse_id(sp, bp, &lock->id)) == NULL) {
-			free(locks->rl_locks);
+		if ((sp = rcslib_parse_id(sp, bp, &lock->id)) == NULL)
 			return (NULL);
-		}
 
-		if (*sp++ != ':') {
-			free(locks->rl_locks);
+		if (*sp++ != ':')
 			return (NULL);
-		}
 
-		if ((sp = rcslib_parse_num(sp, bp, &lock->num)) == NULL) {
-			free(locks->rl_locks);
+		if ((sp = rcslib_parse_num(sp, bp, &lock->num)) == NULL)
 			return (NULL);
-		}
 
 		RCS_SKIP_NORET(sp, bp)
-		if (sp > bp) {
-			free(locks->rl_locks);
+		if (sp > bp)
 			return (NULL);
-		}
 		if (*sp == ';')
 			break;
 	}
 
-	if (*sp++ != ';') {
-		free(locks->rl_locks);
+	if (*sp++ != ';')
 		return (NULL);
-	}
 
 do_parse_strict:
 	RCS_SKIP_NORET(sp, bp)
 	if (sp > bp) {
-		if (locks->rl_locks != NULL)
-			free(locks->rl_locks);
 		return (NULL);
 	}
 
@@ -873,14 +1245,10 @@ do_parse_strict:
 		sp += rcskey->namelen;
 		RCS_SKIP_NORET(sp, bp)
 		if ((sp > bp) || (*sp++ != ';')) {
-			if (locks->rl_locks != NULL)
-				free(locks->rl_locks);
 			return (NULL);
 		}
 		RCS_SKIP_NORET(sp, bp)
 		if (sp > bp) {
-			if (locks->rl_locks != NULL)
-				free(locks->rl_locks);
 			return (NULL);
 		}
 
@@ -888,7 +1256,7 @@ do_parse_strict:
 	}
 
 	if (locks->rl_count > 0) {
-		qsort(locks, locks->rl_count, RCSLIB_LOCK_SIZE, (rcslib_cmp_func)(void *)rcslib_cmp_lock);
+		qsort(locks->rl_locks, locks->rl_count, RCSLIB_LOCK_SIZE, (rcslib_cmp_func)(void *)rcslib_cmp_lock);
 	}
 
 	return (sp);
@@ -931,9 +1299,6 @@ rcslib_parse_date(char *sp, const char *bp, struct rcslib_date *date)
 		if (++sp > bp)
 			return (NULL);
 	}
-	date->rd_tm.tm_year = n;
-	if (n > 100)
-		date->rd_tm.tm_year -= 1900;
 
 	if (*sp++ != '.')
 		return (NULL);
@@ -949,7 +1314,6 @@ rcslib_parse_date(char *sp, const char *bp, struct rcslib_date *date)
 	n += *sp++ - '0';
 	if ((n < 1) || (n > 12))
 		return (NULL);
-	date->rd_tm.tm_mon = n - 1;
 
 	if (*sp++ != '.')
 		return (NULL);
@@ -965,7 +1329,6 @@ rcslib_parse_date(char *sp, const char *bp, struct rcslib_date *date)
 	n += *sp++ - '0';
 	if ((n < 1) || (n > 31))
 		return (NULL);
-	date->rd_tm.tm_mday = n;
 
 	if (*sp++ != '.')
 		return (NULL);
@@ -981,7 +1344,6 @@ rcslib_parse_date(char *sp, const char *bp, struct rcslib_date *date)
 	n += *sp++ - '0';
 	if (n > 23)
 		return (NULL);
-	date->rd_tm.tm_hour = n;
 
 	if (*sp++ != '.')
 		return (NULL);
@@ -997,7 +1359,6 @@ rcslib_parse_date(char *sp, const char *bp, struct rcslib_date *date)
 	n += *sp++ - '0';
 	if (n > 59)
 		return (NULL);
-	date->rd_tm.tm_min = n;
 
 	if (*sp++ != '.')
 		return (NULL);
@@ -1013,16 +1374,15 @@ rcslib_parse_date(char *sp, const char *bp, struct rcslib_date *date)
 	n += *sp++ - '0';
 	if (n > 60)
 		return (NULL);
-	date->rd_tm.tm_sec = n;
 
 	date->rd_num.n_str = sv_sp;
-	date->rd_num.n_len = (size_t)(sp - sv_sp);
+	date->rd_num.n_len = (uint8_t)(sp - sv_sp);
 
 	return (sp);
 }
 
 char *
-rcslib_parse_branches(char *sp, const char *bp, struct rcslib_branches *branches)
+rcslib_parse_branches(struct rcslib_file *rcs, char *sp, const char *bp, struct rcslib_branches *branches)
 {
 	const struct rcs_keyword *rcskey = &rcs_keywords[RCS_BRANCHES];
 	struct rcsnum *num;
@@ -1047,38 +1407,26 @@ rcslib_parse_branches(char *sp, const char *bp, struct rcslib_branches *branches
 		if (branches->rb_count == branches->rb_size) {
 			size_t size = branches->rb_size, new = size + 4;
 
-			if ((num = malloc(new * RCSNUM_SIZE)) == NULL) {
-				if (branches->rb_num != NULL)
-					free(branches->rb_num);
+			num = rcslib_realloc(rcs, branches->rb_num, size * RCSNUM_SIZE, new * RCSNUM_SIZE);
+			if (num == NULL)
 				return (NULL);
-			}
-			if (size > 0) {
-				(void)memcpy(num, branches->rb_num, size * RCSNUM_SIZE);
-				free(branches->rb_num);
-			}
 			branches->rb_num = num;
 			branches->rb_size = new;
 		}
 
 		num = &branches->rb_num[branches->rb_count++];
-		if ((sp = rcslib_parse_num(sp, bp, num)) == NULL) {
-			free(branches->rb_num);
+		if ((sp = rcslib_parse_num(sp, bp, num)) == NULL)
 			return (NULL);
-		}
 
 		RCS_SKIP_NORET(sp, bp)
-		if (sp > bp) {
-			free(branches->rb_num);
+		if (sp > bp)
 			return (NULL);
-		}
 		if (*sp == ';')
 			break;
 	}
 
-	if (*sp++ != ';') {
-		free(branches->rb_num);
+	if (*sp++ != ';')
 		return (NULL);
-	}
 
 	return (sp);
 }
@@ -1207,7 +1555,6 @@ char *
 rcslib_parse_num(char *sp, const char *bp, struct rcsnum *num)
 {
 	char *sv_sp = sp;
-	size_t i;
 
 	while (isdigit((int)(*sp)) || (*sp == '.')) {
 		if (++sp > bp)
@@ -1217,25 +1564,12 @@ rcslib_parse_num(char *sp, const char *bp, struct rcsnum *num)
 		return (NULL);
 
 	if (num != NULL) {
+		if ((size_t)(sp - sv_sp) > UINT8_MAX)
+			return (NULL);
 		num->n_str = sv_sp;
-		num->n_len = (size_t)(sp - sv_sp);
-		num->n_level = 0;
-		num->n_num[num->n_level] = 0;
-		sp = sv_sp;
-		for (i = 0 ; i < num->n_len ; i++) {
-			if (*sp == '.') {
-				if (num->n_level == RCSNUM_MAXLEVEL)
-					return (NULL);
-				num->n_num[++num->n_level] = 0;
-			} else {
-				num->n_num[num->n_level] *= 10;
-				num->n_num[num->n_level] += *sp - '0';
-				if (num->n_num[num->n_level] > RCSNUM_MAX)
-					return (NULL);
-			}
-			sp++;
-		}
-		num->n_level++;
+		num->n_len = (uint8_t)(sp - sv_sp);
+		if (!rcslib_num_levels(num))
+			return (NULL);
 	}
 
 	return (sp);
@@ -1324,17 +1658,16 @@ rcslib_parse_string(char *sp, const char *bp, struct rcsstr *str)
 
 	sv_sp = sp;
 
-	while (sp < bp) {
-		if (*sp != '@') {
-			sp++;
-			continue;
-		}
-		if (*(sp + 1) != '@')
+	/* Most of an RCS file is in strings: leave the search to memchr(3). */
+	for (;;) {
+		if ((sp = memchr(sp, '@', (size_t)(bp - sp))) == NULL)
+			return (NULL);
+		if ((sp + 1 == bp) || (*(sp + 1) != '@'))
 			break;
 		sp += 2;
+		if (sp >= bp)
+			return (NULL);
 	}
-	if (sp == bp)
-		return (NULL);
 
 	if (str != NULL) {
 		str->s_str = sv_sp;
@@ -1347,36 +1680,18 @@ rcslib_parse_string(char *sp, const char *bp, struct rcsstr *str)
 struct rcslib_revision *
 rcslib_lookup_revision(struct rcslib_file *rcs, const struct rcsnum *num)
 {
-	struct rcslib_delta *delta = &rcs->delta;
+	struct rcslib_index *idx = &rcs->rf_revidx;
 	struct rcslib_revision *rev;
-	size_t l = 0, r = delta->rd_count, i;
-	int rv;
+	size_t i;
 
-	if ((delta->rd_count == 0) || (num->n_len == 0))
+	if ((rcs->delta.rd_count == 0) || (num->n_len == 0))
 		return (NULL);
 
-	if (delta->rd_count < 100) {
-		for (i = 0 ; i < delta->rd_count ; i++) {
-			rev = &delta->rd_rev[i];
-			if ((num->n_len == rev->num.n_len) && (memcmp(num->n_str, rev->num.n_str, num->n_len) == 0))
-				return (rev);
-		}
-	} else {
-		while (l <= r) {
-			i = (l + r) / 2;
-			rev = &delta->rd_rev[i];
-			if ((rv = rcslib_cmp_num(num, &rev->num)) == 0)
-				return (rev);
-			if (rv < 0) {
-				if (l == i)
-					break;
-				r = i - 1;
-			} else { /* rv > 0 */
-				if (r == i)
-					break;
-				l = i + 1;
-			}
-		}
+	for (i = rcslib_hash(num->n_str, num->n_len) & idx->ri_mask ; idx->ri_slots[i] != 0 ;
+	     i = (i + 1) & idx->ri_mask) {
+		rev = &rcs->delta.rd_rev[idx->ri_slots[i] - 1];
+		if ((num->n_len == rev->num.n_len) && (memcmp(num->n_str, rev->num.n_str, num->n_len) == 0))
+			return (rev);
 	}
 
 	return (NULL);
@@ -1385,16 +1700,20 @@ rcslib_lookup_revision(struct rcslib_file *rcs, const struct rcsnum *num)
 struct rcslib_revision *
 rcslib_lookup_symbol(struct rcslib_file *rcs, void *symstr, size_t symlen)
 {
+	struct rcslib_index *idx = &rcs->rf_symidx;
 	struct rcslib_revision *rev;
 	struct rcslib_symbol *symbol;
 	struct rcsnum *num = NULL, *br_num = NULL, t_num;
 	size_t sv_level, n, i;
 
-	for (i = 0 ; i < rcs->symbols.rs_count ; i++) {
-		symbol = &rcs->symbols.rs_symbols[i];
-		if ((symlen == symbol->sym.s_len) && (memcmp(symstr, symbol->sym.s_sym, symlen) == 0)) {
-			num = &symbol->num;
-			break;
+	if (rcs->symbols.rs_count > 0) {
+		for (i = rcslib_hash(symstr, symlen) & idx->ri_mask ; idx->ri_slots[i] != 0 ;
+		     i = (i + 1) & idx->ri_mask) {
+			symbol = &rcs->symbols.rs_symbols[idx->ri_slots[i] - 1];
+			if ((symlen == symbol->sym.s_len) && (memcmp(symstr, symbol->sym.s_sym, symlen) == 0)) {
+				num = &symbol->num;
+				break;
+			}
 		}
 	}
 	if (num == NULL) {
@@ -1429,7 +1748,7 @@ rcslib_lookup_symbol(struct rcslib_file *rcs, void *symstr, size_t symlen)
 		sv_level = num->n_level;
 	} else {
 		for (sv_level = 0 ; sv_level < num->n_level ; sv_level += 2) {
-			if (num->n_num[sv_level] == 0)
+			if (RCSNUM_LEVEL(num, sv_level) == 0)
 				break;
 		}
 		if (sv_level == num->n_level)
@@ -1452,7 +1771,7 @@ rcslib_lookup_symbol(struct rcslib_file *rcs, void *symstr, size_t symlen)
 	for (n = 0 ; n < rev->branches.rb_count ; n++) {
 		br_num = &rev->branches.rb_num[n];
 		for (i = 0 ; i < sv_level ; i++) {
-			if (br_num->n_num[i] != num->n_num[i])
+			if (RCSNUM_LEVEL(br_num, i) != RCSNUM_LEVEL(num, i))
 				break;
 		}
 		if (i == sv_level)
@@ -1469,13 +1788,257 @@ rcslib_lookup_symbol(struct rcslib_file *rcs, void *symstr, size_t symlen)
 	return (rev);
 }
 
+struct rcslib_writer *
+rcslib_writer_init(void)
+{
+	struct rcslib_writer *rw;
+
+	if ((rw = malloc(sizeof(*rw))) == NULL)
+		return (NULL);
+	rw->rw_size = RCSLIB_WRITER_BUFSIZE;
+	if ((rw->rw_buf = malloc(rw->rw_size)) == NULL) {
+		free(rw);
+		return (NULL);
+	}
+	rw->rw_fd = -1;
+	rw->rw_len = 0;
+	rw->rw_sfd = -1;
+	rw->rw_slen = 0;
+	rw->rw_nocopy = false;
+
+	return (rw);
+}
+
+void
+rcslib_writer_destroy(struct rcslib_writer *rw)
+{
+	free(rw->rw_buf);
+	free(rw);
+}
+
+/* Anything left from a previous file that failed is discarded. */
+void
+rcslib_writer_start(struct rcslib_writer *rw, int fd)
+{
+	rw->rw_fd = fd;
+	rw->rw_len = 0;
+	rw->rw_slen = 0;
+}
+
+bool
+rcslib_writer_write(struct rcslib_writer *rw, const void *data, size_t len)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *)data;
+	iov.iov_len = len;
+
+	return (rcslib_writer_writev(rw, &iov, 1));
+}
+
+/*
+ * What fits is copied into the buffer.  Otherwise the buffer and the
+ * vector are handed to the kernel at once, so that large texts are
+ * never copied.
+ */
+bool
+rcslib_writer_writev(struct rcslib_writer *rw, const struct iovec *iov, int iovcnt)
+{
+	struct iovec vec[RCSLIB_WRITER_IOVMAX + 1];
+	size_t len = 0;
+	int i;
+
+	if (iovcnt > RCSLIB_WRITER_IOVMAX) {
+		errno = EINVAL;
+		return (false);
+	}
+	if ((rw->rw_slen > 0) && !rcslib_writer_drain(rw))
+		return (false);
+
+	for (i = 0 ; i < iovcnt ; i++)
+		len += iov[i].iov_len;
+	if (len <= rw->rw_size - rw->rw_len) {
+		for (i = 0 ; i < iovcnt ; i++) {
+			if (iov[i].iov_len == 0)
+				continue;
+			(void)memcpy(&rw->rw_buf[rw->rw_len], iov[i].iov_base, iov[i].iov_len);
+			rw->rw_len += iov[i].iov_len;
+		}
+		return (true);
+	}
+
+	vec[0].iov_base = rw->rw_buf;
+	vec[0].iov_len = rw->rw_len;
+	for (i = 0 ; i < iovcnt ; i++)
+		vec[i + 1] = iov[i];
+	rw->rw_len = 0;
+
+	return (rcslib_writer_output(rw->rw_fd, vec, iovcnt + 1));
+}
+
+bool
+rcslib_writer_flush(struct rcslib_writer *rw)
+{
+	struct iovec iov;
+
+	if ((rw->rw_slen > 0) && !rcslib_writer_drain(rw))
+		return (false);
+	if (rw->rw_len == 0)
+		return (true);
+
+	iov.iov_base = rw->rw_buf;
+	iov.iov_len = rw->rw_len;
+	rw->rw_len = 0;
+
+	return (rcslib_writer_output(rw->rw_fd, &iov, 1));
+}
+
+/* len bytes of fd at offset, which must not change until the next flush. */
+bool
+rcslib_writer_splice(struct rcslib_writer *rw, int fd, off_t offset, size_t len)
+{
+	if ((rw->rw_slen > 0) && (rw->rw_sfd == fd) && (rw->rw_soff + (off_t)rw->rw_slen == offset)) {
+		rw->rw_slen += len;
+		return (true);
+	}
+	if ((rw->rw_slen > 0) && !rcslib_writer_drain(rw))
+		return (false);
+
+	rw->rw_sfd = fd;
+	rw->rw_soff = offset;
+	rw->rw_slen = len;
+
+	return (true);
+}
+
+/* Small regions are read into the buffer, the rest is copied. */
+bool
+rcslib_writer_drain(struct rcslib_writer *rw)
+{
+	struct iovec iov;
+	ssize_t rn;
+
+	if ((rw->rw_slen < RCSLIB_WRITER_SPLICE) && (rw->rw_slen <= rw->rw_size - rw->rw_len)) {
+		while (rw->rw_slen > 0) {
+			if ((rn = pread(rw->rw_sfd, &rw->rw_buf[rw->rw_len], rw->rw_slen, rw->rw_soff)) == -1) {
+				if (errno == EINTR)
+					continue;
+				return (false);
+			}
+			if (rn == 0) {
+				errno = EIO;
+				return (false);
+			}
+			rw->rw_len += (size_t)rn;
+			rw->rw_soff += rn;
+			rw->rw_slen -= (size_t)rn;
+		}
+		return (true);
+	}
+
+	if (rw->rw_len > 0) {
+		iov.iov_base = rw->rw_buf;
+		iov.iov_len = rw->rw_len;
+		rw->rw_len = 0;
+		if (!rcslib_writer_output(rw->rw_fd, &iov, 1))
+			return (false);
+	}
+
+	return (rcslib_writer_copy(rw));
+}
+
+/*
+ * copy_file_range(2) lets the file system share or copy the blocks itself,
+ * and read(2)/write(2) through the buffer is the fallback.
+ */
+bool
+rcslib_writer_copy(struct rcslib_writer *rw)
+{
+	struct iovec iov;
+	ssize_t rn;
+	size_t len;
+
+#if defined(HAVE_COPY_FILE_RANGE)
+	while (!rw->rw_nocopy && (rw->rw_slen > 0)) {
+		if ((rn = copy_file_range(rw->rw_sfd, &rw->rw_soff, rw->rw_fd, NULL, rw->rw_slen, 0)) == -1) {
+			if (errno == EINTR)
+				continue;
+			if ((errno != ENOSYS) && (errno != EXDEV) && (errno != EINVAL) &&
+			    (errno != EOPNOTSUPP) && (errno != EBADF)) {
+				return (false);
+			}
+			rw->rw_nocopy = true;
+			break;
+		}
+		if (rn == 0) {
+			errno = EIO;
+			return (false);
+		}
+		rw->rw_slen -= (size_t)rn;
+	}
+#endif /* defined(HAVE_COPY_FILE_RANGE) */
+
+	while (rw->rw_slen > 0) {
+		if ((len = rw->rw_slen) > rw->rw_size)
+			len = rw->rw_size;
+		if ((rn = pread(rw->rw_sfd, rw->rw_buf, len, rw->rw_soff)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return (false);
+		}
+		if (rn == 0) {
+			errno = EIO;
+			return (false);
+		}
+		iov.iov_base = rw->rw_buf;
+		iov.iov_len = (size_t)rn;
+		if (!rcslib_writer_output(rw->rw_fd, &iov, 1))
+			return (false);
+		rw->rw_soff += rn;
+		rw->rw_slen -= (size_t)rn;
+	}
+
+	return (true);
+}
+
+/* writev(2) until everything is out, iov is consumed on the way. */
+bool
+rcslib_writer_output(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t wn;
+	size_t len;
+
+	while (iovcnt > 0) {
+		if ((wn = writev(fd, iov, iovcnt)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return (false);
+		}
+		if (wn == 0) {
+			errno = EIO;
+			return (false);
+		}
+		len = (size_t)wn;
+		while ((iovcnt > 0) && (len >= iov->iov_len)) {
+			len -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + len;
+			iov->iov_len -= len;
+		}
+	}
+
+	return (true);
+}
+
 bool
-rcslib_write_delta(int fd, const struct rcslib_revision *rev)
+rcslib_write_delta(struct rcslib_writer *rw, const struct rcslib_revision *rev)
 {
 	const struct rcslib_branches *branches = &rev->branches;
 	struct iovec iov[8];
-	size_t len, i;
-	ssize_t wn;
+	size_t i;
 
 	iov[0].iov_base = rev->num.n_str;
 	iov[0].iov_len = rev->num.n_len;
@@ -1485,23 +2048,18 @@ rcslib_write_delta(int fd, const struct rcslib_revision *rev)
 	iov[2].iov_len = rev->date.rd_num.n_len;
 	iov[3].iov_base = ";\tauthor ";
 	iov[3].iov_len = 9;
-	iov[4].iov_base = rev->author.i_id;
-	iov[4].iov_len = rev->author.i_len;
+	iov[4].iov_base = rev->author->i_id;
+	iov[4].iov_len = rev->author->i_len;
 	iov[5].iov_base = ";\tstate ";
-	if (rev->state.i_len > 0)
+	if (rev->state->i_len > 0)
 		iov[5].iov_len = 8;
 	else
 		iov[5].iov_len = 7;
-	iov[6].iov_base = rev->state.i_id;
-	iov[6].iov_len = rev->state.i_len;
+	iov[6].iov_base = rev->state->i_id;
+	iov[6].iov_len = rev->state->i_len;
 	iov[7].iov_base = ";\nbranches";
 	iov[7].iov_len = 10;
-	len = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len + iov[3].iov_len +
-	      iov[4].iov_len + iov[5].iov_len + iov[6].iov_len + iov[7].iov_len;
-
-	if ((wn = writev(fd, iov, 8)) == -1)
-		return (false);
-	if ((size_t)wn != len)
+	if (!rcslib_writer_writev(rw, iov, 8))
 		return (false);
 
 	iov[0].iov_base = "\n\t";
@@ -1509,10 +2067,7 @@ rcslib_write_delta(int fd, const struct rcslib_revision *rev)
 	for (i = 0 ; i < branches->rb_count ; i++) {
 		iov[1].iov_base = branches->rb_num[i].n_str;
 		iov[1].iov_len = branches->rb_num[i].n_len;
-		len = iov[0].iov_len + iov[1].iov_len;
-		if ((wn = writev(fd, iov, 2)) == -1)
-			return (false);
-		if ((size_t)wn != len)
+		if (!rcslib_writer_writev(rw, iov, 2))
 			return (false);
 	}
 
@@ -1522,21 +2077,14 @@ rcslib_write_delta(int fd, const struct rcslib_revision *rev)
 	iov[1].iov_len = rev->next.n_len;
 	iov[2].iov_base = ";\n\n";
 	iov[2].iov_len = 3;
-	len = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
-	if ((wn = writev(fd, iov, 3)) == -1)
-		return (false);
-	if ((size_t)wn != len)
-		return (false);
 
-	return (true);
+	return (rcslib_writer_writev(rw, iov, 3));
 }
 
 bool
-rcslib_write_deltatext(int fd, const struct rcslib_revision *rev)
+rcslib_write_deltatext(struct rcslib_writer *rw, const struct rcslib_revision *rev)
 {
 	struct iovec iov[7];
-	size_t len;
-	ssize_t wn;
 
 	iov[0].iov_base = "\n\n";
 	iov[0].iov_len = 2;
@@ -1552,48 +2100,476 @@ rcslib_write_deltatext(int fd, const struct rcslib_revision *rev)
 	iov[5].iov_len = rev->text.s_len;
 	iov[6].iov_base = "@\n";
 	iov[6].iov_len = 2;
-	len = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len + iov[3].iov_len +
-	      iov[4].iov_len + iov[5].iov_len + iov[6].iov_len;
 
-	if ((wn = writev(fd, iov, 7)) == -1)
+	return (rcslib_writer_writev(rw, iov, 7));
+}
+
+/*
+ * Where the deltatext of rev is laid out in the file exactly the way
+ * rcslib_write_deltatext() would write it, which is how this library and
+ * RCS itself write files.
+ */
+bool
+rcslib_deltatext_extent(const struct rcslib_file *rcs, const struct rcslib_revision *rev, off_t *offset,
+			size_t *len)
+{
+	const struct rcsnum *num = &rev->num;
+	const char *sp, *ep;
+
+	if ((size_t)(rev->log.s_str - rcs->rf_addr) < (size_t)num->n_len + 8)
+		return (false);
+	sp = rev->log.s_str - num->n_len - 8;
+	if ((memcmp(sp, "\n\n", 2) != 0) || (memcmp(sp + 2, num->n_str, num->n_len) != 0) ||
+	    (memcmp(sp + 2 + num->n_len, "\nlog\n@", 6) != 0)) {
+		return (false);
+	}
+	if (rev->text.s_str != rev->log.s_str + rev->log.s_len + 8)
+		return (false);
+	if (memcmp(rev->log.s_str + rev->log.s_len, "@\ntext\n@", 8) != 0)
+		return (false);
+	ep = rev->text.s_str + rev->text.s_len;
+	if ((ep + 1 > rcs->rf_bp) || (memcmp(ep, "@\n", 2) != 0))
 		return (false);
-	if ((size_t)wn != len)
+
+	*offset = (off_t)(sp - rcs->rf_addr);
+	*len = (size_t)(ep + 2 - sp);
+
+	return (true);
+}
+
+/*
+ * Applies the rcsdiff script to the text, both in their escaped form.  The
+ * result goes to rw and/or the digest ctx, whichever is not NULL.
+ */
+bool
+rcslib_apply_rcsdiff(struct rcslib_writer *rw, const struct hash_args *hashops, void *ctx,
+		     const struct rcsstr *text, char *diff, size_t difflen)
+{
+	struct rcslib_rcsdiff rd;
+	const char *tp = text->s_str, *tbp = text->s_str + text->s_len, *p;
+	char *sp = diff, *bp = diff + difflen;
+	size_t lineno = 0;
+
+	while (sp < bp) {
+		if ((sp = rcslib_parse_rcsdiff(sp, bp, &rd)) == NULL)
+			return (false);
+		if (rd.rd_cmd == 'd') {
+			if ((rd.rd_lineno <= lineno) || (rd.rd_count == 0))
+				return (false);
+			if ((p = rcslib_skip_lines(tp, tbp, rd.rd_lineno - lineno - 1)) == NULL)
+				return (false);
+			if (!rcslib_rcsdiff_output(rw, hashops, ctx, tp, (size_t)(p - tp)))
+				return (false);
+			if ((tp = rcslib_skip_lines(p, tbp, rd.rd_count)) == NULL)
+				return (false);
+			lineno = rd.rd_lineno + rd.rd_count - 1;
+		} else {
+			if (rd.rd_lineno < lineno)
+				return (false);
+			if ((p = rcslib_skip_lines(tp, tbp, rd.rd_lineno - lineno)) == NULL)
+				return (false);
+			if (!rcslib_rcsdiff_output(rw, hashops, ctx, tp, (size_t)(p - tp)))
+				return (false);
+			tp = p;
+			lineno = rd.rd_lineno;
+			if ((p = rcslib_skip_lines(sp, bp, rd.rd_count)) == NULL)
+				return (false);
+			if (!rcslib_rcsdiff_output(rw, hashops, ctx, sp, (size_t)(p - sp)))
+				return (false);
+			sp = (char *)p;
+		}
+	}
+
+	return (rcslib_rcsdiff_output(rw, hashops, ctx, tp, (size_t)(tbp - tp)));
+}
+
+/*
+ * Turns the rcsdiff script, which produces another text from this one,
+ * into the script which produces this text from the other one.  Returns
+ * NULL if the script is not well-formed.
+ */
+char *
+rcslib_invert_rcsdiff(const struct rcsstr *text, const struct rcsstr *diff, size_t *lenp)
+{
+	struct rcslib_rcsdiff rd;
+	const char *tp = text->s_str, *tbp = text->s_str + text->s_len, *p;
+	char *sp = diff->s_str, *bp = diff->s_str + diff->s_len;
+	char *buffer = NULL, cmd[64];
+	size_t lineno = 0, outno = 0, len = 0, size = 0, n;
+	bool partial = false;
+
+	while (sp < bp) {
+		if (partial)
+			goto fail;
+		if ((sp = rcslib_parse_rcsdiff(sp, bp, &rd)) == NULL)
+			goto fail;
+		if (rd.rd_cmd == 'd') {
+			if ((rd.rd_lineno <= lineno) || (rd.rd_count == 0))
+				goto fail;
+			n = rd.rd_lineno - lineno - 1;
+			if ((tp = rcslib_skip_lines(tp, tbp, n)) == NULL)
+				goto fail;
+			outno += n;
+			if ((p = rcslib_skip_lines(tp, tbp, rd.rd_count)) == NULL)
+				goto fail;
+			n = rcslib_rcsdiff_command(cmd, 'a', outno, rd.rd_count);
+			if (!rcslib_rcsdiff_append(&buffer, &len, &size, cmd, n))
+				goto fail;
+			if (!rcslib_rcsdiff_append(&buffer, &len, &size, tp, (size_t)(p - tp)))
+				goto fail;
+			partial = (p[-1] != '\n');
+			tp = p;
+			lineno = rd.rd_lineno + rd.rd_count - 1;
+		} else {
+			if (rd.rd_lineno < lineno)
+				goto fail;
+			n = rd.rd_lineno - lineno;
+			if ((tp = rcslib_skip_lines(tp, tbp, n)) == NULL)
+				goto fail;
+			outno += n;
+			lineno = rd.rd_lineno;
+			if (rd.rd_count == 0)
+				continue;
+			if ((p = rcslib_skip_lines(sp, bp, rd.rd_count)) == NULL)
+				goto fail;
+			n = rcslib_rcsdiff_command(cmd, 'd', outno + 1, rd.rd_count);
+			if (!rcslib_rcsdiff_append(&buffer, &len, &size, cmd, n))
+				goto fail;
+			sp = (char *)p;
+			outno += rd.rd_count;
+		}
+	}
+
+	if (buffer == NULL) {
+		/* the texts are the same */
+		if ((buffer = malloc(1)) == NULL)
+			return (NULL);
+	}
+	*lenp = len;
+
+	return (buffer);
+
+fail:
+	if (buffer != NULL)
+		free(buffer);
+
+	return (NULL);
+}
+
+/* Skips n lines, the last of which may lack its newline. */
+const char *
+rcslib_skip_lines(const char *sp, const char *bp, size_t n)
+{
+	const char *p;
+
+	while (n-- > 0) {
+		if (sp == bp)
+			return (NULL);
+		if ((p = memchr(sp, '\n', (size_t)(bp - sp))) == NULL)
+			sp = bp;
+		else
+			sp = p + 1;
+	}
+
+	return (sp);
+}
+
+bool
+rcslib_rcsdiff_output(struct rcslib_writer *rw, const struct hash_args *hashops, void *ctx, const char *sp,
+		      size_t len)
+{
+	if (len == 0)
+		return (true);
+	if ((rw != NULL) && !rcslib_writer_write(rw, sp, len))
 		return (false);
+	if (ctx != NULL)
+		(*hashops->update)(ctx, sp, len);
 
 	return (true);
 }
 
+bool
+rcslib_rcsdiff_append(char **bufferp, size_t *lenp, size_t *sizep, const char *sp, size_t len)
+{
+	char *buffer;
+	size_t size;
+
+	if (*lenp + len > *sizep) {
+		for (size = (*sizep == 0) ? 4096 : *sizep ; size < *lenp + len ; size *= 2)
+			continue;
+		if ((buffer = realloc(*bufferp, size)) == NULL)
+			return (false);
+		*bufferp = buffer;
+		*sizep = size;
+	}
+	(void)memcpy(*bufferp + *lenp, sp, len);
+	*lenp += len;
+
+	return (true);
+}
+
+/* "[ad]<lineno> <count>\n" */
+size_t
+rcslib_rcsdiff_command(char *buffer, char cmd, size_t lineno, size_t count)
+{
+	char digits[24];
+	size_t len = 0, n, i;
+
+	buffer[len++] = cmd;
+	for (i = 0 ; i < 2 ; i++) {
+		n = 0;
+		do {
+			digits[n++] = (char)('0' + (lineno % 10));
+			lineno /= 10;
+		} while (lineno > 0);
+		while (n > 0)
+			buffer[len++] = digits[--n];
+		buffer[len++] = (i == 0) ? ' ' : '\n';
+		lineno = count;
+	}
+
+	return (len);
+}
+
+/*
+ * The logical digest covers everything rcsfile(5) defines but not the way
+ * it is laid out, so that it is the same for the files on the server and
+ * on the client after an update.
+ */
+bool
+rcslib_digest(struct rcslib_file *rcs, const struct hash_args *hashops, uint8_t *digest)
+{
+	struct rcslib_revision *rev;
+	struct rcslib_symbol *symbol;
+	struct rcslib_lock *lock;
+	struct rcsid *id;
+	uint8_t strict;
+	void *ctx;
+	size_t i, j;
+
+	if (!(*hashops->init)(&ctx))
+		return (false);
+
+	rcslib_digest_update(hashops, ctx, rcs->head.n_str, rcs->head.n_len);
+	rcslib_digest_update(hashops, ctx, rcs->branch.n_str, rcs->branch.n_len);
+
+	rcslib_digest_update(hashops, ctx, NULL, rcs->access.ra_count);
+	for (i = 0 ; i < rcs->access.ra_count ; i++) {
+		id = &rcs->access.ra_id[i];
+		rcslib_digest_update(hashops, ctx, id->i_id, id->i_len);
+	}
+
+	rcslib_digest_update(hashops, ctx, NULL, rcs->symbols.rs_count);
+	for (i = 0 ; i < rcs->symbols.rs_count ; i++) {
+		symbol = &rcs->symbols.rs_symbols[i];
+		rcslib_digest_update(hashops, ctx, symbol->sym.s_sym, symbol->sym.s_len);
+		rcslib_digest_update(hashops, ctx, symbol->num.n_str, symbol->num.n_len);
+	}
+
+	rcslib_digest_update(hashops, ctx, NULL, rcs->locks.rl_count);
+	for (i = 0 ; i < rcs->locks.rl_count ; i++) {
+		lock = &rcs->locks.rl_locks[i];
+		rcslib_digest_update(hashops, ctx, lock->id.i_id, lock->id.i_len);
+		rcslib_digest_update(hashops, ctx, lock->num.n_str, lock->num.n_len);
+	}
+	strict = (rcs->locks.rl_strict != 0) ? 1 : 0;
+	(*hashops->update)(ctx, &strict, 1);
+
+	rcslib_digest_update(hashops, ctx, rcs->comment.s_str, rcs->comment.s_len);
+	rcslib_digest_update(hashops, ctx, rcs->expand.s_str, rcs->expand.s_len);
+
+	rcslib_digest_update(hashops, ctx, NULL, rcs->delta.rd_count);
+	for (i = 0 ; i < rcs->delta.rd_count ; i++) {
+		rev = &rcs->delta.rd_rev[i];
+		rcslib_digest_update(hashops, ctx, rev->num.n_str, rev->num.n_len);
+		rcslib_digest_update(hashops, ctx, rev->date.rd_num.n_str, rev->date.rd_num.n_len);
+		rcslib_digest_update(hashops, ctx, rev->author->i_id, rev->author->i_len);
+		rcslib_digest_update(hashops, ctx, rev->state->i_id, rev->state->i_len);
+		rcslib_digest_update(hashops, ctx, NULL, rev->branches.rb_count);
+		for (j = 0 ; j < rev->branches.rb_count ; j++)
+			rcslib_digest_update(hashops, ctx, rev->branches.rb_num[j].n_str, rev->branches.rb_num[j].n_len);
+		rcslib_digest_update(hashops, ctx, rev->next.n_str, rev->next.n_len);
+	}
+
+	rcslib_digest_update(hashops, ctx, rcs->desc.s_str, rcs->desc.s_len);
+
+	for (i = 0 ; i < rcs->delta.rd_count ; i++) {
+		rev = &rcs->delta.rd_rev[i];
+		rcslib_digest_update(hashops, ctx, rev->log.s_str, rev->log.s_len);
+		rcslib_digest_update(hashops, ctx, rev->text.s_str, rev->text.s_len);
+	}
+
+	(*hashops->final)(ctx, digest);
+
+	return (true);
+}
+
+/* The digest of the log and text of each revision, in rd_rev order. */
+bool
+rcslib_digest_deltatext(struct rcslib_file *rcs, const struct hash_args *hashops, uint8_t *digests)
+{
+	struct rcslib_revision *rev;
+	void *ctx;
+	size_t i;
+
+	for (i = 0 ; i < rcs->delta.rd_count ; i++) {
+		rev = &rcs->delta.rd_rev[i];
+		if (!(*hashops->init)(&ctx))
+			return (false);
+		if (rev->log.s_len > 0)
+			(*hashops->update)(ctx, rev->log.s_str, rev->log.s_len);
+		if (rev->text.s_len > 0)
+			(*hashops->update)(ctx, rev->text.s_str, rev->text.s_len);
+		(*hashops->final)(ctx, &digests[i * hashops->length]);
+	}
+
+	return (true);
+}
+
+/*
+ * The digest of each bucket of the symbol table, over its symbols in
+ * sorted order.
+ */
+bool
+rcslib_digest_symbols(struct rcslib_file *rcs, size_t nbuckets, const struct hash_args *hashops, uint8_t *digests)
+{
+	struct rcslib_symbol *symbol;
+	size_t *start, *order, n = rcs->symbols.rs_count, b, i, j;
+	void *ctx;
+
+	if ((start = malloc((nbuckets + 1 + n) * sizeof(*start))) == NULL)
+		return (false);
+	order = &start[nbuckets + 1];
+
+	(void)memset(start, 0, (nbuckets + 1) * sizeof(*start));
+	for (i = 0 ; i < n ; i++)
+		start[rcslib_symbol_bucket(&rcs->symbols.rs_symbols[i], nbuckets) + 1]++;
+	for (b = 0 ; b < nbuckets ; b++)
+		start[b + 1] += start[b];
+	for (i = 0 ; i < n ; i++) {
+		b = rcslib_symbol_bucket(&rcs->symbols.rs_symbols[i], nbuckets);
+		order[start[b]++] = i;
+	}
+
+	/* start[b] is now the end of bucket b. */
+	for (b = 0, j = 0 ; b < nbuckets ; b++) {
+		if (!(*hashops->init)(&ctx)) {
+			free(start);
+			return (false);
+		}
+		for ( ; j < start[b] ; j++) {
+			symbol = &rcs->symbols.rs_symbols[order[j]];
+			rcslib_digest_update(hashops, ctx, symbol->sym.s_sym, symbol->sym.s_len);
+			rcslib_digest_update(hashops, ctx, symbol->num.n_str, symbol->num.n_len);
+		}
+		(*hashops->final)(ctx, &digests[b * hashops->length]);
+	}
+
+	free(start);
+
+	return (true);
+}
+
+size_t
+rcslib_symbol_buckets(size_t count)
+{
+	size_t n;
+
+	n = (count + RCSLIB_SYMBOL_BUCKETSIZE - 1) / RCSLIB_SYMBOL_BUCKETSIZE;
+	if (n == 0)
+		return (1);
+	if (n > RCSLIB_SYMBOL_BUCKETMAX)
+		return (RCSLIB_SYMBOL_BUCKETMAX);
+
+	return (n);
+}
+
+size_t
+rcslib_symbol_bucket(const struct rcslib_symbol *symbol, size_t nbuckets)
+{
+	return (rcslib_hash(symbol->sym.s_sym, symbol->sym.s_len) % nbuckets);
+}
+
+/* Each field is prefixed with its length, so that no two files collide. */
+void
+rcslib_digest_update(const struct hash_args *hashops, void *ctx, const void *data, size_t len)
+{
+	uint8_t buffer[8];
+	uint64_t len64 = (uint64_t)len;
+	int i;
+
+	for (i = 7 ; i >= 0 ; i--) {
+		buffer[i] = (uint8_t)(len64 & 0xff);
+		len64 >>= 8;
+	}
+	(*hashops->update)(ctx, buffer, sizeof(buffer));
+	if ((data != NULL) && (len > 0))
+		(*hashops->update)(ctx, data, len);
+}
+
 bool
 rcslib_str2num(void *buffer, size_t bufsize, struct rcsnum *num)
 {
 	char *sp = buffer;
 	size_t i;
 
+	if (bufsize > UINT8_MAX)
+		return (false);
+	for (i = 0 ; i < bufsize ; i++) {
+		if (!isdigit((int)sp[i]) && (sp[i] != '.'))
+			return (false);
+	}
+
 	num->n_str = buffer;
-	num->n_len = bufsize;
-	num->n_level = 0;
-	num->n_num[num->n_level] = 0;
+	num->n_len = (uint8_t)bufsize;
+
+	return (rcslib_num_levels(num));
+}
+
+/* n_str consists of digits and dots. */
+bool
+rcslib_num_levels(struct rcsnum *num)
+{
+	const char *sp = num->n_str;
+	int32_t n = 0;
+	size_t level = 0, i;
 
 	for (i = 0 ; i < num->n_len ; i++) {
-		if (*sp == '.') {
-			if (num->n_level == RCSNUM_MAXLEVEL)
-				return (false);
-			num->n_num[++num->n_level] = 0;
-		} else if (isdigit((int)(*sp))) {
-			num->n_num[num->n_level] *= 10;
-			num->n_num[num->n_level] += *sp - '0';
-			if (num->n_num[num->n_level] > RCSNUM_MAX)
+		if (sp[i] == '.') {
+			if (level < RCSNUM_INLINE)
+				num->n_num[level] = n;
+			if (++level == RCSNUM_MAXLEVEL)
 				return (false);
+			n = 0;
 		} else {
-			return (false);
+			n = n * 10 + (sp[i] - '0');
+			if (n > RCSNUM_MAX)
+				return (false);
 		}
-		sp++;
 	}
-	num->n_level++;
+	if (level < RCSNUM_INLINE)
+		num->n_num[level] = n;
+	num->n_level = (uint8_t)(level + 1);
 
 	return (true);
 }
 
+int32_t
+rcslib_num_level(const struct rcsnum *num, size_t level)
+{
+	const char *sp = num->n_str, *ep = sp + num->n_len;
+	int32_t n = 0;
+
+	while ((level > 0) && (sp < ep)) {
+		if (*sp++ == '.')
+			level--;
+	}
+	while ((sp < ep) && (*sp != '.'))
+		n = n * 10 + (*sp++ - '0');
+
+	return (n);
+}
+
 int
 rcslib_cmp_lock(const struct rcslib_lock *l1, const struct rcslib_lock *l2)
 {
@@ -1643,18 +2619,18 @@ rcslib_cmp_num(const struct rcsnum *n1, const struct rcsnum *n2)
 	if (n1->n_level == n2->n_level) {
 		if (n1->n_level == 2) { /* main trunk */
 			for (i = 0 ; i < n1->n_level ; i++) {
-				if (n1->n_num[i] == n2->n_num[i])
+				if (RCSNUM_LEVEL(n1, i) == RCSNUM_LEVEL(n2, i))
 					continue;
-				if (n1->n_num[i] > n2->n_num[i])
+				if (RCSNUM_LEVEL(n1, i) > RCSNUM_LEVEL(n2, i))
 					return (-1);
 				else
 					return (1);
 			}
 		} else {
 			for (i = 0 ; i < n1->n_level ; i++) {
-				if (n1->n_num[i] == n2->n_num[i])
+				if (RCSNUM_LEVEL(n1, i) == RCSNUM_LEVEL(n2, i))
 					continue;
-				if (n1->n_num[i] > n2->n_num[i])
+				if (RCSNUM_LEVEL(n1, i) > RCSNUM_LEVEL(n2, i))
 					return (1);
 				else
 					return (-1);
@@ -1700,15 +2676,15 @@ rcslib_is_ancestor(const struct rcsnum *n1, const struct rcsnum *n2)
 	n = n1->n_level - 1;
 
 	for (i = 0 ; i < n ; i++) {
-		if (n1->n_num[i] != n2->n_num[i])
+		if (RCSNUM_LEVEL(n1, i) != RCSNUM_LEVEL(n2, i))
 			return (false);
 	}
 
 	if (n1->n_level == 2) {
-		if (n1->n_num[n] < n2->n_num[n])
+		if (RCSNUM_LEVEL(n1, n) < RCSNUM_LEVEL(n2, n))
 			return (false);
 	} else {
-		if (n1->n_num[n] > n2->n_num[n])
+		if (RCSNUM_LEVEL(n1, n) > RCSNUM_LEVEL(n2, n))
 			return (false);
 	}
 
@@ -5,6 +5,11 @@
 #ifndef CVSYNC_RCSLIB_H
 #define	CVSYNC_RCSLIB_H
 
+struct hash_args;
+struct iovec;
+struct rcslib_chunk;
+struct rcslib_ident;
+
 #define	RCSLIB_HASH_INIT	(5381)
 #define	RCSLIB_HASH(h, k)	((uint32_t)(((h) * 33) + (int)(k)))
 #define	RCSLIB_HASH_END(h)	((uint32_t)((h) + ((h) >> 5)))
@@ -19,12 +24,17 @@ struct rcsid {
 };
 #define	RCSID_SIZE		(sizeof(struct rcsid))
 
+/*
+ * Only the first RCSNUM_INLINE levels are kept in n_num, the others are
+ * read back from n_str when needed.
+ */
 struct rcsnum {
 	char	*n_str;
-	size_t	n_len;
-	size_t	n_level;
+	uint8_t	n_len;
+	uint8_t	n_level;
 #define	RCSNUM_MAXLEVEL		(16)	/* heuristic */
-	int32_t	n_num[RCSNUM_MAXLEVEL];
+#define	RCSNUM_INLINE		(5)
+	int32_t	n_num[RCSNUM_INLINE];
 };
 #define	RCSNUM_SIZE		(sizeof(struct rcsnum))
 #define	RCSNUM_MAX		(10000000)	/* heuristic */
@@ -52,12 +62,11 @@ struct rcslib_branches {
 
 struct rcslib_date {
 	struct rcsnum	rd_num;
-	struct tm	rd_tm;
 };
 
 struct rcslib_delta {
 	size_t			rd_size, rd_count;
-	struct rcslib_revision	*rd_rev, **rd_rev_deltatext;
+	struct rcslib_revision	*rd_rev;
 };
 
 struct rcslib_lock {
@@ -75,8 +84,8 @@ struct rcslib_locks {
 struct rcslib_revision {
 	struct rcsnum		num;
 	struct rcslib_date	date;
-	struct rcsid		author;
-	struct rcsid		state;
+	const struct rcsid	*author;
+	const struct rcsid	*state;
 	struct rcslib_branches	branches;
 	struct rcsnum		next;
 	struct rcsstr		log;
@@ -100,6 +109,19 @@ struct rcslib_symbols {
 	struct rcslib_symbol	*rs_symbols;
 };
 
+/*
+ * The symbol table is compared as buckets of about RCSLIB_SYMBOL_BUCKETSIZE
+ * symbols each, selected by the hash of the symbol name.
+ */
+#define	RCSLIB_SYMBOL_BUCKETSIZE	(32)
+#define	RCSLIB_SYMBOL_BUCKETMAX		(8192)
+
+/* open addressing over positions in an array, 0 marks an empty slot */
+struct rcslib_index {
+	uint32_t	*ri_slots;
+	size_t		ri_mask;
+};
+
 struct rcslib_file {
 	/* admin */
 	struct rcsnum		head;
@@ -115,8 +137,47 @@ struct rcslib_file {
 
 	/* desc */
 	struct rcsstr		desc;
+
+	/* internal use */
+	char			*rf_addr, *rf_deltatext;
+	const char		*rf_bp;
+	int			rf_flags;
+#define	RCSLIB_FILE_DELTATEXT	(0x0001)
+	struct rcslib_chunk	*rf_arena;
+	size_t			rf_memsize;
+	struct rcslib_ident	**rf_ids;
+	struct rcslib_index	rf_revidx, rf_symidx;
 };
 
+/*
+ * The deltatext section of files this large is read in bounded chunks
+ * rather than through the mapping.
+ */
+#define	RCSLIB_STREAM_SIZE	(4 * 1024 * 1024)
+#define	RCSLIB_STREAM_BUFSIZE	(64 * 1024)
+
+/*
+ * New RCS files are produced through a buffer of RCSLIB_WRITER_BUFSIZE
+ * bytes, which is written out together with whatever overflows it.
+ * Regions spliced from another file are held back until the next write,
+ * so that adjacent ones go out as one, and those of RCSLIB_WRITER_SPLICE
+ * bytes or more are copied by the kernel where it can.
+ */
+struct rcslib_writer {
+	int	rw_fd;
+	char	*rw_buf;
+	size_t	rw_len, rw_size;
+
+	int	rw_sfd;
+	off_t	rw_soff;
+	size_t	rw_slen;
+	bool	rw_nocopy;
+};
+
+#define	RCSLIB_WRITER_BUFSIZE	(256 * 1024)
+#define	RCSLIB_WRITER_IOVMAX	(16)
+#define	RCSLIB_WRITER_SPLICE	(64 * 1024)
+
 /* "[ad]<lineno> <count>\n" */
 struct rcslib_rcsdiff {
 	char	rd_cmd;
@@ -125,13 +186,34 @@ struct rcslib_rcsdiff {
 };
 
 struct rcslib_file *rcslib_init(void *, off_t);
+struct rcslib_file *rcslib_init_lazy(void *, off_t);
+bool rcslib_load_deltatext(struct rcslib_file *);
+bool rcslib_load_deltatext_fd(struct rcslib_file *, int, const struct hash_args *, uint8_t *);
 void rcslib_destroy(struct rcslib_file *);
+size_t rcslib_memsize(const struct rcslib_file *);
 
 struct rcslib_revision *rcslib_lookup_revision(struct rcslib_file *, const struct rcsnum *);
 struct rcslib_revision *rcslib_lookup_symbol(struct rcslib_file *, void *, size_t);
 
-bool rcslib_write_delta(int, const struct rcslib_revision *);
-bool rcslib_write_deltatext(int, const struct rcslib_revision *);
+struct rcslib_writer *rcslib_writer_init(void);
+void rcslib_writer_destroy(struct rcslib_writer *);
+void rcslib_writer_start(struct rcslib_writer *, int);
+bool rcslib_writer_write(struct rcslib_writer *, const void *, size_t);
+bool rcslib_writer_writev(struct rcslib_writer *, const struct iovec *, int);
+bool rcslib_writer_splice(struct rcslib_writer *, int, off_t, size_t);
+bool rcslib_writer_flush(struct rcslib_writer *);
+
+bool rcslib_write_delta(struct rcslib_writer *, const struct rcslib_revision *);
+bool rcslib_write_deltatext(struct rcslib_writer *, const struct rcslib_revision *);
+bool rcslib_deltatext_extent(const struct rcslib_file *, const struct rcslib_revision *, off_t *, size_t *);
+bool rcslib_apply_rcsdiff(struct rcslib_writer *, const struct hash_args *, void *, const struct rcsstr *, char *, size_t);
+char *rcslib_invert_rcsdiff(const struct rcsstr *, const struct rcsstr *, size_t *);
+
+bool rcslib_digest(struct rcslib_file *, const struct hash_args *, uint8_t *);
+bool rcslib_digest_deltatext(struct rcslib_file *, const struct hash_args *, uint8_t *);
+bool rcslib_digest_symbols(struct rcslib_file *, size_t, const struct hash_args *, uint8_t *);
+size_t rcslib_symbol_buckets(size_t);
+size_t rcslib_symbol_bucket(const struct rcslib_symbol *, size_t);
 
 bool rcslib_str2num(void *, size_t, struct rcsnum *);
 
@@ -17,6 +17,20 @@
 #include "mux.h"
 #include "rdiff.h"
 
+uint32_t
+rdiff_blocksize(uint64_t size)
+{
+	uint32_t bsize = RDIFF_MIN_BLOCKSIZE;
+
+	while (bsize < RDIFF_MAX_BLOCKSIZE) {
+		if (size / bsize <= RDIFF_NBLOCKS)
+			break;
+		bsize *= 2;
+	}
+
+	return (bsize);
+}
+
 uint32_t
 rdiff_weak(const uint8_t *addr, size_t size)
 {
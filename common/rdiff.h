@@ -12,6 +12,11 @@ struct mux;
 #define	RDIFF_MAX_BLOCKSIZE	(65536)
 #define	RDIFF_NBLOCKS		(128)
 
+/* Deltatexts whose text is at least this long are signed for rdiff. */
+#define	RDIFF_DELTATEXT_MINSIZE	(RDIFF_MIN_BLOCKSIZE * 8)
+/* RCS files at least this large are signed as a whole as well. */
+#define	RDIFF_RCS_MINSIZE	(RDIFF_MIN_BLOCKSIZE * 16)
+
 #define	RDIFF_CMD_EOF		(0x00)
 #define	RDIFF_CMD_COPY		(0x01)
 #define	RDIFF_CMD_DATA		(0x02)
@@ -21,6 +26,7 @@ struct mux;
 #define	RDIFF_WEAK_LOW(x)	((uint16_t)(x))
 #define	RDIFF_WEAK_HIGH(x)	((uint16_t)((x) >> 16))
 
+uint32_t rdiff_blocksize(uint64_t);
 uint32_t rdiff_weak(const uint8_t *, size_t);
 uint8_t *rdiff_search(uint8_t *, uint8_t *, uint32_t, size_t, uint32_t, uint8_t *, const struct hash_args *);
 
@@ -10,6 +10,7 @@
 #include <stdlib.h>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <pthread.h>
 #include <string.h>
@@ -22,6 +23,7 @@
 #include "compat_limits.h"
 #include "basedef.h"
 
+#include "attribute.h"
 #include "cvsync.h"
 #include "filetypes.h"
 #include "list.h"
@@ -29,8 +31,62 @@
 #include "scanfile.h"
 
 bool scanfile_insert_attr(struct scanfile_args *, struct scanfile_attr *);
-bool scanfile_remove_attr(struct scanfile_args *, struct scanfile_attr *);
+bool scanfile_remove_attr(struct scanfile_args *, struct scanfile_attr *, bool *);
 bool scanfile_flush_attr(struct scanfile_args *, struct scanfile_attr *);
+bool scanfile_copy_attr(struct scanfile_args *, struct scanfile_attr *);
+bool scanfile_put_attr(struct scanfile_args *, struct scanfile_attr *);
+
+struct scanfile_journal_op {
+	struct scanfile_attr	jo_attr;
+	uint8_t			jo_op;
+	size_t			jo_seq;
+};
+
+bool scanfile_journal_name(struct scanfile_args *);
+bool scanfile_journal_open(struct scanfile_args *);
+bool scanfile_journal_write(struct scanfile_args *, uint8_t, struct scanfile_attr *);
+bool scanfile_journal_replay(struct scanfile_args *);
+bool scanfile_journal_merge(struct scanfile_args *, struct scanfile_journal_op *, size_t);
+int scanfile_journal_cmp(const void *, const void *);
+bool scanfile_index(struct scanfile_args *);
+
+/*
+ * Decoded v2 images are shared by all sessions of the daemon once
+ * scanfile_cache_init() has been called, keyed by (dev, inode, size,
+ * mtime) of the scanfile.  An image is never modified once it is in the
+ * cache.  The newest image of each scanfile stays cached while it is
+ * unreferenced; older ones are freed with their last reference.
+ */
+struct scanfile_image {
+	struct scanfile_image	*si_next;
+	dev_t			si_dev;
+	ino_t			si_ino;
+	off_t			si_size;
+	time_t			si_mtime;
+	uint8_t			*si_image, *si_end;
+	uint8_t			**si_dirs;
+	size_t			si_ndirs;
+	uint64_t		si_digest;
+	size_t			si_refcnt;
+	bool			si_stale;
+	char			si_name[1];
+};
+
+bool scanfile_load(struct scanfile_args *);
+void scanfile_cache_release(struct scanfile_image *);
+void scanfile_cache_free(struct scanfile_image *);
+
+static struct scanfile_image *scanfile_cache_head = NULL;
+static bool scanfile_cache_enabled = false;
+static pthread_mutex_t scanfile_cache_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+bool scanfile_decode(struct scanfile_args *);
+bool scanfile_write_entry(struct scanfile_args *, struct scanfile_attr *);
+bool scanfile_write_data(struct scanfile_args *, struct iovec *, int);
+bool scanfile_write_buffer(struct scanfile_args *, const uint8_t *, size_t);
+bool scanfile_write_fd(struct scanfile_args *, const uint8_t *, size_t);
+bool scanfile_flush(struct scanfile_args *);
+bool scanfile_write_header(struct scanfile_args *);
 
 void
 scanfile_init(struct scanfile_args *sa)
@@ -39,9 +95,30 @@ scanfile_init(struct scanfile_args *sa)
 	sa->sa_scanfile_name = NULL;
 	sa->sa_start = NULL;
 	sa->sa_end = NULL;
+	sa->sa_version = SCANFILE_VERSION_1;
+	sa->sa_image = NULL;
+	sa->sa_dirs = NULL;
+	sa->sa_ndirs = 0;
+	sa->sa_digest = 0;
+	sa->sa_cached = NULL;
+	sa->sa_journal = -1;
+	sa->sa_journal_name[0] = '\0';
+	sa->sa_journal_size = 0;
 	sa->sa_tmp = -1;
 	sa->sa_tmp_name[0] = '\0';
 	sa->sa_tmp_mode = 0;
+	sa->sa_tmp_version = SCANFILE_VERSION;
+	sa->sa_tmp_prevlen = 0;
+	sa->sa_tmp_offset = 0;
+	sa->sa_tmp_size = 0;
+	sa->sa_tmp_digest = SCANFILE_FNV_BASIS;
+	sa->sa_tmp_nentries = 0;
+	sa->sa_tmp_table = NULL;
+	sa->sa_tmp_ndirs = 0;
+	sa->sa_tmp_maxdirs = 0;
+	sa->sa_tmp_buffer = NULL;
+	sa->sa_tmp_buflen = 0;
+	sa->sa_tmp_nocache = false;
 	sa->sa_dirlist = NULL;
 	(void)memset(&sa->sa_attr, 0, sizeof(sa->sa_attr));
 	sa->sa_changed = false;
@@ -71,6 +148,20 @@ scanfile_open(const char *fname)
 	sa->sa_start = sa->sa_scanfile->cf_addr;
 	sa->sa_end = sa->sa_start + (size_t)sa->sa_scanfile->cf_size;
 
+	if (((size_t)(sa->sa_end - sa->sa_start) >= SCANFILE_MAGICLEN) &&
+	    (memcmp(sa->sa_start, SCANFILE_MAGIC, SCANFILE_MAGICLEN) == 0)) {
+		if (!scanfile_load(sa)) {
+			logmsg_err("Scanfile Error: %s: failed to decode", fname);
+			scanfile_close(sa);
+			return (NULL);
+		}
+		if (!scanfile_journal_name(sa) || !scanfile_journal_replay(sa)) {
+			logmsg_err("Scanfile Error: %s: failed to replay the journal", fname);
+			scanfile_close(sa);
+			return (NULL);
+		}
+	}
+
 	return (sa);
 }
 
@@ -82,9 +173,313 @@ scanfile_close(struct scanfile_args *sa)
 
 	if (sa->sa_scanfile != NULL)
 		cvsync_fclose(sa->sa_scanfile);
+	if (sa->sa_journal != -1)
+		(void)close(sa->sa_journal);
+	if (sa->sa_cached != NULL) {
+		scanfile_cache_release(sa->sa_cached);
+	} else {
+		if (sa->sa_image != NULL)
+			free(sa->sa_image);
+		if (sa->sa_dirs != NULL)
+			free(sa->sa_dirs);
+	}
 	free(sa);
 }
 
+void
+scanfile_cache_init(void)
+{
+	scanfile_cache_enabled = true;
+}
+
+void
+scanfile_cache_destroy(void)
+{
+	struct scanfile_image *si, *next;
+
+	pthread_mutex_lock(&scanfile_cache_mtx);
+	for (si = scanfile_cache_head ; si != NULL ; si = next) {
+		next = si->si_next;
+		scanfile_cache_free(si);
+	}
+	scanfile_cache_head = NULL;
+	scanfile_cache_enabled = false;
+	pthread_mutex_unlock(&scanfile_cache_mtx);
+}
+
+bool
+scanfile_load(struct scanfile_args *sa)
+{
+	struct scanfile_image *si, *old, **sip;
+	struct stat st;
+	size_t len;
+
+	if (!scanfile_cache_enabled)
+		return (scanfile_decode(sa));
+
+	if (fstat(sa->sa_scanfile->cf_fileno, &st) == -1) {
+		logmsg_err("Scanfile Error: %s: %s", sa->sa_scanfile_name, strerror(errno));
+		return (false);
+	}
+
+	pthread_mutex_lock(&scanfile_cache_mtx);
+	for (si = scanfile_cache_head ; si != NULL ; si = si->si_next) {
+		if (!si->si_stale && (si->si_dev == st.st_dev) && (si->si_ino == st.st_ino) &&
+		    (si->si_size == st.st_size) && (si->si_mtime == st.st_mtime)) {
+			si->si_refcnt++;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&scanfile_cache_mtx);
+
+	if (si == NULL) {
+		if (!scanfile_decode(sa))
+			return (false);
+
+		len = strlen(sa->sa_scanfile_name);
+		if ((si = malloc(sizeof(*si) + len)) == NULL) {
+			logmsg_err("%s", strerror(errno));
+			return (false);
+		}
+		si->si_dev = st.st_dev;
+		si->si_ino = st.st_ino;
+		si->si_size = st.st_size;
+		si->si_mtime = st.st_mtime;
+		si->si_image = sa->sa_image;
+		si->si_end = sa->sa_end;
+		si->si_dirs = sa->sa_dirs;
+		si->si_ndirs = sa->sa_ndirs;
+		si->si_digest = sa->sa_digest;
+		si->si_refcnt = 1;
+		si->si_stale = false;
+		(void)memcpy(si->si_name, sa->sa_scanfile_name, len + 1);
+
+		pthread_mutex_lock(&scanfile_cache_mtx);
+		for (sip = &scanfile_cache_head ; (old = *sip) != NULL ; ) {
+			if (strcmp(old->si_name, si->si_name) == 0) {
+				old->si_stale = true;
+				if (old->si_refcnt == 0) {
+					*sip = old->si_next;
+					scanfile_cache_free(old);
+					continue;
+				}
+			}
+			sip = &old->si_next;
+		}
+		si->si_next = scanfile_cache_head;
+		scanfile_cache_head = si;
+		pthread_mutex_unlock(&scanfile_cache_mtx);
+	}
+
+	sa->sa_cached = si;
+	sa->sa_version = SCANFILE_VERSION_2;
+	sa->sa_image = si->si_image;
+	sa->sa_start = si->si_image;
+	sa->sa_end = si->si_end;
+	sa->sa_dirs = si->si_dirs;
+	sa->sa_ndirs = si->si_ndirs;
+	sa->sa_digest = si->si_digest;
+
+	return (true);
+}
+
+void
+scanfile_cache_release(struct scanfile_image *si)
+{
+	struct scanfile_image **sip;
+
+	pthread_mutex_lock(&scanfile_cache_mtx);
+	if ((--si->si_refcnt == 0) && si->si_stale) {
+		for (sip = &scanfile_cache_head ; *sip != NULL ; sip = &(*sip)->si_next) {
+			if (*sip == si) {
+				*sip = si->si_next;
+				break;
+			}
+		}
+		scanfile_cache_free(si);
+	}
+	pthread_mutex_unlock(&scanfile_cache_mtx);
+}
+
+void
+scanfile_cache_free(struct scanfile_image *si)
+{
+	free(si->si_image);
+	if (si->si_dirs != NULL)
+		free(si->si_dirs);
+	free(si);
+}
+
+bool
+scanfile_decode(struct scanfile_args *sa)
+{
+	uint8_t *sp = sa->sa_start, *bp, *tp, *dp, *ep, *name, *prev = NULL;
+	uint64_t imagesize, tableoff;
+	size_t size = (size_t)(sa->sa_end - sa->sa_start), ndirs;
+	size_t shared, suffixlen, namelen, auxlen, prevlen = 0, i = 0;
+	uint32_t nentries, n = 0;
+
+	if (size < SCANFILE_HDRLEN) {
+		logmsg_err("Scanfile Error: read header");
+		return (false);
+	}
+	if (sp[SCANFILE_MAGICLEN] != SCANFILE_VERSION_2) {
+		logmsg_err("Scanfile Error: unsupported version %u", sp[SCANFILE_MAGICLEN]);
+		return (false);
+	}
+	sa->sa_digest = GetDDWord(&sp[32]);
+	nentries = GetDWord(&sp[8]);
+	ndirs = (size_t)GetDWord(&sp[12]);
+	imagesize = GetDDWord(&sp[16]);
+	tableoff = GetDDWord(&sp[24]);
+	if ((tableoff < SCANFILE_HDRLEN) || (tableoff > size) ||
+	    ((size - (size_t)tableoff) != ndirs * SCANFILE_DIRENTLEN)) {
+		logmsg_err("Scanfile Error: directory table");
+		return (false);
+	}
+	if ((uint64_t)(size_t)imagesize != imagesize) {
+		logmsg_err("Scanfile Error: %s", strerror(EFBIG));
+		return (false);
+	}
+	if (scanfile_digest(SCANFILE_FNV_BASIS, &sp[SCANFILE_HDRLEN], size - SCANFILE_HDRLEN) != sa->sa_digest) {
+		logmsg_err("Scanfile Error: digest mismatch");
+		return (false);
+	}
+
+	if ((sa->sa_image = malloc((size_t)imagesize + 1)) == NULL) {
+		logmsg_err("%s", strerror(errno));
+		return (false);
+	}
+	if ((ndirs > 0) && ((sa->sa_dirs = malloc(ndirs * sizeof(*sa->sa_dirs))) == NULL)) {
+		logmsg_err("%s", strerror(errno));
+		return (false);
+	}
+
+	dp = sa->sa_image;
+	ep = dp + (size_t)imagesize;
+	bp = sa->sa_start + (size_t)tableoff;
+	for (sp += SCANFILE_HDRLEN ; sp < bp ; sp += suffixlen + auxlen + 7) {
+		if ((bp - sp) < 7) {
+			logmsg_err("Scanfile Error: read entry");
+			return (false);
+		}
+		shared = GetWord(&sp[1]);
+		suffixlen = GetWord(&sp[3]);
+		namelen = shared + suffixlen;
+		if ((shared > prevlen) || (namelen == 0) || (namelen > 0xffff)) {
+			logmsg_err("Scanfile Error: entry namelen");
+			return (false);
+		}
+		if ((size_t)(bp - sp) - 7 < suffixlen) {
+			logmsg_err("Scanfile Error: read entry name");
+			return (false);
+		}
+		if ((auxlen = GetWord(&sp[suffixlen + 5])) == 0) {
+			logmsg_err("Scanfile Error: entry auxlen is zero");
+			return (false);
+		}
+		if ((size_t)(bp - sp) - 7 - suffixlen < auxlen) {
+			logmsg_err("Scanfile Error: read entry aux");
+			return (false);
+		}
+		if ((size_t)(ep - dp) < namelen + auxlen + 5) {
+			logmsg_err("Scanfile Error: image size");
+			return (false);
+		}
+
+		if (sp[0] == FILETYPE_DIR) {
+			tp = &bp[i * SCANFILE_DIRENTLEN];
+			if ((shared != 0) || (i == ndirs) ||
+			    (GetDDWord(tp) != (uint64_t)(sp - sa->sa_start)) ||
+			    (GetDDWord(&tp[8]) != (uint64_t)(dp - sa->sa_image))) {
+				logmsg_err("Scanfile Error: directory table");
+				return (false);
+			}
+			sa->sa_dirs[i++] = dp;
+		}
+
+		dp[0] = sp[0];
+		SetWord(&dp[1], namelen);
+		name = &dp[3];
+		if (shared > 0)
+			(void)memcpy(name, prev, shared);
+		(void)memcpy(&name[shared], &sp[5], suffixlen);
+		SetWord(&name[namelen], auxlen);
+		(void)memcpy(&name[namelen + 2], &sp[suffixlen + 7], auxlen);
+
+		prev = name;
+		prevlen = namelen;
+		dp += namelen + auxlen + 5;
+		n++;
+	}
+	if ((n != nentries) || (i != ndirs) || (dp != ep)) {
+		logmsg_err("Scanfile Error: entry count");
+		return (false);
+	}
+
+	sa->sa_version = SCANFILE_VERSION_2;
+	sa->sa_ndirs = ndirs;
+	sa->sa_start = sa->sa_image;
+	sa->sa_end = ep;
+
+	return (true);
+}
+
+uint8_t *
+scanfile_seek(struct scanfile_args *sa, uint8_t *sp, const void *name, size_t namelen)
+{
+	struct scanfile_attr attr;
+	uint8_t *dp;
+	size_t lo = 0, hi = sa->sa_ndirs, mid;
+
+	if (sa->sa_version != SCANFILE_VERSION_2)
+		return (NULL);
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		dp = sa->sa_dirs[mid];
+		if (cvsync_cmp_pathname((const char *)&dp[3], GetWord(&dp[1]), name, namelen) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if ((lo > 0) && (sa->sa_dirs[lo - 1] > sp))
+		sp = sa->sa_dirs[lo - 1];
+
+	while (sp < sa->sa_end) {
+		if (!scanfile_read_attr(sp, sa->sa_end, &attr))
+			return (NULL);
+		if (cvsync_cmp_pathname(attr.a_name, attr.a_namelen, name, namelen) >= 0)
+			break;
+		sp += attr.a_size;
+	}
+
+	return (sp);
+}
+
+/*
+ * attr is the record at sp and is neither an ancestor of prefix nor
+ * under it.  Returns the next record which may be, or NULL when the
+ * scanfile has no directory table.
+ */
+uint8_t *
+scanfile_seek_prefix(struct scanfile_args *sa, uint8_t *sp, struct scanfile_attr *attr, const char *prefix, size_t prefixlen)
+{
+	size_t len;
+
+	if (sa->sa_version != SCANFILE_VERSION_2)
+		return (NULL);
+
+	for (len = 1 ; len <= prefixlen ; len++) {
+		if ((len < prefixlen) && (prefix[len] != '/'))
+			continue;
+		if (cvsync_cmp_pathname(prefix, len, attr->a_name, attr->a_namelen) > 0)
+			return (scanfile_seek(sa, sp, prefix, len));
+	}
+
+	return (sa->sa_end);
+}
+
 bool
 scanfile_read_attr(uint8_t *sp, const uint8_t *bp, struct scanfile_attr *attr)
 {
@@ -129,8 +524,9 @@ scanfile_write_attr(struct scanfile_args *sa, struct scanfile_attr *attr)
 {
 	struct iovec iov[4];
 	uint8_t buffer1[3], buffer2[2];
-	size_t len;
-	ssize_t wn;
+
+	if (sa->sa_tmp_version == SCANFILE_VERSION_2)
+		return (scanfile_write_entry(sa, attr));
 
 	buffer1[0] = attr->a_type;
 	SetWord(&buffer1[1], attr->a_namelen);
@@ -144,19 +540,224 @@ scanfile_write_attr(struct scanfile_args *sa, struct scanfile_attr *attr)
 	iov[2].iov_len = 2;
 	iov[3].iov_base = attr->a_aux;
 	iov[3].iov_len = attr->a_auxlen;
-	len = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len + iov[3].iov_len;
-	if ((wn = writev(sa->sa_tmp, iov, 4)) == -1) {
-		logmsg_err("Scanfile Error: write attr");
+	if (!scanfile_write_data(sa, iov, 4))
 		return (false);
+	sa->sa_tmp_nentries++;
+
+	return (true);
+}
+
+bool
+scanfile_write_entry(struct scanfile_args *sa, struct scanfile_attr *attr)
+{
+	struct iovec iov[4];
+	uint8_t buffer1[5], buffer2[2], *name = attr->a_name, *tp;
+	size_t shared = 0, max;
+
+	if (attr->a_type == FILETYPE_DIR) {
+		if (sa->sa_tmp_ndirs == sa->sa_tmp_maxdirs) {
+			if ((max = sa->sa_tmp_maxdirs * 2) == 0)
+				max = 64;
+			if ((tp = realloc(sa->sa_tmp_table, max * SCANFILE_DIRENTLEN)) == NULL) {
+				logmsg_err("%s", strerror(errno));
+				return (false);
+			}
+			sa->sa_tmp_table = tp;
+			sa->sa_tmp_maxdirs = max;
+		}
+		tp = &sa->sa_tmp_table[sa->sa_tmp_ndirs++ * SCANFILE_DIRENTLEN];
+		SetDDWord(tp, sa->sa_tmp_offset + SCANFILE_HDRLEN);
+		SetDDWord(&tp[8], sa->sa_tmp_size);
+	} else {
+		if ((max = sa->sa_tmp_prevlen) > attr->a_namelen)
+			max = attr->a_namelen;
+		while ((shared < max) && (sa->sa_tmp_prev[shared] == name[shared]))
+			shared++;
 	}
-	if ((size_t)wn != len) {
-		logmsg_err("Scanfile Error: write attr");
+
+	buffer1[0] = attr->a_type;
+	SetWord(&buffer1[1], shared);
+	SetWord(&buffer1[3], attr->a_namelen - shared);
+	SetWord(buffer2, attr->a_auxlen);
+
+	iov[0].iov_base = (void *)buffer1;
+	iov[0].iov_len = 5;
+	iov[1].iov_base = &name[shared];
+	iov[1].iov_len = attr->a_namelen - shared;
+	iov[2].iov_base = (void *)buffer2;
+	iov[2].iov_len = 2;
+	iov[3].iov_base = attr->a_aux;
+	iov[3].iov_len = attr->a_auxlen;
+	if (!scanfile_write_data(sa, iov, 4))
+		return (false);
+
+	if (attr->a_namelen <= sizeof(sa->sa_tmp_prev)) {
+		(void)memcpy(&sa->sa_tmp_prev[shared], &name[shared], attr->a_namelen - shared);
+		sa->sa_tmp_prevlen = attr->a_namelen;
+	} else {
+		sa->sa_tmp_prevlen = 0;
+	}
+	sa->sa_tmp_size += attr->a_namelen + attr->a_auxlen + 5;
+	sa->sa_tmp_nentries++;
+
+	return (true);
+}
+
+bool
+scanfile_write_data(struct scanfile_args *sa, struct iovec *iov, int iovcnt)
+{
+	int i;
+
+	for (i = 0 ; i < iovcnt ; i++) {
+		if (sa->sa_tmp_version == SCANFILE_VERSION_2) {
+			sa->sa_tmp_digest = scanfile_digest(sa->sa_tmp_digest, iov[i].iov_base,
+							    iov[i].iov_len);
+		}
+		if (!scanfile_write_buffer(sa, iov[i].iov_base, iov[i].iov_len))
+			return (false);
+		sa->sa_tmp_offset += iov[i].iov_len;
+	}
+
+	return (true);
+}
+
+bool
+scanfile_write_buffer(struct scanfile_args *sa, const uint8_t *sp, size_t len)
+{
+	if (sa->sa_tmp_buflen + len > SCANFILE_BSIZE) {
+		if (!scanfile_flush(sa))
+			return (false);
+		if (len >= SCANFILE_BSIZE)
+			return (scanfile_write_fd(sa, sp, len));
+	}
+	(void)memcpy(&sa->sa_tmp_buffer[sa->sa_tmp_buflen], sp, len);
+	sa->sa_tmp_buflen += len;
+
+	return (true);
+}
+
+bool
+scanfile_flush(struct scanfile_args *sa)
+{
+	if (sa->sa_tmp_buflen == 0)
+		return (true);
+	if (!scanfile_write_fd(sa, sa->sa_tmp_buffer, sa->sa_tmp_buflen))
+		return (false);
+	sa->sa_tmp_buflen = 0;
+
+	return (true);
+}
+
+bool
+scanfile_write_fd(struct scanfile_args *sa, const uint8_t *sp, size_t len)
+{
+	const uint8_t *bp = sp + len;
+	ssize_t wn;
+#if defined(POSIX_FADV_DONTNEED)
+	off_t offset;
+#endif /* defined(POSIX_FADV_DONTNEED) */
+
+	while (sp < bp) {
+		if ((wn = write(sa->sa_tmp, sp, (size_t)(bp - sp))) == -1) {
+			if (errno == EINTR) {
+				logmsg_intr();
+				continue;
+			}
+			logmsg_err("Scanfile Error: %s: %s", sa->sa_tmp_name, strerror(errno));
+			return (false);
+		}
+		if (wn == 0) {
+			logmsg_err("Scanfile Error: %s: write", sa->sa_tmp_name);
+			return (false);
+		}
+		sp += wn;
+	}
+
+#if defined(POSIX_FADV_DONTNEED)
+	/*
+	 * The scanfile is read again by the next run, so the written range
+	 * is only dropped from the page cache on request.
+	 */
+	if (sa->sa_tmp_nocache && ((offset = lseek(sa->sa_tmp, (off_t)0, SEEK_CUR)) != -1))
+		(void)posix_fadvise(sa->sa_tmp, offset - (off_t)len, (off_t)len, POSIX_FADV_DONTNEED);
+#endif /* defined(POSIX_FADV_DONTNEED) */
+
+	return (true);
+}
+
+bool
+scanfile_write_header(struct scanfile_args *sa)
+{
+	struct iovec iov;
+	uint8_t header[SCANFILE_HDRLEN];
+	uint64_t tableoff = sa->sa_tmp_offset + SCANFILE_HDRLEN;
+
+	if (sa->sa_tmp_ndirs > 0) {
+		iov.iov_base = (void *)sa->sa_tmp_table;
+		iov.iov_len = sa->sa_tmp_ndirs * SCANFILE_DIRENTLEN;
+		if (!scanfile_write_data(sa, &iov, 1))
+			return (false);
+	}
+	if (!scanfile_flush(sa))
+		return (false);
+
+	(void)memset(header, 0, sizeof(header));
+	(void)memcpy(header, SCANFILE_MAGIC, SCANFILE_MAGICLEN);
+	header[SCANFILE_MAGICLEN] = SCANFILE_VERSION_2;
+	SetDWord(&header[8], sa->sa_tmp_nentries);
+	SetDWord(&header[12], sa->sa_tmp_ndirs);
+	SetDDWord(&header[16], sa->sa_tmp_size);
+	SetDDWord(&header[24], tableoff);
+	SetDDWord(&header[32], sa->sa_tmp_digest);
+
+	if (lseek(sa->sa_tmp, (off_t)0, SEEK_SET) == -1) {
+		logmsg_err("Scanfile Error: %s", strerror(errno));
+		return (false);
+	}
+	if (write(sa->sa_tmp, header, sizeof(header)) != (ssize_t)sizeof(header)) {
+		logmsg_err("Scanfile Error: write header");
 		return (false);
 	}
 
 	return (true);
 }
 
+bool
+scanfile_write_image(struct scanfile_args *sa, uint8_t *sp, const uint8_t *bp)
+{
+	struct scanfile_attr attr;
+	struct iovec iov;
+
+	if (sa->sa_tmp_version == SCANFILE_VERSION_2) {
+		while (sp < bp) {
+			if (!scanfile_read_attr(sp, bp, &attr))
+				return (false);
+			if (!scanfile_write_entry(sa, &attr))
+				return (false);
+			sp += attr.a_size;
+		}
+		return (true);
+	}
+
+	iov.iov_base = (void *)sp;
+	iov.iov_len = (size_t)(bp - sp);
+
+	return (scanfile_write_data(sa, &iov, 1));
+}
+
+uint64_t
+scanfile_digest(uint64_t digest, const uint8_t *sp, size_t len)
+{
+	const uint8_t *bp = sp + len;
+
+	while (sp < bp) {
+		digest ^= *sp++;
+		digest *= SCANFILE_FNV_PRIME;
+	}
+
+	return (digest);
+}
+
 bool
 scanfile_create(struct scanfile_create_args *sca)
 {
@@ -175,6 +776,24 @@ scanfile_create(struct scanfile_create_args *sca)
 	return (true);
 }
 
+bool
+scanfile_refresh(struct scanfile_create_args *sca, char **dirs, size_t ndirs)
+{
+	switch (cvsync_release_pton(sca->sca_release)) {
+	case CVSYNC_RELEASE_RCS:
+		if (!scanfile_rcs_refresh(sca, dirs, ndirs)) {
+			logmsg_err("Scanfile Error: %s: failed to refresh", sca->sca_name);
+			return (false);
+		}
+		break;
+	default:
+		logmsg_err("Scanfile Error: unknown release type");
+		return (false);
+	}
+
+	return (true);
+}
+
 bool
 scanfile_create_tmpfile(struct scanfile_args *sa, mode_t mode)
 {
@@ -184,6 +803,25 @@ scanfile_create_tmpfile(struct scanfile_args *sa, mode_t mode)
 	if (sa == NULL)
 		return (true);
 
+	if (!scanfile_journal_name(sa))
+		return (false);
+	sa->sa_tmp_mode = mode;
+
+	if ((sa->sa_scanfile != NULL) && (sa->sa_version == SCANFILE_VERSION_2) &&
+	    (sa->sa_journal_size <= sa->sa_scanfile->cf_size / SCANFILE_JOURNAL_RATIO)) {
+		if ((sa->sa_dirlist = list_init()) == NULL) {
+			logmsg_err("Scanfile Error: list init");
+			return (false);
+		}
+		list_set_destructor(sa->sa_dirlist, free);
+		if (!scanfile_journal_open(sa)) {
+			list_destroy(sa->sa_dirlist);
+			sa->sa_dirlist = NULL;
+			return (false);
+		}
+		return (true);
+	}
+
 	len = strlen(sa->sa_scanfile_name);
 	for (ep = &sa->sa_scanfile_name[len - 1] ; ep >= sa->sa_scanfile_name ; ep--) {
 		if (*ep == '/')
@@ -202,7 +840,23 @@ scanfile_create_tmpfile(struct scanfile_args *sa, mode_t mode)
 		logmsg_err("Scanfile Error: %s: %s",  sa->sa_tmp_name, strerror(errno));
 		return (false);
 	}
-	sa->sa_tmp_mode = mode;
+
+	if (sa->sa_tmp_version == SCANFILE_VERSION_2) {
+		if (lseek(sa->sa_tmp, (off_t)SCANFILE_HDRLEN, SEEK_SET) == -1) {
+			logmsg_err("Scanfile Error: %s: %s",  sa->sa_tmp_name, strerror(errno));
+			(void)unlink(sa->sa_tmp_name);
+			(void)close(sa->sa_tmp);
+			return (false);
+		}
+	}
+
+	if ((sa->sa_tmp_buffer = malloc(SCANFILE_BSIZE)) == NULL) {
+		logmsg_err("%s", strerror(errno));
+		(void)unlink(sa->sa_tmp_name);
+		(void)close(sa->sa_tmp);
+		return (false);
+	}
+	sa->sa_tmp_buflen = 0;
 
 	if ((sa->sa_dirlist = list_init()) == NULL) {
 		logmsg_err("Scanfile Error: list init");
@@ -221,23 +875,43 @@ scanfile_remove_tmpfile(struct scanfile_args *sa)
 	if (sa == NULL)
 		return;
 
+	if (sa->sa_journal != -1) {
+		(void)close(sa->sa_journal);
+		sa->sa_journal = -1;
+	}
 	if (sa->sa_tmp != -1)
 		(void)close(sa->sa_tmp);
 	if (strlen(sa->sa_tmp_name) != 0)
 		(void)unlink(sa->sa_tmp_name);
 	if (sa->sa_dirlist != NULL)
 		list_destroy(sa->sa_dirlist);
+	if (sa->sa_tmp_table != NULL) {
+		free(sa->sa_tmp_table);
+		sa->sa_tmp_table = NULL;
+	}
+	if (sa->sa_tmp_buffer != NULL) {
+		free(sa->sa_tmp_buffer);
+		sa->sa_tmp_buffer = NULL;
+	}
 }
 
 bool
 scanfile_rename(struct scanfile_args *sa)
 {
-	ssize_t wn;
-	size_t len;
-
 	if (sa == NULL)
 		return (true);
 
+	if (sa->sa_journal != -1) {
+		if (close(sa->sa_journal) == -1) {
+			logmsg_err("Scanfile Error: %s: %s", sa->sa_journal_name, strerror(errno));
+			return (false);
+		}
+		sa->sa_journal = -1;
+		list_destroy(sa->sa_dirlist);
+		sa->sa_dirlist = NULL;
+		return (true);
+	}
+
 	if (!sa->sa_changed) {
 		if (close(sa->sa_tmp) == -1) {
 			logmsg_err("Scanfile Error: %s", strerror(errno));
@@ -253,6 +927,14 @@ scanfile_rename(struct scanfile_args *sa)
 			list_destroy(sa->sa_dirlist);
 			sa->sa_dirlist = NULL;
 		}
+		if (sa->sa_tmp_table != NULL) {
+			free(sa->sa_tmp_table);
+			sa->sa_tmp_table = NULL;
+		}
+		if (sa->sa_tmp_buffer != NULL) {
+			free(sa->sa_tmp_buffer);
+			sa->sa_tmp_buffer = NULL;
+		}
 		return (true);
 	}
 
@@ -261,30 +943,23 @@ scanfile_rename(struct scanfile_args *sa)
 			logmsg_err("Scanfile Error: Flush");
 			return (false);
 		}
-		while (sa->sa_start < sa->sa_end) {
-			len = (size_t)(sa->sa_end - sa->sa_start);
-			if (len > CVSYNC_BSIZE)
-				len = CVSYNC_BSIZE;
-			if ((wn = write(sa->sa_tmp, sa->sa_start, len)) == -1) {
-				if (errno == EINTR) {
-					logmsg_intr();
-					continue;
-				}
-				logmsg_err("Scanfile Error: Flush: %s", strerror(errno));
-				return (false);
-			}
-			if (wn == 0)
-				break;
-			sa->sa_start += wn;
-		}
-		if (sa->sa_start != sa->sa_end) {
+		if (!scanfile_write_image(sa, sa->sa_start, sa->sa_end)) {
 			logmsg_err("Scanfile Error: Flush");
 			return (false);
 		}
+		sa->sa_start = sa->sa_end;
 		cvsync_fclose(sa->sa_scanfile);
 		sa->sa_scanfile = NULL;
 	}
 	if (sa->sa_tmp != -1) {
+		if ((sa->sa_tmp_version == SCANFILE_VERSION_2) && !scanfile_write_header(sa)) {
+			logmsg_err("Scanfile Error: Flush");
+			return (false);
+		}
+		if (!scanfile_flush(sa)) {
+			logmsg_err("Scanfile Error: Flush");
+			return (false);
+		}
 		if (fchmod(sa->sa_tmp, sa->sa_tmp_mode) == -1) {
 			logmsg_err("Scanfile Error: %s", strerror(errno));
 			return (false);
@@ -299,11 +974,24 @@ scanfile_rename(struct scanfile_args *sa)
 			return (false);
 		}
 		sa->sa_tmp_name[0] = '\0';
+		/* The new scanfile already contains the journal. */
+		if ((unlink(sa->sa_journal_name) == -1) && (errno != ENOENT)) {
+			logmsg_err("Scanfile Error: %s: %s", sa->sa_journal_name, strerror(errno));
+			return (false);
+		}
 	}
 	if (sa->sa_dirlist != NULL) {
 		list_destroy(sa->sa_dirlist);
 		sa->sa_dirlist = NULL;
 	}
+	if (sa->sa_tmp_table != NULL) {
+		free(sa->sa_tmp_table);
+		sa->sa_tmp_table = NULL;
+	}
+	if (sa->sa_tmp_buffer != NULL) {
+		free(sa->sa_tmp_buffer);
+		sa->sa_tmp_buffer = NULL;
+	}
 
 	return (true);
 }
@@ -325,9 +1013,7 @@ scanfile_add(struct scanfile_args *sa, uint8_t type, void *name, size_t namelen,
 		if (rv > 0)
 			break;
 		/* rv < 0 */
-		if (!scanfile_flush_attr(sa, attr))
-			return (false);
-		if (!scanfile_write_attr(sa, attr))
+		if (!scanfile_copy_attr(sa, attr))
 			return (false);
 		sa->sa_start += attr->a_size;
 	}
@@ -338,9 +1024,7 @@ scanfile_add(struct scanfile_args *sa, uint8_t type, void *name, size_t namelen,
 	attr->a_aux = aux;
 	attr->a_auxlen = auxlen;
 
-	if (!scanfile_flush_attr(sa, attr))
-		return (false);
-	if (!scanfile_write_attr(sa, attr))
+	if (!scanfile_put_attr(sa, attr))
 		return (false);
 
 	return (true);
@@ -350,6 +1034,7 @@ bool
 scanfile_remove(struct scanfile_args *sa, uint8_t type, void *name, size_t namelen)
 {
 	struct scanfile_attr *attr = &sa->sa_attr;
+	bool found = false;
 	int rv;
 
 	sa->sa_changed = true;
@@ -360,6 +1045,7 @@ scanfile_remove(struct scanfile_args *sa, uint8_t type, void *name, size_t namel
 
 		if ((rv = cvsync_cmp_pathname(attr->a_name, attr->a_namelen, name, namelen)) == 0) {
 			sa->sa_start += attr->a_size;
+			found = true;
 			break;
 		}
 		if (rv > 0)
@@ -369,9 +1055,7 @@ scanfile_remove(struct scanfile_args *sa, uint8_t type, void *name, size_t namel
 			if (!scanfile_insert_attr(sa, attr))
 				return (false);
 		} else {
-			if (!scanfile_flush_attr(sa, attr))
-				return (false);
-			if (!scanfile_write_attr(sa, attr))
+			if (!scanfile_copy_attr(sa, attr))
 				return (false);
 		}
 		sa->sa_start += attr->a_size;
@@ -382,10 +1066,17 @@ scanfile_remove(struct scanfile_args *sa, uint8_t type, void *name, size_t namel
 	attr->a_namelen = namelen;
 
 	if (attr->a_type == FILETYPE_DIR) {
-		if (!scanfile_remove_attr(sa, attr))
+		if (!scanfile_remove_attr(sa, attr, &found))
 			return (false);
 	}
 
+	/*
+	 * Only what the full rewrite would have dropped is deleted, so that
+	 * the replayed journal gives the same scanfile.
+	 */
+	if ((sa->sa_journal != -1) && found)
+		return (scanfile_journal_write(sa, SCANFILE_JOURNAL_DELETE, attr));
+
 	return (true);
 }
 
@@ -406,9 +1097,7 @@ scanfile_replace(struct scanfile_args *sa, uint8_t type, void *name, size_t name
 		if (rv == 0)
 			break;
 		/* rv < 0 */
-		if (!scanfile_flush_attr(sa, attr))
-			return (false);
-		if (!scanfile_write_attr(sa, attr))
+		if (!scanfile_copy_attr(sa, attr))
 			return (false);
 		sa->sa_start += attr->a_size;
 	}
@@ -423,9 +1112,7 @@ scanfile_replace(struct scanfile_args *sa, uint8_t type, void *name, size_t name
 	attr->a_aux = aux;
 	attr->a_auxlen = auxlen;
 
-	if (!scanfile_flush_attr(sa, attr))
-		return (false);
-	if (!scanfile_write_attr(sa, attr))
+	if (!scanfile_put_attr(sa, attr))
 		return (false);
 
 	return (true);
@@ -448,9 +1135,68 @@ scanfile_update(struct scanfile_args *sa, uint8_t type, void *name, size_t namel
 		if (rv == 0)
 			break;
 		/* rv < 0 */
-		if (!scanfile_flush_attr(sa, attr))
+		if (!scanfile_copy_attr(sa, attr))
+			return (false);
+		sa->sa_start += attr->a_size;
+	}
+	if (sa->sa_start == sa->sa_end)
+		return (false);
+
+	sa->sa_start += attr->a_size;
+
+	if (attr->a_type != type)
+		return (false);
+	switch (attr->a_type) {
+	case FILETYPE_DIR:
+	case FILETYPE_FILE:
+		if (attr->a_auxlen != auxlen)
+			return (false);
+		break;
+	case FILETYPE_RCS:
+	case FILETYPE_RCS_ATTIC:
+		/* The digest may come and go. */
+		if (attr->a_auxlen < RCS_ATTRLEN_RCS)
 			return (false);
-		if (!scanfile_write_attr(sa, attr))
+		break;
+	default:
+		break;
+	}
+
+	attr->a_type = type;
+	attr->a_name = name;
+	attr->a_namelen = namelen;
+	attr->a_aux = aux;
+	attr->a_auxlen = auxlen;
+
+	if (!scanfile_put_attr(sa, attr))
+		return (false);
+
+	return (true);
+}
+
+/*
+ * Same as scanfile_update(), but keeps the part of the old aux which
+ * follows the first auxlen bytes, i.e. the digest of an RCS file.
+ */
+bool
+scanfile_setattr(struct scanfile_args *sa, uint8_t type, void *name, size_t namelen, void *aux, size_t auxlen,
+		 size_t auxmax)
+{
+	struct scanfile_attr *attr = &sa->sa_attr;
+	int rv;
+
+	sa->sa_changed = true;
+
+	while (sa->sa_start < sa->sa_end) {
+		if (!scanfile_read_attr(sa->sa_start, sa->sa_end, attr))
+			return (false);
+
+		if ((rv = cvsync_cmp_pathname(attr->a_name, attr->a_namelen, name, namelen)) > 0)
+			return (false);
+		if (rv == 0)
+			break;
+		/* rv < 0 */
+		if (!scanfile_copy_attr(sa, attr))
 			return (false);
 		sa->sa_start += attr->a_size;
 	}
@@ -461,8 +1207,12 @@ scanfile_update(struct scanfile_args *sa, uint8_t type, void *name, size_t namel
 
 	if (attr->a_type != type)
 		return (false);
-	if ((attr->a_type != FILETYPE_SYMLINK) && (attr->a_auxlen != auxlen))
+	if ((attr->a_auxlen < auxlen) || (attr->a_auxlen > auxmax))
 		return (false);
+	if (attr->a_auxlen > auxlen) {
+		(void)memcpy((uint8_t *)aux + auxlen, (uint8_t *)attr->a_aux + auxlen, attr->a_auxlen - auxlen);
+		auxlen = attr->a_auxlen;
+	}
 
 	attr->a_type = type;
 	attr->a_name = name;
@@ -470,9 +1220,7 @@ scanfile_update(struct scanfile_args *sa, uint8_t type, void *name, size_t namel
 	attr->a_aux = aux;
 	attr->a_auxlen = auxlen;
 
-	if (!scanfile_flush_attr(sa, attr))
-		return (false);
-	if (!scanfile_write_attr(sa, attr))
+	if (!scanfile_put_attr(sa, attr))
 		return (false);
 
 	return (true);
@@ -498,7 +1246,7 @@ scanfile_insert_attr(struct scanfile_args *sa, struct scanfile_attr *attr)
 }
 
 bool
-scanfile_remove_attr(struct scanfile_args *sa, struct scanfile_attr *attr)
+scanfile_remove_attr(struct scanfile_args *sa, struct scanfile_attr *attr, bool *found)
 {
 	struct listent *lep;
 	struct scanfile_attr *dirattr;
@@ -515,6 +1263,7 @@ scanfile_remove_attr(struct scanfile_args *sa, struct scanfile_attr *attr)
 		if (!list_remove(sa->sa_dirlist, lep))
 			return (false);
 		free(dirattr);
+		*found = true;
 	}
 
 	return (true);
@@ -536,10 +1285,356 @@ scanfile_flush_attr(struct scanfile_args *sa, struct scanfile_attr *attr)
 				break;
 			}
 		}
-		if (!scanfile_write_attr(sa, dirattr))
+		/* The journal leaves it in the scanfile as it is. */
+		if ((sa->sa_journal == -1) && !scanfile_write_attr(sa, dirattr)) {
+			free(dirattr);
 			return (false);
+		}
 		free(dirattr);
 	}
 
 	return (true);
 }
+
+bool
+scanfile_copy_attr(struct scanfile_args *sa, struct scanfile_attr *attr)
+{
+	if (!scanfile_flush_attr(sa, attr))
+		return (false);
+	if (sa->sa_journal != -1)
+		return (true);
+	if (!scanfile_write_attr(sa, attr))
+		return (false);
+
+	return (true);
+}
+
+bool
+scanfile_put_attr(struct scanfile_args *sa, struct scanfile_attr *attr)
+{
+	if (!scanfile_flush_attr(sa, attr))
+		return (false);
+	if (sa->sa_journal != -1)
+		return (scanfile_journal_write(sa, SCANFILE_JOURNAL_SET, attr));
+	if (!scanfile_write_attr(sa, attr))
+		return (false);
+
+	return (true);
+}
+
+bool
+scanfile_journal_name(struct scanfile_args *sa)
+{
+	size_t len = strlen(sa->sa_scanfile_name);
+
+	if (len + SCANFILE_JOURNAL_SUFFIXLEN >= sizeof(sa->sa_journal_name)) {
+		logmsg_err("Scanfile Error: %s: %s", sa->sa_scanfile_name, strerror(ENAMETOOLONG));
+		return (false);
+	}
+	(void)memcpy(sa->sa_journal_name, sa->sa_scanfile_name, len);
+	(void)memcpy(&sa->sa_journal_name[len], SCANFILE_JOURNAL_SUFFIX, SCANFILE_JOURNAL_SUFFIXLEN);
+	sa->sa_journal_name[len + SCANFILE_JOURNAL_SUFFIXLEN] = '\0';
+
+	return (true);
+}
+
+bool
+scanfile_journal_open(struct scanfile_args *sa)
+{
+	uint8_t header[SCANFILE_JOURNAL_HDRLEN];
+	int flags = O_WRONLY|O_CREAT|O_APPEND;
+
+	if (sa->sa_journal_size == 0)
+		flags |= O_TRUNC;
+	if ((sa->sa_journal = open(sa->sa_journal_name, flags, sa->sa_tmp_mode)) == -1) {
+		logmsg_err("Scanfile Error: %s: %s", sa->sa_journal_name, strerror(errno));
+		return (false);
+	}
+
+	if (sa->sa_journal_size > 0) {
+		/* Drop a record torn by an interrupted run. */
+		if (ftruncate(sa->sa_journal, sa->sa_journal_size) == -1) {
+			logmsg_err("Scanfile Error: %s: %s", sa->sa_journal_name, strerror(errno));
+			(void)close(sa->sa_journal);
+			sa->sa_journal = -1;
+			return (false);
+		}
+		return (true);
+	}
+
+	(void)memset(header, 0, sizeof(header));
+	(void)memcpy(header, SCANFILE_JOURNAL_MAGIC, SCANFILE_MAGICLEN);
+	header[SCANFILE_MAGICLEN] = SCANFILE_JOURNAL_VERSION;
+	SetDDWord(&header[8], sa->sa_digest);
+	if (write(sa->sa_journal, header, sizeof(header)) != (ssize_t)sizeof(header)) {
+		logmsg_err("Scanfile Error: %s: write header", sa->sa_journal_name);
+		(void)close(sa->sa_journal);
+		sa->sa_journal = -1;
+		return (false);
+	}
+	sa->sa_journal_size = SCANFILE_JOURNAL_HDRLEN;
+
+	return (true);
+}
+
+bool
+scanfile_journal_write(struct scanfile_args *sa, uint8_t op, struct scanfile_attr *attr)
+{
+	struct iovec iov[4];
+	uint8_t buffer1[4], buffer2[2];
+	size_t auxlen, len;
+	ssize_t wn;
+
+	auxlen = (op == SCANFILE_JOURNAL_SET) ? attr->a_auxlen : 0;
+
+	buffer1[0] = op;
+	buffer1[1] = attr->a_type;
+	SetWord(&buffer1[2], attr->a_namelen);
+	SetWord(buffer2, auxlen);
+
+	iov[0].iov_base = (void *)buffer1;
+	iov[0].iov_len = 4;
+	iov[1].iov_base = attr->a_name;
+	iov[1].iov_len = attr->a_namelen;
+	iov[2].iov_base = (void *)buffer2;
+	iov[2].iov_len = 2;
+	iov[3].iov_base = attr->a_aux;
+	iov[3].iov_len = auxlen;
+	len = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len + iov[3].iov_len;
+	if ((wn = writev(sa->sa_journal, iov, 4)) == -1) {
+		logmsg_err("Scanfile Error: %s: %s", sa->sa_journal_name, strerror(errno));
+		return (false);
+	}
+	if ((size_t)wn != len) {
+		logmsg_err("Scanfile Error: %s: write record", sa->sa_journal_name);
+		return (false);
+	}
+	sa->sa_journal_size += (off_t)len;
+
+	return (true);
+}
+
+bool
+scanfile_journal_replay(struct scanfile_args *sa)
+{
+	struct cvsync_file *cfp;
+	struct scanfile_journal_op *ops, *op;
+	struct stat st;
+	uint8_t *sp, *bp;
+	size_t nops = 0, maxops, namelen, auxlen, i;
+
+	if (stat(sa->sa_journal_name, &st) == -1) {
+		if (errno == ENOENT)
+			return (true);
+		logmsg_err("Scanfile Error: %s: %s", sa->sa_journal_name, strerror(errno));
+		return (false);
+	}
+	if ((cfp = cvsync_fopen(sa->sa_journal_name)) == NULL)
+		return (false);
+	if (cfp->cf_size < SCANFILE_JOURNAL_HDRLEN) {
+		logmsg("Scanfile: %s: ignoring a truncated journal", sa->sa_journal_name);
+		cvsync_fclose(cfp);
+		return (true);
+	}
+	if (!cvsync_mmap(cfp, (off_t)0, cfp->cf_size)) {
+		cvsync_fclose(cfp);
+		return (false);
+	}
+	sp = cfp->cf_addr;
+	bp = sp + (size_t)cfp->cf_size;
+	if ((memcmp(sp, SCANFILE_JOURNAL_MAGIC, SCANFILE_MAGICLEN) != 0) ||
+	    (sp[SCANFILE_MAGICLEN] != SCANFILE_JOURNAL_VERSION) ||
+	    (GetDDWord(&sp[8]) != sa->sa_digest)) {
+		logmsg("Scanfile: %s: ignoring a stale journal", sa->sa_journal_name);
+		cvsync_fclose(cfp);
+		return (true);
+	}
+
+	/* Each record is at least 7 bytes long. */
+	maxops = ((size_t)(bp - sp) - SCANFILE_JOURNAL_HDRLEN) / 7 + 1;
+	if ((ops = malloc(maxops * sizeof(*ops))) == NULL) {
+		logmsg_err("%s", strerror(errno));
+		cvsync_fclose(cfp);
+		return (false);
+	}
+
+	for (sp += SCANFILE_JOURNAL_HDRLEN ; sp < bp ; sp += namelen + auxlen + 6) {
+		if ((bp - sp) < 6)
+			break;
+		namelen = GetWord(&sp[2]);
+		if ((size_t)(bp - sp) - 6 < namelen)
+			break;
+		auxlen = GetWord(&sp[namelen + 4]);
+		if ((size_t)(bp - sp) - 6 - namelen < auxlen)
+			break;
+		if ((namelen == 0) ||
+		    ((sp[0] == SCANFILE_JOURNAL_SET) && (auxlen == 0)) ||
+		    ((sp[0] == SCANFILE_JOURNAL_DELETE) && (auxlen != 0)) ||
+		    ((sp[0] != SCANFILE_JOURNAL_SET) && (sp[0] != SCANFILE_JOURNAL_DELETE))) {
+			logmsg_err("Scanfile Error: %s: broken record", sa->sa_journal_name);
+			free(ops);
+			cvsync_fclose(cfp);
+			return (false);
+		}
+
+		op = &ops[nops];
+		op->jo_op = sp[0];
+		op->jo_seq = nops++;
+		op->jo_attr.a_type = sp[1];
+		op->jo_attr.a_name = &sp[4];
+		op->jo_attr.a_namelen = namelen;
+		op->jo_attr.a_aux = &sp[namelen + 6];
+		op->jo_attr.a_auxlen = auxlen;
+		op->jo_attr.a_size = namelen + auxlen + 5;
+	}
+	if (sp != bp)
+		logmsg("Scanfile: %s: ignoring a torn record", sa->sa_journal_name);
+	sa->sa_journal_size = (off_t)(sp - (uint8_t *)cfp->cf_addr);
+
+	if (nops > 0) {
+		qsort(ops, nops, sizeof(*ops), scanfile_journal_cmp);
+
+		/* Only the last record of each name matters. */
+		for (i = 1, maxops = 0 ; i < nops ; i++) {
+			if ((ops[maxops].jo_attr.a_namelen != ops[i].jo_attr.a_namelen) ||
+			    (memcmp(ops[maxops].jo_attr.a_name, ops[i].jo_attr.a_name,
+				    ops[i].jo_attr.a_namelen) != 0)) {
+				maxops++;
+			}
+			ops[maxops] = ops[i];
+		}
+		nops = maxops + 1;
+
+		if (!scanfile_journal_merge(sa, ops, nops)) {
+			free(ops);
+			cvsync_fclose(cfp);
+			return (false);
+		}
+	}
+
+	free(ops);
+	cvsync_fclose(cfp);
+
+	return (true);
+}
+
+bool
+scanfile_journal_merge(struct scanfile_args *sa, struct scanfile_journal_op *ops, size_t nops)
+{
+	struct scanfile_attr attr, *ap;
+	uint8_t *image, *sp = sa->sa_start, *dp;
+	size_t size = (size_t)(sa->sa_end - sa->sa_start), i;
+	int rv;
+
+	for (i = 0 ; i < nops ; i++)
+		size += ops[i].jo_attr.a_size;
+	if ((image = malloc(size + 1)) == NULL) {
+		logmsg_err("%s", strerror(errno));
+		return (false);
+	}
+
+	dp = image;
+	i = 0;
+	while ((sp < sa->sa_end) || (i < nops)) {
+		if (sp < sa->sa_end) {
+			if (!scanfile_read_attr(sp, sa->sa_end, &attr)) {
+				free(image);
+				return (false);
+			}
+		}
+		if (sp == sa->sa_end)
+			rv = 1;
+		else if (i == nops)
+			rv = -1;
+		else
+			rv = cvsync_cmp_pathname(attr.a_name, attr.a_namelen, ops[i].jo_attr.a_name,
+						 ops[i].jo_attr.a_namelen);
+		if (rv < 0) {
+			(void)memcpy(dp, sp, attr.a_size);
+			dp += attr.a_size;
+			sp += attr.a_size;
+			continue;
+		}
+		if (rv == 0)
+			sp += attr.a_size;
+		if (ops[i].jo_op == SCANFILE_JOURNAL_SET) {
+			ap = &ops[i].jo_attr;
+			dp[0] = ap->a_type;
+			SetWord(&dp[1], ap->a_namelen);
+			(void)memcpy(&dp[3], ap->a_name, ap->a_namelen);
+			SetWord(&dp[ap->a_namelen + 3], ap->a_auxlen);
+			(void)memcpy(&dp[ap->a_namelen + 5], ap->a_aux, ap->a_auxlen);
+			dp += ap->a_size;
+		}
+		i++;
+	}
+
+	if (sa->sa_cached != NULL) {
+		scanfile_cache_release(sa->sa_cached);
+		sa->sa_cached = NULL;
+		sa->sa_dirs = NULL;
+	} else if (sa->sa_image != NULL) {
+		free(sa->sa_image);
+	}
+	sa->sa_image = image;
+	sa->sa_start = image;
+	sa->sa_end = dp;
+
+	return (scanfile_index(sa));
+}
+
+int
+scanfile_journal_cmp(const void *p1, const void *p2)
+{
+	const struct scanfile_journal_op *op1 = p1, *op2 = p2;
+	int rv;
+
+	rv = cvsync_cmp_pathname(op1->jo_attr.a_name, op1->jo_attr.a_namelen,
+				 op2->jo_attr.a_name, op2->jo_attr.a_namelen);
+	if (rv != 0)
+		return (rv);
+
+	return ((op1->jo_seq < op2->jo_seq) ? -1 : 1);
+}
+
+bool
+scanfile_index(struct scanfile_args *sa)
+{
+	struct scanfile_attr attr;
+	uint8_t *sp, **dirs;
+	size_t ndirs = 0;
+
+	for (sp = sa->sa_start ; sp < sa->sa_end ; sp += attr.a_size) {
+		if (!scanfile_read_attr(sp, sa->sa_end, &attr))
+			return (false);
+		if (attr.a_type == FILETYPE_DIR)
+			ndirs++;
+	}
+
+	if (ndirs > 0) {
+		if ((dirs = malloc(ndirs * sizeof(*dirs))) == NULL) {
+			logmsg_err("%s", strerror(errno));
+			return (false);
+		}
+	} else {
+		dirs = NULL;
+	}
+
+	ndirs = 0;
+	for (sp = sa->sa_start ; sp < sa->sa_end ; sp += attr.a_size) {
+		if (!scanfile_read_attr(sp, sa->sa_end, &attr)) {
+			if (dirs != NULL)
+				free(dirs);
+			return (false);
+		}
+		if (attr.a_type == FILETYPE_DIR)
+			dirs[ndirs++] = sp;
+	}
+
+	if (sa->sa_dirs != NULL)
+		free(sa->sa_dirs);
+	sa->sa_dirs = dirs;
+	sa->sa_ndirs = ndirs;
+
+	return (true);
+}
@@ -6,6 +6,53 @@
 #define	CVSYNC_SCANFILE_H
 
 struct cvsync_file;
+struct hash_args;
+struct scanfile_image;
+
+#define	SCANFILE_BSIZE		(256 * 1024)
+
+#define	SCANFILE_MAGIC		"\0CSF"
+#define	SCANFILE_MAGICLEN	(4)
+
+#define	SCANFILE_VERSION_1	(1)
+#define	SCANFILE_VERSION_2	(2)
+#define	SCANFILE_VERSION	SCANFILE_VERSION_2
+
+/*
+ * v2 layout (all integers are big-endian):
+ *   header:  magic(4) version(1) pad(3) nentries(4) ndirs(4)
+ *            imagesize(8) tableoff(8) digest(8)
+ *   entries: type(1) shared(2) suffixlen(2) suffix auxlen(2) aux
+ *   table:   { entryoff(8) imageoff(8) } x ndirs
+ * Names are front-coded against the previous entry, except that
+ * directory entries always carry the full name so that the table
+ * can be used as restart points.  The digest is 64bit FNV-1a over
+ * the entries and the table.
+ */
+#define	SCANFILE_HDRLEN		(40)
+#define	SCANFILE_DIRENTLEN	(16)
+
+#define	SCANFILE_FNV_BASIS	((((uint64_t)0xcbf29ce4) << 32) | (uint64_t)0x84222325)
+#define	SCANFILE_FNV_PRIME	((((uint64_t)0x00000100) << 32) | (uint64_t)0x000001b3)
+
+/*
+ * The journal next to a v2 scanfile holds the updates made since the
+ * scanfile was written, and is bound to it by the scanfile's digest:
+ *   header:  magic(4) version(1) pad(3) digest(8)
+ *   records: op(1) type(1) namelen(2) name auxlen(2) aux
+ * auxlen is zero for deletions.  scanfile_open() merges the journal;
+ * the updater appends to it while it stays below 1/RATIO of the
+ * scanfile, and rewrites the scanfile in full otherwise.
+ */
+#define	SCANFILE_JOURNAL_SUFFIX		".journal"
+#define	SCANFILE_JOURNAL_SUFFIXLEN	(8)
+#define	SCANFILE_JOURNAL_MAGIC		"\0CSJ"
+#define	SCANFILE_JOURNAL_VERSION	(1)
+#define	SCANFILE_JOURNAL_HDRLEN		(16)
+#define	SCANFILE_JOURNAL_RATIO		(4)
+
+#define	SCANFILE_JOURNAL_SET		'+'
+#define	SCANFILE_JOURNAL_DELETE		'-'
 
 struct scanfile_attr {
 	size_t		a_size;
@@ -20,10 +67,30 @@ struct scanfile_args {
 	struct cvsync_file	*sa_scanfile;
 	const char		*sa_scanfile_name;
 	uint8_t			*sa_start, *sa_end;
+	int			sa_version;
+	uint8_t			*sa_image;
+	uint8_t			**sa_dirs;
+	size_t			sa_ndirs;
+	uint64_t		sa_digest;
+	struct scanfile_image	*sa_cached;
+
+	int			sa_journal;
+	char			sa_journal_name[PATH_MAX + CVSYNC_NAME_MAX + 1];
+	off_t			sa_journal_size;
 
 	int			sa_tmp;
 	char			sa_tmp_name[PATH_MAX + CVSYNC_NAME_MAX + 1];
 	mode_t			sa_tmp_mode;
+	int			sa_tmp_version;
+	char			sa_tmp_prev[PATH_MAX + CVSYNC_NAME_MAX + 1];
+	size_t			sa_tmp_prevlen;
+	uint64_t		sa_tmp_offset, sa_tmp_size, sa_tmp_digest;
+	uint32_t		sa_tmp_nentries;
+	uint8_t			*sa_tmp_table;
+	size_t			sa_tmp_ndirs, sa_tmp_maxdirs;
+	uint8_t			*sa_tmp_buffer;
+	size_t			sa_tmp_buflen;
+	bool			sa_tmp_nocache;
 
 	struct list		*sa_dirlist;
 	struct scanfile_attr	sa_attr;
@@ -38,13 +105,22 @@ struct scanfile_create_args {
 	mode_t			sca_mode;
 	struct mdirent_args	*sca_mdirent_args;
 	mode_t			sca_umask;
+	const struct hash_args	*sca_hash_ops;
+	uint32_t		sca_nentries;
+	bool			sca_nocache;
 };
 
 void scanfile_init(struct scanfile_args *);
 struct scanfile_args *scanfile_open(const char *);
 void scanfile_close(struct scanfile_args *);
+void scanfile_cache_init(void);
+void scanfile_cache_destroy(void);
 bool scanfile_read_attr(uint8_t *, const uint8_t *, struct scanfile_attr *);
 bool scanfile_write_attr(struct scanfile_args *, struct scanfile_attr *);
+bool scanfile_write_image(struct scanfile_args *, uint8_t *, const uint8_t *);
+uint64_t scanfile_digest(uint64_t, const uint8_t *, size_t);
+uint8_t *scanfile_seek(struct scanfile_args *, uint8_t *, const void *, size_t);
+uint8_t *scanfile_seek_prefix(struct scanfile_args *, uint8_t *, struct scanfile_attr *, const char *, size_t);
 
 bool scanfile_create_tmpfile(struct scanfile_args *, mode_t);
 void scanfile_remove_tmpfile(struct scanfile_args *);
@@ -54,8 +130,12 @@ bool scanfile_add(struct scanfile_args *, uint8_t, void *, size_t, void *, size_
 bool scanfile_remove(struct scanfile_args *, uint8_t, void *, size_t);
 bool scanfile_replace(struct scanfile_args *, uint8_t, void *, size_t, void *, size_t);
 bool scanfile_update(struct scanfile_args *, uint8_t, void *, size_t, void *, size_t);
+bool scanfile_setattr(struct scanfile_args *, uint8_t, void *, size_t, void *, size_t, size_t);
 
 bool scanfile_create(struct scanfile_create_args *);
+bool scanfile_refresh(struct scanfile_create_args *, char **, size_t);
 bool scanfile_rcs(struct scanfile_create_args *);
+bool scanfile_rcs_refresh(struct scanfile_create_args *, char **, size_t);
+bool scanfile_rcs_digest(const char *, const struct hash_args *, uint8_t *);
 
 #endif /* CVSYNC_SCANFILE_H */
@@ -23,9 +23,11 @@
 #include "cvsync.h"
 #include "cvsync_attr.h"
 #include "filetypes.h"
+#include "hash.h"
 #include "list.h"
 #include "logmsg.h"
 #include "mdirent.h"
+#include "rcslib.h"
 #include "scanfile.h"
 
 struct scanfile_rcs_args {
@@ -39,12 +41,34 @@ struct scanfile_rcs_args {
 
 	uint8_t			sra_aux[CVSYNC_MAXAUXLEN];
 	size_t			sra_auxmax;
+
+	const struct hash_args	*sra_hash_ops;
+	struct scanfile_args	*sra_prev;
+
+	struct scanfile_args	*sra_base;
+	char			**sra_dirs;
+	size_t			sra_ndirs;
 };
 
+#define	SCANFILE_RCS_CLEAN	(0)
+#define	SCANFILE_RCS_SUBDIR	(1)
+#define	SCANFILE_RCS_DIRTY	(2)
+
 struct scanfile_rcs_args *scanfile_rcs_init(struct scanfile_create_args *);
 void scanfile_rcs_destroy(struct scanfile_rcs_args *);
+bool scanfile_rcs_tree(struct scanfile_rcs_args *, size_t);
+bool scanfile_rcs_refresh_dir(struct scanfile_rcs_args *, size_t);
+bool scanfile_rcs_refresh_merge(struct scanfile_rcs_args *, size_t);
+bool scanfile_rcs_refresh_skip(struct scanfile_rcs_args *, struct scanfile_attr *);
+bool scanfile_rcs_refresh_pass(struct scanfile_rcs_args *, size_t, bool);
+size_t scanfile_rcs_refresh_path(struct scanfile_rcs_args *, const void *, size_t);
+int scanfile_rcs_refresh_lookup(struct scanfile_rcs_args *, const char *, size_t);
+bool scanfile_rcs_isunder(struct scanfile_attr *, const char *, size_t);
+int scanfile_rcs_cmp_dirs(const void *, const void *);
 bool scanfile_rcs_dir(struct scanfile_rcs_args *, struct mdirent_rcs *);
-bool scanfile_rcs_file(struct scanfile_rcs_args *, struct mdirent_rcs *);
+bool scanfile_rcs_file(struct scanfile_rcs_args *, struct mdirent_rcs *, struct scanfile_attr *);
+size_t scanfile_rcs_file_digest(struct scanfile_rcs_args *, struct mdirent_rcs *, struct scanfile_attr *, size_t);
+struct scanfile_attr *scanfile_rcs_prev(struct scanfile_rcs_args *, const void *, size_t);
 bool scanfile_rcs_symlink(struct scanfile_rcs_args *, struct mdirent_rcs *);
 
 struct mDIR *scanfile_rcs_opendir(struct scanfile_rcs_args *, size_t);
@@ -62,6 +86,7 @@ scanfile_rcs_init(struct scanfile_create_args *sca)
 
 	scanfile_init(&sra->sra_scanfile);
 	sra->sra_scanfile.sa_scanfile_name = sca->sca_name;
+	sra->sra_scanfile.sa_tmp_nocache = sca->sca_nocache;
 	if (!scanfile_create_tmpfile(&sra->sra_scanfile, sca->sca_mode)) {
 		free(sra);
 		return (NULL);
@@ -110,12 +135,21 @@ scanfile_rcs_init(struct scanfile_create_args *sca)
 
 	sra->sra_auxmax = sizeof(sra->sra_aux);
 
+	sra->sra_hash_ops = sca->sca_hash_ops;
+	sra->sra_prev = NULL;
+
+	sra->sra_base = NULL;
+	sra->sra_dirs = NULL;
+	sra->sra_ndirs = 0;
+
 	return (sra);
 }
 
 void
 scanfile_rcs_destroy(struct scanfile_rcs_args *sra)
 {
+	if (sra->sra_prev != NULL)
+		scanfile_close(sra->sra_prev);
 	if (strlen(sra->sra_scanfile.sa_tmp_name) != 0)
 		scanfile_remove_tmpfile(&sra->sra_scanfile);
 	free(sra);
@@ -125,39 +159,60 @@ bool
 scanfile_rcs(struct scanfile_create_args *sca)
 {
 	struct scanfile_rcs_args *sra;
-	struct mDIR *mdirp;
-	struct mdirent_rcs *mdp, *entries;
-	struct list *lp;
-	size_t len;
+	struct stat st;
 
 	if ((sra = scanfile_rcs_init(sca)) == NULL)
 		return (false);
 	sra->sra_scanfile.sa_changed = true;
 
-	if ((lp = list_init()) == NULL) {
+	/* The digests of the files which have not been modified are reused. */
+	if ((sra->sra_hash_ops != NULL) && (lstat(sca->sca_name, &st) == 0))
+		sra->sra_prev = scanfile_open(sca->sca_name);
+
+	if (!scanfile_rcs_tree(sra, sra->sra_pathlen)) {
+		scanfile_rcs_destroy(sra);
+		return (false);
+	}
+
+	if (!scanfile_rename(&sra->sra_scanfile)) {
 		scanfile_rcs_destroy(sra);
 		return (false);
 	}
+	sca->sca_nentries = sra->sra_scanfile.sa_tmp_nentries;
+
+	scanfile_rcs_destroy(sra);
+
+	return (true);
+}
+
+bool
+scanfile_rcs_tree(struct scanfile_rcs_args *sra, size_t pathlen)
+{
+	struct mDIR *mdirp;
+	struct mdirent_rcs *mdp, *entries;
+	struct list *lp;
+	size_t len;
+
+	if ((lp = list_init()) == NULL)
+		return (false);
 	list_set_destructor(lp, mclosedir);
 
-	if ((mdirp = scanfile_rcs_opendir(sra, sra->sra_pathlen)) == NULL) {
+	if ((mdirp = scanfile_rcs_opendir(sra, pathlen)) == NULL) {
 		list_destroy(lp);
-		scanfile_rcs_destroy(sra);
 		return (false);
 	}
-	mdirp->m_parent_pathlen = sra->sra_pathlen;
+	mdirp->m_parent_pathlen = pathlen;
+	sra->sra_pathlen = pathlen;
 
 	if (!list_insert_tail(lp, mdirp)) {
 		mclosedir(mdirp);
 		list_destroy(lp);
-		scanfile_rcs_destroy(sra);
 		return (false);
 	}
 
 	do {
 		if ((mdirp = list_remove_tail(lp)) == NULL) {
 			list_destroy(lp);
-			scanfile_rcs_destroy(sra);
 			return (false);
 		}
 
@@ -165,7 +220,6 @@ scanfile_rcs(struct scanfile_create_args *sca)
 			if (cvsync_is_interrupted()) {
 				mclosedir(mdirp);
 				list_destroy(lp);
-				scanfile_rcs_destroy(sra);
 				return (false);
 			}
 
@@ -174,12 +228,11 @@ scanfile_rcs(struct scanfile_create_args *sca)
 			if (mdp->md_dead)
 				continue;
 
-			switch (mdp->md_stat.st_mode & S_IFMT) {
+			switch (mdp->md_mode & S_IFMT) {
 			case S_IFDIR:
 				if (!scanfile_rcs_dir(sra, mdp)) {
 					mclosedir(mdirp);
 					list_destroy(lp);
-					scanfile_rcs_destroy(sra);
 					return (false);
 				}
 
@@ -187,7 +240,6 @@ scanfile_rcs(struct scanfile_create_args *sca)
 				if (len >= sra->sra_pathmax) {
 					mclosedir(mdirp);
 					list_destroy(lp);
-					scanfile_rcs_destroy(sra);
 					return (false);
 				}
 				(void)memcpy(&sra->sra_path[sra->sra_pathlen], mdp->md_name, mdp->md_namelen);
@@ -197,14 +249,12 @@ scanfile_rcs(struct scanfile_create_args *sca)
 				if (!list_insert_tail(lp, mdirp)) {
 					mclosedir(mdirp);
 					list_destroy(lp);
-					scanfile_rcs_destroy(sra);
 					return (false);
 				}
 
 				mdirp = scanfile_rcs_opendir(sra, len);
 				if (mdirp == NULL) {
 					list_destroy(lp);
-					scanfile_rcs_destroy(sra);
 					return (false);
 				}
 				mdirp->m_parent = mdp;
@@ -214,10 +264,9 @@ scanfile_rcs(struct scanfile_create_args *sca)
 
 				break;
 			case S_IFREG:
-				if (!scanfile_rcs_file(sra, mdp)) {
+				if (!scanfile_rcs_file(sra, mdp, NULL)) {
 					mclosedir(mdirp);
 					list_destroy(lp);
-					scanfile_rcs_destroy(sra);
 					return (false);
 				}
 				break;
@@ -225,14 +274,12 @@ scanfile_rcs(struct scanfile_create_args *sca)
 				if (!scanfile_rcs_symlink(sra, mdp)) {
 					mclosedir(mdirp);
 					list_destroy(lp);
-					scanfile_rcs_destroy(sra);
 					return (false);
 				}
 				break;
 			default:
 				mclosedir(mdirp);
 				list_destroy(lp);
-				scanfile_rcs_destroy(sra);
 				return (false);
 			}
 		}
@@ -245,22 +292,318 @@ scanfile_rcs(struct scanfile_create_args *sca)
 
 	list_destroy(lp);
 
+	return (true);
+}
+
+bool
+scanfile_rcs_refresh(struct scanfile_create_args *sca, char **dirs, size_t ndirs)
+{
+	struct scanfile_rcs_args *sra;
+	struct scanfile_args *sa;
+
+	if ((sra = scanfile_rcs_init(sca)) == NULL)
+		return (false);
+	sra->sra_scanfile.sa_changed = true;
+
+	if ((sa = scanfile_open(sca->sca_name)) == NULL) {
+		scanfile_rcs_destroy(sra);
+		return (false);
+	}
+
+	qsort(dirs, ndirs, sizeof(*dirs), scanfile_rcs_cmp_dirs);
+	sra->sra_base = sa;
+	sra->sra_dirs = dirs;
+	sra->sra_ndirs = ndirs;
+
+	if (!scanfile_rcs_refresh_dir(sra, sra->sra_pathlen)) {
+		scanfile_close(sa);
+		scanfile_rcs_destroy(sra);
+		return (false);
+	}
+	if (sa->sa_start != sa->sa_end) {
+		logmsg_err("Scanfile Error: %s: unexpected entries", sca->sca_name);
+		scanfile_close(sa);
+		scanfile_rcs_destroy(sra);
+		return (false);
+	}
+
 	if (!scanfile_rename(&sra->sra_scanfile)) {
+		scanfile_close(sa);
 		scanfile_rcs_destroy(sra);
 		return (false);
 	}
+	sca->sca_nentries = sra->sra_scanfile.sa_tmp_nentries;
 
+	scanfile_close(sa);
 	scanfile_rcs_destroy(sra);
 
 	return (true);
 }
 
+bool
+scanfile_rcs_refresh_dir(struct scanfile_rcs_args *sra, size_t pathlen)
+{
+	struct scanfile_args *sa = sra->sra_base;
+	struct scanfile_attr *attr = &sa->sa_attr;
+	size_t rpathlen, len;
+
+	rpathlen = pathlen - (size_t)(sra->sra_rpath - sra->sra_path);
+
+	switch (scanfile_rcs_refresh_lookup(sra, sra->sra_rpath, (rpathlen > 0) ? rpathlen - 1 : 0)) {
+	case SCANFILE_RCS_CLEAN:
+		return (scanfile_rcs_refresh_pass(sra, rpathlen, true));
+	case SCANFILE_RCS_DIRTY:
+		return (scanfile_rcs_refresh_merge(sra, pathlen));
+	default:
+		break;
+	}
+
+	while (sa->sa_start < sa->sa_end) {
+		if (!scanfile_read_attr(sa->sa_start, sa->sa_end, attr))
+			return (false);
+		if (!scanfile_rcs_isunder(attr, sra->sra_rpath, rpathlen))
+			break;
+		sa->sa_start += attr->a_size;
+
+		if (!scanfile_write_attr(&sra->sra_scanfile, attr))
+			return (false);
+		if (attr->a_type != FILETYPE_DIR)
+			continue;
+
+		if ((len = scanfile_rcs_refresh_path(sra, attr->a_name, attr->a_namelen)) == 0)
+			return (false);
+		if (!scanfile_rcs_refresh_dir(sra, len))
+			return (false);
+		sra->sra_path[pathlen] = '\0';
+	}
+
+	return (true);
+}
+
+bool
+scanfile_rcs_refresh_merge(struct scanfile_rcs_args *sra, size_t pathlen)
+{
+	struct scanfile_args *sa = sra->sra_base;
+	struct scanfile_attr *attr = &sa->sa_attr;
+	struct mDIR *mdirp;
+	struct mdirent_rcs *mdp, *entries;
+	size_t rpathlen, len;
+	int rv;
+	bool found, isdir;
+
+	rpathlen = pathlen - (size_t)(sra->sra_rpath - sra->sra_path);
+
+	sra->sra_path[pathlen] = '\0';
+	if ((mdirp = scanfile_rcs_opendir(sra, pathlen)) == NULL)
+		return (false);
+	entries = mdirp->m_entries;
+
+	for (;;) {
+		if (cvsync_is_interrupted()) {
+			mclosedir(mdirp);
+			return (false);
+		}
+
+		found = false;
+		if (sa->sa_start < sa->sa_end) {
+			if (!scanfile_read_attr(sa->sa_start, sa->sa_end, attr)) {
+				mclosedir(mdirp);
+				return (false);
+			}
+			found = scanfile_rcs_isunder(attr, sra->sra_rpath, rpathlen);
+		}
+		while ((mdirp->m_offset < mdirp->m_nentries) && entries[mdirp->m_offset].md_dead)
+			mdirp->m_offset++;
+		if (mdirp->m_offset < mdirp->m_nentries)
+			mdp = &entries[mdirp->m_offset];
+		else
+			mdp = NULL;
+
+		if (!found && (mdp == NULL))
+			break;
+		if (found && (mdp != NULL)) {
+			rv = cvsync_cmp_pathname((char *)attr->a_name + rpathlen, attr->a_namelen - rpathlen,
+						 mdp->md_name, mdp->md_namelen);
+		} else {
+			rv = found ? -1 : 1;
+		}
+
+		isdir = false;
+		if (rv <= 0) {
+			sa->sa_start += attr->a_size;
+			isdir = (attr->a_type == FILETYPE_DIR);
+		}
+		if (rv < 0) {
+			/* Removed. */
+			if (isdir && !scanfile_rcs_refresh_skip(sra, attr)) {
+				mclosedir(mdirp);
+				return (false);
+			}
+			sra->sra_path[pathlen] = '\0';
+			continue;
+		}
+		mdirp->m_offset++;
+
+		sra->sra_pathlen = pathlen;
+		switch (mdp->md_mode & S_IFMT) {
+		case S_IFDIR:
+			if (!scanfile_rcs_dir(sra, mdp)) {
+				mclosedir(mdirp);
+				return (false);
+			}
+			if ((len = pathlen + mdp->md_namelen + 1) >= sra->sra_pathmax) {
+				mclosedir(mdirp);
+				return (false);
+			}
+			(void)memcpy(&sra->sra_path[pathlen], mdp->md_name, mdp->md_namelen);
+			sra->sra_path[len - 1] = '/';
+			sra->sra_path[len] = '\0';
+			if (isdir) {
+				if (!scanfile_rcs_refresh_dir(sra, len)) {
+					mclosedir(mdirp);
+					return (false);
+				}
+			} else {
+				if (!scanfile_rcs_tree(sra, len)) {
+					mclosedir(mdirp);
+					return (false);
+				}
+			}
+			isdir = false;
+			break;
+		case S_IFREG:
+			if (!scanfile_rcs_file(sra, mdp, (rv == 0) ? attr : NULL)) {
+				mclosedir(mdirp);
+				return (false);
+			}
+			break;
+		case S_IFLNK:
+			if (!scanfile_rcs_symlink(sra, mdp)) {
+				mclosedir(mdirp);
+				return (false);
+			}
+			break;
+		default:
+			mclosedir(mdirp);
+			return (false);
+		}
+		/* A directory was replaced with a non-directory. */
+		if (isdir && !scanfile_rcs_refresh_skip(sra, attr)) {
+			mclosedir(mdirp);
+			return (false);
+		}
+		sra->sra_pathlen = pathlen;
+		sra->sra_path[pathlen] = '\0';
+	}
+
+	mclosedir(mdirp);
+
+	return (true);
+}
+
+bool
+scanfile_rcs_refresh_skip(struct scanfile_rcs_args *sra, struct scanfile_attr *attr)
+{
+	size_t len;
+
+	if ((len = scanfile_rcs_refresh_path(sra, attr->a_name, attr->a_namelen)) == 0)
+		return (false);
+
+	return (scanfile_rcs_refresh_pass(sra, len - (size_t)(sra->sra_rpath - sra->sra_path), false));
+}
+
+bool
+scanfile_rcs_refresh_pass(struct scanfile_rcs_args *sra, size_t rpathlen, bool copy)
+{
+	struct scanfile_args *sa = sra->sra_base;
+	struct scanfile_attr attr;
+	uint8_t *sp = sa->sa_start;
+
+	while (sa->sa_start < sa->sa_end) {
+		if (!scanfile_read_attr(sa->sa_start, sa->sa_end, &attr))
+			return (false);
+		if (!scanfile_rcs_isunder(&attr, sra->sra_rpath, rpathlen))
+			break;
+		sa->sa_start += attr.a_size;
+	}
+	if (!copy)
+		return (true);
+
+	if (!scanfile_write_image(&sra->sra_scanfile, sp, sa->sa_start))
+		return (false);
+
+	return (true);
+}
+
+size_t
+scanfile_rcs_refresh_path(struct scanfile_rcs_args *sra, const void *name, size_t namelen)
+{
+	size_t len;
+
+	len = (size_t)(sra->sra_rpath - sra->sra_path) + namelen + 1;
+	if (len >= sra->sra_pathmax)
+		return (0);
+	(void)memcpy(sra->sra_rpath, name, namelen);
+	sra->sra_path[len - 1] = '/';
+	sra->sra_path[len] = '\0';
+
+	return (len);
+}
+
+int
+scanfile_rcs_refresh_lookup(struct scanfile_rcs_args *sra, const char *name, size_t namelen)
+{
+	const char *dir;
+	size_t lo = 0, hi = sra->sra_ndirs, mid, len;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		dir = sra->sra_dirs[mid];
+		if (cvsync_cmp_pathname(dir, strlen(dir), name, namelen) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == sra->sra_ndirs)
+		return (SCANFILE_RCS_CLEAN);
+
+	dir = sra->sra_dirs[lo];
+	len = strlen(dir);
+	if ((len == namelen) && (memcmp(dir, name, namelen) == 0))
+		return (SCANFILE_RCS_DIRTY);
+	if (namelen == 0)
+		return (SCANFILE_RCS_SUBDIR);
+	if ((len > namelen) && (memcmp(dir, name, namelen) == 0) && (dir[namelen] == '/'))
+		return (SCANFILE_RCS_SUBDIR);
+
+	return (SCANFILE_RCS_CLEAN);
+}
+
+bool
+scanfile_rcs_isunder(struct scanfile_attr *attr, const char *rpath, size_t rpathlen)
+{
+	if (rpathlen == 0)
+		return (true);
+	if (attr->a_namelen <= rpathlen)
+		return (false);
+
+	return (memcmp(attr->a_name, rpath, rpathlen) == 0);
+}
+
+int
+scanfile_rcs_cmp_dirs(const void *p1, const void *p2)
+{
+	const char * const *d1 = p1, * const *d2 = p2;
+
+	return (cvsync_cmp_pathname(*d1, strlen(*d1), *d2, strlen(*d2)));
+}
+
 bool
 scanfile_rcs_dir(struct scanfile_rcs_args *sra, struct mdirent_rcs *mdp)
 {
 	struct scanfile_args *sa = &sra->sra_scanfile;
 	struct scanfile_attr *attr = &sa->sa_attr;
-	uint16_t mode = RCS_MODE(mdp->md_stat.st_mode, sra->sra_umask);
+	uint16_t mode = RCS_MODE(mdp->md_mode, sra->sra_umask);
 	size_t rpathlen, namelen, auxlen;
 
 	rpathlen = sra->sra_pathlen - (size_t)(sra->sra_rpath - sra->sra_path);
@@ -284,12 +627,11 @@ scanfile_rcs_dir(struct scanfile_rcs_args *sra, struct mdirent_rcs *mdp)
 }
 
 bool
-scanfile_rcs_file(struct scanfile_rcs_args *sra, struct mdirent_rcs *mdp)
+scanfile_rcs_file(struct scanfile_rcs_args *sra, struct mdirent_rcs *mdp, struct scanfile_attr *prev)
 {
 	struct scanfile_args *sa = &sra->sra_scanfile;
 	struct scanfile_attr *attr = &sa->sa_attr;
-	struct stat *st = &mdp->md_stat;
-	uint16_t mode = RCS_MODE(st->st_mode, sra->sra_umask);
+	uint16_t mode = RCS_MODE(mdp->md_mode, sra->sra_umask);
 	size_t rpathlen, namelen, auxlen;
 
 	rpathlen = sra->sra_pathlen - (size_t)(sra->sra_rpath - sra->sra_path);
@@ -301,11 +643,16 @@ scanfile_rcs_file(struct scanfile_rcs_args *sra, struct mdirent_rcs *mdp)
 			attr->a_type = FILETYPE_RCS_ATTIC;
 		else
 			attr->a_type = FILETYPE_RCS;
-		if ((auxlen = attr_rcs_encode_rcs(sra->sra_aux, sra->sra_auxmax, st->st_mtime, mode)) == 0)
+		if ((auxlen = attr_rcs_encode_rcs(sra->sra_aux, sra->sra_auxmax, mdp->md_mtime, mode)) == 0)
 			return (false);
+		if (sra->sra_hash_ops != NULL) {
+			if ((prev == NULL) && (sra->sra_prev != NULL))
+				prev = scanfile_rcs_prev(sra, sra->sra_rpath, namelen);
+			auxlen = scanfile_rcs_file_digest(sra, mdp, prev, auxlen);
+		}
 	} else {
 		attr->a_type = FILETYPE_FILE;
-		if ((auxlen = attr_rcs_encode_file(sra->sra_aux, sra->sra_auxmax, st->st_mtime, st->st_size,
+		if ((auxlen = attr_rcs_encode_file(sra->sra_aux, sra->sra_auxmax, mdp->md_mtime, mdp->md_size,
 						   mode)) == 0) {
 			return (false);
 		}
@@ -321,6 +668,91 @@ scanfile_rcs_file(struct scanfile_rcs_args *sra, struct mdirent_rcs *mdp)
 	return (true);
 }
 
+size_t
+scanfile_rcs_file_digest(struct scanfile_rcs_args *sra, struct mdirent_rcs *mdp, struct scanfile_attr *prev,
+			 size_t auxlen)
+{
+	const struct hash_args *hashops = sra->sra_hash_ops;
+	const uint8_t *digest = NULL;
+	uint8_t buffer[HASH_MAXLEN];
+	char path[PATH_MAX + CVSYNC_NAME_MAX + 1];
+	size_t len;
+
+	if ((prev != NULL) && ((prev->a_type == FILETYPE_RCS) || (prev->a_type == FILETYPE_RCS_ATTIC)) &&
+	    (prev->a_auxlen >= RCS_ATTRLEN_RCS) && (memcmp(prev->a_aux, sra->sra_aux, RCS_ATTRLEN_RCS) == 0)) {
+		digest = attr_rcs_digest(prev->a_aux, prev->a_auxlen, hashops->length);
+	}
+	if (digest == NULL) {
+		len = sra->sra_pathlen;
+		if (mdp->md_attic)
+			len += 6; /* "Attic/" */
+		if (len + mdp->md_namelen >= sizeof(path))
+			return (auxlen);
+		(void)memcpy(path, sra->sra_path, sra->sra_pathlen);
+		if (mdp->md_attic)
+			(void)memcpy(&path[sra->sra_pathlen], "Attic/", 6);
+		(void)memcpy(&path[len], mdp->md_name, mdp->md_namelen);
+		path[len + mdp->md_namelen] = '\0';
+
+		/* The file is still listed without its digest. */
+		if (!scanfile_rcs_digest(path, hashops, buffer))
+			return (auxlen);
+		digest = buffer;
+	}
+	if ((len = attr_rcs_encode_digest(sra->sra_aux, sra->sra_auxmax, digest, hashops->length)) == 0)
+		return (auxlen);
+
+	return (len);
+}
+
+struct scanfile_attr *
+scanfile_rcs_prev(struct scanfile_rcs_args *sra, const void *name, size_t namelen)
+{
+	struct scanfile_args *sa = sra->sra_prev;
+	struct scanfile_attr *attr = &sa->sa_attr;
+	int rv;
+
+	while (sa->sa_start < sa->sa_end) {
+		if (!scanfile_read_attr(sa->sa_start, sa->sa_end, attr))
+			break;
+		if ((rv = cvsync_cmp_pathname(attr->a_name, attr->a_namelen, name, namelen)) > 0)
+			return (NULL);
+		sa->sa_start += attr->a_size;
+		if (rv == 0)
+			return (attr);
+	}
+
+	return (NULL);
+}
+
+bool
+scanfile_rcs_digest(const char *path, const struct hash_args *hashops, uint8_t *digest)
+{
+	struct cvsync_file *cfp;
+	struct rcslib_file *rcs;
+
+	if ((cfp = cvsync_fopen(path)) == NULL)
+		return (false);
+	if (!cvsync_mmap(cfp, (off_t)0, cfp->cf_size)) {
+		cvsync_fclose(cfp);
+		return (false);
+	}
+	if ((rcs = rcslib_init(cfp->cf_addr, cfp->cf_size)) == NULL) {
+		cvsync_fclose(cfp);
+		return (false);
+	}
+	if (!rcslib_digest(rcs, hashops, digest)) {
+		rcslib_destroy(rcs);
+		cvsync_fclose(cfp);
+		return (false);
+	}
+
+	rcslib_destroy(rcs);
+	cvsync_fclose(cfp);
+
+	return (true);
+}
+
 bool
 scanfile_rcs_symlink(struct scanfile_rcs_args *sra, struct mdirent_rcs *mdp)
 {
@@ -355,6 +787,7 @@ scanfile_rcs_opendir(struct scanfile_rcs_args *sra, size_t pathlen)
 {
 	struct mDIR *mdirp;
 	struct mdirent_rcs *mdp;
+	struct stat st;
 	size_t rpathlen, len;
 	int rv;
 
@@ -366,7 +799,7 @@ scanfile_rcs_opendir(struct scanfile_rcs_args *sra, size_t pathlen)
 		return (mdirp);
 	}
 
-	if ((mdp = malloc(sizeof(*mdp))) == NULL) {
+	if ((mdp = malloc(sizeof(*mdp) + CVSYNC_NAME_MAX + 1)) == NULL) {
 		logmsg_err("%s", strerror(errno));
 		return (NULL);
 	}
@@ -375,12 +808,14 @@ scanfile_rcs_opendir(struct scanfile_rcs_args *sra, size_t pathlen)
 		if (sra->sra_rprefix[len] == '/')
 			break;
 	}
-	if ((len -= rpathlen) >= sizeof(mdp->md_name)) {
+	if ((len -= rpathlen) > CVSYNC_NAME_MAX) {
 		free(mdp);
 		return (NULL);
 	}
+	mdp->md_name = (char *)&mdp[1];
 	(void)memcpy(mdp->md_name, &sra->sra_rprefix[rpathlen], len);
-	mdp->md_namelen = len;
+	mdp->md_nameoff = 0;
+	mdp->md_namelen = (uint16_t)len;
 	mdp->md_attic = false;
 	mdp->md_dead = false;
 
@@ -392,9 +827,9 @@ scanfile_rcs_opendir(struct scanfile_rcs_args *sra, size_t pathlen)
 	sra->sra_path[len] = '\0';
 
 	if (sra->sra_mdirent_args->mda_symfollow)
-		rv = stat(sra->sra_path, &mdp->md_stat);
+		rv = stat(sra->sra_path, &st);
 	else
-		rv = lstat(sra->sra_path, &mdp->md_stat);
+		rv = lstat(sra->sra_path, &st);
 	if (rv == -1) {
 		free(mdp);
 		if (errno != ENOENT) {
@@ -403,11 +838,14 @@ scanfile_rcs_opendir(struct scanfile_rcs_args *sra, size_t pathlen)
 		}
 		mdp = NULL;
 	} else {
-		if (!S_ISDIR(mdp->md_stat.st_mode)) {
+		if (!S_ISDIR(st.st_mode)) {
 			logmsg_err("%s: %s", sra->sra_path, strerror(ENOTDIR));
 			free(mdp);
 			return (NULL);
 		}
+		mdp->md_mode = st.st_mode;
+		mdp->md_size = st.st_size;
+		mdp->md_mtime = st.st_mtime;
 	}
 
 	if ((mdirp = malloc(sizeof(*mdirp))) == NULL) {
@@ -418,6 +856,7 @@ scanfile_rcs_opendir(struct scanfile_rcs_args *sra, size_t pathlen)
 	mdirp->m_entries = mdp;
 	mdirp->m_nentries = (mdp != NULL) ? 1 : 0;
 	mdirp->m_offset = 0;
+	mdirp->m_names = NULL;
 	mdirp->m_parent = NULL;
 	mdirp->m_parent_pathlen = 0;
 
@@ -24,10 +24,14 @@
 #include "collection.h"
 #include "cvsync.h"
 #include "cvsync_attr.h"
+#include "dict.h"
 #include "hash.h"
 #include "logmsg.h"
 #include "mux.h"
+#include "digestfile.h"
+#include "rcslib.h"
 #include "scanfile.h"
+#include "version.h"
 
 #include "updater.h"
 
@@ -63,12 +67,50 @@ updater_init(struct mux *mx, struct collection *cls, uint32_t proto, int type)
 		return (NULL);
 	}
 
+	uda->uda_digestfile = NULL;
+	if ((uda->uda_digests = digestfile_list_init()) == NULL) {
+		free(uda->uda_buffer);
+		free(uda);
+		return (NULL);
+	}
+	if ((uda->uda_odigests = digestfile_list_init()) == NULL) {
+		digestfile_list_destroy(uda->uda_digests);
+		free(uda->uda_buffer);
+		free(uda);
+		return (NULL);
+	}
+	if ((uda->uda_writer = rcslib_writer_init()) == NULL) {
+		logmsg_err("%s", strerror(errno));
+		digestfile_list_destroy(uda->uda_odigests);
+		digestfile_list_destroy(uda->uda_digests);
+		free(uda->uda_buffer);
+		free(uda);
+		return (NULL);
+	}
+
+	uda->uda_dict = NULL;
+	if (proto >= CVSYNC_PROTO(0, 27)) {
+		if ((uda->uda_dict = dict_init()) == NULL) {
+			rcslib_writer_destroy(uda->uda_writer);
+			digestfile_list_destroy(uda->uda_odigests);
+			digestfile_list_destroy(uda->uda_digests);
+			free(uda->uda_buffer);
+			free(uda);
+			return (NULL);
+		}
+	}
+
 	return (uda);
 }
 
 void
 updater_destroy(struct updater_args *uda)
 {
+	if (uda->uda_dict != NULL)
+		dict_destroy(uda->uda_dict);
+	rcslib_writer_destroy(uda->uda_writer);
+	digestfile_list_destroy(uda->uda_odigests);
+	digestfile_list_destroy(uda->uda_digests);
 	free(uda->uda_buffer);
 	free(uda);
 }
@@ -118,9 +160,12 @@ updater(void *arg)
 		uda->uda_rpath = &uda->uda_path[uda->uda_pathlen];
 		uda->uda_scanfile = cl->cl_scanfile;
 		uda->uda_umask = cl->cl_umask;
+		uda->uda_digestfile = cl->cl_digestfile;
 
 		cl->cl_scanfile = NULL;
 
+		if (uda->uda_scanfile != NULL)
+			uda->uda_scanfile->sa_tmp_nocache = cl->cl_scan_nocache;
 		if (!scanfile_create_tmpfile(uda->uda_scanfile, cl->cl_scan_mode)) {
 			logmsg_err("Updater: Scanfile Error");
 			scanfile_close(uda->uda_scanfile);
@@ -7,8 +7,12 @@
 
 struct collection;
 struct cvsync_attr;
+struct dict;
+struct digestfile;
+struct digestfile_list;
 struct hash_args;
 struct mux;
+struct rcslib_writer;
 struct scanfile_args;
 
 #define	UPDATER_START		(0x80)
@@ -25,6 +29,9 @@ struct scanfile_args;
 #define	UPDATER_UPDATE_ADD	(0x82)
 #define	UPDATER_UPDATE_REMOVE	(0x83)
 #define	UPDATER_UPDATE_UPDATE	(0x84)
+#define	UPDATER_UPDATE_RESET	(0x85)
+#define	UPDATER_UPDATE_EDIT	(0x86)
+#define	UPDATER_UPDATE_PATCH	(0x87)
 
 #define	UPDATER_UPDATE_GENERIC	(0x00)
 #define	UPDATER_UPDATE_RCS	(0x01)
@@ -69,9 +76,14 @@ struct updater_args {
 	const struct hash_args	*uda_hash_ops;
 	uint8_t			uda_hash[HASH_MAXLEN];
 
+	struct digestfile	*uda_digestfile;
+	struct digestfile_list	*uda_digests, *uda_odigests;
+
 	int			uda_fileno;
 	void			*uda_buffer;
 	size_t			uda_bufsize;
+	struct rcslib_writer	*uda_writer;
+	struct dict		*uda_dict;
 };
 
 struct updater_args *updater_init(struct mux *, struct collection *, uint32_t, int);
@@ -29,11 +29,15 @@
 #include "collection.h"
 #include "cvsync.h"
 #include "cvsync_attr.h"
+#include "dict.h"
+#include "digestfile.h"
 #include "filetypes.h"
 #include "hash.h"
 #include "logmsg.h"
 #include "mux.h"
 #include "rcslib.h"
+#include "rdiff.h"
+#include "version.h"
 
 #include "updater.h"
 
@@ -51,12 +55,19 @@ bool updater_rcs_update_rcs(struct updater_args *);
 bool updater_rcs_update_symlink(struct updater_args *);
 
 bool updater_rcs_admin(struct updater_args *, struct rcslib_file *);
+bool updater_rcs_symbol(struct updater_args *, uint8_t *, size_t, struct rcslib_symbol *);
+bool updater_rcs_symbol_reset(const uint8_t *, size_t, const struct rcslib_symbol *);
 bool updater_rcs_delta(struct updater_args *, struct rcslib_file *);
 bool updater_rcs_desc(struct updater_args *);
-bool updater_rcs_deltatext(struct updater_args *, struct rcslib_file *);
+bool updater_rcs_deltatext(struct updater_args *, struct cvsync_file *, struct rcslib_file *);
+bool updater_rcs_copy_deltatext(struct updater_args *, struct cvsync_file *, struct rcslib_file *, struct rcslib_revision *);
 
 bool updater_rcs_write_delta(struct updater_args *, uint8_t *, size_t);
+bool updater_rcs_string(struct updater_args *, uint8_t **, size_t *, char **, size_t *);
 bool updater_rcs_write_deltatext(struct updater_args *, struct rcsnum *);
+bool updater_rcs_edit_deltatext(struct updater_args *, struct rcslib_file *, struct rcsnum *);
+bool updater_rcs_patch_deltatext(struct updater_args *, struct rcslib_revision *);
+bool updater_rcs_write_string(struct updater_args *, uint64_t);
 
 bool
 updater_rcs(struct updater_args *uda)
@@ -808,6 +819,7 @@ bool
 updater_rcs_update(struct updater_args *uda)
 {
 	struct cvsync_attr *cap = &uda->uda_attr;
+	struct stat st;
 	uint8_t *cmd = uda->uda_cmd;
 	char *ep;
 	size_t len;
@@ -861,6 +873,11 @@ updater_rcs_update(struct updater_args *uda)
 		return (false);
 	}
 
+	if ((cap->ca_tag == UPDATER_UPDATE_RCS) && uda->uda_digests->dl_valid) {
+		if (stat(uda->uda_path, &st) != -1)
+			digestfile_insert(uda->uda_digestfile, uda->uda_rpath, &st, uda->uda_digests);
+	}
+
 	if (!mux_recv(uda->uda_mux, MUX_UPDATER_IN, cmd, 3))
 		return (false);
 	if (GetWord(cmd) != 1)
@@ -881,11 +898,13 @@ updater_rcs_update_rcs(struct updater_args *uda)
 	struct rcslib_file *rcs;
 	struct cvsync_attr *cap = &uda->uda_attr;
 	struct utimbuf times;
+	struct stat st;
 
 	if ((uda->uda_fileno = mkstemp(uda->uda_tmpfile)) == -1) {
 		logmsg_err("%s", strerror(errno));
 		return (false);
 	}
+	rcslib_writer_start(uda->uda_writer, uda->uda_fileno);
 
 	if ((cfp = cvsync_fopen(uda->uda_path)) == NULL) {
 		(void)unlink(uda->uda_tmpfile);
@@ -899,13 +918,25 @@ updater_rcs_update_rcs(struct updater_args *uda)
 		return (false);
 	}
 
-	if ((rcs = rcslib_init(cfp->cf_addr, cfp->cf_size)) == NULL) {
+	if ((rcs = rcslib_init_lazy(cfp->cf_addr, cfp->cf_size)) == NULL) {
+		cvsync_fclose(cfp);
+		(void)unlink(uda->uda_tmpfile);
+		(void)close(uda->uda_fileno);
+		return (false);
+	}
+	if (!rcslib_load_deltatext_fd(rcs, cfp->cf_fileno, NULL, NULL)) {
+		rcslib_destroy(rcs);
 		cvsync_fclose(cfp);
 		(void)unlink(uda->uda_tmpfile);
 		(void)close(uda->uda_fileno);
 		return (false);
 	}
 
+	uda->uda_digests->dl_count = 0;
+	uda->uda_digests->dl_valid = false;
+	if ((uda->uda_digestfile != NULL) && (fstat(cfp->cf_fileno, &st) != -1))
+		uda->uda_digests->dl_valid = digestfile_lookup(uda->uda_digestfile, uda->uda_rpath, &st, rcs->delta.rd_count, uda->uda_odigests);
+
 	if (!updater_rcs_admin(uda, rcs)) {
 		logmsg_err("Updater(RCS): UPDATE(admin): error");
 		rcslib_destroy(rcs);
@@ -930,7 +961,7 @@ updater_rcs_update_rcs(struct updater_args *uda)
 		(void)close(uda->uda_fileno);
 		return (false);
 	}
-	if (!updater_rcs_deltatext(uda, rcs)) {
+	if (!updater_rcs_deltatext(uda, cfp, rcs)) {
 		logmsg_err("Updater(RCS): UPDATE(deltatext): error");
 		rcslib_destroy(rcs);
 		cvsync_fclose(cfp);
@@ -938,6 +969,14 @@ updater_rcs_update_rcs(struct updater_args *uda)
 		(void)close(uda->uda_fileno);
 		return (false);
 	}
+	if (!rcslib_writer_flush(uda->uda_writer)) {
+		logmsg_err("%s: %s", uda->uda_path, strerror(errno));
+		rcslib_destroy(rcs);
+		cvsync_fclose(cfp);
+		(void)unlink(uda->uda_tmpfile);
+		(void)close(uda->uda_fileno);
+		return (false);
+	}
 
 	rcslib_destroy(rcs);
 
@@ -1006,11 +1045,11 @@ updater_rcs_admin(struct updater_args *uda, struct rcslib_file *rcs)
 	struct rcsid *i1, *i2;
 	struct rcsnum *n1, *n2;
 	struct rcssym *s1, *s2;
+	struct rcslib_writer *rw = uda->uda_writer;
 	struct iovec iov[4];
-	uint8_t *cmd = uda->uda_cmd;
-	size_t len, iovlen, c;
-	ssize_t wn;
-	int fd = uda->uda_fileno, rv;
+	uint8_t *cmd = uda->uda_cmd, mask[RCSLIB_SYMBOL_BUCKETMAX / 8];
+	size_t len, c, nbuckets = 0;
+	int rv;
 
 	lock2 = &t_lock;
 	sym2 = &t_sym;
@@ -1052,16 +1091,11 @@ updater_rcs_admin(struct updater_args *uda, struct rcslib_file *rcs)
 		iov[0].iov_len = 4;
 	iov[2].iov_base = ";\n";
 	iov[2].iov_len = 2;
-	iovlen = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
 
-	if ((wn = writev(fd, iov, 3)) == -1) {
+	if (!rcslib_writer_writev(rw, iov, 3)) {
 		logmsg_err("%s", strerror(errno));
 		return (false);
 	}
-	if ((size_t)wn != iovlen) {
-		logmsg_err("writev error");
-		return (false);
-	}
 
 	/* branch */
 	if (cmd[0] == UPDATER_UPDATE_RCS_BRANCH) {
@@ -1095,21 +1129,16 @@ updater_rcs_admin(struct updater_args *uda, struct rcslib_file *rcs)
 		iov[0].iov_len = 7;
 		iov[2].iov_base = ";\n";
 		iov[2].iov_len = 2;
-		iovlen = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
 
-		if ((wn = writev(fd, iov, 3)) == -1) {
+		if (!rcslib_writer_writev(rw, iov, 3)) {
 			logmsg_err("%s", strerror(errno));
 			return (false);
 		}
-		if ((size_t)wn != iovlen) {
-			logmsg_err("writev error");
-			return (false);
-		}
 	}
 
 	/* access */
 	c = 0;
-	if (write(fd, "access", 6) != 6) {
+	if (!rcslib_writer_write(rw, "access", 6)) {
 		logmsg_err("%s", strerror(errno));
 		return (false);
 	}
@@ -1134,8 +1163,7 @@ updater_rcs_admin(struct updater_args *uda, struct rcslib_file *rcs)
 						break;
 					iov[1].iov_base = i1->i_id;
 					iov[1].iov_len = i1->i_len;
-					wn = (ssize_t)(i1->i_len + 2);
-					if (writev(fd, iov, 2) != wn) {
+					if (!rcslib_writer_writev(rw, iov, 2)) {
 						logmsg_err("%s", strerror(errno));
 						return (false);
 					}
@@ -1149,14 +1177,10 @@ updater_rcs_admin(struct updater_args *uda, struct rcslib_file *rcs)
 			}
 			iov[1].iov_base = i2->i_id;
 			iov[1].iov_len = i2->i_len;
-			if ((wn = writev(fd, iov, 2)) == -1) {
+			if (!rcslib_writer_writev(rw, iov, 2)) {
 				logmsg_err("%s", strerror(errno));
 				return (false);
 			}
-			if ((size_t)wn != (i2->i_len + 2)) {
-				logmsg_err("writev error");
-				return (false);
-			}
 			break;
 		case UPDATER_UPDATE_REMOVE:
 			if (c == rcs->access.ra_count)
@@ -1171,14 +1195,10 @@ updater_rcs_admin(struct updater_args *uda, struct rcslib_file *rcs)
 				}
 				iov[1].iov_base = i1->i_id;
 				iov[1].iov_len = i1->i_len;
-				if ((wn = writev(fd, iov, 2)) == -1) {
+				if (!rcslib_writer_writev(rw, iov, 2)) {
 					logmsg_err("%s", strerror(errno));
 					return (false);
 				}
-				if ((size_t)wn != (i1->i_len + 2)) {
-					logmsg_err("writev error");
-					return (false);
-				}
 			} while (++c < rcs->access.ra_count);
 			break;
 		default:
@@ -1197,17 +1217,13 @@ updater_rcs_admin(struct updater_args *uda, struct rcslib_file *rcs)
 		i1 = &rcs->access.ra_id[c++];
 		iov[1].iov_base = i1->i_id;
 		iov[1].iov_len = i1->i_len;
-		if ((wn = writev(fd, iov, 2)) == -1) {
+		if (!rcslib_writer_writev(rw, iov, 2)) {
 			logmsg_err("%s", strerror(errno));
 			return (false);
 		}
-		if ((size_t)wn != (i1->i_len + 2)) {
-			logmsg_err("writev error");
-			return (false);
-		}
 	}
 
-	if (write(fd, ";\nsymbols", 9) != 9) {
+	if (!rcslib_writer_write(rw, ";\nsymbols", 9)) {
 		logmsg_err("%s", strerror(errno));
 		return (false);
 	}
@@ -1217,16 +1233,28 @@ updater_rcs_admin(struct updater_args *uda, struct rcslib_file *rcs)
 	iov[0].iov_len = 2;
 	iov[2].iov_base = ":";
 	iov[2].iov_len = 1;
-	while (cmd[0] == UPDATER_UPDATE_RCS_SYMBOLS) {
+	c = 0;
+	if ((uda->uda_proto >= CVSYNC_PROTO(0, 26)) &&
+	    (cmd[0] == UPDATER_UPDATE_RCS_SYMBOLS) && (cmd[1] == UPDATER_UPDATE_RESET)) {
 		if (len < 6)
 			return (false);
-		if ((cmd[2] == 0) || (cmd[3] == 0))
+		nbuckets = GetDWord(&cmd[2]);
+		if ((nbuckets == 0) || (nbuckets > RCSLIB_SYMBOL_BUCKETMAX))
 			return (false);
-		if (len != ((size_t)cmd[2] + ((size_t)cmd[3] + 4)))
+		if (len != ((nbuckets + 7) / 8 + 6))
 			return (false);
-		s2->s_sym = (char *)&cmd[4];
-		s2->s_len = cmd[2];
-		if (!rcslib_str2num(&cmd[s2->s_len + 4], cmd[3], n2))
+		(void)memcpy(mask, &cmd[6], len - 6);
+
+		if (!mux_recv(uda->uda_mux, MUX_UPDATER_IN, cmd, 2))
+			return (false);
+		len = GetWord(cmd);
+		if ((len == 0) || (len > (uda->uda_cmdmax - 2)))
+			return (false);
+		if (!mux_recv(uda->uda_mux, MUX_UPDATER_IN, cmd, len))
+			return (false);
+	}
+	while (cmd[0] == UPDATER_UPDATE_RCS_SYMBOLS) {
+		if (!updater_rcs_symbol(uda, cmd, len, sym2))
 			return (false);
 
 		switch (cmd[1]) {
@@ -1235,18 +1263,19 @@ updater_rcs_admin(struct updater_args *uda, struct rcslib_file *rcs)
 				do {
 					sym1 = &rcs->symbols.rs_symbols[c];
 					rv = rcslib_cmp_symbol(sym1, sym2);
-					if (rv == 0)
-						return (false);
 					if (rv > 0)
 						break;
+					if (updater_rcs_symbol_reset(mask, nbuckets, sym1))
+						continue;
+					if (rv == 0)
+						return (false);
 					n1 = &sym1->num;
 					s1 = &sym1->sym;
 					iov[1].iov_base = s1->s_sym;
 					iov[1].iov_len = s1->s_len;
 					iov[3].iov_base = n1->n_str;
 					iov[3].iov_len = n1->n_len;
-					wn = (ssize_t)(s1->s_len + n1->n_len + 3);
-					if (writev(fd, iov, 4) != wn) {
+					if (!rcslib_writer_writev(rw, iov, 4)) {
 						logmsg_err("%s", strerror(errno));
 						return (false);
 					}
@@ -1262,8 +1291,7 @@ updater_rcs_admin(struct updater_args *uda, struct rcslib_file *rcs)
 			iov[1].iov_len = s2->s_len;
 			iov[3].iov_base = n2->n_str;
 			iov[3].iov_len = n2->n_len;
-			wn = (ssize_t)(s2->s_len + n2->n_len + 3);
-			if (writev(fd, iov, 4) != wn) {
+			if (!rcslib_writer_writev(rw, iov, 4)) {
 				logmsg_err("%s", strerror(errno));
 				return (false);
 			}
@@ -1279,14 +1307,15 @@ updater_rcs_admin(struct updater_args *uda, struct rcslib_file *rcs)
 					c++;
 					break;
 				}
+				if (updater_rcs_symbol_reset(mask, nbuckets, sym1))
+					continue;
 				n1 = &sym1->num;
 				s1 = &sym1->sym;
 				iov[1].iov_base = s1->s_sym;
 				iov[1].iov_len = s1->s_len;
 				iov[3].iov_base = n1->n_str;
 				iov[3].iov_len = n1->n_len;
-				wn = (ssize_t)(s1->s_len + n1->n_len + 3);
-				if (writev(fd, iov, 4) != wn) {
+				if (!rcslib_writer_writev(rw, iov, 4)) {
 					logmsg_err("%s", strerror(errno));
 					return (false);
 				}
@@ -1306,20 +1335,21 @@ updater_rcs_admin(struct updater_args *uda, struct rcslib_file *rcs)
 	}
 	while (c < rcs->symbols.rs_count) {
 		sym1 = &rcs->symbols.rs_symbols[c++];
+		if (updater_rcs_symbol_reset(mask, nbuckets, sym1))
+			continue;
 		n1 = &sym1->num;
 		s1 = &sym1->sym;
 		iov[1].iov_base = s1->s_sym;
 		iov[1].iov_len = s1->s_len;
 		iov[3].iov_base = n1->n_str;
 		iov[3].iov_len = n1->n_len;
-		wn = (ssize_t)(s1->s_len + n1->n_len + 3);
-		if (writev(fd, iov, 4) != wn) {
+		if (!rcslib_writer_writev(rw, iov, 4)) {
 			logmsg_err("%s", strerror(errno));
 			return (false);
 		}
 	}
 
-	if (write(fd, ";\nlocks", 7) != 7) {
+	if (!rcslib_writer_write(rw, ";\nlocks", 7)) {
 		logmsg_err("%s", strerror(errno));
 		return(false);
 	}
@@ -1381,8 +1411,7 @@ updater_rcs_admin(struct updater_args *uda, struct rcslib_file *rcs)
 					iov[1].iov_len = i1->i_len;
 					iov[3].iov_base = n1->n_str;
 					iov[3].iov_len = n1->n_len;
-					wn = (ssize_t)(i1->i_len + n1->n_len + 3);
-					if (writev(fd, iov, 4) != wn) {
+					if (!rcslib_writer_writev(rw, iov, 4)) {
 						logmsg_err("%s",
 							   strerror(errno));
 						return (false);
@@ -1399,8 +1428,7 @@ updater_rcs_admin(struct updater_args *uda, struct rcslib_file *rcs)
 			iov[1].iov_len = i2->i_len;
 			iov[3].iov_base = n2->n_str;
 			iov[3].iov_len = n2->n_len;
-			wn = (ssize_t)(i2->i_len + n2->n_len + 3);
-			if (writev(fd, iov, 4) != wn) {
+			if (!rcslib_writer_writev(rw, iov, 4)) {
 				logmsg_err("%s", strerror(errno));
 				return (false);
 			}
@@ -1422,8 +1450,7 @@ updater_rcs_admin(struct updater_args *uda, struct rcslib_file *rcs)
 				iov[1].iov_len = i1->i_len;
 				iov[3].iov_base = n1->n_str;
 				iov[3].iov_len = n1->n_len;
-				wn = (ssize_t)(i1->i_len + n1->n_len + 3);
-				if (writev(fd, iov, 4) != wn) {
+				if (!rcslib_writer_writev(rw, iov, 4)) {
 					logmsg_err("%s", strerror(errno));
 					return (false);
 				}
@@ -1449,19 +1476,18 @@ updater_rcs_admin(struct updater_args *uda, struct rcslib_file *rcs)
 		iov[1].iov_len = i1->i_len;
 		iov[3].iov_base = n1->n_str;
 		iov[3].iov_len = n1->n_len;
-		wn = (ssize_t)(i1->i_len + n1->n_len + 3);
-		if (writev(fd, iov, 4) != wn) {
+		if (!rcslib_writer_writev(rw, iov, 4)) {
 			logmsg_err("%s", strerror(errno));
 			return (false);
 		}
 	}
 	if (rcs->locks.rl_strict != 0) {
-		if (write(fd, "; strict;\n", 10) != 10) {
+		if (!rcslib_writer_write(rw, "; strict;\n", 10)) {
 			logmsg_err("%s", strerror(errno));
 			return (false);
 		}
 	} else {
-		if (write(fd, ";\n", 2) != 2) {
+		if (!rcslib_writer_write(rw, ";\n", 2)) {
 			logmsg_err("%s", strerror(errno));
 			return (false);
 		}
@@ -1478,7 +1504,7 @@ updater_rcs_admin(struct updater_args *uda, struct rcslib_file *rcs)
 		if (cmd[1] > 0) {
 			iov[1].iov_base = (void *)&cmd[2];
 			iov[1].iov_len = cmd[1];
-			if (writev(fd, iov, 3) != (cmd[1] + 12)) {
+			if (!rcslib_writer_writev(rw, iov, 3)) {
 				logmsg_err("%s", strerror(errno));
 				return (false);
 			}
@@ -1495,14 +1521,10 @@ updater_rcs_admin(struct updater_args *uda, struct rcslib_file *rcs)
 		if (rcs->comment.s_len > 0) {
 			iov[1].iov_base = rcs->comment.s_str;
 			iov[1].iov_len = rcs->comment.s_len;
-			if ((wn = writev(fd, iov, 3)) == -1) {
+			if (!rcslib_writer_writev(rw, iov, 3)) {
 				logmsg_err("%s", strerror(errno));
 				return (false);
 			}
-			if ((size_t)wn != (rcs->comment.s_len + 12)) {
-				logmsg_err("writev error");
-				return (false);
-			}
 		}
 	}
 
@@ -1517,7 +1539,7 @@ updater_rcs_admin(struct updater_args *uda, struct rcslib_file *rcs)
 		if (cmd[1] > 0) {
 			iov[1].iov_base = (void *)&cmd[2];
 			iov[1].iov_len = cmd[1];
-			if (writev(fd, iov, 3) != (cmd[1] + 11)) {
+			if (!rcslib_writer_writev(rw, iov, 3)) {
 				logmsg_err("%s", strerror(errno));
 				return (false);
 			}
@@ -1534,14 +1556,10 @@ updater_rcs_admin(struct updater_args *uda, struct rcslib_file *rcs)
 		if (rcs->expand.s_len > 0) {
 			iov[1].iov_base = rcs->expand.s_str;
 			iov[1].iov_len = rcs->expand.s_len;
-			if ((wn = writev(fd, iov, 3)) == -1) {
+			if (!rcslib_writer_writev(rw, iov, 3)) {
 				logmsg_err("%s", strerror(errno));
 				return (false);
 			}
-			if ((size_t)wn != (rcs->expand.s_len + 11)) {
-				logmsg_err("writev error");
-				return (false);
-			}
 		}
 	}
 
@@ -1553,16 +1571,68 @@ updater_rcs_admin(struct updater_args *uda, struct rcslib_file *rcs)
 	return (true);
 }
 
+bool
+updater_rcs_symbol(struct updater_args *uda, uint8_t *cmd, size_t len, struct rcslib_symbol *symbol)
+{
+	struct rcsnum *num = &symbol->num;
+	struct rcssym *sym = &symbol->sym;
+	size_t nlen;
+
+	if (uda->uda_proto < CVSYNC_PROTO(0, 27)) {
+		if (len < 6)
+			return (false);
+		if ((cmd[2] == 0) || (cmd[3] == 0))
+			return (false);
+		if (len != ((size_t)cmd[2] + ((size_t)cmd[3] + 4)))
+			return (false);
+		sym->s_sym = (char *)&cmd[4];
+		sym->s_len = cmd[2];
+		return (rcslib_str2num(&cmd[sym->s_len + 4], cmd[3], num));
+	}
+
+	/* op(1) nlen(1) num name */
+	if (len < 4)
+		return (false);
+	if ((nlen = cmd[2]) == 0)
+		return (false);
+	if (len < nlen + 4)
+		return (false);
+	if (!rcslib_str2num(&cmd[3], nlen, num))
+		return (false);
+	len -= nlen + 3;
+	if (dict_decode(uda->uda_dict, &cmd[nlen + 3], len, &sym->s_sym, &sym->s_len) != len)
+		return (false);
+	if (sym->s_len == 0)
+		return (false);
+
+	return (true);
+}
+
+/* Whether the symbol is in a bucket which FileCmp has reset. */
+bool
+updater_rcs_symbol_reset(const uint8_t *mask, size_t nbuckets, const struct rcslib_symbol *symbol)
+{
+	size_t b;
+
+	if (nbuckets == 0)
+		return (false);
+
+	b = rcslib_symbol_bucket(symbol, nbuckets);
+
+	return ((mask[b / 8] & (1 << (b % 8))) != 0);
+}
+
 bool
 updater_rcs_delta(struct updater_args *uda, struct rcslib_file *rcs)
 {
 	struct rcslib_revision *rev;
 	struct rcsnum *n1, *n2, t_num;
+	struct rcslib_writer *rw = uda->uda_writer;
 	uint8_t *cmd = uda->uda_cmd;
 	size_t len = 0, c = 0;
-	int fd = uda->uda_fileno, rv;
+	int rv;
 
-	if (write(fd, "\n\n", 2) != 2) {
+	if (!rcslib_writer_write(rw, "\n\n", 2)) {
 		logmsg_err("%s", strerror(errno));
 		return (false);
 	}
@@ -1602,7 +1672,7 @@ updater_rcs_delta(struct updater_args *uda, struct rcslib_file *rcs)
 						return (false);
 					if (rv > 0)
 						break;
-					if (!rcslib_write_delta(fd, rev))
+					if (!rcslib_write_delta(rw, rev))
 						return (false);
 				} while (++c < rcs->delta.rd_count);
 			} else {
@@ -1633,7 +1703,7 @@ updater_rcs_delta(struct updater_args *uda, struct rcslib_file *rcs)
 					c++;
 					break;
 				}
-				if (!rcslib_write_delta(fd, rev))
+				if (!rcslib_write_delta(rw, rev))
 					return (false);
 			} while (++c < rcs->delta.rd_count);
 			break;
@@ -1652,7 +1722,7 @@ updater_rcs_delta(struct updater_args *uda, struct rcslib_file *rcs)
 				if ((rv = rcslib_cmp_num(n1, n2)) > 0)
 					return (false);
 				if (rv < 0) {
-					if (!rcslib_write_delta(fd, rev))
+					if (!rcslib_write_delta(rw, rev))
 						return (false);
 					continue;
 				}
@@ -1667,7 +1737,7 @@ updater_rcs_delta(struct updater_args *uda, struct rcslib_file *rcs)
 	}
 	while (c < rcs->delta.rd_count) {
 		rev = &rcs->delta.rd_rev[c++];
-		if (!rcslib_write_delta(fd, rev))
+		if (!rcslib_write_delta(rw, rev))
 			return (false);
 	}
 
@@ -1681,9 +1751,10 @@ bool
 updater_rcs_write_delta(struct updater_args *uda, uint8_t *sp, size_t len)
 {
 	const struct hash_args *hashops = uda->uda_hash_ops;
+	struct rcslib_writer *rw = uda->uda_writer;
 	struct iovec iov[13];
+	char *str;
 	size_t slen, n, i;
-	ssize_t wn;
 
 	if (len < 2)
 		return (false);
@@ -1705,7 +1776,6 @@ updater_rcs_write_delta(struct updater_args *uda, uint8_t *sp, size_t len)
 	iov[0].iov_len = slen;
 	iov[1].iov_base = "\n";
 	iov[1].iov_len = 1;
-	wn = (ssize_t)(slen + 1);
 	sp += slen;
 
 	/* date */
@@ -1727,7 +1797,6 @@ updater_rcs_write_delta(struct updater_args *uda, uint8_t *sp, size_t len)
 	iov[3].iov_len = slen;
 	iov[4].iov_base = ";";
 	iov[4].iov_len = 1;
-	wn += slen + 6;
 	(*hashops->update)(uda->uda_hash_ctx, sp, slen);
 	sp += slen;
 
@@ -1736,31 +1805,20 @@ updater_rcs_write_delta(struct updater_args *uda, uint8_t *sp, size_t len)
 		(*hashops->destroy)(uda->uda_hash_ctx);
 		return (false);
 	}
-	if ((slen = *sp++) == 0) {
-		(*hashops->destroy)(uda->uda_hash_ctx);
-		return (false);
-	}
-	if (len < (slen + 1)) {
+	if (!updater_rcs_string(uda, &sp, &len, &str, &slen) || (slen == 0)) {
 		(*hashops->destroy)(uda->uda_hash_ctx);
 		return (false);
 	}
 	iov[5].iov_base = "\tauthor ";
 	iov[5].iov_len = 8;
-	iov[6].iov_base = (void *)sp;
+	iov[6].iov_base = str;
 	iov[6].iov_len = slen;
 	iov[7].iov_base = ";";
 	iov[7].iov_len = 1;
-	wn += slen + 9;
-	(*hashops->update)(uda->uda_hash_ctx, sp, slen);
-	sp += slen;
+	(*hashops->update)(uda->uda_hash_ctx, str, slen);
 
 	/* state */
-	if ((len -= slen + 1) == 0) {
-		(*hashops->destroy)(uda->uda_hash_ctx);
-		return (false);
-	}
-	slen = *sp++;
-	if (len < (slen + 1)) {
+	if (!updater_rcs_string(uda, &sp, &len, &str, &slen)) {
 		(*hashops->destroy)(uda->uda_hash_ctx);
 		return (false);
 	}
@@ -1769,17 +1827,14 @@ updater_rcs_write_delta(struct updater_args *uda, uint8_t *sp, size_t len)
 		iov[8].iov_len = 7;
 	else
 		iov[8].iov_len = 6;
-	iov[9].iov_base = (void *)sp;
+	iov[9].iov_base = str;
 	iov[9].iov_len = slen;
-	if (slen > 0) {
-		(*hashops->update)(uda->uda_hash_ctx, sp, slen);
-		sp += slen;
-	}
+	if (slen > 0)
+		(*hashops->update)(uda->uda_hash_ctx, str, slen);
 	iov[10].iov_base = ";\n";
 	iov[10].iov_len = 2;
-	wn += slen + iov[8].iov_len + 2;
 
-	if ((len -= slen + 1) < 2) {
+	if (len < 2) {
 		(*hashops->destroy)(uda->uda_hash_ctx);
 		return (false);
 	}
@@ -1792,7 +1847,7 @@ updater_rcs_write_delta(struct updater_args *uda, uint8_t *sp, size_t len)
 	iov[11].iov_base = "branches";
 	iov[11].iov_len = 8;
 
-	if (writev(uda->uda_fileno, iov, 12) != (wn + 8)) {
+	if (!rcslib_writer_writev(rw, iov, 12)) {
 		logmsg_err("%s", strerror(errno));
 		(*hashops->destroy)(uda->uda_hash_ctx);
 		return (false);
@@ -1808,16 +1863,11 @@ updater_rcs_write_delta(struct updater_args *uda, uint8_t *sp, size_t len)
 		}
 		iov[1].iov_base = (void *)sp;
 		iov[1].iov_len = slen;
-		if ((wn = writev(uda->uda_fileno, iov, 2)) == -1) {
+		if (!rcslib_writer_writev(rw, iov, 2)) {
 			logmsg_err("%s", strerror(errno));
 			(*hashops->destroy)(uda->uda_hash_ctx);
 			return (false);
 		}
-		if ((size_t)wn != (slen + 2)) {
-			logmsg_err("writev error");
-			(*hashops->destroy)(uda->uda_hash_ctx);
-			return (false);
-		}
 		(*hashops->update)(uda->uda_hash_ctx, sp, slen);
 		sp += slen;
 		if ((len -= slen + 1) == 0) {
@@ -1845,26 +1895,295 @@ updater_rcs_write_delta(struct updater_args *uda, uint8_t *sp, size_t len)
 	iov[2].iov_base = ";\n\n";
 	iov[2].iov_len = 3;
 
-	if ((wn = writev(uda->uda_fileno, iov, 3)) == -1) {
+	if (!rcslib_writer_writev(rw, iov, 3)) {
 		logmsg_err("%s", strerror(errno));
 		(*hashops->destroy)(uda->uda_hash_ctx);
 		return (false);
 	}
-	if ((size_t)wn != (slen + 10)) {
-		logmsg_err("writev error");
+
+	if (len != hashops->length) {
 		(*hashops->destroy)(uda->uda_hash_ctx);
 		return (false);
 	}
 
-	if (len != hashops->length) {
+	(*hashops->final)(uda->uda_hash_ctx, uda->uda_hash);
+
+	if (memcmp(uda->uda_hash, sp, hashops->length) != 0)
+		return (false);
+
+	return (true);
+}
+
+/* An author or a state, through the dictionary since protocol 0.27. */
+bool
+updater_rcs_string(struct updater_args *uda, uint8_t **spp, size_t *lenp, char **str, size_t *slen)
+{
+	uint8_t *sp = *spp;
+	size_t len = *lenp, n;
+
+	if (len == 0)
+		return (false);
+
+	if (uda->uda_proto < CVSYNC_PROTO(0, 27)) {
+		if ((n = (size_t)sp[0] + 1) > len)
+			return (false);
+		*str = (char *)&sp[1];
+		*slen = sp[0];
+	} else {
+		if ((n = dict_decode(uda->uda_dict, sp, len, str, slen)) == 0)
+			return (false);
+	}
+
+	*spp = sp + n;
+	*lenp = len - n;
+
+	return (true);
+}
+
+/*
+ * The new head, given as the script which edits the full text of the
+ * old head into it.
+ */
+bool
+updater_rcs_edit_deltatext(struct updater_args *uda, struct rcslib_file *rcs, struct rcsnum *num)
+{
+	const struct hash_args *hashops = uda->uda_hash_ops;
+	struct rcslib_writer *rw = uda->uda_writer;
+	struct rcslib_revision *base;
+	struct rcsnum t_num;
+	struct iovec iov[3];
+	uint64_t scriptlen;
+	uint8_t *cmd = uda->uda_cmd;
+	char *script;
+	size_t len;
+
+	if (!(*hashops->init)(&uda->uda_hash_ctx))
+		return (false);
+
+	iov[0].iov_base = "\n\n";
+	iov[0].iov_len = 2;
+	iov[1].iov_base = num->n_str;
+	iov[1].iov_len = num->n_len;
+	iov[2].iov_base = "\nlog\n@";
+	iov[2].iov_len = 6;
+	if (!rcslib_writer_writev(rw, iov, 3)) {
+		logmsg_err("%s", strerror(errno));
+		(*hashops->destroy)(uda->uda_hash_ctx);
+		return (false);
+	}
+
+	/* base */
+	if (!mux_recv(uda->uda_mux, MUX_UPDATER_IN, cmd, 1)) {
+		(*hashops->destroy)(uda->uda_hash_ctx);
+		return (false);
+	}
+	if ((len = cmd[0]) == 0) {
+		(*hashops->destroy)(uda->uda_hash_ctx);
+		return (false);
+	}
+	if (!mux_recv(uda->uda_mux, MUX_UPDATER_IN, cmd, len)) {
+		(*hashops->destroy)(uda->uda_hash_ctx);
+		return (false);
+	}
+	if (!rcslib_str2num(cmd, len, &t_num) || ((base = rcslib_lookup_revision(rcs, &t_num)) == NULL)) {
+		(*hashops->destroy)(uda->uda_hash_ctx);
+		return (false);
+	}
+
+	/* log */
+	if (!mux_recv(uda->uda_mux, MUX_UPDATER_IN, cmd, 4)) {
+		(*hashops->destroy)(uda->uda_hash_ctx);
+		return (false);
+	}
+	if (!updater_rcs_write_string(uda, GetDWord(cmd))) {
+		(*hashops->destroy)(uda->uda_hash_ctx);
+		return (false);
+	}
+
+	if (!rcslib_writer_write(rw, "@\ntext\n@", 8)) {
+		logmsg_err("%s", strerror(errno));
+		(*hashops->destroy)(uda->uda_hash_ctx);
+		return (false);
+	}
+
+	/* script */
+	if (!mux_recv(uda->uda_mux, MUX_UPDATER_IN, cmd, 8)) {
+		(*hashops->destroy)(uda->uda_hash_ctx);
+		return (false);
+	}
+	if ((scriptlen = GetDDWord(cmd)) > SIZE_MAX - 1) {
+		(*hashops->destroy)(uda->uda_hash_ctx);
+		return (false);
+	}
+	if ((script = malloc((size_t)scriptlen + 1)) == NULL) {
+		logmsg_err("%s", strerror(errno));
+		(*hashops->destroy)(uda->uda_hash_ctx);
+		return (false);
+	}
+	if (!mux_recv(uda->uda_mux, MUX_UPDATER_IN, script, (size_t)scriptlen)) {
+		free(script);
+		(*hashops->destroy)(uda->uda_hash_ctx);
+		return (false);
+	}
+	if (!rcslib_apply_rcsdiff(rw, hashops, uda->uda_hash_ctx, &base->text, script, (size_t)scriptlen)) {
+		logmsg_err("%s: %.*s: invalid edit script", uda->uda_path, (int)base->num.n_len, base->num.n_str);
+		free(script);
+		(*hashops->destroy)(uda->uda_hash_ctx);
+		return (false);
+	}
+	free(script);
+
+	if (!rcslib_writer_write(rw, "@\n", 2)) {
+		logmsg_err("%s", strerror(errno));
 		(*hashops->destroy)(uda->uda_hash_ctx);
 		return (false);
 	}
 
 	(*hashops->final)(uda->uda_hash_ctx, uda->uda_hash);
 
-	if (memcmp(uda->uda_hash, sp, hashops->length) != 0)
+	if (!mux_recv(uda->uda_mux, MUX_UPDATER_IN, cmd, hashops->length))
+		return (false);
+	if (memcmp(uda->uda_hash, cmd, hashops->length) != 0)
+		return (false);
+
+	if (uda->uda_digests->dl_valid)
+		digestfile_list_add(uda->uda_digestfile, uda->uda_digests, uda->uda_hash);
+
+	return (true);
+}
+
+/*
+ * A changed deltatext, whose text is given as an rdiff against the text
+ * rev has in the old file.
+ */
+bool
+updater_rcs_patch_deltatext(struct updater_args *uda, struct rcslib_revision *rev)
+{
+	const struct hash_args *hashops = uda->uda_hash_ops;
+	struct rcslib_writer *rw = uda->uda_writer;
+	struct iovec iov[3];
+	uint64_t offset;
+	uint32_t length;
+	uint8_t *cmd = uda->uda_cmd;
+
+	if (!(*hashops->init)(&uda->uda_hash_ctx))
+		return (false);
+
+	iov[0].iov_base = "\n\n";
+	iov[0].iov_len = 2;
+	iov[1].iov_base = rev->num.n_str;
+	iov[1].iov_len = rev->num.n_len;
+	iov[2].iov_base = "\nlog\n@";
+	iov[2].iov_len = 6;
+	if (!rcslib_writer_writev(rw, iov, 3)) {
+		logmsg_err("%s", strerror(errno));
+		(*hashops->destroy)(uda->uda_hash_ctx);
+		return (false);
+	}
+
+	/* log */
+	if (!mux_recv(uda->uda_mux, MUX_UPDATER_IN, cmd, 4)) {
+		(*hashops->destroy)(uda->uda_hash_ctx);
+		return (false);
+	}
+	if (!updater_rcs_write_string(uda, GetDWord(cmd))) {
+		(*hashops->destroy)(uda->uda_hash_ctx);
+		return (false);
+	}
+
+	if (!rcslib_writer_write(rw, "@\ntext\n@", 8)) {
+		logmsg_err("%s", strerror(errno));
+		(*hashops->destroy)(uda->uda_hash_ctx);
+		return (false);
+	}
+
+	/* text */
+	for (;;) {
+		if (!mux_recv(uda->uda_mux, MUX_UPDATER_IN, cmd, 1)) {
+			(*hashops->destroy)(uda->uda_hash_ctx);
+			return (false);
+		}
+		if (cmd[0] == RDIFF_CMD_EOF)
+			break;
+
+		switch (cmd[0]) {
+		case RDIFF_CMD_COPY:
+			if (!mux_recv(uda->uda_mux, MUX_UPDATER_IN, cmd, 12)) {
+				(*hashops->destroy)(uda->uda_hash_ctx);
+				return (false);
+			}
+			offset = GetDDWord(cmd);
+			length = GetDWord(&cmd[8]);
+			if ((length == 0) || (offset > rev->text.s_len) ||
+			    (length > rev->text.s_len - offset)) {
+				logmsg_err("%s: rdiff(COPY) error: offset=%" PRIu64 ", length=%lu", uda->uda_path,
+					   offset, (unsigned long)length);
+				(*hashops->destroy)(uda->uda_hash_ctx);
+				return (false);
+			}
+			if (!rcslib_writer_write(rw, rev->text.s_str + offset, length)) {
+				logmsg_err("%s", strerror(errno));
+				(*hashops->destroy)(uda->uda_hash_ctx);
+				return (false);
+			}
+			(*hashops->update)(uda->uda_hash_ctx, rev->text.s_str + offset, length);
+			break;
+		case RDIFF_CMD_DATA:
+			if (!mux_recv(uda->uda_mux, MUX_UPDATER_IN, cmd, 4)) {
+				(*hashops->destroy)(uda->uda_hash_ctx);
+				return (false);
+			}
+			if (!updater_rcs_write_string(uda, GetDWord(cmd))) {
+				(*hashops->destroy)(uda->uda_hash_ctx);
+				return (false);
+			}
+			break;
+		default:
+			logmsg_err("%s: rdiff: unsupported command: %02x", uda->uda_path, cmd[0]);
+			(*hashops->destroy)(uda->uda_hash_ctx);
+			return (false);
+		}
+	}
+
+	if (!rcslib_writer_write(rw, "@\n", 2)) {
+		logmsg_err("%s", strerror(errno));
+		(*hashops->destroy)(uda->uda_hash_ctx);
 		return (false);
+	}
+
+	(*hashops->final)(uda->uda_hash_ctx, uda->uda_hash);
+
+	if (!mux_recv(uda->uda_mux, MUX_UPDATER_IN, cmd, hashops->length))
+		return (false);
+	if (memcmp(uda->uda_hash, cmd, hashops->length) != 0)
+		return (false);
+
+	if (uda->uda_digests->dl_valid)
+		digestfile_list_add(uda->uda_digestfile, uda->uda_digests, uda->uda_hash);
+
+	return (true);
+}
+
+/* Receives a string of len bytes, writes it out and adds it to the digest. */
+bool
+updater_rcs_write_string(struct updater_args *uda, uint64_t len)
+{
+	size_t n;
+
+	while (len > 0) {
+		if (len > uda->uda_bufsize)
+			n = uda->uda_bufsize;
+		else
+			n = (size_t)len;
+		if (!mux_recv(uda->uda_mux, MUX_UPDATER_IN, uda->uda_buffer, n))
+			return (false);
+		if (!rcslib_writer_write(uda->uda_writer, uda->uda_buffer, n)) {
+			logmsg_err("%s", strerror(errno));
+			return (false);
+		}
+		(*uda->uda_hash_ops->update)(uda->uda_hash_ctx, uda->uda_buffer, n);
+		len -= (uint64_t)n;
+	}
 
 	return (true);
 }
@@ -1875,7 +2194,6 @@ updater_rcs_desc(struct updater_args *uda)
 	struct iovec iov[3];
 	uint8_t *cmd = uda->uda_cmd;
 	size_t len;
-	ssize_t wn;
 
 	iov[0].iov_base = "\n\ndesc\n@";
 	iov[0].iov_len = 8;
@@ -1895,28 +2213,23 @@ updater_rcs_desc(struct updater_args *uda)
 	iov[1].iov_len = len - 2;
 	iov[2].iov_base = "@\n";
 	iov[2].iov_len = 2;
-	len = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
 
-	if ((wn = writev(uda->uda_fileno, iov, 3)) == -1) {
+	if (!rcslib_writer_writev(uda->uda_writer, iov, 3)) {
 		logmsg_err("%s", strerror(errno));
 		return (false);
 	}
-	if ((size_t)wn != len) {
-		logmsg_err("writev error");
-		return (false);
-	}
 
 	return (true);
 }
 
 bool
-updater_rcs_deltatext(struct updater_args *uda, struct rcslib_file *rcs)
+updater_rcs_deltatext(struct updater_args *uda, struct cvsync_file *cfp, struct rcslib_file *rcs)
 {
 	struct rcslib_revision *rev;
 	struct rcsnum *n1, *n2, t_num;
-	uint8_t *cmd = uda->uda_cmd;
+	uint8_t *cmd = uda->uda_cmd, op;
 	size_t len, c = 0;
-	int fd = uda->uda_fileno, rv;
+	int rv;
 
 	n2 = &t_num;
 
@@ -1941,7 +2254,11 @@ updater_rcs_deltatext(struct updater_args *uda, struct rcslib_file *rcs)
 		if (!rcslib_str2num(&cmd[3], cmd[2], n2))
 			return (false);
 
-		switch (cmd[1]) {
+		switch ((op = cmd[1])) {
+		case UPDATER_UPDATE_EDIT:
+			if (uda->uda_proto < CVSYNC_PROTO(0, 28))
+				return (false);
+			/* FALLTHROUGH */
 		case UPDATER_UPDATE_ADD:
 			if (c < rcs->delta.rd_count) {
 				do {
@@ -1952,7 +2269,7 @@ updater_rcs_deltatext(struct updater_args *uda, struct rcslib_file *rcs)
 						return (false);
 					if (rv > 0)
 						break;
-					if (!rcslib_write_deltatext(fd, rev))
+					if (!updater_rcs_copy_deltatext(uda, cfp, rcs, rev))
 						return (false);
 				} while (++c < rcs->delta.rd_count);
 			} else {
@@ -1962,8 +2279,13 @@ updater_rcs_deltatext(struct updater_args *uda, struct rcslib_file *rcs)
 						return (false);
 				}
 			}
-			if (!updater_rcs_write_deltatext(uda, n2))
-				return (false);
+			if (op == UPDATER_UPDATE_EDIT) {
+				if (!updater_rcs_edit_deltatext(uda, rcs, n2))
+					return (false);
+			} else {
+				if (!updater_rcs_write_deltatext(uda, n2))
+					return (false);
+			}
 			break;
 		case UPDATER_UPDATE_REMOVE:
 			if (c == rcs->delta.rd_count)
@@ -1978,10 +2300,14 @@ updater_rcs_deltatext(struct updater_args *uda, struct rcslib_file *rcs)
 					c++;
 					break;
 				}
-				if (!rcslib_write_deltatext(fd, rev))
+				if (!updater_rcs_copy_deltatext(uda, cfp, rcs, rev))
 					return (false);
 			} while (++c < rcs->delta.rd_count);
 			break;
+		case UPDATER_UPDATE_PATCH:
+			if (uda->uda_proto < CVSYNC_PROTO(0, 29))
+				return (false);
+			/* FALLTHROUGH */
 		case UPDATER_UPDATE_UPDATE:
 			if (c == rcs->delta.rd_count)
 				return (false);
@@ -1992,12 +2318,17 @@ updater_rcs_deltatext(struct updater_args *uda, struct rcslib_file *rcs)
 				if ((rv = rcslib_cmp_num(n1, n2)) > 0)
 					return (false);
 				if (rv < 0) {
-					if (!rcslib_write_deltatext(fd, rev))
+					if (!updater_rcs_copy_deltatext(uda, cfp, rcs, rev))
 						return (false);
 					continue;
 				}
-				if (!updater_rcs_write_deltatext(uda, n2))
-					return (false);
+				if (op == UPDATER_UPDATE_PATCH) {
+					if (!updater_rcs_patch_deltatext(uda, rev))
+						return (false);
+				} else {
+					if (!updater_rcs_write_deltatext(uda, n2))
+						return (false);
+				}
 				break;
 			} while (c < rcs->delta.rd_count);
 			break;
@@ -2007,7 +2338,7 @@ updater_rcs_deltatext(struct updater_args *uda, struct rcslib_file *rcs)
 	}
 	while (c < rcs->delta.rd_count) {
 		rev = &rcs->delta.rd_rev[c++];
-		if (!rcslib_write_deltatext(fd, rev))
+		if (!updater_rcs_copy_deltatext(uda, cfp, rcs, rev))
 			return (false);
 	}
 
@@ -2017,17 +2348,40 @@ updater_rcs_deltatext(struct updater_args *uda, struct rcslib_file *rcs)
 	return (true);
 }
 
+bool
+updater_rcs_copy_deltatext(struct updater_args *uda, struct cvsync_file *cfp, struct rcslib_file *rcs,
+			   struct rcslib_revision *rev)
+{
+	struct digestfile_list *dl = uda->uda_odigests;
+	size_t n = (size_t)(rev - rcs->delta.rd_rev), len;
+	off_t offset;
+
+	/* Unchanged deltatexts are taken from the old file as they are. */
+	if (rcslib_deltatext_extent(rcs, rev, &offset, &len)) {
+		if (!rcslib_writer_splice(uda->uda_writer, cfp->cf_fileno, offset, len)) {
+			logmsg_err("%s", strerror(errno));
+			return (false);
+		}
+	} else {
+		if (!rcslib_write_deltatext(uda->uda_writer, rev)) {
+			logmsg_err("%s", strerror(errno));
+			return (false);
+		}
+	}
+
+	if (uda->uda_digests->dl_valid)
+		digestfile_list_add(uda->uda_digestfile, uda->uda_digests, &dl->dl_digests[n * uda->uda_hash_ops->length]);
+
+	return (true);
+}
+
 bool
 updater_rcs_write_deltatext(struct updater_args *uda, struct rcsnum *num)
 {
 	const struct hash_args *hashops = uda->uda_hash_ops;
+	struct rcslib_writer *rw = uda->uda_writer;
 	struct iovec iov[3];
-	uint64_t textlen;
-	uint32_t loglen;
 	uint8_t *cmd = uda->uda_cmd;
-	size_t len;
-	ssize_t wn;
-	int fd = uda->uda_fileno;
 
 	if (!(*hashops->init)(&uda->uda_hash_ctx))
 		return (false);
@@ -2038,47 +2392,22 @@ updater_rcs_write_deltatext(struct updater_args *uda, struct rcsnum *num)
 	iov[1].iov_len = num->n_len;
 	iov[2].iov_base = "\nlog\n@";
 	iov[2].iov_len = 6;
-	if ((wn = writev(fd, iov, 3)) == -1) {
+	if (!rcslib_writer_writev(rw, iov, 3)) {
 		logmsg_err("%s", strerror(errno));
 		(*hashops->destroy)(uda->uda_hash_ctx);
 		return (false);
 	}
-	if ((size_t)wn != (num->n_len + 8)) {
-		logmsg_err("writev error");
-		(*hashops->destroy)(uda->uda_hash_ctx);
-		return (false);
-	}
 
 	if (!mux_recv(uda->uda_mux, MUX_UPDATER_IN, cmd, 4)) {
 		(*hashops->destroy)(uda->uda_hash_ctx);
 		return (false);
 	}
-	if ((loglen = GetDWord(cmd)) != 0) {
-		while (loglen > 0) {
-			if (loglen > uda->uda_bufsize)
-				len = uda->uda_bufsize;
-			else
-				len = (size_t)loglen;
-			if (!mux_recv(uda->uda_mux, MUX_UPDATER_IN, uda->uda_buffer, len)) {
-				(*hashops->destroy)(uda->uda_hash_ctx);
-				return (false);
-			}
-			if ((wn = write(fd, uda->uda_buffer, len)) == -1) {
-				logmsg_err("%s", strerror(errno));
-				(*hashops->destroy)(uda->uda_hash_ctx);
-				return (false);
-			}
-			if ((size_t)wn != len) {
-				logmsg_err("writev error");
-				(*hashops->destroy)(uda->uda_hash_ctx);
-				return (false);
-			}
-			(*hashops->update)(uda->uda_hash_ctx, uda->uda_buffer, len);
-			loglen -= (uint32_t)len;
-		}
+	if (!updater_rcs_write_string(uda, GetDWord(cmd))) {
+		(*hashops->destroy)(uda->uda_hash_ctx);
+		return (false);
 	}
 
-	if (write(fd, "@\ntext\n@", 8) != 8) {
+	if (!rcslib_writer_write(rw, "@\ntext\n@", 8)) {
 		logmsg_err("%s", strerror(errno));
 		(*hashops->destroy)(uda->uda_hash_ctx);
 		return (false);
@@ -2088,32 +2417,12 @@ updater_rcs_write_deltatext(struct updater_args *uda, struct rcsnum *num)
 		(*hashops->destroy)(uda->uda_hash_ctx);
 		return (false);
 	}
-	if ((textlen = GetDDWord(cmd)) != 0) {
-		while (textlen > 0) {
-			if (textlen > uda->uda_bufsize)
-				len = uda->uda_bufsize;
-			else
-				len = (size_t)textlen;
-			if (!mux_recv(uda->uda_mux, MUX_UPDATER_IN, uda->uda_buffer, len)) {
-				(*hashops->destroy)(uda->uda_hash_ctx);
-				return (false);
-			}
-			if ((wn = write(fd, uda->uda_buffer, len)) == -1) {
-				logmsg_err("%s", strerror(errno));
-				(*hashops->destroy)(uda->uda_hash_ctx);
-				return (false);
-			}
-			if ((size_t)wn != len) {
-				logmsg_err("writev error");
-				(*hashops->destroy)(uda->uda_hash_ctx);
-				return (false);
-			}
-			(*hashops->update)(uda->uda_hash_ctx, uda->uda_buffer, len);
-			textlen -= (uint64_t)len;
-		}
+	if (!updater_rcs_write_string(uda, GetDDWord(cmd))) {
+		(*hashops->destroy)(uda->uda_hash_ctx);
+		return (false);
 	}
 
-	if (write(fd, "@\n", 2) != 2) {
+	if (!rcslib_writer_write(rw, "@\n", 2)) {
 		logmsg_err("%s", strerror(errno));
 		(*hashops->destroy)(uda->uda_hash_ctx);
 		return (false);
@@ -2126,5 +2435,8 @@ updater_rcs_write_deltatext(struct updater_args *uda, struct rcsnum *num)
 	if (memcmp(uda->uda_hash, cmd, hashops->length) != 0)
 		return (false);
 
+	if (uda->uda_digests->dl_valid)
+		digestfile_list_add(uda->uda_digestfile, uda->uda_digests, uda->uda_hash);
+
 	return (true);
 }
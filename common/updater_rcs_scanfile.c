@@ -20,13 +20,17 @@
 #include "collection.h"
 #include "cvsync.h"
 #include "cvsync_attr.h"
+#include "digestfile.h"
 #include "filetypes.h"
 #include "hash.h"
 #include "logmsg.h"
 #include "scanfile.h"
+#include "version.h"
 
 #include "updater.h"
 
+size_t updater_rcs_scanfile_digest(struct updater_args *, size_t);
+
 bool
 updater_rcs_scanfile_attic(struct updater_args *uda)
 {
@@ -42,6 +46,7 @@ updater_rcs_scanfile_attic(struct updater_args *uda)
 					  cap->ca_mode)) == 0) {
 		return (false);
 	}
+	auxlen = updater_rcs_scanfile_digest(uda, auxlen);
 
 	if (!scanfile_replace(sa, cap->ca_type, cap->ca_name, cap->ca_namelen,
 			      cap->ca_aux, auxlen)) {
@@ -97,6 +102,7 @@ updater_rcs_scanfile_create(struct updater_args *uda)
 						  cap->ca_mode)) == 0) {
 			return (false);
 		}
+		auxlen = updater_rcs_scanfile_digest(uda, auxlen);
 		break;
 	case FILETYPE_SYMLINK:
 		auxlen = cap->ca_auxlen;
@@ -162,6 +168,9 @@ updater_rcs_scanfile_remove(struct updater_args *uda)
 	struct cvsync_attr *cap = &uda->uda_attr;
 	struct scanfile_args *sa = uda->uda_scanfile;
 
+	if ((uda->uda_digestfile != NULL) && (cap->ca_type != FILETYPE_DIR))
+		digestfile_remove(uda->uda_digestfile, uda->uda_rpath);
+
 	if (sa == NULL)
 		goto done;
 
@@ -214,8 +223,9 @@ updater_rcs_scanfile_setattr(struct updater_args *uda)
 		return (false);
 	}
 
-	if (!scanfile_update(sa, cap->ca_type, cap->ca_name, cap->ca_namelen,
-			     cap->ca_aux, auxlen)) {
+	/* The contents, and thus the digest, have not been changed. */
+	if (!scanfile_setattr(sa, cap->ca_type, cap->ca_name, cap->ca_namelen,
+			      cap->ca_aux, auxlen, auxmax)) {
 		return (false);
 	}
 
@@ -257,6 +267,7 @@ updater_rcs_scanfile_update(struct updater_args *uda)
 						  cap->ca_mode)) == 0) {
 			return (false);
 		}
+		auxlen = updater_rcs_scanfile_digest(uda, auxlen);
 		break;
 	case FILETYPE_SYMLINK:
 		auxlen = cap->ca_auxlen;
@@ -292,3 +303,27 @@ done:
 
 	return (true);
 }
+
+/*
+ * Since 0.25 the scanfile keeps the logical digest of an RCS file, which
+ * is sent to DirCmp.  The file is listed without it if it is not parsable.
+ */
+size_t
+updater_rcs_scanfile_digest(struct updater_args *uda, size_t auxlen)
+{
+	struct cvsync_attr *cap = &uda->uda_attr;
+	uint8_t digest[HASH_MAXLEN];
+	size_t len;
+
+	if (uda->uda_proto < CVSYNC_PROTO(0, 25))
+		return (auxlen);
+	if (!scanfile_rcs_digest(uda->uda_path, uda->uda_hash_ops, digest))
+		return (auxlen);
+	if ((len = attr_rcs_encode_digest(cap->ca_aux, sizeof(cap->ca_aux),
+					  digest,
+					  uda->uda_hash_ops->length)) == 0) {
+		return (auxlen);
+	}
+
+	return (len);
+}
@@ -6,8 +6,8 @@
 #define	CVSYNC_VERSION_H
 
 #define	CVSYNC_MAJOR		(0)
-#define	CVSYNC_MINOR		(24)
-#define	CVSYNC_PATCHLEVEL	(21)
+#define	CVSYNC_MINOR		(30)
+#define	CVSYNC_PATCHLEVEL	(0)
 
 #define	CVSYNC_PROTO_MAJOR	CVSYNC_MAJOR
 #define	CVSYNC_PROTO_MINOR	CVSYNC_MINOR
@@ -42,6 +42,12 @@
 #define	CVSYNCD_MIN_MAXCLIENTS		(1)
 #define	CVSYNCD_MAX_MAXCLIENTS		(2048)
 
+#ifndef CVSYNCD_DEFAULT_RCSCACHE
+#define	CVSYNCD_DEFAULT_RCSCACHE	(64)
+#endif /* CVSYNCD_DEFAULT_RCSCACHE */
+
+#define	CVSYNCD_MAX_RCSCACHE		(2048)
+
 enum {
 	TOK_ACL,
 	TOK_BASE,
@@ -53,6 +59,7 @@ enum {
 	TOK_ERRORMODE,
 	TOK_HALTFILE,
 	TOK_HASH,
+	TOK_INODEORDER,
 	TOK_LBRACE,
 	TOK_LISTEN,
 	TOK_LOOSE,
@@ -63,8 +70,10 @@ enum {
 	TOK_PORT,
 	TOK_PREFIX,
 	TOK_RBRACE,
+	TOK_RCSCACHE,
 	TOK_RELEASE,
 	TOK_SCANFILE,
+	TOK_SCANFILE_NOCACHE,
 	TOK_SUPER,
 	TOK_UMASK,
 
@@ -84,6 +93,7 @@ static const struct token_keyword config_keywords[] = {
 	{ "errormode",		9,	TOK_ERRORMODE },
 	{ "haltfile",		8,	TOK_HALTFILE },
 	{ "hash",		4,	TOK_HASH },
+	{ "inode-order",	11,	TOK_INODEORDER },
 	{ "listen",		6,	TOK_LISTEN },
 	{ "loose",		5,	TOK_LOOSE },
 	{ "maxclients",		10,	TOK_MAXCLIENTS },
@@ -92,8 +102,10 @@ static const struct token_keyword config_keywords[] = {
 	{ "pidfile",		7,	TOK_PIDFILE },
 	{ "port",		4,	TOK_PORT },
 	{ "prefix",		6,	TOK_PREFIX },
+	{ "rcscache",		8,	TOK_RCSCACHE },
 	{ "release",		7,	TOK_RELEASE },
 	{ "scanfile",		8,	TOK_SCANFILE },
+	{ "scanfile-nocache",	16,	TOK_SCANFILE_NOCACHE },
 	{ "super",		5,	TOK_SUPER },
 	{ "umask",		5,	TOK_UMASK },
 	{ NULL,			0,	TOK_UNKNOWN },
@@ -267,6 +279,7 @@ config_parse_config(struct config_args *ca)
 	}
 	(void)memset(cf, 0, sizeof(*cf));
 	cf->cf_maxclients = SIZE_MAX;
+	cf->cf_rcscache = SIZE_MAX;
 	cf->cf_hash = HASH_UNSPEC;
 
 	for (;;) {
@@ -350,6 +363,23 @@ config_parse_config(struct config_args *ca)
 			}
 			cf->cf_maxclients = (size_t)ul;
 			break;
+		case TOK_RCSCACHE:
+			if (cf->cf_rcscache != SIZE_MAX) {
+				logmsg_err("line %u: found duplication of the '%s'", lineno, key->name);
+				config_destroy(cf);
+				return (NULL);
+			}
+			if (!token_get_number(fp, &ul)) {
+				config_destroy(cf);
+				return (NULL);
+			}
+			if (ul > CVSYNCD_MAX_RCSCACHE) {
+				logmsg_err("line %u: %s %lu: %s", lineno, key->name, ul, strerror(ERANGE));
+				config_destroy(cf);
+				return (NULL);
+			}
+			cf->cf_rcscache = (size_t)ul;
+			break;
 		case TOK_PIDFILE:
 			ca->ca_buffer = cf->cf_pid_name;
 			ca->ca_bufsize = sizeof(cf->cf_pid_name);
@@ -377,6 +407,8 @@ config_parse_config(struct config_args *ca)
 		snprintf(cf->cf_serv, sizeof(cf->cf_serv), "%s", CVSYNC_DEFAULT_PORT);
 	if (cf->cf_maxclients == SIZE_MAX)
 		cf->cf_maxclients = CVSYNCD_DEFAULT_MAXCLIENTS;
+	if (cf->cf_rcscache == SIZE_MAX)
+		cf->cf_rcscache = CVSYNCD_DEFAULT_RCSCACHE;
 	if (cf->cf_hash == HASH_UNSPEC)
 		cf->cf_hash = HASH_DEFAULT_TYPE;
 
@@ -491,6 +523,14 @@ config_parse_collection(struct config_args *ca)
 				return (NULL);
 			}
 			break;
+		case TOK_INODEORDER:
+			if (cl->cl_inodeorder) {
+				logmsg_err("line %u: found duplication of the '%s'", lineno, key->name);
+				collection_destroy(cl);
+				return (NULL);
+			}
+			cl->cl_inodeorder = true;
+			break;
 		case TOK_LOOSE:
 			logmsg_err("line %u: '%s' is obsoleted", lineno, key->name);
 			if (cl->cl_errormode != CVSYNC_ERRORMODE_UNSPEC) {
@@ -538,6 +578,14 @@ config_parse_collection(struct config_args *ca)
 				return (NULL);
 			}
 			break;
+		case TOK_SCANFILE_NOCACHE:
+			if (cl->cl_scan_nocache) {
+				logmsg_err("line %u: found duplication of the '%s'", lineno, key->name);
+				collection_destroy(cl);
+				return (NULL);
+			}
+			cl->cl_scan_nocache = true;
+			break;
 		case TOK_SUPER:
 			ca->ca_buffer = cl->cl_super_name;
 			ca->ca_bufsize = sizeof(cl->cl_super_name);
@@ -721,6 +769,8 @@ config_set_collection_super(struct collection *cl, struct collection *super)
 	switch (cvsync_release_pton(cl->cl_release)) {
 	case CVSYNC_RELEASE_RCS:
 		cl->cl_symfollow = super->cl_symfollow;
+		if (!cl->cl_inodeorder)
+			cl->cl_inodeorder = super->cl_inodeorder;
 		cl->cl_umask = super->cl_umask;
 		break;
 	default:
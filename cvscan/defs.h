@@ -11,6 +11,7 @@ struct config {
 	char			cf_addr[CVSYNC_MAXHOST];
 	char			cf_serv[CVSYNC_MAXSERV];
 	size_t			cf_maxclients;
+	size_t			cf_rcscache;
 	char			cf_base[PATH_MAX], cf_base_prefix[PATH_MAX];
 	char			cf_access_name[PATH_MAX + CVSYNC_NAME_MAX + 1];
 	char			cf_halt_name[PATH_MAX + CVSYNC_NAME_MAX + 1];
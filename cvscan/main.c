@@ -4,13 +4,16 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/uio.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <errno.h>
 #include <limits.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "compat_stdbool.h"
@@ -22,31 +25,49 @@
 #include "attribute.h"
 #include "collection.h"
 #include "cvsync.h"
+#include "hash.h"
 #include "logmsg.h"
 #include "mdirent.h"
 #include "network.h"
 #include "scanfile.h"
 
 #include "defs.h"
+#include "watch.h"
 
 bool cvscan(struct collection *);
+bool cvscan_refresh(struct collection *, struct watch_root *);
+bool cvscan_daemon(struct collection *, time_t);
+bool cvscan_isskipped(struct collection *);
+void cvscan_set_args(struct collection *, struct scanfile_create_args *, struct mdirent_args *);
 NORETURN void usage(void);
 
+const struct hash_args *cvscan_hash_ops = NULL;
+
 int
 main(int argc, char *argv[])
 {
 	const char *cfname = NULL;
 	struct collection *cls = NULL, *cl, base_cl;
 	struct config *cf;
+	time_t interval = 0;
 	size_t len;
+	long n;
 	int ch, status = EXIT_SUCCESS;
-	bool log_flag = false;
+	bool daemon_flag = false, digest_flag = false, log_flag = false;
+	char *ep;
 
 	cl = &base_cl;
 	collection_init(cl);
 
-	while ((ch = getopt(argc, argv, "FLc:f:hlqr:v")) != -1) {
+	while ((ch = getopt(argc, argv, "DFILc:df:hi:lqr:v")) != -1) {
 		switch (ch) {
+		case 'D':
+			if (digest_flag) {
+				usage();
+				/* NOTREACHED */
+			}
+			digest_flag = true;
+			break;
 		case 'F':
 			if (!cl->cl_symfollow) {
 				usage();
@@ -54,6 +75,13 @@ main(int argc, char *argv[])
 			}
 			cl->cl_symfollow = false;
 			break;
+		case 'I':
+			if (cl->cl_inodeorder) {
+				usage();
+				/* NOTREACHED */
+			}
+			cl->cl_inodeorder = true;
+			break;
 		case 'L':
 			if (cl->cl_errormode != CVSYNC_ERRORMODE_UNSPEC) {
 				usage();
@@ -68,6 +96,13 @@ main(int argc, char *argv[])
 			}
 			cfname = optarg;
 			break;
+		case 'd':
+			if (daemon_flag) {
+				usage();
+				/* NOTREACHED */
+			}
+			daemon_flag = true;
+			break;
 		case 'f':
 			if (strlen(cl->cl_scan_name) != 0) {
 				usage();
@@ -84,6 +119,19 @@ main(int argc, char *argv[])
 		case 'h':
 			usage();
 			/* NOTREACHED */
+		case 'i':
+			if (interval != 0) {
+				usage();
+				/* NOTREACHED */
+			}
+			errno = 0;
+			n = strtol(optarg, &ep, 10);
+			if ((errno != 0) || (*ep != '\0') || (n <= 0)) {
+				usage();
+				/* NOTREACHED */
+			}
+			interval = (time_t)n;
+			break;
 		case 'l':
 			if (cl->cl_errormode != CVSYNC_ERRORMODE_UNSPEC) {
 				usage();
@@ -130,6 +178,12 @@ main(int argc, char *argv[])
 
 	if (cl->cl_errormode == CVSYNC_ERRORMODE_UNSPEC)
 		cl->cl_errormode = CVSYNC_ERRORMODE_ABORT;
+	if ((interval != 0) && !daemon_flag) {
+		usage();
+		/* NOTREACHED */
+	}
+	if (interval == 0)
+		interval = WATCH_INTERVAL;
 
 	if (!cvsync_init())
 		exit(EXIT_FAILURE);
@@ -145,14 +199,25 @@ main(int argc, char *argv[])
 			logmsg_err("Not specified the output file.");
 			exit(EXIT_FAILURE);
 		}
-		if (!cvscan(cl))
-			status = EXIT_FAILURE;
+		if (digest_flag && !hash_set(HASH_DEFAULT_TYPE, &cvscan_hash_ops))
+			exit(EXIT_FAILURE);
+		if (daemon_flag) {
+			if (!cvscan_daemon(cl, interval))
+				status = EXIT_FAILURE;
+		} else {
+			if (!cvscan(cl))
+				status = EXIT_FAILURE;
+		}
 	} else {
 		if (!collection_set_default(cl, NULL))
 			exit(EXIT_FAILURE);
 
 		if ((cf = config_load(cfname)) == NULL)
 			exit(EXIT_FAILURE);
+		if (digest_flag && !hash_set(cf->cf_hash, &cvscan_hash_ops)) {
+			config_destroy(cf);
+			exit(EXIT_FAILURE);
+		}
 
 		switch (argc) {
 		case 0:
@@ -177,9 +242,14 @@ main(int argc, char *argv[])
 			/* NOTREACHED */
 		}
 
-		for (cl = cls ; cl != NULL ; cl = cl->cl_next) {
-			if (!cvscan(cl))
+		if (daemon_flag) {
+			if (!cvscan_daemon(cls, interval))
 				status = EXIT_FAILURE;
+		} else {
+			for (cl = cls ; cl != NULL ; cl = cl->cl_next) {
+				if (!cvscan(cl))
+					status = EXIT_FAILURE;
+			}
 		}
 
 		if (argc != 0)
@@ -196,39 +266,143 @@ cvscan(struct collection *cl)
 {
 	struct scanfile_create_args sca;
 	struct mdirent_args mda;
+	struct timeval tic, toc;
+	double sec;
 
-	if (strlen(cl->cl_scan_name) == 0)
-		return (true);
-	if ((cl->cl_super != NULL) && (strcmp(cl->cl_super->cl_scan_name, cl->cl_scan_name) == 0))
+	if (cvscan_isskipped(cl))
 		return (true);
 
 	logmsg("Scanfile: name %s, release %s, prefix %s", cl->cl_name, cl->cl_release, cl->cl_prefix);
 
-	mda.mda_errormode = cl->cl_errormode;
-	mda.mda_symfollow = cl->cl_symfollow;
-	mda.mda_remove = false;
+	cvscan_set_args(cl, &sca, &mda);
 
-	sca.sca_name = cl->cl_scan_name;
-	sca.sca_prefix = cl->cl_prefix;
-	sca.sca_release = cl->cl_release;
-	sca.sca_rprefix = cl->cl_rprefix;
-	sca.sca_rprefixlen = cl->cl_rprefixlen;
-	sca.sca_mode = S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH;
-	sca.sca_mdirent_args = &mda;
-	sca.sca_umask = cl->cl_umask;
+	gettimeofday(&tic, NULL);
 
 	if (!scanfile_create(&sca))
 		return (false);
 
+	gettimeofday(&toc, NULL);
+
+	sec = (double)(toc.tv_sec - tic.tv_sec) + (double)(toc.tv_usec - tic.tv_usec) / 1000000;
+	if (sec > 0) {
+		logmsg_verbose("Scanfile: %" PRIu32 " entries in %.3f sec (%.0f entries/sec)",
+			       sca.sca_nentries, sec, (double)sca.sca_nentries / sec);
+	}
+
 	logmsg("Finished successfully");
 
 	return (true);
 }
 
+bool
+cvscan_refresh(struct collection *cl, struct watch_root *wr)
+{
+	struct scanfile_create_args sca;
+	struct mdirent_args mda;
+
+	logmsg_verbose("Scanfile: name %s, release %s, %lu director%s changed", cl->cl_name, cl->cl_release,
+		       (unsigned long)wr->wr_ndirs, (wr->wr_ndirs == 1) ? "y" : "ies");
+
+	cvscan_set_args(cl, &sca, &mda);
+
+	return (scanfile_refresh(&sca, wr->wr_dirs, wr->wr_ndirs));
+}
+
+bool
+cvscan_daemon(struct collection *cls, time_t interval)
+{
+	struct collection *cl;
+	struct watch *w;
+	struct watch_root *wr;
+	size_t i;
+
+	if ((w = watch_init()) == NULL)
+		return (false);
+
+	for (cl = cls ; cl != NULL ; cl = cl->cl_next) {
+		if (cvscan_isskipped(cl))
+			continue;
+		if (!watch_add(w, cl) || !cvscan(cl)) {
+			watch_destroy(w);
+			return (false);
+		}
+	}
+
+	while (!cvsync_is_interrupted()) {
+		if (!watch_wait(w, interval)) {
+			watch_destroy(w);
+			return (false);
+		}
+
+		for (i = 0 ; i < w->w_nroots ; i++) {
+			if (cvsync_is_interrupted())
+				break;
+
+			wr = &w->w_roots[i];
+			cl = wr->wr_collection;
+			if (wr->wr_overflow) {
+				watch_clear(wr);
+				if (!watch_reset(w, i) || !cvscan(cl)) {
+					watch_destroy(w);
+					return (false);
+				}
+				continue;
+			}
+			if (wr->wr_ndirs == 0)
+				continue;
+
+			if (!cvscan_refresh(cl, wr)) {
+				watch_clear(wr);
+				if (!cvscan(cl)) {
+					watch_destroy(w);
+					return (false);
+				}
+			}
+			watch_clear(wr);
+		}
+	}
+
+	watch_destroy(w);
+
+	return (true);
+}
+
+bool
+cvscan_isskipped(struct collection *cl)
+{
+	if (strlen(cl->cl_scan_name) == 0)
+		return (true);
+	if ((cl->cl_super != NULL) && (strcmp(cl->cl_super->cl_scan_name, cl->cl_scan_name) == 0))
+		return (true);
+
+	return (false);
+}
+
+void
+cvscan_set_args(struct collection *cl, struct scanfile_create_args *sca, struct mdirent_args *mda)
+{
+	mda->mda_errormode = cl->cl_errormode;
+	mda->mda_symfollow = cl->cl_symfollow;
+	mda->mda_inodeorder = cl->cl_inodeorder;
+	mda->mda_remove = false;
+
+	sca->sca_name = cl->cl_scan_name;
+	sca->sca_prefix = cl->cl_prefix;
+	sca->sca_release = cl->cl_release;
+	sca->sca_rprefix = cl->cl_rprefix;
+	sca->sca_rprefixlen = cl->cl_rprefixlen;
+	sca->sca_mode = S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH;
+	sca->sca_mdirent_args = mda;
+	sca->sca_umask = cl->cl_umask;
+	sca->sca_hash_ops = cvscan_hash_ops;
+	sca->sca_nentries = 0;
+	sca->sca_nocache = cl->cl_scan_nocache;
+}
+
 NORETURN void
 usage(void)
 {
-	logmsg_err("Usage: cvscan [-hqv] [-r <release>] -c <file> [<name>]\n"
-		   "       cvscan [-FLhlqv] [-r <release>] -f <file> <directory>");
+	logmsg_err("Usage: cvscan [-Ddhqv] [-i <interval>] [-r <release>] -c <file> [<name>]\n"
+		   "       cvscan [-DFILdhlqv] [-i <interval>] [-r <release>] -f <file> <directory>");
 	exit(EXIT_FAILURE);
 }
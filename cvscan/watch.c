@@ -0,0 +1,122 @@
+/*-
+ * This software is released under the BSD License, see LICENSE.
+ */
+
+#include <sys/types.h>
+
+#include <stdlib.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+
+#include "compat_stdbool.h"
+#include "compat_stdint.h"
+#include "compat_inttypes.h"
+#include "compat_limits.h"
+
+#include "collection.h"
+#include "cvsync.h"
+#include "logmsg.h"
+
+#include "watch.h"
+
+struct watch_root *
+watch_insert_root(struct watch *w, struct collection *cl)
+{
+	struct watch_root *wr;
+	size_t len;
+
+	if ((wr = realloc(w->w_roots, (w->w_nroots + 1) * sizeof(*wr))) == NULL) {
+		logmsg_err("%s", strerror(errno));
+		return (NULL);
+	}
+	w->w_roots = wr;
+	wr = &w->w_roots[w->w_nroots];
+
+	len = cl->cl_prefixlen;
+	while ((len > 1) && (cl->cl_prefix[len - 1] == '/'))
+		len--;
+	if (len + cl->cl_rprefixlen + 1 >= sizeof(wr->wr_path)) {
+		logmsg_err("%s: %s", cl->cl_prefix, strerror(ENAMETOOLONG));
+		return (NULL);
+	}
+	(void)memcpy(wr->wr_path, cl->cl_prefix, len);
+	wr->wr_path[len++] = '/';
+	wr->wr_pathlen = len;
+	wr->wr_path[len] = '\0';
+
+	wr->wr_collection = cl;
+	wr->wr_dirs = NULL;
+	wr->wr_ndirs = 0;
+	wr->wr_maxdirs = 0;
+	wr->wr_overflow = false;
+
+	w->w_nroots++;
+
+	return (wr);
+}
+
+void
+watch_free_roots(struct watch *w)
+{
+	size_t i;
+
+	for (i = 0 ; i < w->w_nroots ; i++) {
+		watch_clear(&w->w_roots[i]);
+		if (w->w_roots[i].wr_dirs != NULL)
+			free(w->w_roots[i].wr_dirs);
+	}
+	if (w->w_roots != NULL)
+		free(w->w_roots);
+	w->w_roots = NULL;
+	w->w_nroots = 0;
+}
+
+bool
+watch_mark(struct watch_root *wr, const char *name, size_t namelen)
+{
+	char **dirs, *dir;
+	size_t max;
+
+	if (wr->wr_overflow)
+		return (true);
+	if (wr->wr_ndirs > 0) {
+		dir = wr->wr_dirs[wr->wr_ndirs - 1];
+		if ((strlen(dir) == namelen) && (memcmp(dir, name, namelen) == 0))
+			return (true);
+	}
+
+	if (wr->wr_ndirs == wr->wr_maxdirs) {
+		max = (wr->wr_maxdirs == 0) ? 64 : wr->wr_maxdirs * 2;
+		if ((dirs = realloc(wr->wr_dirs, max * sizeof(*dirs))) == NULL) {
+			logmsg_err("%s", strerror(errno));
+			return (false);
+		}
+		wr->wr_dirs = dirs;
+		wr->wr_maxdirs = max;
+	}
+
+	if ((dir = malloc(namelen + 1)) == NULL) {
+		logmsg_err("%s", strerror(errno));
+		return (false);
+	}
+	(void)memcpy(dir, name, namelen);
+	dir[namelen] = '\0';
+
+	wr->wr_dirs[wr->wr_ndirs++] = dir;
+
+	return (true);
+}
+
+void
+watch_clear(struct watch_root *wr)
+{
+	size_t i;
+
+	for (i = 0 ; i < wr->wr_ndirs ; i++)
+		free(wr->wr_dirs[i]);
+	wr->wr_ndirs = 0;
+	wr->wr_overflow = false;
+}
@@ -0,0 +1,39 @@
+/*-
+ * This software is released under the BSD License, see LICENSE.
+ */
+
+#ifndef CVSYNC_WATCH_H
+#define	CVSYNC_WATCH_H
+
+struct collection;
+
+#define	WATCH_INTERVAL	(10)
+
+struct watch_root {
+	struct collection	*wr_collection;
+	char			wr_path[PATH_MAX + CVSYNC_NAME_MAX + 1];
+	size_t			wr_pathlen;
+
+	char			**wr_dirs;
+	size_t			wr_ndirs, wr_maxdirs;
+	bool			wr_overflow;
+};
+
+struct watch {
+	struct watch_root	*w_roots;
+	size_t			w_nroots;
+	void			*w_private;
+};
+
+struct watch *watch_init(void);
+void watch_destroy(struct watch *);
+bool watch_add(struct watch *, struct collection *);
+bool watch_reset(struct watch *, size_t);
+bool watch_wait(struct watch *, time_t);
+
+struct watch_root *watch_insert_root(struct watch *, struct collection *);
+void watch_free_roots(struct watch *);
+bool watch_mark(struct watch_root *, const char *, size_t);
+void watch_clear(struct watch_root *);
+
+#endif /* CVSYNC_WATCH_H */
@@ -0,0 +1,421 @@
+/*-
+ * This software is released under the BSD License, see LICENSE.
+ */
+
+#include <sys/types.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include <stdlib.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "compat_stdbool.h"
+#include "compat_stdint.h"
+#include "compat_dirent.h"
+#include "compat_inttypes.h"
+#include "compat_limits.h"
+
+#include "collection.h"
+#include "cvsync.h"
+#include "filetypes.h"
+#include "logmsg.h"
+
+#include "watch.h"
+
+#define	WATCH_INOTIFY_MASK	(IN_ATTRIB|IN_CLOSE_WRITE|IN_CREATE|IN_DELETE|IN_DELETE_SELF|IN_MOVE_SELF|\
+				 IN_MOVED_FROM|IN_MOVED_TO|IN_ONLYDIR)
+#define	WATCH_INOTIFY_BUFSIZE	(64 * 1024)
+
+struct watch_inotify_dir {
+	size_t	wd_root;
+	char	*wd_name;
+	size_t	wd_namelen;
+};
+
+struct watch_inotify {
+	int				wi_fd;
+	struct watch_inotify_dir	**wi_dirs;
+	size_t				wi_ndirs;
+	bool				wi_exhausted;
+	uint8_t				wi_buffer[WATCH_INOTIFY_BUFSIZE];
+};
+
+bool watch_inotify_tree(struct watch *, size_t, char *, size_t, size_t);
+bool watch_inotify_insert(struct watch *, size_t, int, const char *, size_t);
+void watch_inotify_remove(struct watch *, size_t, const char *, size_t);
+bool watch_inotify_event(struct watch *, struct inotify_event *);
+bool watch_inotify_isroot(struct watch_root *, struct watch_inotify_dir *);
+
+struct watch *
+watch_init(void)
+{
+	struct watch *w;
+	struct watch_inotify *wi;
+
+	if ((w = malloc(sizeof(*w))) == NULL) {
+		logmsg_err("%s", strerror(errno));
+		return (NULL);
+	}
+	if ((wi = malloc(sizeof(*wi))) == NULL) {
+		logmsg_err("%s", strerror(errno));
+		free(w);
+		return (NULL);
+	}
+	if ((wi->wi_fd = inotify_init()) == -1) {
+		logmsg_err("inotify: %s", strerror(errno));
+		free(wi);
+		free(w);
+		return (NULL);
+	}
+	wi->wi_dirs = NULL;
+	wi->wi_ndirs = 0;
+	wi->wi_exhausted = false;
+
+	w->w_roots = NULL;
+	w->w_nroots = 0;
+	w->w_private = wi;
+
+	return (w);
+}
+
+void
+watch_destroy(struct watch *w)
+{
+	struct watch_inotify *wi = w->w_private;
+	size_t i;
+
+	for (i = 0 ; i < wi->wi_ndirs ; i++) {
+		if (wi->wi_dirs[i] == NULL)
+			continue;
+		free(wi->wi_dirs[i]->wd_name);
+		free(wi->wi_dirs[i]);
+	}
+	if (wi->wi_dirs != NULL)
+		free(wi->wi_dirs);
+	(void)close(wi->wi_fd);
+	free(wi);
+
+	watch_free_roots(w);
+	free(w);
+}
+
+bool
+watch_add(struct watch *w, struct collection *cl)
+{
+	struct watch_root *wr;
+
+	if ((wr = watch_insert_root(w, cl)) == NULL)
+		return (false);
+
+	return (watch_reset(w, w->w_nroots - 1));
+}
+
+bool
+watch_reset(struct watch *w, size_t root)
+{
+	struct watch_root *wr = &w->w_roots[root];
+	struct collection *cl = wr->wr_collection;
+	char path[PATH_MAX + CVSYNC_NAME_MAX + 1];
+	size_t len;
+
+	watch_inotify_remove(w, root, NULL, 0);
+
+	if ((len = wr->wr_pathlen + cl->cl_rprefixlen) >= sizeof(path)) {
+		logmsg_err("%s%s: %s", wr->wr_path, cl->cl_rprefix, strerror(ENAMETOOLONG));
+		return (false);
+	}
+	(void)memcpy(path, wr->wr_path, wr->wr_pathlen);
+	(void)memcpy(&path[wr->wr_pathlen], cl->cl_rprefix, cl->cl_rprefixlen);
+	path[len] = '\0';
+
+	return (watch_inotify_tree(w, root, path, len, sizeof(path)));
+}
+
+bool
+watch_wait(struct watch *w, time_t interval)
+{
+	struct watch_inotify *wi = w->w_private;
+	struct inotify_event *ev;
+	struct pollfd pfd;
+	time_t deadline, now;
+	uint8_t *sp, *bp;
+	ssize_t rn;
+	int rv;
+
+	deadline = time(NULL) + interval;
+
+	while ((now = time(NULL)) < deadline) {
+		if (cvsync_is_interrupted())
+			return (true);
+
+		pfd.fd = wi->wi_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if ((rv = poll(&pfd, 1, (int)(deadline - now) * 1000)) == -1) {
+			if (errno == EINTR)
+				continue;
+			logmsg_err("poll: %s", strerror(errno));
+			return (false);
+		}
+		if (rv == 0)
+			continue;
+
+		if ((rn = read(wi->wi_fd, wi->wi_buffer, sizeof(wi->wi_buffer))) == -1) {
+			if (errno == EINTR)
+				continue;
+			logmsg_err("inotify: %s", strerror(errno));
+			return (false);
+		}
+
+		sp = wi->wi_buffer;
+		bp = sp + rn;
+		while ((size_t)(bp - sp) >= sizeof(*ev)) {
+			ev = (struct inotify_event *)(void *)sp;
+			if (!watch_inotify_event(w, ev))
+				return (false);
+			sp += sizeof(*ev) + ev->len;
+		}
+	}
+
+	return (true);
+}
+
+bool
+watch_inotify_event(struct watch *w, struct inotify_event *ev)
+{
+	struct watch_inotify *wi = w->w_private;
+	struct watch_inotify_dir *wd;
+	struct watch_root *wr;
+	char path[PATH_MAX + CVSYNC_NAME_MAX + 1];
+	size_t namelen, len, i;
+
+	if (ev->mask & IN_Q_OVERFLOW) {
+		logmsg_verbose("inotify: event queue overflow");
+		for (i = 0 ; i < w->w_nroots ; i++)
+			w->w_roots[i].wr_overflow = true;
+		return (true);
+	}
+
+	if ((ev->wd < 0) || ((size_t)ev->wd >= wi->wi_ndirs))
+		return (true);
+	if ((wd = wi->wi_dirs[ev->wd]) == NULL)
+		return (true);
+	wr = &w->w_roots[wd->wd_root];
+
+	if (ev->mask & IN_IGNORED) {
+		if (watch_inotify_isroot(wr, wd))
+			wr->wr_overflow = true;
+		free(wd->wd_name);
+		free(wd);
+		wi->wi_dirs[ev->wd] = NULL;
+		return (true);
+	}
+	if (ev->mask & (IN_DELETE_SELF|IN_MOVE_SELF)) {
+		if (watch_inotify_isroot(wr, wd))
+			wr->wr_overflow = true;
+		return (true);
+	}
+
+	/* Attic entries are recorded in the parent directory. */
+	for (len = wd->wd_namelen ; len > 0 ; len--) {
+		if (wd->wd_name[len - 1] == '/')
+			break;
+	}
+	if (IS_DIR_ATTIC(&wd->wd_name[len], wd->wd_namelen - len))
+		namelen = (len > 0) ? len - 1 : 0;
+	else
+		namelen = wd->wd_namelen;
+	if (!watch_mark(wr, wd->wd_name, namelen))
+		return (false);
+
+	if (!(ev->mask & IN_ISDIR) || (ev->len == 0))
+		return (true);
+
+	namelen = strlen(ev->name);
+	if (wd->wd_namelen > 0)
+		len = wr->wr_pathlen + wd->wd_namelen + namelen + 1;
+	else
+		len = wr->wr_pathlen + namelen;
+	if (len >= sizeof(path)) {
+		logmsg_err("%s%s%s%s: %s", wr->wr_path, wd->wd_name, (wd->wd_namelen > 0) ? "/" : "", ev->name,
+			   strerror(ENAMETOOLONG));
+		return (false);
+	}
+	(void)memcpy(path, wr->wr_path, wr->wr_pathlen);
+	(void)memcpy(&path[wr->wr_pathlen], wd->wd_name, wd->wd_namelen);
+	if (wd->wd_namelen > 0)
+		path[wr->wr_pathlen + wd->wd_namelen] = '/';
+	(void)memcpy(&path[len - namelen], ev->name, namelen);
+	path[len] = '\0';
+
+	if (ev->mask & IN_MOVED_FROM)
+		watch_inotify_remove(w, wd->wd_root, &path[wr->wr_pathlen], len - wr->wr_pathlen);
+	if (ev->mask & (IN_CREATE|IN_MOVED_TO)) {
+		if (!watch_inotify_tree(w, wd->wd_root, path, len, sizeof(path)))
+			return (false);
+	}
+
+	return (true);
+}
+
+bool
+watch_inotify_isroot(struct watch_root *wr, struct watch_inotify_dir *wd)
+{
+	struct collection *cl = wr->wr_collection;
+
+	if (wd->wd_namelen != cl->cl_rprefixlen)
+		return (false);
+
+	return (memcmp(wd->wd_name, cl->cl_rprefix, cl->cl_rprefixlen) == 0);
+}
+
+bool
+watch_inotify_tree(struct watch *w, size_t root, char *path, size_t pathlen, size_t pathmax)
+{
+	struct watch_inotify *wi = w->w_private;
+	struct watch_root *wr = &w->w_roots[root];
+	struct stat st;
+	DIR *dirp;
+	struct dirent *dp;
+	size_t namelen, base, len;
+	int wd;
+
+	if (wr->wr_overflow)
+		return (true);
+
+	if ((wd = inotify_add_watch(wi->wi_fd, path, WATCH_INOTIFY_MASK)) == -1) {
+		if ((errno == ENOENT) || (errno == ENOTDIR))
+			return (true);
+		if ((errno == ENOSPC) || (errno == ENOMEM)) {
+			/* Out of watches: the root is scanned in full every interval. */
+			if (!wi->wi_exhausted) {
+				logmsg_err("inotify: %s: %s, falling back to periodic scans", path, strerror(errno));
+				wi->wi_exhausted = true;
+			}
+			wr->wr_overflow = true;
+			return (true);
+		}
+		logmsg_err("inotify: %s: %s", path, strerror(errno));
+		return (false);
+	}
+	if (!watch_inotify_insert(w, root, wd, &path[wr->wr_pathlen], pathlen - wr->wr_pathlen))
+		return (false);
+
+	if ((dirp = opendir(path)) == NULL) {
+		if ((errno == ENOENT) || (errno == EACCES))
+			return (true);
+		logmsg_err("%s: %s", path, strerror(errno));
+		return (false);
+	}
+
+	base = pathlen;
+	if (pathlen > wr->wr_pathlen)
+		path[base++] = '/';
+
+	while ((dp = readdir(dirp)) != NULL) {
+		namelen = DIRENT_NAMLEN(dp);
+		if (IS_DIR_CURRENT(dp->d_name, namelen) || IS_DIR_PARENT(dp->d_name, namelen))
+			continue;
+		if ((len = base + namelen) >= pathmax) {
+			path[base] = '\0';
+			logmsg_err("%s%s: %s", path, dp->d_name, strerror(ENAMETOOLONG));
+			closedir(dirp);
+			return (false);
+		}
+		(void)memcpy(&path[base], dp->d_name, namelen);
+		path[len] = '\0';
+		if (lstat(path, &st) == -1)
+			continue;
+		if (!S_ISDIR(st.st_mode))
+			continue;
+		if (!watch_inotify_tree(w, root, path, len, pathmax)) {
+			closedir(dirp);
+			return (false);
+		}
+	}
+	path[pathlen] = '\0';
+
+	closedir(dirp);
+
+	return (true);
+}
+
+bool
+watch_inotify_insert(struct watch *w, size_t root, int wd, const char *name, size_t namelen)
+{
+	struct watch_inotify *wi = w->w_private;
+	struct watch_inotify_dir **dirs, *dir;
+	size_t max, i;
+
+	if ((size_t)wd >= wi->wi_ndirs) {
+		max = (wi->wi_ndirs == 0) ? 1024 : wi->wi_ndirs;
+		while (max <= (size_t)wd)
+			max *= 2;
+		if ((dirs = realloc(wi->wi_dirs, max * sizeof(*dirs))) == NULL) {
+			logmsg_err("%s", strerror(errno));
+			return (false);
+		}
+		for (i = wi->wi_ndirs ; i < max ; i++)
+			dirs[i] = NULL;
+		wi->wi_dirs = dirs;
+		wi->wi_ndirs = max;
+	}
+
+	if ((dir = wi->wi_dirs[wd]) != NULL) {
+		/* The same directory was reached by another path. */
+		free(dir->wd_name);
+	} else {
+		if ((dir = malloc(sizeof(*dir))) == NULL) {
+			logmsg_err("%s", strerror(errno));
+			return (false);
+		}
+	}
+	if ((dir->wd_name = malloc(namelen + 1)) == NULL) {
+		logmsg_err("%s", strerror(errno));
+		free(dir);
+		wi->wi_dirs[wd] = NULL;
+		return (false);
+	}
+	(void)memcpy(dir->wd_name, name, namelen);
+	dir->wd_name[namelen] = '\0';
+	dir->wd_namelen = namelen;
+	dir->wd_root = root;
+
+	wi->wi_dirs[wd] = dir;
+
+	return (true);
+}
+
+void
+watch_inotify_remove(struct watch *w, size_t root, const char *name, size_t namelen)
+{
+	struct watch_inotify *wi = w->w_private;
+	struct watch_inotify_dir *dir;
+	size_t i;
+
+	for (i = 0 ; i < wi->wi_ndirs ; i++) {
+		if ((dir = wi->wi_dirs[i]) == NULL)
+			continue;
+		if (dir->wd_root != root)
+			continue;
+		if (name != NULL) {
+			if (dir->wd_namelen < namelen)
+				continue;
+			if (memcmp(dir->wd_name, name, namelen) != 0)
+				continue;
+			if ((dir->wd_namelen > namelen) && (dir->wd_name[namelen] != '/'))
+				continue;
+		}
+		(void)inotify_rm_watch(wi->wi_fd, (int)i);
+		free(dir->wd_name);
+		free(dir);
+		wi->wi_dirs[i] = NULL;
+	}
+}
@@ -0,0 +1,90 @@
+/*-
+ * This software is released under the BSD License, see LICENSE.
+ */
+
+#include <sys/types.h>
+
+#include <stdlib.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "compat_stdbool.h"
+#include "compat_stdint.h"
+#include "compat_inttypes.h"
+#include "compat_limits.h"
+
+#include "collection.h"
+#include "cvsync.h"
+#include "logmsg.h"
+
+#include "watch.h"
+
+/*
+ * Without a change notification facility every interval turns into
+ * a full rescan of each collection.
+ */
+
+struct watch *
+watch_init(void)
+{
+	struct watch *w;
+
+	if ((w = malloc(sizeof(*w))) == NULL) {
+		logmsg_err("%s", strerror(errno));
+		return (NULL);
+	}
+	w->w_roots = NULL;
+	w->w_nroots = 0;
+	w->w_private = NULL;
+
+	return (w);
+}
+
+void
+watch_destroy(struct watch *w)
+{
+	watch_free_roots(w);
+	free(w);
+}
+
+bool
+watch_add(struct watch *w, struct collection *cl)
+{
+	if (watch_insert_root(w, cl) == NULL)
+		return (false);
+
+	return (true);
+}
+
+bool
+watch_reset(struct watch *w, size_t root)
+{
+	if (root >= w->w_nroots)
+		return (false);
+
+	return (true);
+}
+
+bool
+watch_wait(struct watch *w, time_t interval)
+{
+	time_t deadline, now;
+	size_t i;
+
+	deadline = time(NULL) + interval;
+
+	while ((now = time(NULL)) < deadline) {
+		if (cvsync_is_interrupted())
+			return (true);
+		(void)sleep((unsigned int)(deadline - now));
+	}
+
+	for (i = 0 ; i < w->w_nroots ; i++)
+		w->w_roots[i].wr_overflow = true;
+
+	return (true);
+}
@@ -5,6 +5,7 @@
 #ifndef CVSYNC_COLLECTION_H
 #define	CVSYNC_COLLECTION_H
 
+struct digestfile;
 struct refuse_args;
 struct scanfile_args;
 
@@ -15,6 +16,8 @@ struct collection {
 	char			cl_prefix[PATH_MAX], cl_rprefix[PATH_MAX];
 	size_t			cl_prefixlen, cl_rprefixlen;
 	int			cl_errormode;
+	bool			cl_inodeorder;
+	bool			cl_rcs_rdiff;
 	uint16_t		cl_umask;
 
 	struct refuse_args	*cl_refuse;
@@ -23,6 +26,10 @@ struct collection {
 	struct scanfile_args	*cl_scanfile;
 	char			cl_scan_name[PATH_MAX + CVSYNC_NAME_MAX + 1];
 	mode_t			cl_scan_mode;
+	bool			cl_scan_nocache;
+
+	struct digestfile	*cl_digestfile;
+	char			cl_digest_name[PATH_MAX + CVSYNC_NAME_MAX + 1];
 
 	int			cl_flags;
 };
@@ -42,9 +42,11 @@ enum {
 	TOK_COLLECTION,
 	TOK_COMPRESS,
 	TOK_CONFIG,
+	TOK_DIGESTFILE,
 	TOK_ERRORMODE,
 	TOK_HASH,
 	TOK_HOSTNAME,
+	TOK_INODEORDER,
 	TOK_LBRACE,
 	TOK_LOOSE,
 	TOK_NAME,
@@ -52,9 +54,11 @@ enum {
 	TOK_PREFIX,
 	TOK_PROTOCOL,
 	TOK_RBRACE,
+	TOK_RCS_RDIFF,
 	TOK_REFUSE,
 	TOK_RELEASE,
 	TOK_SCANFILE,
+	TOK_SCANFILE_NOCACHE,
 	TOK_UMASK,
 
 	TOK_UNKNOWN
@@ -68,19 +72,23 @@ static const struct token_keyword config_keywords[] = {
 	{ "collection",		10,	TOK_COLLECTION },
 	{ "compress",		8,	TOK_COMPRESS },
 	{ "config",		6,	TOK_CONFIG },
+	{ "digestfile",		10,	TOK_DIGESTFILE },
 	{ "errormode",		9,	TOK_ERRORMODE },
 	{ "hash",		4,	TOK_HASH },
 	{ "host",		4,	TOK_HOSTNAME },
 	{ "hostname",		8,	TOK_HOSTNAME },
+	{ "inode-order",	11,	TOK_INODEORDER },
 	{ "loose",		5,	TOK_LOOSE },
 	{ "name",		4,	TOK_NAME },
 	{ "port",		4,	TOK_PORT },
 	{ "prefix",		6,	TOK_PREFIX },
 	{ "proto",		5,	TOK_PROTOCOL },
 	{ "protocol",		8,	TOK_PROTOCOL },
+	{ "rcs-rdiff",		9,	TOK_RCS_RDIFF },
 	{ "refuse",		6,	TOK_REFUSE },
 	{ "release",		7,	TOK_RELEASE },
 	{ "scanfile",		8,	TOK_SCANFILE },
+	{ "scanfile-nocache",	16,	TOK_SCANFILE_NOCACHE },
 	{ "umask",		5,	TOK_UMASK },
 	{ NULL,			0,	TOK_UNKNOWN },
 };
@@ -112,6 +120,7 @@ bool config_parse_uri_aux(const char *, const char *, struct collection *);
 struct config *config_init_config(void);
 struct collection *config_init_collection(void);
 
+bool config_resolv_digestfile(struct config *, struct collection *);
 bool config_resolv_refuse(struct config *, struct collection *);
 bool config_set_config_default(struct config *);
 bool config_set_collection_default(struct config *, struct collection *);
@@ -357,6 +366,10 @@ config_parse_file_config(struct config_args *ca)
 			config_destroy(cf);
 			return (NULL);
 		}
+		if (!config_resolv_digestfile(cf, cl)) {
+			config_destroy(cf);
+			return (NULL);
+		}
 	}
 
 	return (cf);
@@ -390,12 +403,28 @@ config_parse_file_collection(struct config_args *ca)
 		ca->ca_key = key;
 
 		switch (key->type) {
+		case TOK_DIGESTFILE:
+			ca->ca_buffer = cl->cl_digest_name;
+			ca->ca_bufsize = sizeof(cl->cl_digest_name);
+			if (!config_set_string(ca)) {
+				collection_destroy(cl);
+				return (NULL);
+			}
+			break;
 		case TOK_ERRORMODE:
 			if (!config_parse_errormode(ca, cl)) {
 				collection_destroy(cl);
 				return (NULL);
 			}
 			break;
+		case TOK_INODEORDER:
+			if (cl->cl_inodeorder) {
+				logmsg_err("line %u: found duplication of the '%s'", lineno, key->name);
+				collection_destroy(cl);
+				return (NULL);
+			}
+			cl->cl_inodeorder = true;
+			break;
 		case TOK_LOOSE:
 			logmsg_err("line %u: '%s' is obsoleted", lineno, key->name);
 			if (cl->cl_errormode != CVSYNC_ERRORMODE_UNSPEC) {
@@ -443,6 +472,22 @@ config_parse_file_collection(struct config_args *ca)
 				return (NULL);
 			}
 			break;
+		case TOK_RCS_RDIFF:
+			if (cl->cl_rcs_rdiff) {
+				logmsg_err("line %u: found duplication of the '%s'", lineno, key->name);
+				collection_destroy(cl);
+				return (NULL);
+			}
+			cl->cl_rcs_rdiff = true;
+			break;
+		case TOK_SCANFILE_NOCACHE:
+			if (cl->cl_scan_nocache) {
+				logmsg_err("line %u: found duplication of the '%s'", lineno, key->name);
+				collection_destroy(cl);
+				return (NULL);
+			}
+			cl->cl_scan_nocache = true;
+			break;
 		case TOK_UMASK:
 			if (!config_parse_umask(ca, cl)) {
 				collection_destroy(cl);
@@ -796,6 +841,40 @@ config_init_collection(void)
 	return (cl);
 }
 
+bool
+config_resolv_digestfile(struct config *cf, struct collection *cl)
+{
+	char path[PATH_MAX + CVSYNC_NAME_MAX + 1];
+	int wn;
+
+	if (strlen(cl->cl_digest_name) == 0)
+		return (true);
+
+	if (cl->cl_digest_name[0] != '/') {
+		if (strlen(cf->cf_base) == 0) {
+			logmsg_err("collection %s/%s: digestfile %s: must be an absolute path", cl->cl_name,
+				   cl->cl_release, cl->cl_digest_name);
+			return (false);
+		}
+		wn = snprintf(path, sizeof(path), "%s/%s", cf->cf_base, cl->cl_digest_name);
+	} else {
+		wn = snprintf(path, sizeof(path), "%s", cl->cl_digest_name);
+	}
+	if ((wn <= 0) || ((size_t)wn >= sizeof(path))) {
+		logmsg_err("collection %s/%s: digestfile %s: %s", cl->cl_name, cl->cl_release,
+			   cl->cl_digest_name, strerror(EINVAL));
+		return (false);
+	}
+	wn = snprintf(cl->cl_digest_name, sizeof(cl->cl_digest_name), "%s", path);
+	if ((wn <= 0) || ((size_t)wn >= sizeof(cl->cl_digest_name))) {
+		logmsg_err("collection %s/%s: digestfile %s: %s", cl->cl_name, cl->cl_release, path,
+			   strerror(EINVAL));
+		return (false);
+	}
+
+	return (true);
+}
+
 bool
 config_resolv_refuse(struct config *cf, struct collection *cl)
 {
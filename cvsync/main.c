@@ -24,6 +24,7 @@
 #include "collection.h"
 #include "cvsync.h"
 #include "cvsync_attr.h"
+#include "digestfile.h"
 #include "hash.h"
 #include "logmsg.h"
 #include "mdirent.h"
@@ -242,6 +243,7 @@ client(struct config *cf)
 	struct dirscan_args *dsa;
 	struct filescan_args *fsa;
 	struct updater_args *uda;
+	struct collection *cl;
 	struct mux *mx;
 	void *status;
 	int sock;
@@ -304,6 +306,16 @@ client(struct config *cf)
 		return (false);
 	}
 
+	for (cl = cf->cf_collections ; cl != NULL ; cl = cl->cl_next) {
+		if (cl->cl_flags & CLFLAGS_DISABLE)
+			continue;
+		if (cvsync_release_pton(cl->cl_release) != CVSYNC_RELEASE_RCS)
+			continue;
+		if (cl->cl_digest_name[0] == '\0')
+			continue;
+		cl->cl_digestfile = digestfile_open(cl->cl_digest_name, cf->cf_hash);
+	}
+
 	if (pthread_create(&mx->mx_receiver, &attr, receiver, mx) != 0)
 		mux_abort(mx);
 	if (pthread_create(&dsa->dsa_thread, &attr, dirscan, dsa) != 0)
@@ -330,6 +342,13 @@ client(struct config *cf)
 		rv = true;
 	}
 
+	for (cl = cf->cf_collections ; cl != NULL ; cl = cl->cl_next) {
+		if (cl->cl_digestfile != NULL) {
+			digestfile_close(cl->cl_digestfile);
+			cl->cl_digestfile = NULL;
+		}
+	}
+
 	dirscan_destroy(dsa);
 	filescan_destroy(fsa);
 	updater_destroy(uda);
@@ -16,7 +16,7 @@ struct collection {
 	size_t			cl_prefixlen, cl_rprefixlen;
 	char			cl_comment[256];
 	int			cl_errormode;
-	bool			cl_symfollow;
+	bool			cl_symfollow, cl_inodeorder;
 	uint16_t		cl_umask;
 
 	struct distfile_args	*cl_distfile;
@@ -24,6 +24,7 @@ struct collection {
 
 	struct scanfile_args	*cl_scanfile;
 	char			cl_scan_name[PATH_MAX + CVSYNC_NAME_MAX + 1];
+	bool			cl_scan_nocache;
 
 	struct collection	*cl_super;
 	char			cl_super_name[CVSYNC_NAME_MAX + 1];
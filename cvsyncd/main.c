@@ -33,6 +33,8 @@
 #include "mux.h"
 #include "network.h"
 #include "pid.h"
+#include "rcscache.h"
+#include "scanfile.h"
 #include "version.h"
 
 #include "receiver.h"
@@ -290,10 +292,20 @@ main(int argc, char *argv[])
 		logmsg_close();
 		exit(EXIT_FAILURE);
 	}
+	if (!rcscache_init(cf->cf_rcscache * 1024 * 1024)) {
+		pthread_attr_destroy(&attr);
+		access_destroy();
+		pid_remove();
+		config_destroy(cf);
+		logmsg_close();
+		exit(EXIT_FAILURE);
+	}
+	scanfile_cache_init();
 
 	socks = sock_listen((strlen(cf->cf_addr) == 0 ? NULL : cf->cf_addr), cf->cf_serv);
 	if (socks == NULL) {
 		pthread_attr_destroy(&attr);
+		rcscache_destroy();
 		access_destroy();
 		pid_remove();
 		config_destroy(cf);
@@ -303,6 +315,7 @@ main(int argc, char *argv[])
 
 	if (!sock_init(socks)) {
 		pthread_attr_destroy(&attr);
+		rcscache_destroy();
 		access_destroy();
 		pid_remove();
 		config_destroy(cf);
@@ -364,6 +377,8 @@ main(int argc, char *argv[])
 	if (!pid_remove())
 		status = EXIT_FAILURE;
 
+	rcscache_destroy();
+	scanfile_cache_destroy();
 	access_destroy();
 	config_destroy(cf);
 
@@ -417,7 +432,7 @@ server(void *arg)
 		access_done(sa);
 		return (CVSYNC_THREAD_FAILURE);
 	}
-	if ((dca = dircmp_init(mx, sa->sa_hostinfo, cls, proto)) == NULL) {
+	if ((dca = dircmp_init(mx, sa->sa_hostinfo, cls, proto, hash)) == NULL) {
 		mux_destroy(mx);
 		collection_destroy_all(cls);
 		access_done(sa);
@@ -430,6 +445,15 @@ server(void *arg)
 		access_done(sa);
 		return (CVSYNC_THREAD_FAILURE);
 	}
+	if ((fca->fca_prefetch = filecmp_prefetch_init(fca->fca_hash_ops)) == NULL) {
+		filecmp_destroy(fca);
+		dircmp_destroy(dca);
+		mux_destroy(mx);
+		collection_destroy_all(cls);
+		access_done(sa);
+		return (CVSYNC_THREAD_FAILURE);
+	}
+	dca->dca_prefetch = fca->fca_prefetch;
 
 	if (pthread_create(&mx->mx_receiver, &attr, receiver, mx) != 0)
 		mux_abort(mx);
@@ -451,14 +475,16 @@ server(void *arg)
 		logmsg_verbose("%s Finished successfully", sa->sa_hostinfo);
 	}
 
-	filecmp_destroy(fca);
+	filecmp_prefetch_destroy(fca->fca_prefetch);
 	dircmp_destroy(dca);
 
 	collection_destroy_all(cls);
 
-	logmsg("%s in=%" PRIu64 ", out=%" PRIu64 ", time=%ds", sa->sa_hostinfo, mx->mx_xfer_in, mx->mx_xfer_out,
-	       time(NULL) - sa->sa_tick);
+	logmsg("%s in=%" PRIu64 ", out=%" PRIu64 ", time=%ds, rcs=%" PRIu64 ", rdiff=%" PRIu64 ", saved=%" PRIu64,
+	       sa->sa_hostinfo, mx->mx_xfer_in, mx->mx_xfer_out, time(NULL) - sa->sa_tick, fca->fca_nrcs,
+	       fca->fca_nrdiff, fca->fca_saved);
 
+	filecmp_destroy(fca);
 	mux_destroy(mx);
 	access_done(sa);
 
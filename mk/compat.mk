@@ -2,7 +2,12 @@
 # This software is released under the BSD License, see LICENSE.
 #
 
+ifeq (${HOST_OS}, Linux)
+CFLAGS += -D_POSIX_C_SOURCE=200809L -D_XOPEN_SOURCE=700
+CFLAGS += -DHAVE_COPY_FILE_RANGE
+else
 CFLAGS += -D_POSIX_C_SOURCE=200112L -D_XOPEN_SOURCE=600
+endif # Linux
 
 ifeq (${HOST_OS}, AIX)
 CFLAGS += -D_UNIX98
@@ -4,6 +4,7 @@
 
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <sys/time.h>
 #include <sys/uio.h>
 
 #include <stdio.h>
@@ -11,6 +12,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
@@ -22,7 +24,9 @@
 
 #include "rcslib.h"
 
+bool rcscan_bench(void *, off_t, long, bool, double *);
 bool rcscan_dump(struct rcslib_file *);
+bool rcscan_dump_rcs(struct rcslib_writer *, struct rcslib_file *);
 NORETURN void usage(void);
 
 int
@@ -32,13 +36,36 @@ main(int argc, char *argv[])
 	struct rcslib_file *rcs;
 	void *addr;
 	off_t size;
-	uint64_t size64;
+	uint64_t size64, total = 0;
+	double sec = 0;
+	long count = 0;
 	int fd, ch;
+	bool lazy = false;
 	bool quiet = false;
 	bool verbose = false;
+	char *ep;
 
-	while ((ch = getopt(argc, argv, "qv")) != -1) {
+	while ((ch = getopt(argc, argv, "b:lqv")) != -1) {
 		switch (ch) {
+		case 'b':
+			if (count != 0) {
+				usage();
+				/* NOTREACHED */
+			}
+			errno = 0;
+			count = strtol(optarg, &ep, 10);
+			if ((errno != 0) || (*ep != '\0') || (count <= 0) || (count == LONG_MAX)) {
+				usage();
+				/* NOTREACHED */
+			}
+			break;
+		case 'l':
+			if (lazy) {
+				usage();
+				/* NOTREACHED */
+			}
+			lazy = true;
+			break;
 		case 'q':
 			if (quiet) {
 				usage();
@@ -61,7 +88,7 @@ main(int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 
-	if (argc == 0) {
+	if ((argc == 0) || (lazy && (count == 0))) {
 		usage();
 		/* NOTREACHED */
 	}
@@ -102,7 +129,12 @@ main(int argc, char *argv[])
 			exit(EXIT_FAILURE);
 		}
 
-		if ((rcs = rcslib_init(addr, size)) != NULL) {
+		if (count > 0) {
+			if (rcscan_bench(addr, size, count, lazy, &sec))
+				total += size64 * (uint64_t)count;
+			else
+				(void)printf("ERROR: %s\n", fname);
+		} else if ((rcs = rcslib_init(addr, size)) != NULL) {
 			if (verbose) {
 				if (!rcscan_dump(rcs))
 					(void)printf("ERROR: %s\n", fname);
@@ -121,20 +153,69 @@ main(int argc, char *argv[])
 		}
 	}
 
+	if ((count > 0) && (sec > 0)) {
+		(void)printf("%" PRIu64 " bytes in %.3f sec (%.1f MB/s)\n", total, sec,
+			     (double)total / sec / (1024 * 1024));
+	}
+
 	exit(EXIT_SUCCESS);
 	/* NOTREACHED */
 }
 
+bool
+rcscan_bench(void *addr, off_t size, long count, bool lazy, double *sec)
+{
+	struct rcslib_file *rcs;
+	struct timeval tic, toc;
+	long i;
+
+	gettimeofday(&tic, NULL);
+
+	for (i = 0 ; i < count ; i++) {
+		if (lazy)
+			rcs = rcslib_init_lazy(addr, size);
+		else
+			rcs = rcslib_init(addr, size);
+		if (rcs == NULL)
+			return (false);
+		rcslib_destroy(rcs);
+	}
+
+	gettimeofday(&toc, NULL);
+
+	*sec += (double)(toc.tv_sec - tic.tv_sec) + (double)(toc.tv_usec - tic.tv_usec) / 1000000;
+
+	return (true);
+}
+
 bool
 rcscan_dump(struct rcslib_file *rcs)
+{
+	struct rcslib_writer *rw;
+	bool rv;
+
+	if ((rw = rcslib_writer_init()) == NULL) {
+		(void)fprintf(stderr, "%s\n", strerror(errno));
+		return (false);
+	}
+	rcslib_writer_start(rw, STDOUT_FILENO);
+
+	if ((rv = rcscan_dump_rcs(rw, rcs)) && !(rv = rcslib_writer_flush(rw)))
+		(void)fprintf(stderr, "%s\n", strerror(errno));
+
+	rcslib_writer_destroy(rw);
+
+	return (rv);
+}
+
+bool
+rcscan_dump_rcs(struct rcslib_writer *rw, struct rcslib_file *rcs)
 {
 	struct rcsid *id;
 	struct rcsnum *num;
 	struct rcssym *sym;
 	struct iovec iov[10];
-	size_t len, i;
-	ssize_t wn;
-	int fd = STDOUT_FILENO;
+	size_t i;
 
 	iov[0].iov_base = "head\t";
 	if (rcs->head.n_len > 0)
@@ -145,30 +226,21 @@ rcscan_dump(struct rcslib_file *rcs)
 	iov[1].iov_len = rcs->head.n_len;
 	iov[2].iov_base = ";\n";
 	iov[2].iov_len = 2;
-	len = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
 	i = 3;
 	if (rcs->branch.n_len > 0) {
 		iov[i].iov_base = "branch\t";
-		iov[i].iov_len = 7;
-		len += iov[i++].iov_len;
+		iov[i++].iov_len = 7;
 		iov[i].iov_base = rcs->branch.n_str;
-		iov[i].iov_len = rcs->branch.n_len;
-		len += iov[i++].iov_len;
+		iov[i++].iov_len = rcs->branch.n_len;
 		iov[i].iov_base = ";\n";
-		iov[i].iov_len = 2;
-		len += iov[i++].iov_len;
+		iov[i++].iov_len = 2;
 	}
 	iov[i].iov_base = "access";
-	iov[i].iov_len = 6;
-	len += iov[i++].iov_len;
-	if ((wn = writev(fd, iov, (int)i)) == -1) {
+	iov[i++].iov_len = 6;
+	if (!rcslib_writer_writev(rw, iov, (int)i)) {
 		(void)fprintf(stderr, "%s\n", strerror(errno));
 		return (false);
 	}
-	if ((size_t)wn != len) {
-		(void)fprintf(stderr, "writev error\n");
-		return (false);
-	}
 
 	for (i = 0 ; i < rcs->access.ra_count ; i++) {
 		id =  &rcs->access.ra_id[i];
@@ -176,25 +248,15 @@ rcscan_dump(struct rcslib_file *rcs)
 		iov[0].iov_len = 2;
 		iov[1].iov_base = id->i_id;
 		iov[1].iov_len = id->i_len;
-		len = iov[0].iov_len + iov[1].iov_len;
-		if ((wn = writev(fd, iov, 2)) == -1) {
+		if (!rcslib_writer_writev(rw, iov, 2)) {
 			(void)fprintf(stderr, "%s\n", strerror(errno));
 			return (false);
 		}
-		if ((size_t)wn != len) {
-			(void)fprintf(stderr, "writev error\n");
-			return (false);
-		}
 	}
-	len = 9;
-	if ((wn = write(fd, ";\nsymbols", len)) == -1) {
+	if (!rcslib_writer_write(rw, ";\nsymbols", 9)) {
 		(void)fprintf(stderr, "%s\n", strerror(errno));
 		return (false);
 	}
-	if ((size_t)wn != len) {
-		(void)fprintf(stderr, "write error\n");
-		return (false);
-	}
 
 	for (i = 0 ; i < rcs->symbols.rs_count ; i++) {
 		struct rcslib_symbol *symbol = &rcs->symbols.rs_symbols[i];
@@ -208,25 +270,15 @@ rcscan_dump(struct rcslib_file *rcs)
 		iov[2].iov_len = 1;
 		iov[3].iov_base = num->n_str;
 		iov[3].iov_len = num->n_len;
-		len = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len + iov[3].iov_len;
-		if ((wn = writev(fd, iov, 4)) == -1) {
+		if (!rcslib_writer_writev(rw, iov, 4)) {
 			(void)fprintf(stderr, "%s\n", strerror(errno));
 			return (false);
 		}
-		if ((size_t)wn != len) {
-			(void)fprintf(stderr, "writev error\n");
-			return (false);
-		}
 	}
-	len = 7;
-	if ((wn = write(fd, ";\nlocks", len)) == -1) {
+	if (!rcslib_writer_write(rw, ";\nlocks", 7)) {
 		(void)fprintf(stderr, "%s\n", strerror(errno));
 		return (false);
 	}
-	if ((size_t)wn != len) {
-		(void)fprintf(stderr, "write error\n");
-		return (false);
-	}
 
 	for (i = 0 ; i < rcs->locks.rl_count ; i++) {
 		struct rcslib_lock *lock = &rcs->locks.rl_locks[i];
@@ -240,15 +292,10 @@ rcscan_dump(struct rcslib_file *rcs)
 		iov[2].iov_len = 1;
 		iov[3].iov_base = num->n_str;
 		iov[3].iov_len = num->n_len;
-		len = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len + iov[3].iov_len;
-		if ((wn = writev(fd, iov, 4)) == -1) {
+		if (!rcslib_writer_writev(rw, iov, 4)) {
 			(void)fprintf(stderr, "%s\n", strerror(errno));
 			return (false);
 		}
-		if ((size_t)wn != len) {
-			(void)fprintf(stderr, "writev error\n");
-			return (false);
-		}
 	}
 
 	iov[0].iov_base = ";";
@@ -286,20 +333,14 @@ rcscan_dump(struct rcslib_file *rcs)
 		iov[8].iov_len = 0;
 	iov[9].iov_base = "\n\n\n";
 	iov[9].iov_len = 3;
-	len = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len + iov[3].iov_len + iov[4].iov_len + iov[5].iov_len +
-	      iov[6].iov_len + iov[7].iov_len + iov[8].iov_len + iov[9].iov_len;
 
-	if ((wn = writev(fd, iov, 10)) == -1) {
+	if (!rcslib_writer_writev(rw, iov, 10)) {
 		(void)fprintf(stderr, "%s\n", strerror(errno));
 		return (false);
 	}
-	if ((size_t)wn != len) {
-		(void)fprintf(stderr, "writev error\n");
-		return (false);
-	}
 
 	for (i = 0 ; i < rcs->delta.rd_count ; i++) {
-		if (!rcslib_write_delta(fd, &rcs->delta.rd_rev[i]))
+		if (!rcslib_write_delta(rw, &rcs->delta.rd_rev[i]))
 			return (false);
 	}
 
@@ -309,18 +350,13 @@ rcscan_dump(struct rcslib_file *rcs)
 	iov[1].iov_len = rcs->desc.s_len;
 	iov[2].iov_base = "@\n";
 	iov[2].iov_len = 2;
-	len = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
-	if ((wn = writev(fd, iov, 3)) == -1) {
+	if (!rcslib_writer_writev(rw, iov, 3)) {
 		(void)fprintf(stderr, "%s\n", strerror(errno));
 		return (false);
 	}
-	if ((size_t)wn != len) {
-		(void)fprintf(stderr, "writev error\n");
-		return (false);
-	}
 
 	for (i = 0 ; i < rcs->delta.rd_count ; i++) {
-		if (!rcslib_write_deltatext(fd, &rcs->delta.rd_rev[i]))
+		if (!rcslib_write_deltatext(rw, &rcs->delta.rd_rev[i]))
 			return (false);
 	}
 
@@ -330,6 +366,6 @@ rcscan_dump(struct rcslib_file *rcs)
 NORETURN void
 usage(void)
 {
-	(void)fprintf(stderr, "Usage: rcscan [-qv] <file> ...\n");
+	(void)fprintf(stderr, "Usage: rcscan [-qv] [-b <count> [-l]] <file> ...\n");
 	exit(EXIT_FAILURE);
 }
@@ -21,8 +21,6 @@
 #include "hash.h"
 #include "rcslib.h"
 
-void rcscmp_hash(struct rcslib_file *, const struct hash_args *, uint8_t *);
-
 int
 main(int argc, char *argv[])
 {
@@ -89,7 +87,8 @@ main(int argc, char *argv[])
 			exit(EXIT_FAILURE);
 		}
 
-		rcscmp_hash(rcs, hashops, hash[i]);
+		if (!rcslib_digest(rcs, hashops, hash[i]))
+			(void)memset(hash[i], 0, hashops->length);
 
 		rcslib_destroy(rcs);
 
@@ -107,82 +106,3 @@ main(int argc, char *argv[])
 	exit(EXIT_SUCCESS);
 	/* NOTREACHED */
 }
-
-void
-rcscmp_hash(struct rcslib_file *rcs, const struct hash_args *hashops, uint8_t *hash)
-{
-	struct rcslib_revision *rev;
-	struct rcsid *id;
-	struct rcsnum *num;
-	struct rcssym *sym;
-	void *ctx;
-	size_t i, j;
-
-	if (!(*hashops->init)(&ctx)) {
-		(void)memset(hash, 0, hashops->length);
-		return;
-	}
-
-	if (rcs->head.n_len > 0)
-		(*hashops->update)(ctx, rcs->head.n_str, rcs->head.n_len);
-
-	if (rcs->branch.n_len > 0)
-		(*hashops->update)(ctx, rcs->branch.n_str, rcs->branch.n_len);
-
-	for (i = 0 ; i < rcs->access.ra_count ; i++) {
-		id =  &rcs->access.ra_id[i];
-		(*hashops->update)(ctx, id->i_id, id->i_len);
-	}
-
-	for (i = 0 ; i < rcs->symbols.rs_count ; i++) {
-		struct rcslib_symbol *symbol = &rcs->symbols.rs_symbols[i];
-		sym = &symbol->sym;
-		num = &symbol->num;
-		(*hashops->update)(ctx, sym->s_sym, sym->s_len);
-		(*hashops->update)(ctx, num->n_str, num->n_len);
-	}
-
-	for (i = 0 ; i < rcs->locks.rl_count ; i++) {
-		struct rcslib_lock *lock = &rcs->locks.rl_locks[i];
-		id = &lock->id;
-		num = &lock->num;
-		(*hashops->update)(ctx, id->i_id, id->i_len);
-		(*hashops->update)(ctx, num->n_str, num->n_len);
-	}
-	if (rcs->locks.rl_strict) {
-		uint8_t strict = 1;
-		(*hashops->update)(ctx, &strict, 1);
-	}
-
-	if (rcs->comment.s_len > 0)
-		(*hashops->update)(ctx, rcs->comment.s_str, rcs->comment.s_len);
-
-	if (rcs->expand.s_len > 0)
-		(*hashops->update)(ctx, rcs->expand.s_str, rcs->expand.s_len);
-
-	for (i = 0 ; i < rcs->delta.rd_count ; i++) {
-		rev = &rcs->delta.rd_rev[i];
-		(*hashops->update)(ctx, rev->num.n_str, rev->num.n_len);
-		(*hashops->update)(ctx, rev->author.i_id, rev->author.i_len);
-		if (rev->state.i_len > 0)
-			(*hashops->update)(ctx, rev->state.i_id, rev->state.i_len);
-		for (j = 0 ; j < rev->branches.rb_count ; j++) {
-			(*hashops->update)(ctx, rev->branches.rb_num[j].n_str, rev->branches.rb_num[j].n_len);
-		}
-		if (rev->next.n_len > 0)
-			(*hashops->update)(ctx, rev->next.n_str, rev->next.n_len);
-	}
-
-	if (rcs->desc.s_len > 0)
-		(*hashops->update)(ctx, rcs->desc.s_str, rcs->desc.s_len);
-
-	for (i = 0 ; i < rcs->delta.rd_count ; i++) {
-		rev = &rcs->delta.rd_rev[i];
-		if (rev->log.s_len > 0)
-			(*hashops->update)(ctx, rev->log.s_str, rev->log.s_len);
-		if (rev->text.s_len > 0)
-			(*hashops->update)(ctx, rev->text.s_str, rev->text.s_len);
-	}
-
-	(*hashops->final)(ctx, hash);
-}